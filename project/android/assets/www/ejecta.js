@@ -63,6 +63,7 @@ self = window = this;
  // The native Image, Audio, HttpRequest and LocalStorage class mimic the real elements
  window.Image = Ejecta.Image;
  window.Audio = Ejecta.Audio;
+ window.Path2D = Ejecta.Path2D;
  window.XMLHttpRequest = Ejecta.HttpRequest;
  window.localStorage = new Ejecta.LocalStorage();
  
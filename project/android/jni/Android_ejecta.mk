@@ -61,12 +61,21 @@ LOCAL_SRC_FILES := \
                     ../../../sources/ejecta/EJAudio/EJBindingAudio.cpp \
                     ../../../sources/ejecta/EJCanvas/EJBindingImage.cpp \
                     ../../../sources/ejecta/EJCanvas/EJBindingImageData.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJBindingPath2D.cpp \
                     ../../../sources/ejecta/EJCanvas/EJBindingCanvas.cpp \
                     ../../../sources/ejecta/EJCanvas/EJCanvasContext.cpp \
                     ../../../sources/ejecta/EJCanvas/EJCanvasContextScreen.cpp \
                     ../../../sources/ejecta/EJCanvas/EJCanvasContextTexture.cpp \
                     ../../../sources/ejecta/EJCanvas/EJPath.cpp \
                     ../../../sources/ejecta/EJCanvas/EJTexture.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJTextureAtlas.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJTextureCache.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJTextureLoader.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJGLUploadContext.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJCompressedTexture.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJGLState.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJVertexTransform.cpp \
+                    ../../../sources/ejecta/EJCanvas/EJPremultiply.cpp \
                     ../../../sources/ejecta/EJCanvas/EJFont.cpp \
                     ../../../sources/ejecta/EJCanvas/EJGLProgram2D.cpp \
                     ../../../sources/ejecta/EJCanvas/EJImageData.cpp \
@@ -75,12 +84,24 @@ LOCAL_SRC_FILES := \
                     ../../../sources/ejecta/EJUtils/EJBindingTouchInput.cpp \
                     ejecta.cpp \
 
-LOCAL_LDLIBS :=  -lz -llog -lGLESv2 -lGLESv1_CM \
+# The NEON vertex transform, premultiply and JPEG RGB to RGBA kernels are only
+# built for armeabi-v7a and only used if the CPU reports NEON support at runtime
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_CFLAGS += -DEJ_VERTEX_TRANSFORM_NEON=1 -DEJ_PREMULTIPLY_NEON=1 -DLODEJPEG_NEON=1
+LOCAL_SRC_FILES += ../../../sources/ejecta/EJCanvas/EJVertexTransformNEON.cpp.neon \
+                    ../../../sources/ejecta/EJCanvas/EJPremultiplyNEON.cpp.neon \
+                    ../../../sources/ejecta/lodejpeg/lodejpeg_neon.cpp.neon
+endif
+
+LOCAL_LDLIBS :=  -lz -llog -lEGL -lGLESv2 -lGLESv1_CM \
                     -L$(LOCAL_PATH)/../../../library/android/libfreetype/libs/$(TARGET_ARCH_ABI) -lfreetype \
                     -L$(LOCAL_PATH)/../../../library/android/libpng/libs/$(TARGET_ARCH_ABI) -lpng \
                     -L$(LOCAL_PATH)/../../../library/android/libjpeg/libs/$(TARGET_ARCH_ABI) -ljpeg \
                     -L$(LOCAL_PATH)/../../../library/android/libcurl/libs/$(TARGET_ARCH_ABI) -lcurl \
 
 LOCAL_SHARED_LIBRARIES := libJavaScriptCore
+LOCAL_STATIC_LIBRARIES := cpufeatures
+
+include $(BUILD_SHARED_LIBRARY)
 
-include $(BUILD_SHARED_LIBRARY)
\ No newline at end of file
+$(call import-module,android/cpufeatures)
\ No newline at end of file
@@ -31,7 +31,7 @@ extern "C" {
         NSLog("nativeChanged : %d, %d", w, h);
     }
 
-    JNIEXPORT void JNICALL Java_com_impactjs_ejecta_EjectaRenderer_nativeRender(JNIEnv* env, jobject thiz)
+    JNIEXPORT jint JNICALL Java_com_impactjs_ejecta_EjectaRenderer_nativeRender(JNIEnv* env, jobject thiz)
     {
 
         if (s_is_resumed)
@@ -42,6 +42,7 @@ extern "C" {
 
         EJApp::instance()->run();
 
+        return EJApp::instance()->getIdleDelay();
     }
 
     JNIEXPORT void JNICALL Java_com_impactjs_ejecta_EjectaRenderer_nativeFinalize(JNIEnv* env, jobject thiz)
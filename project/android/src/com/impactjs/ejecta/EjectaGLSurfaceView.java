@@ -1,27 +1,114 @@
 package com.impactjs.ejecta;
 
+import javax.microedition.khronos.egl.EGL10;
+import javax.microedition.khronos.egl.EGLConfig;
+import javax.microedition.khronos.egl.EGLDisplay;
+
 import android.content.Context;
 import android.content.res.Configuration;
 import android.opengl.GLSurfaceView;
+import android.os.Handler;
+import android.os.Looper;
 import android.view.KeyEvent;
 import android.view.MotionEvent;
 import android.view.View;
 
 public class EjectaGLSurfaceView extends GLSurfaceView {
 	
+	// Not defined in EGL10
+	private static final int EGL_SWAP_BEHAVIOR_PRESERVED_BIT = 0x0400;
+	private static final int EGL_RENDERABLE_TYPE = 0x3040;
+	private static final int EGL_OPENGL_ES2_BIT = 4;
+	
+	// Prefers a config whose window surface can keep its contents across
+	// swaps, so that each frame only has to draw what changed on the canvas.
+	// Otherwise picks the same kind of config as the default chooser.
+	private static class PreservedConfigChooser implements GLSurfaceView.EGLConfigChooser {
+		public EGLConfig chooseConfig(EGL10 egl, EGLDisplay display) {
+			EGLConfig config = chooseConfig(egl, display, EGL10.EGL_WINDOW_BIT | EGL_SWAP_BEHAVIOR_PRESERVED_BIT);
+			if (config == null) {
+				config = chooseConfig(egl, display, EGL10.EGL_WINDOW_BIT);
+			}
+			if (config == null) {
+				throw new IllegalArgumentException("No EGL config for OpenGL ES 2.0");
+			}
+			return config;
+		}
+		
+		private EGLConfig chooseConfig(EGL10 egl, EGLDisplay display, int surfaceType) {
+			int[] attribs = {
+				EGL10.EGL_RED_SIZE, 8,
+				EGL10.EGL_GREEN_SIZE, 8,
+				EGL10.EGL_BLUE_SIZE, 8,
+				EGL10.EGL_DEPTH_SIZE, 16,
+				EGL10.EGL_SURFACE_TYPE, surfaceType,
+				EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+				EGL10.EGL_NONE
+			};
+			EGLConfig[] configs = new EGLConfig[1];
+			int[] count = new int[1];
+			if (!egl.eglChooseConfig(display, attribs, configs, 1, count) || count[0] == 0) {
+				return null;
+			}
+			return configs[0];
+		}
+	}
+	
 	public EjectaGLSurfaceView(Context context) {
 		// TODO Auto-generated constructor stub
 		super(context);
 	}
 	
 	EjectaRenderer mRenderer;
+	
+	// Frames are only rendered continuously while something changes on the
+	// canvas. When a frame draws nothing new, the view waits for input or
+	// for the next timer that the native side reports.
+	private final Handler mHandler = new Handler(Looper.getMainLooper());
+	private final Runnable mWakeUp = new Runnable() {
+		public void run() {
+			wakeUp();
+		}
+	};
+	
+	private void scheduleNextFrame(int idleDelay) {
+		mHandler.removeCallbacks(mWakeUp);
+		if (idleDelay == 0) {
+			if (getRenderMode() != RENDERMODE_CONTINUOUSLY) {
+				setRenderMode(RENDERMODE_CONTINUOUSLY);
+			}
+			return;
+		}
+		if (getRenderMode() != RENDERMODE_WHEN_DIRTY) {
+			setRenderMode(RENDERMODE_WHEN_DIRTY);
+		}
+		if (idleDelay > 0) {
+			mHandler.postDelayed(mWakeUp, idleDelay);
+		}
+	}
+	
+	private void wakeUp() {
+		mHandler.removeCallbacks(mWakeUp);
+		requestRender();
+	}
 	public EjectaGLSurfaceView(Context context, int width, int height) {
 		super(context);
 		//Sets OpenGLES 2.0 to be used
         setEGLContextClientVersion(2);
+        setEGLConfigChooser(new PreservedConfigChooser());
 		// TODO Auto-generated constructor stub
 		mRenderer = new EjectaRenderer(context, width, height);
         setRenderer(mRenderer);
+        mRenderer.setFrameListener(new EjectaRenderer.FrameListener() {
+            @Override
+            public void onFrameRendered(final int idleDelay) {
+                mHandler.post(new Runnable() {
+                    public void run() {
+                        scheduleNextFrame(idleDelay);
+                    }
+                });
+            }
+        });
 
         super.setOnTouchListener(new OnTouchListener() {
             @Override
@@ -37,6 +124,7 @@ public class EjectaGLSurfaceView extends GLSurfaceView {
                         mRenderer.nativeTouch(motionEvent.getAction(), (int)motionEvent.getX(), (int)motionEvent.getY());
                         break;
                 }
+                wakeUp();
                 // Get all touches, return true
                 return true;
             }
@@ -48,11 +136,13 @@ public class EjectaGLSurfaceView extends GLSurfaceView {
 		// TODO Auto-generated method stub
 		mRenderer.nativeResume();
 		super.onResume();
+		wakeUp();
 	}
 	
 	@Override
 	public void onPause() {
 		// TODO Auto-generated method stub
+		mHandler.removeCallbacks(mWakeUp);
 		super.onPause();
 		mRenderer.nativePause();
 	}
@@ -61,6 +151,7 @@ public class EjectaGLSurfaceView extends GLSurfaceView {
 	public boolean onKeyDown(int keyCode, KeyEvent event) {
 		// TODO Auto-generated method stub
 		mRenderer.nativeOnKeyDown(keyCode);
+		wakeUp();
 		return super.onKeyDown(keyCode, event);
 	}
 	
@@ -68,6 +159,7 @@ public class EjectaGLSurfaceView extends GLSurfaceView {
 	public boolean onKeyUp(int keyCode, KeyEvent event) {
 		// TODO Auto-generated method stub
 		mRenderer.nativeOnKeyUp(keyCode);
+		wakeUp();
 		return super.onKeyUp(keyCode, event);
 	}
 	
@@ -94,6 +186,7 @@ public class EjectaGLSurfaceView extends GLSurfaceView {
 
     public void loadJavaScriptFile(String filename) {
         mRenderer.nativeLoadJavaScriptFile(filename);
+        wakeUp();
     }
 
 	@Override
@@ -13,6 +13,7 @@ public class EjectaRenderer implements Renderer {
     private int screen_width;
     private int screen_height;
     private EjectaEventListener ejectaEventListener = null;
+    private FrameListener frameListener = null;
 
     public EjectaRenderer(Context ctx, int width, int height) {
 		mainBundle = "/data/data/" + ctx.getPackageName();
@@ -25,7 +26,10 @@ public class EjectaRenderer implements Renderer {
 
 	@Override
 	public void onDrawFrame(GL10 gl) {  
-		nativeRender(); 
+		int idleDelay = nativeRender(); 
+		if (frameListener != null) {
+			frameListener.onFrameRendered(idleDelay);
+		}
 	}
 
 	@Override
@@ -46,7 +50,9 @@ public class EjectaRenderer implements Renderer {
         onCanvasCreated();
 	}
 
-	private native void nativeRender();
+	// Returns the time in ms until the next frame is needed; 0 if frames should
+	// be rendered continuously, -1 if nothing happens until the next input
+	private native int nativeRender();
 
 	private native void nativeCreated(String mainBundle, int width, int height);
 	
@@ -81,4 +87,13 @@ public class EjectaRenderer implements Renderer {
         public abstract void onCanvasCreated();
     }
 
+    public void setFrameListener(FrameListener listener) {
+        frameListener = listener;
+    }
+
+    // Called on the GL thread after each frame
+    public interface FrameListener {
+        public abstract void onFrameRendered(int idleDelay);
+    }
+
 }
\ No newline at end of file
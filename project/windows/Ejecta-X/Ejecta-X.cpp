@@ -54,6 +54,8 @@ void SetupRC()
 
 }
 
+#define IDLE_TIMER_ID 1
+
 void RenderScene(void)
 {
 	if(!g_ContinueRendering)
@@ -70,9 +72,33 @@ void RenderScene(void)
 
 	EJApp::instance()->run();
 
+	// Flush drawing commands; the front buffer still shows the last frame
+	// if nothing changed
+	if( !EJApp::instance()->isIdle() )
+	{
+		SwapBuffers(g_hDC);
+	}
 
-	// Flush drawing commands
-	SwapBuffers(g_hDC);
+	// Keep painting while the canvas changes, otherwise sleep until the
+	// next input message or timer
+	int idleDelay = EJApp::instance()->getIdleDelay();
+	if( idleDelay == 0 )
+	{
+		KillTimer(g_hWnd, IDLE_TIMER_ID);
+		InvalidateRect(g_hWnd, NULL, FALSE);
+	}
+	else
+	{
+		ValidateRect(g_hWnd, NULL);
+		if( idleDelay > 0 )
+		{
+			SetTimer(g_hWnd, IDLE_TIMER_ID, idleDelay, NULL);
+		}
+		else
+		{
+			KillTimer(g_hWnd, IDLE_TIMER_ID);
+		}
+	}
 }
 
 void ChangeSize(int w, int h)
@@ -396,6 +422,13 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		}
 		//EndPaint(hWnd, &ps);
 		break;
+	case WM_TIMER:
+		// Wakes up the message loop, which renders the next frame
+		if (wParam == IDLE_TIMER_ID)
+		{
+			KillTimer(hWnd, IDLE_TIMER_ID);
+		}
+		break;
 	case WM_SIZE:
 		ChangeSize(LOWORD(lParam),HIWORD(lParam));
 		RenderScene();
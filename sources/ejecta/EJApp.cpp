@@ -1,9 +1,12 @@
 #include "EJApp.h"
+#include <math.h>
 #include "EJBindingBase.h"
 #include "EJUtils/EJBindingTouchInput.h"
 #include "EJUtils/EJBindingHttpRequest.h"
 #include "EJCanvas/EJCanvasContext.h"
 #include "EJCanvas/EJCanvasContextScreen.h"
+#include "EJCanvas/EJGLState.h"
+#include "EJCanvas/EJTextureLoader.h"
 #include "EJCocoa/NSObjectFactory.h"
 #include "EJCocoa/NSAutoreleasePool.h"
 #include "EJTimer.h"
@@ -75,6 +78,7 @@ EJApp::EJApp() : currentRenderingContext(0), screenRenderingContext(0), touchDel
 	//[self.view addSubview:loadingScreen];
 	
 	paused = false;
+	idle = false;
 	internalScaling = 1.0f;
 
 	mainBundle = 0;
@@ -185,6 +189,9 @@ void EJApp::run(void)
 	if( paused ) { return; }
 
 	EJHttpClient::getInstance()->dispatchResponseCallbacks(0);
+	
+	// Create textures for decoded images and call their onload
+	EJTextureLoader::getInstance()->update();
 
 
 	if (!lockTouches)
@@ -215,6 +222,38 @@ void EJApp::run(void)
 		screenRenderingContext->present();
 		NSPoolManager::sharedPoolManager()->pop();
 	}
+	EJTexture::enforceMemoryBudget();
+	idle = !screenRenderingContext || screenRenderingContext->isIdle();
+
+	// Compare the shadowed GL state with the real one (debug only)
+	EJGLState::getInstance()->validate();
+}
+
+int EJApp::getIdleDelay(void)
+{
+	if( paused || !idle || (touches && touches->count() > 0) ) {
+		return 0;
+	}
+	
+	// Decoded images are uploaded over the next frames
+	if( EJTextureLoader::getInstance()->hasDecodedImages() ) {
+		return 0;
+	}
+	
+	int delay = -1;
+	double timeout = timers->getNextTimeout();
+	if( timeout >= 0 ) {
+		delay = (int)ceil(timeout);
+	}
+	
+	// Responses and images are only dispatched from run()
+	if(
+		EJHttpClient::getInstance()->hasPendingRequests() ||
+		EJTextureLoader::getInstance()->hasPendingLoads()
+	) {
+		delay = (delay < 0 || delay > EJECTA_IDLE_POLL_INTERVAL) ? EJECTA_IDLE_POLL_INTERVAL : delay;
+	}
+	return delay;
 }
 
 void EJApp::pause(void)
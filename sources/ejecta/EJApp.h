@@ -34,6 +34,9 @@ using namespace std;
 #define EJECTA_VERSION "0.99"
 #define EJECTA_APP_FOLDER "cache/"
 
+// How often to check for finished http requests while nothing is drawn, in ms
+#define EJECTA_IDLE_POLL_INTERVAL 50
+
 class EJBindingBase;
 class EJTimerCollection;
 class EJCanvasContext;
@@ -46,6 +49,7 @@ class EJApp : public NSObject {
 
 private:
 	BOOL paused;
+	BOOL idle;
 
 	JavaVM *jvm;
 	jobject g_obj;
@@ -80,6 +84,12 @@ public:
     void init(JNIEnv* env, jobject jobj, const char* path, int w, int h);
     void setScreenSize(int w, int h);
     void run(void);
+    // Milliseconds the host may wait before calling run() again, as the last
+    // frame didn't change the screen; 0 to keep rendering every frame, -1 to
+    // wait for the next input event
+    int getIdleDelay(void);
+    // Whether the last frame left the screen unchanged
+    BOOL isIdle(void) const { return idle; }
     void pause(void);
     void resume(void);
     void clearCaches(void);
@@ -1,5 +1,18 @@
 #include "EJBindingEjectaCore.h"
 #include "EJConvert.h"
+#include "EJCanvas/EJTextureAtlas.h"
+#include "EJCanvas/EJTextureCache.h"
+#include "EJCanvas/EJTextureLoader.h"
+#include "EJCanvas/EJGLState.h"
+#include "EJCanvas/EJVertexTransform.h"
+#include "EJCanvas/EJCanvasContextScreen.h"
+#include "EJCanvas/EJCanvasContextTexture.h"
+
+static void EJSetNumberProperty(JSContextRef ctx, JSObjectRef object, const char * name, double value) {
+	JSStringRef nameRef = JSStringCreateWithUTF8CString(name);
+	JSObjectSetProperty(ctx, object, nameRef, JSValueMakeNumber(ctx, value), kJSPropertyAttributeNone, NULL);
+	JSStringRelease(nameRef);
+}
 
 
 EJBindingEjectaCore::EJBindingEjectaCore() : urlToOpen(0), getTextCallback(0)
@@ -102,4 +115,171 @@ EJ_BIND_GET(EJBindingEjectaCore,onLine, ctx) {
 	return JSValueMakeBoolean(ctx, true);
 }
 
+//
+EJ_BIND_GET(EJBindingEjectaCore,textureAtlasStats, ctx) {
+	EJTextureAtlasStats stats = EJTextureAtlas::getInstance()->getStats();
+	
+	JSObjectRef objRef = JSObjectMake(ctx, NULL, NULL);
+	EJSetNumberProperty(ctx, objRef, "pages", stats.pages);
+	EJSetNumberProperty(ctx, objRef, "images", stats.images);
+	EJSetNumberProperty(ctx, objRef, "rejectedImages", stats.rejectedImages);
+	EJSetNumberProperty(ctx, objRef, "usedPixels", stats.usedPixels);
+	EJSetNumberProperty(ctx, objRef, "totalPixels", stats.totalPixels);
+	EJSetNumberProperty(ctx, objRef, "utilization", stats.totalPixels ? (double)stats.usedPixels / stats.totalPixels : 0);
+	return objRef;
+}
+
+// Damage of the screen canvas; savedFraction is the share of pixels that
+// didn't have to be drawn since startup
+EJ_BIND_GET(EJBindingEjectaCore,damageStats, ctx) {
+	EJCanvasContextScreen * screen = EJApp::instance()->screenRenderingContext;
+	if( !screen ) { return JSValueMakeUndefined(ctx); }
+	EJCanvasDamageStats stats = screen->getDamageStats();
+	
+	JSObjectRef objRef = JSObjectMake(ctx, NULL, NULL);
+	EJSetNumberProperty(ctx, objRef, "frames", stats.frames);
+	EJSetNumberProperty(ctx, objRef, "idleFrames", stats.idleFrames);
+	EJSetNumberProperty(ctx, objRef, "skippedFrames", stats.skippedFrames);
+	EJSetNumberProperty(ctx, objRef, "x", stats.x);
+	EJSetNumberProperty(ctx, objRef, "y", stats.y);
+	EJSetNumberProperty(ctx, objRef, "width", stats.width);
+	EJSetNumberProperty(ctx, objRef, "height", stats.height);
+	EJSetNumberProperty(ctx, objRef, "damagedPixels", stats.damagedPixels);
+	EJSetNumberProperty(ctx, objRef, "totalPixels", stats.totalPixels);
+	EJSetNumberProperty(ctx, objRef, "savedFraction", stats.totalPixels ? 1 - stats.damagedPixels / stats.totalPixels : 0);
+	
+	JSStringRef nameRef = JSStringCreateWithUTF8CString("preservedSwap");
+	JSObjectSetProperty(ctx, objRef, nameRef, JSValueMakeBoolean(ctx, stats.preservedSwap), kJSPropertyAttributeNone, NULL);
+	JSStringRelease(nameRef);
+	return objRef;
+}
+
+// GPU memory of all textures in bytes; evicted textures are loaded again
+// from their file when they are drawn
+EJ_BIND_GET(EJBindingEjectaCore,textureMemoryStats, ctx) {
+	EJTextureMemoryStats stats = EJTexture::getMemoryStats();
+	
+	JSObjectRef objRef = JSObjectMake(ctx, NULL, NULL);
+	EJSetNumberProperty(ctx, objRef, "usedBytes", stats.usedBytes);
+	EJSetNumberProperty(ctx, objRef, "highWaterBytes", stats.highWaterBytes);
+	EJSetNumberProperty(ctx, objRef, "budgetBytes", stats.budgetBytes);
+	EJSetNumberProperty(ctx, objRef, "textures", stats.textures);
+	EJSetNumberProperty(ctx, objRef, "evictions", stats.evictions);
+	EJSetNumberProperty(ctx, objRef, "reloads", stats.reloads);
+	return objRef;
+}
+
+EJ_BIND_GET(EJBindingEjectaCore,textureCacheStats, ctx) {
+	EJTextureCacheStats stats = EJTextureCache::getInstance()->getStats();
+	
+	JSObjectRef objRef = JSObjectMake(ctx, NULL, NULL);
+	EJSetNumberProperty(ctx, objRef, "entries", stats.entries);
+	EJSetNumberProperty(ctx, objRef, "lookups", stats.lookups);
+	EJSetNumberProperty(ctx, objRef, "hits", stats.hits);
+	EJSetNumberProperty(ctx, objRef, "hitRate", stats.lookups ? (double)stats.hits / stats.lookups : 0);
+	EJSetNumberProperty(ctx, objRef, "savedBytes", stats.savedBytes);
+	return objRef;
+}
+
+// Images decoded in the background; times are in ms
+EJ_BIND_GET(EJBindingEjectaCore,textureLoaderStats, ctx) {
+	EJTextureLoaderStats stats = EJTextureLoader::getInstance()->getStats();
+	
+	JSObjectRef objRef = JSObjectMake(ctx, NULL, NULL);
+	EJSetNumberProperty(ctx, objRef, "decodeQueue", stats.decodeQueue);
+	EJSetNumberProperty(ctx, objRef, "uploadQueue", stats.uploadQueue);
+	EJSetNumberProperty(ctx, objRef, "sharedQueue", stats.sharedQueue);
+	EJSetNumberProperty(ctx, objRef, "loaded", stats.loaded);
+	EJSetNumberProperty(ctx, objRef, "cancelled", stats.cancelled);
+	EJSetNumberProperty(ctx, objRef, "coalesced", stats.coalesced);
+	EJSetNumberProperty(ctx, objRef, "sharedUploads", stats.sharedUploads);
+	EJSetNumberProperty(ctx, objRef, "decodeTime", stats.decodeTime);
+	EJSetNumberProperty(ctx, objRef, "uploadTime", stats.uploadTime);
+	return objRef;
+}
+
+EJ_BIND_GET(EJBindingEjectaCore,textureMemoryBudget, ctx) {
+	return JSValueMakeNumber(ctx, EJTexture::getMemoryStats().budgetBytes);
+}
+
+EJ_BIND_SET(EJBindingEjectaCore,textureMemoryBudget, ctx, value) {
+	EJTexture::setMemoryBudget(JSValueToNumberFast(ctx, value));
+}
+
+EJ_BIND_GET(EJBindingEjectaCore,imageDownscaleLimit, ctx) {
+	return JSValueMakeNumber(ctx, EJTexture::getDownscaleLimit());
+}
+
+EJ_BIND_SET(EJBindingEjectaCore,imageDownscaleLimit, ctx, value) {
+	// E.g. 1 to downscale images that are larger than the screen; only
+	// affects images loaded afterwards
+	EJTexture::setDownscaleLimit(JSValueToNumberFast(ctx, value));
+}
+
+EJ_BIND_GET(EJBindingEjectaCore,imageMipmaps, ctx) {
+	return JSValueMakeBoolean(ctx, EJTexture::mipmapsEnabled());
+}
+
+EJ_BIND_SET(EJBindingEjectaCore,imageMipmaps, ctx, value) {
+	// Default for images that don't set their mipmaps property; only affects
+	// images loaded afterwards
+	EJTexture::setMipmapsEnabled(JSValueToBoolean(ctx, value));
+}
+
+EJ_BIND_GET(EJBindingEjectaCore,glStateValidation, ctx) {
+	return JSValueMakeBoolean(ctx, EJGLState::getInstance()->validationEnabled);
+}
+
+EJ_BIND_SET(EJBindingEjectaCore,glStateValidation, ctx, value) {
+	EJGLState::getInstance()->validationEnabled = JSValueToBoolean(ctx, value);
+}
+
+// Microbenchmark for the vertex transform kernels:
+// ejecta.benchmarkVertexTransform(points, iterations)
+EJ_BIND_FUNCTION(EJBindingEjectaCore,benchmarkVertexTransform, ctx, argc, argv) {
+	int points = argc > 0 ? (int)JSValueToNumberFast(ctx, argv[0]) : 4096;
+	int iterations = argc > 1 ? (int)JSValueToNumberFast(ctx, argv[1]) : 1000;
+	if( points < 1 || iterations < 1 ) { return NULL; }
+	
+	EJTransformBenchmarkResult result = EJTransformBenchmark(points, iterations);
+	
+	JSObjectRef objRef = JSObjectMake(ctx, NULL, NULL);
+	EJSetNumberProperty(ctx, objRef, "points", result.points);
+	EJSetNumberProperty(ctx, objRef, "iterations", result.iterations);
+	EJSetNumberProperty(ctx, objRef, "scalarTime", result.scalarTime);
+	EJSetNumberProperty(ctx, objRef, "simdTime", result.simdTime);
+	
+	JSStringRef nameRef = JSStringCreateWithUTF8CString("simdKernel");
+	JSObjectSetProperty(ctx, objRef, nameRef, NSStringToJSValue(ctx, NSStringMake(result.simdKernel)), kJSPropertyAttributeNone, NULL);
+	JSStringRelease(nameRef);
+	return objRef;
+}
+
+// Throughput of minified sprites with and without mipmaps:
+// ejecta.benchmarkMipmaps(sprites, frames, scale)
+EJ_BIND_FUNCTION(EJBindingEjectaCore,benchmarkMipmaps, ctx, argc, argv) {
+	int sprites = argc > 0 ? (int)JSValueToNumberFast(ctx, argv[0]) : 200;
+	int frames = argc > 1 ? (int)JSValueToNumberFast(ctx, argv[1]) : 30;
+	float scale = argc > 2 ? (float)JSValueToNumberFast(ctx, argv[2]) : 0.25f;
+	if( sprites < 1 || frames < 1 || scale <= 0 ) { return NULL; }
+	
+	// The benchmark draws into its own offscreen canvas
+	EJCanvasContext * current = EJApp::instance()->currentRenderingContext;
+	if( current ) {
+		current->flushBuffers();
+	}
+	EJMipmapBenchmarkResult result = EJCanvasContextTexture::benchmarkMipmaps(sprites, frames, scale);
+	if( current ) {
+		current->prepare();
+	}
+	
+	JSObjectRef objRef = JSObjectMake(ctx, NULL, NULL);
+	EJSetNumberProperty(ctx, objRef, "sprites", result.sprites);
+	EJSetNumberProperty(ctx, objRef, "frames", result.frames);
+	EJSetNumberProperty(ctx, objRef, "scale", result.scale);
+	EJSetNumberProperty(ctx, objRef, "plainTime", result.plainTime);
+	EJSetNumberProperty(ctx, objRef, "mipmapTime", result.mipmapTime);
+	return objRef;
+}
+
 REFECTION_CLASS_IMPLEMENT(EJBindingEjectaCore);
\ No newline at end of file
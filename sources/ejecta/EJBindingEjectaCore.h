@@ -38,6 +38,8 @@ public:
 	EJ_BIND_FUNCTION_DEFINE(setInterval, ctx, argc, argv );
 	EJ_BIND_FUNCTION_DEFINE(clearTimeout, ctx, argc, argv);
 	EJ_BIND_FUNCTION_DEFINE(clearInterval, ctx, argc, argv );
+	EJ_BIND_FUNCTION_DEFINE(benchmarkVertexTransform, ctx, argc, argv );
+	EJ_BIND_FUNCTION_DEFINE(benchmarkMipmaps, ctx, argc, argv );
 
 	EJ_BIND_GET_DEFINE(devicePixelRatio, ctx);
 	EJ_BIND_GET_DEFINE(screenWidth, ctx);
@@ -46,6 +48,19 @@ public:
 	EJ_BIND_GET_DEFINE(userAgent, ctx);
 	EJ_BIND_GET_DEFINE(appVersion, ctx);
 	EJ_BIND_GET_DEFINE(onLine, ctx);
+	EJ_BIND_GET_DEFINE(textureAtlasStats, ctx);
+	EJ_BIND_GET_DEFINE(damageStats, ctx);
+	EJ_BIND_GET_DEFINE(textureMemoryStats, ctx);
+	EJ_BIND_GET_DEFINE(textureCacheStats, ctx);
+	EJ_BIND_GET_DEFINE(textureLoaderStats, ctx);
+	EJ_BIND_GET_DEFINE(textureMemoryBudget, ctx);
+	EJ_BIND_SET_DEFINE(textureMemoryBudget, ctx, value);
+	EJ_BIND_GET_DEFINE(imageDownscaleLimit, ctx);
+	EJ_BIND_SET_DEFINE(imageDownscaleLimit, ctx, value);
+	EJ_BIND_GET_DEFINE(imageMipmaps, ctx);
+	EJ_BIND_SET_DEFINE(imageMipmaps, ctx, value);
+	EJ_BIND_GET_DEFINE(glStateValidation, ctx);
+	EJ_BIND_SET_DEFINE(glStateValidation, ctx, value);
 };
 
 #endif // __EJ_BINDING_EJECTA_CORE_H__
@@ -1,5 +1,6 @@
 #include "EJBindingCanvas.h"
 #include "EJBindingImageData.h"
+#include "EJBindingPath2D.h"
 #include "EJCanvasContextScreen.h"
 
 bool EJBindingCanvas::firstCanvasInstance = true;
@@ -223,6 +224,33 @@ EJ_BIND_GET(EJBindingCanvas, imageSmoothingEnabled, ctx) {
 	return JSValueMakeBoolean(ctx, renderingContext->imageSmoothingEnabled);
 }
 
+EJ_BIND_SET(EJBindingCanvas, multiTextureBatchingEnabled, ctx, value) {
+	ejectaInstance->setCurrentRenderingContext(renderingContext);
+	renderingContext->multiTextureBatchingEnabled = JSValueToBoolean(ctx, value);
+}
+
+EJ_BIND_GET(EJBindingCanvas, multiTextureBatchingEnabled, ctx) {
+	return JSValueMakeBoolean(ctx, renderingContext->multiTextureBatchingEnabled);
+}
+
+EJ_BIND_SET(EJBindingCanvas, commandReorderingEnabled, ctx, value) {
+	ejectaInstance->setCurrentRenderingContext(renderingContext);
+	renderingContext->commandReorderingEnabled = JSValueToBoolean(ctx, value);
+}
+
+EJ_BIND_GET(EJBindingCanvas, commandReorderingEnabled, ctx) {
+	return JSValueMakeBoolean(ctx, renderingContext->commandReorderingEnabled);
+}
+
+EJ_BIND_SET(EJBindingCanvas, edgeAntialiasingEnabled, ctx, value) {
+	ejectaInstance->setCurrentRenderingContext(renderingContext);
+	renderingContext->edgeAntialiasingEnabled = JSValueToBoolean(ctx, value);
+}
+
+EJ_BIND_GET(EJBindingCanvas, edgeAntialiasingEnabled, ctx) {
+	return JSValueMakeBoolean(ctx, renderingContext->edgeAntialiasingEnabled);
+}
+
 EJ_BIND_GET(EJBindingCanvas, backingStorePixelRatio, ctx) {
 	return JSValueMakeNumber(ctx, renderingContext->backingStoreRatio);
 }
@@ -397,7 +425,7 @@ EJ_BIND_FUNCTION(EJBindingCanvas, drawImage, ctx, argc, argv) {
 
 	float scale = image?image->contentScale:1;
 	
-	short sx = 0, sy = 0, sw = 0, sh = 0;
+	float sx = 0, sy = 0, sw = 0, sh = 0;
 	float dx = 0, dy = 0, dw = sw, dh = sh;	
 	
 	if( argc == 3 ) {
@@ -420,10 +448,12 @@ EJ_BIND_FUNCTION(EJBindingCanvas, drawImage, ctx, argc, argv) {
 	}
 	else if( argc >= 9 ) {
 		// drawImage(image, sx, sy, sw, sh, dx, dy, dw, dh)
-		sx = (short)(JSValueToNumberFast(ctx, argv[1]) * scale);
-		sy = (short)(JSValueToNumberFast(ctx, argv[2]) * scale);
-		sw = (short)(JSValueToNumberFast(ctx, argv[3]) * scale);
-		sh = (short)(JSValueToNumberFast(ctx, argv[4]) * scale);
+		// Images downscaled while decoding have a contentScale below 1; the
+		// source rect stays fractional so that sprite sheet frames don't drift
+		sx = (float)(JSValueToNumberFast(ctx, argv[1]) * scale);
+		sy = (float)(JSValueToNumberFast(ctx, argv[2]) * scale);
+		sw = (float)(JSValueToNumberFast(ctx, argv[3]) * scale);
+		sh = (float)(JSValueToNumberFast(ctx, argv[4]) * scale);
 		
 		dx = (float)JSValueToNumberFast(ctx, argv[5]);
 		dy = (float)JSValueToNumberFast(ctx, argv[6]);
@@ -569,17 +599,46 @@ EJ_BIND_FUNCTION(EJBindingCanvas, drawImage, ctx, argc, argv) {
  	return NULL;
  }
 
+// Returns the Path2D passed as the first argument of fill(), stroke() or
+// clip(), or NULL if the current path should be used
+static EJBindingPath2D * EJBindingCanvasGetPath2D(JSContextRef ctx, size_t argc, const JSValueRef argv[]) {
+	if( argc < 1 || !JSValueIsObject(ctx, argv[0]) ) { return NULL; }
+	
+	EJBindingPath2D* path2D = NULL;
+	EJBindingPath2D* tempBindingPath = new EJBindingPath2D();
+	JSClassRef pathClass = EJApp::instance()->getJSClassForClass(tempBindingPath);
+	if( JSValueIsObjectOfClass(ctx, argv[0], pathClass) ) {
+		path2D = (EJBindingPath2D*)JSObjectGetPrivate((JSObjectRef)argv[0]);
+	}
+	delete tempBindingPath;
+	return path2D;
+}
+
  EJ_BIND_FUNCTION( EJBindingCanvas,fill, ctx, argc, argv ) {
  	//ejectaInstance->currentRenderingContext = renderingContext;
 	ejectaInstance->setCurrentRenderingContext(renderingContext);
- 	renderingContext->fill();
+	EJBindingPath2D* path2D = EJBindingCanvasGetPath2D(ctx, argc, argv);
+	if( path2D ) {
+		float scale = CGAffineTransformGetScale(renderingContext->state->transform);
+		renderingContext->fill(path2D->getPathForScale(scale));
+	}
+	else {
+ 		renderingContext->fill();
+	}
  	return NULL;
  }
 
  EJ_BIND_FUNCTION(EJBindingCanvas, stroke, ctx, argc, argv ) {
  	//ejectaInstance->currentRenderingContext = renderingContext;
 	ejectaInstance->setCurrentRenderingContext(renderingContext);
- 	renderingContext->stroke();
+	EJBindingPath2D* path2D = EJBindingCanvasGetPath2D(ctx, argc, argv);
+	if( path2D ) {
+		float scale = CGAffineTransformGetScale(renderingContext->state->transform);
+		renderingContext->stroke(path2D->getPathForScale(scale));
+	}
+	else {
+ 		renderingContext->stroke();
+	}
  	return NULL;
  }
 
@@ -715,7 +774,15 @@ EJ_BIND_FUNCTION(EJBindingCanvas, drawImage, ctx, argc, argv) {
  EJ_BIND_FUNCTION(EJBindingCanvas, clip, ctx, argc, argv ) {
  	//ejectaInstance->currentRenderingContext = renderingContext;
 	 ejectaInstance->setCurrentRenderingContext(renderingContext);
- 	renderingContext->clip();
+	EJBindingPath2D* path2D = EJBindingCanvasGetPath2D(ctx, argc, argv);
+	if( path2D ) {
+		// Clip paths are kept in the state and redrawn on restore(), so they
+		// are stored with the transform applied
+		renderingContext->clip(path2D->pathWithTransform(renderingContext->state->transform));
+	}
+	else {
+ 		renderingContext->clip();
+	}
  	return NULL;
  }
 
@@ -110,6 +110,12 @@ public:
 	EJ_BIND_GET_DEFINE(retinaResolutionEnabled, ctx);
 	EJ_BIND_SET_DEFINE(imageSmoothingEnabled, ctx, value);
 	EJ_BIND_GET_DEFINE(imageSmoothingEnabled, ctx);
+	EJ_BIND_SET_DEFINE(multiTextureBatchingEnabled, ctx, value);
+	EJ_BIND_GET_DEFINE(multiTextureBatchingEnabled, ctx);
+	EJ_BIND_SET_DEFINE(commandReorderingEnabled, ctx, value);
+	EJ_BIND_GET_DEFINE(commandReorderingEnabled, ctx);
+	EJ_BIND_SET_DEFINE(edgeAntialiasingEnabled, ctx, value);
+	EJ_BIND_GET_DEFINE(edgeAntialiasingEnabled, ctx);
 	EJ_BIND_GET_DEFINE(backingStorePixelRatio, ctx);
 	EJ_BIND_SET_DEFINE(MSAAEnabled, ctx, value);
 	EJ_BIND_GET_DEFINE(MSAAEnabled, ctx);
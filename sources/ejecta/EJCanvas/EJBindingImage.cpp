@@ -1,41 +1,65 @@
 #include "EJBindingImage.h"
 #include "../EJApp.h"
+#include "EJCanvasContextScreen.h"
 
 
-EJBindingImage::EJBindingImage() : EJDrawable(0), path(0), loading(false) {
+EJBindingImage::EJBindingImage() : EJDrawable(0), path(0), loading(false), atlasEnabled(true), maxSize(0), mipmaps(-1) {
 }
 
 EJBindingImage::~EJBindingImage() {
+	if( loading ) {
+		EJTextureLoader::getInstance()->cancel(this);
+	}
 	if(texture)texture->release();
 	if(path)path->release();
 }
 
+int EJBindingImage::getEffectiveMaxSize() {
+	if( maxSize ) {
+		return maxSize;
+	}
+
+	// Relative to the screen canvas, or to the screen itself if there's no
+	// screen canvas yet
+	float limit = EJTexture::getDownscaleLimit();
+	if( limit <= 0 ) {
+		return 0;
+	}
+	EJApp * app = EJApp::instance();
+	EJCanvasContextScreen * screen = app->screenRenderingContext;
+	int screenWidth = screen ? screen->getBufferWidth() : app->width;
+	int screenHeight = screen ? screen->getBufferHeight() : app->height;
+	return (int)(limit * (screenWidth > screenHeight ? screenWidth : screenHeight));
+}
+
+bool EJBindingImage::getEffectiveMipmaps() {
+	return mipmaps == -1 ? EJTexture::mipmapsEnabled() : (mipmaps != 0);
+}
+
 void EJBindingImage::beginLoad() {
 	// This will begin loading the texture in a background thread and will call the
 	// JavaScript onload callback when done
 	loading = true;
 	
-	NSString* sharegroup = new NSString();
-	sharegroup->autorelease();
-	load(sharegroup);
-}
-
-void EJBindingImage::load(NSString* sharegroup) {
-
+	// Keep the JS object alive until onload or onerror was called
+	JSValueProtect(EJApp::instance()->jsGlobalContext, jsObject);
+	
 	NSLOG("Loading Image: %s", path->getCString() );
 	NSString * fullPath = EJApp::instance()->pathForResource(path);
-	EJTexture * tempTex = new EJTexture(fullPath, sharegroup);
-	tempTex->autorelease();
-	endLoad(tempTex);
+	EJTextureLoader::getInstance()->loadTexture(fullPath, atlasEnabled, getEffectiveMaxSize(), getEffectiveMipmaps(), this);
+}
 
+void EJBindingImage::textureLoaded(EJTexture * tex) {
+	endLoad(tex);
 }
 
 void EJBindingImage::endLoad(EJTexture * tex) {
 	loading = false;
-	tex->retain();
-	texture = tex;
+	JSValueUnprotect(EJApp::instance()->jsGlobalContext, jsObject);
 
-	if( tex->textureId ) {
+	if( tex ) {
+		tex->retain();
+		texture = tex;
 		EJBindingEventedBase::triggerEvent(NSStringMake("load") ,0 ,NULL);
 	}
 	else {
@@ -55,10 +79,6 @@ EJ_BIND_GET( EJBindingImage, src, ctx ) {
 }
 
 EJ_BIND_SET( EJBindingImage, src, ctx, value) {
-	// If the texture is still loading, do nothing to avoid confusion
-	// This will break some edge cases; FIXME
-	if( loading ) { return; }
-
 	NSString * newPath = JSValueToNSString( ctx, value );
 	
 	// Release the old path and texture?
@@ -67,11 +87,20 @@ EJ_BIND_SET( EJBindingImage, src, ctx, value) {
 		// Same as the old path? Nothing to do here
 		if( path->isEqual(newPath) ) { return; }
 
+		// A load that is still in progress is superseded by the new one
+		if( loading ) {
+			EJTextureLoader::getInstance()->cancel(this);
+			JSValueUnprotect(ctx, jsObject);
+			loading = false;
+		}
+
 		path->release();
 		path = NULL;
 		
-		texture->release();
-		texture = NULL;
+		if( texture ) {
+			texture->release();
+			texture = NULL;
+		}
 	}
 	
 	if( newPath->length() ) {
@@ -82,16 +111,50 @@ EJ_BIND_SET( EJBindingImage, src, ctx, value) {
 
 }
 
+// Downscaled textures report the size of the original image, rounded as the
+// scale is only exact for the width
 EJ_BIND_GET( EJBindingImage, width, ctx ) {
-	return JSValueMakeNumber( ctx, texture ? (texture->width / texture->contentScale) : 0);
+	return JSValueMakeNumber( ctx, texture ? floorf(texture->width / texture->contentScale + 0.5f) : 0);
 }
 
 EJ_BIND_GET( EJBindingImage, height, ctx ) { 
-	return JSValueMakeNumber( ctx, texture ? (texture->height / texture->contentScale) : 0 );
+	return JSValueMakeNumber( ctx, texture ? floorf(texture->height / texture->contentScale + 0.5f) : 0 );
 }
 
 EJ_BIND_GET( EJBindingImage, complete, ctx ) {
-	return JSValueMakeBoolean(ctx, (texture && texture->textureId) );
+	return JSValueMakeBoolean(ctx, (texture && texture->isLoaded()) );
+}
+
+EJ_BIND_GET( EJBindingImage, atlas, ctx ) {
+	return JSValueMakeBoolean(ctx, atlasEnabled);
+}
+
+EJ_BIND_SET( EJBindingImage, atlas, ctx, value) {
+	// Only affects images loaded after this was set; small images are packed
+	// into a shared texture atlas by default
+	atlasEnabled = JSValueToBoolean(ctx, value);
+}
+
+EJ_BIND_GET( EJBindingImage, maxSize, ctx ) {
+	return JSValueMakeNumber(ctx, maxSize);
+}
+
+EJ_BIND_SET( EJBindingImage, maxSize, ctx, value) {
+	// Only affects images loaded after this was set; larger images are
+	// downscaled by powers of two while decoding, but keep reporting their
+	// original width and height. 0 uses the global downscale limit.
+	maxSize = (int)JSValueToNumberFast(ctx, value);
+}
+
+EJ_BIND_GET( EJBindingImage, mipmaps, ctx ) {
+	return JSValueMakeBoolean(ctx, getEffectiveMipmaps());
+}
+
+EJ_BIND_SET( EJBindingImage, mipmaps, ctx, value) {
+	// Only affects images loaded after this was set; mipmapped images look
+	// smooth when drawn scaled down, but are never packed into the atlas.
+	// Defaults to ejecta.imageMipmaps.
+	mipmaps = JSValueToBoolean(ctx, value) ? 1 : 0;
 }
 
 EJ_BIND_EVENT( EJBindingImage, load);
@@ -4,14 +4,19 @@
 #include "../EJBindingEventedBase.h"
 #include "EJDrawable.h"
 #include "../EJCocoa/NSString.h"
+#include "EJTextureLoader.h"
 
-class EJBindingImage : public EJBindingEventedBase, public EJDrawable {
+class EJBindingImage : public EJBindingEventedBase, public EJDrawable, public EJTextureLoaderDelegate {
 
 	NSString* path;
 	BOOL loading;
+	BOOL atlasEnabled;
+	int maxSize;
+	int mipmaps;	// -1 to follow EJTexture::mipmapsEnabled()
 
+	int getEffectiveMaxSize();
+	bool getEffectiveMipmaps();
 	void beginLoad();
-	void load(NSString* sharegroup);
 	void endLoad(EJTexture * tex);
 public:
 
@@ -22,12 +27,19 @@ public:
 	virtual string superclass(){ return EJBindingEventedBase::toString();};
 
 	virtual EJTexture* getTexture();
+	virtual void textureLoaded(EJTexture * texture);
 
 	EJ_BIND_GET_DEFINE(src, ctx );
 	EJ_BIND_SET_DEFINE(src, ctx, value);
 	EJ_BIND_GET_DEFINE(width, ctx );
 	EJ_BIND_GET_DEFINE(height, ctx );
 	EJ_BIND_GET_DEFINE(complete, ctx );
+	EJ_BIND_GET_DEFINE(atlas, ctx );
+	EJ_BIND_SET_DEFINE(atlas, ctx, value);
+	EJ_BIND_GET_DEFINE(maxSize, ctx );
+	EJ_BIND_SET_DEFINE(maxSize, ctx, value);
+	EJ_BIND_GET_DEFINE(mipmaps, ctx );
+	EJ_BIND_SET_DEFINE(mipmaps, ctx, value);
 	
 	// EJ_BIND_EVENT_DEFINE(load);
 	// EJ_BIND_EVENT_DEFINE(error);
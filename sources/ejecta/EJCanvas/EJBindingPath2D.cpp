@@ -0,0 +1,190 @@
+#include "EJBindingPath2D.h"
+#include "../EJApp.h"
+
+
+EJBindingPath2D::EJBindingPath2D() : path(NULL), pathScale(1) {
+}
+
+EJBindingPath2D::~EJBindingPath2D() {
+	if(path)path->release();
+}
+
+void EJBindingPath2D::init(JSContextRef ctx, JSObjectRef obj, size_t argc, const JSValueRef argv[]) {
+	EJBindingBase::init(ctx, obj, argc, argv);
+
+	// new Path2D(otherPath) copies the commands of the other path
+	if( argc > 0 && JSValueIsObject(ctx, argv[0]) ) {
+		EJBindingPath2D* tempBindingPath = new EJBindingPath2D();
+		JSClassRef pathClass = EJApp::instance()->getJSClassForClass(tempBindingPath);
+		if( JSValueIsObjectOfClass(ctx, argv[0], pathClass) ) {
+			EJBindingPath2D* other = (EJBindingPath2D*)JSObjectGetPrivate((JSObjectRef)argv[0]);
+			ops = other->ops;
+		}
+		delete tempBindingPath;
+	}
+}
+
+void EJBindingPath2D::addOp(EJPath2DOpType type, int argc, const float * args) {
+	EJPath2DOp op;
+	op.type = type;
+	for( int i = 0; i < argc; i++ ) {
+		op.args[i] = args[i];
+	}
+	ops.push_back(op);
+
+	// Appending to the cached path only invalidates its fill and stroke
+	// geometry, the points flattened so far can be kept
+	if( path ) {
+		applyOp(op, path, pathScale);
+	}
+}
+
+void EJBindingPath2D::applyOp(const EJPath2DOp &op, EJPath * target, float scale) {
+	const float * a = op.args;
+	switch( op.type ) {
+		case kEJPath2DOpMoveTo:
+			target->moveTo(a[0], a[1]);
+			break;
+		case kEJPath2DOpLineTo:
+			target->lineTo(a[0], a[1]);
+			break;
+		case kEJPath2DOpBezierCurveTo:
+			target->bezierCurveTo(a[0], a[1], a[2], a[3], a[4], a[5], scale);
+			break;
+		case kEJPath2DOpQuadraticCurveTo:
+			target->quadraticCurveTo(a[0], a[1], a[2], a[3], scale);
+			break;
+		case kEJPath2DOpArcTo:
+			target->arcTo(a[0], a[1], a[2], a[3], a[4], scale);
+			break;
+		case kEJPath2DOpArc:
+			target->arc(a[0], a[1], a[2], a[3], a[4], a[5] != 0, scale);
+			break;
+		case kEJPath2DOpClose:
+			target->close();
+			break;
+	}
+}
+
+EJPath * EJBindingPath2D::getPathForScale(float scale) {
+	// Curves are flattened with a tolerance that depends on the scale, so the
+	// points have to be generated again when it changes
+	if( path && scale == pathScale ) {
+		return path;
+	}
+
+	if( !path ) {
+		path = new EJPath();
+	}
+	path->reset();
+	pathScale = scale;
+	for( std::vector<EJPath2DOp>::iterator op = ops.begin(); op != ops.end(); ++op ) {
+		applyOp(*op, path, scale);
+	}
+	return path;
+}
+
+EJPath * EJBindingPath2D::pathWithTransform(CGAffineTransform transform) {
+	EJPath * transformedPath = new EJPath();
+	transformedPath->autorelease();
+	transformedPath->transform = transform;
+	transformedPath->transformKind = EJTransformGetKind(transform);
+
+	float scale = CGAffineTransformGetScale(transform);
+	for( std::vector<EJPath2DOp>::iterator op = ops.begin(); op != ops.end(); ++op ) {
+		applyOp(*op, transformedPath, scale);
+	}
+	return transformedPath;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, moveTo, ctx, argc, argv ) {
+	if( argc < 2 ) { return NULL; }
+
+	float args[] = {
+		(float)JSValueToNumberFast(ctx, argv[0]),
+		(float)JSValueToNumberFast(ctx, argv[1])
+	};
+	addOp(kEJPath2DOpMoveTo, 2, args);
+	return NULL;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, lineTo, ctx, argc, argv ) {
+	if( argc < 2 ) { return NULL; }
+
+	float args[] = {
+		(float)JSValueToNumberFast(ctx, argv[0]),
+		(float)JSValueToNumberFast(ctx, argv[1])
+	};
+	addOp(kEJPath2DOpLineTo, 2, args);
+	return NULL;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, bezierCurveTo, ctx, argc, argv ) {
+	if( argc < 6 ) { return NULL; }
+
+	float args[6];
+	for( int i = 0; i < 6; i++ ) {
+		args[i] = JSValueToNumberFast(ctx, argv[i]);
+	}
+	addOp(kEJPath2DOpBezierCurveTo, 6, args);
+	return NULL;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, quadraticCurveTo, ctx, argc, argv ) {
+	if( argc < 4 ) { return NULL; }
+
+	float args[4];
+	for( int i = 0; i < 4; i++ ) {
+		args[i] = JSValueToNumberFast(ctx, argv[i]);
+	}
+	addOp(kEJPath2DOpQuadraticCurveTo, 4, args);
+	return NULL;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, arcTo, ctx, argc, argv ) {
+	if( argc < 5 ) { return NULL; }
+
+	float args[5];
+	for( int i = 0; i < 5; i++ ) {
+		args[i] = JSValueToNumberFast(ctx, argv[i]);
+	}
+	addOp(kEJPath2DOpArcTo, 5, args);
+	return NULL;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, arc, ctx, argc, argv ) {
+	if( argc < 5 ) { return NULL; }
+
+	float args[6];
+	for( int i = 0; i < 5; i++ ) {
+		args[i] = JSValueToNumberFast(ctx, argv[i]);
+	}
+	args[5] = (argc < 6 ? false : JSValueToBoolean(ctx, argv[5])) ? 1 : 0;
+	addOp(kEJPath2DOpArc, 6, args);
+	return NULL;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, rect, ctx, argc, argv ) {
+	if( argc < 4 ) { return NULL; }
+
+	float
+		x = JSValueToNumberFast(ctx, argv[0]),
+		y = JSValueToNumberFast(ctx, argv[1]),
+		w = JSValueToNumberFast(ctx, argv[2]),
+		h = JSValueToNumberFast(ctx, argv[3]);
+
+	float p1[] = { x, y }, p2[] = { x+w, y }, p3[] = { x+w, y+h }, p4[] = { x, y+h };
+	addOp(kEJPath2DOpMoveTo, 2, p1);
+	addOp(kEJPath2DOpLineTo, 2, p2);
+	addOp(kEJPath2DOpLineTo, 2, p3);
+	addOp(kEJPath2DOpLineTo, 2, p4);
+	addOp(kEJPath2DOpClose, 0, NULL);
+	return NULL;
+}
+
+EJ_BIND_FUNCTION(EJBindingPath2D, closePath, ctx, argc, argv ) {
+	addOp(kEJPath2DOpClose, 0, NULL);
+	return NULL;
+}
+
+REFECTION_CLASS_IMPLEMENT(EJBindingPath2D);
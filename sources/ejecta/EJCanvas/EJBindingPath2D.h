@@ -0,0 +1,62 @@
+#ifndef __EJ_BINDING_PATH2D_H__
+#define __EJ_BINDING_PATH2D_H__
+
+#include <vector>
+#include "../EJBindingBase.h"
+#include "EJPath.h"
+
+typedef enum {
+	kEJPath2DOpMoveTo,
+	kEJPath2DOpLineTo,
+	kEJPath2DOpBezierCurveTo,
+	kEJPath2DOpQuadraticCurveTo,
+	kEJPath2DOpArcTo,
+	kEJPath2DOpArc,
+	kEJPath2DOpClose
+} EJPath2DOpType;
+
+typedef struct {
+	EJPath2DOpType type;
+	float args[6];
+} EJPath2DOp;
+
+// A Path2D records its commands in untransformed space. The flattened points
+// and the fill and stroke triangles are kept in an EJPath that is only rebuilt
+// when the commands or the scale of the drawing transform change; anything
+// else, e.g. a translation, is applied to the cached vertices on submit.
+class EJBindingPath2D : public EJBindingBase {
+private:
+	std::vector<EJPath2DOp> ops;
+	EJPath * path;
+	float pathScale;
+
+	void addOp(EJPath2DOpType type, int argc, const float * args);
+	static void applyOp(const EJPath2DOp &op, EJPath * target, float scale);
+
+public:
+	EJBindingPath2D();
+	~EJBindingPath2D();
+
+	REFECTION_CLASS_IMPLEMENT_DEFINE(EJBindingPath2D);
+
+	virtual string superclass(){ return EJBindingBase::toString();};
+	virtual void init(JSContextRef ctx, JSObjectRef obj, size_t argc, const JSValueRef argv[]);
+
+	// Returns the cached path, flattened for the given drawing scale
+	EJPath * getPathForScale(float scale);
+
+	// Returns an autoreleased path with the transform baked into its points,
+	// e.g. for clipping
+	EJPath * pathWithTransform(CGAffineTransform transform);
+
+	EJ_BIND_FUNCTION_DEFINE(moveTo, ctx, argc, argv);
+	EJ_BIND_FUNCTION_DEFINE(lineTo, ctx, argc, argv);
+	EJ_BIND_FUNCTION_DEFINE(bezierCurveTo, ctx, argc, argv);
+	EJ_BIND_FUNCTION_DEFINE(quadraticCurveTo, ctx, argc, argv);
+	EJ_BIND_FUNCTION_DEFINE(arcTo, ctx, argc, argv);
+	EJ_BIND_FUNCTION_DEFINE(arc, ctx, argc, argv);
+	EJ_BIND_FUNCTION_DEFINE(rect, ctx, argc, argv);
+	EJ_BIND_FUNCTION_DEFINE(closePath, ctx, argc, argv);
+};
+
+#endif //__EJ_BINDING_PATH2D_H__
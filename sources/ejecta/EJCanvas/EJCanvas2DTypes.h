@@ -89,6 +89,7 @@ typedef struct {
 	EJVector2 pos;
 	EJVector2 uv;
 	EJColorRGBA color;
+	float slot; // Texture unit for the multi texture program, see MultiTexture.fsh
 } EJVertex;
 
 #endif // __EJ_CANVAS_2D_TYPES_H__
@@ -10,6 +10,9 @@
 #endif
 #include "../EJApp.h"
 #include "EJCanvasContext.h"
+#include "EJPath.h"
+#include "EJGLState.h"
+#include "EJPremultiply.h"
 
 
 EJCanvasContext::EJCanvasContext() :
@@ -18,13 +21,21 @@ EJCanvasContext::EJCanvasContext() :
 	msaaFrameBuffer(0),
 	msaaRenderBuffer(0),
 	stencilBuffer(0),
+	textureSlotsUsed(0),
+	currentTextureSlot(0),
 	vertexBuffer(NULL),
 	vertexBufferSize(0),
 	vertexBufferIndex(0),
+	clipLevelsUsed(0),
+	clipWriting(false),
 	upsideDown(false),
 	currentProgram(NULL),
-	sharedGLContext(NULL)
+	sharedGLContext(NULL),
+	multiTextureBatchingEnabled(false),
+	commandReorderingEnabled(false),
+	edgeAntialiasingEnabled(false)
 {
+	resetDamage();
 }
 
 //返回类名
@@ -38,14 +49,18 @@ EJCanvasContext::EJCanvasContext(short widthp, short heightp) :
 	msaaFrameBuffer(0),
 	msaaRenderBuffer(0),
 	stencilBuffer(0),
+	textureSlotsUsed(0),
+	currentTextureSlot(0),
 	vertexBufferIndex(0),
+	clipLevelsUsed(0),
+	clipWriting(false),
 	upsideDown(false),
 	currentProgram(NULL)
 {
 	sharedGLContext = EJApp::instance()->getOpenGLContext();
 	if(sharedGLContext != NULL) {
 		vertexBuffer = sharedGLContext->getVertexBuffer();
-		vertexBufferSize = EJ_OPENGL_VERTEX_BUFFER_SIZE;
+		vertexBufferSize = sharedGLContext->getVertexBufferSize();
 	} else {
 		vertexBuffer = NULL;
 		vertexBufferSize = 0;
@@ -57,6 +72,7 @@ EJCanvasContext::EJCanvasContext(short widthp, short heightp) :
 	state->globalAlpha = 1;
 	state->globalCompositeOperation = kEJCompositeOperationSourceOver;
 	state->transform = CGAffineTransformIdentity;
+	state->transformKind = kEJTransformKindIdentity;
 	state->lineWidth = 1;
 	state->lineCap = kEJLineCapButt;
 	state->lineJoin = kEJLineJoinMiter;
@@ -65,9 +81,11 @@ EJCanvasContext::EJCanvasContext(short widthp, short heightp) :
 	state->textAlign = kEJTextAlignStart;
 	//state->font = [[UIFont fontWithName:@"Helvetica" size:10] retain];
 	state->font = new UIFont(NSStringMake("simsun.ttc"),32);
-	state->clipPath = NULL;
+	state->clipStart = state->clipEnd = 0;
+	state->scissor = EJCanvasScissorNone;
 	
 	setScreenSize(widthp, heightp);
+	resetDamage();
 	
 	path = new EJPath();
 	backingStoreRatio = 1;
@@ -76,33 +94,35 @@ EJCanvasContext::EJCanvasContext(short widthp, short heightp) :
 	fontCache->setCountLimit(8);
 	
 	imageSmoothingEnabled = true;
+	multiTextureBatchingEnabled = true;
+	commandReorderingEnabled = true;
+	edgeAntialiasingEnabled = true;
 	msaaEnabled = false;
 	msaaSamples = 2;
 }
 
 EJCanvasContext::~EJCanvasContext()
 {
+	for( std::vector<EJCanvasCommand>::iterator command = commands.begin(); command != commands.end(); ++command ) {
+		if( command->texture ) { command->texture->release(); }
+	}
+	releaseTextureSlots();
 	fontCache->release();
 	
 	// Release all fonts and clip paths from the stack
 	for( int i = 0; i < stateIndex + 1; i++ ) {
 		stateStack[i].font->release();
-		//stateStack[i].clipPath->release();
+	}
+	for( std::vector<EJCanvasClip>::iterator clip = clipPaths.begin(); clip != clipPaths.end(); ++clip ) {
+		clip->path->release();
 	}
 
-#ifdef _WINDOWS
-	if( viewFrameBuffer ) { glDeleteFramebuffers( 1, &viewFrameBuffer); }
-	if( viewRenderBuffer ) { glDeleteRenderbuffers(1, &viewRenderBuffer); }
-	if( msaaFrameBuffer ) {	glDeleteFramebuffers( 1, &msaaFrameBuffer); }
-	if( msaaRenderBuffer ) { glDeleteRenderbuffers(1, &msaaRenderBuffer); }
-	if( stencilBuffer ) { glDeleteRenderbuffers(1, &stencilBuffer); }
-#else
-	if( viewFrameBuffer ) { glDeleteFramebuffers( 1, &viewFrameBuffer); }
-	if( viewRenderBuffer ) { glDeleteRenderbuffers(1, &viewRenderBuffer); }
-	if( msaaFrameBuffer ) {	glDeleteFramebuffers( 1, &msaaFrameBuffer); }
-	if( msaaRenderBuffer ) { glDeleteRenderbuffers(1, &msaaRenderBuffer); }
-	if( stencilBuffer ) { glDeleteRenderbuffers(1, &stencilBuffer); }
-#endif
+	EJGLState * glState = EJGLState::getInstance();
+	glState->deleteFramebuffer(viewFrameBuffer);
+	glState->deleteRenderbuffer(viewRenderBuffer);
+	glState->deleteFramebuffer(msaaFrameBuffer);
+	glState->deleteRenderbuffer(msaaRenderBuffer);
+	glState->deleteRenderbuffer(stencilBuffer);
 	
 	path->release();
 
@@ -112,31 +132,32 @@ EJCanvasContext::~EJCanvasContext()
 
 void EJCanvasContext::create()
 {
+	EJGLState * glState = EJGLState::getInstance();
 #ifdef _WINDOWS
 	if( msaaEnabled ) {
 		glGenFramebuffersEXT(1, &msaaFrameBuffer);
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, msaaFrameBuffer);
+		glState->bindFramebuffer(msaaFrameBuffer);
 
 		glGenRenderbuffersEXT(1, &msaaRenderBuffer);
-		glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, msaaRenderBuffer);
+		glState->bindRenderbuffer(msaaRenderBuffer);
 
 		//glRenderbufferStorageMultisampleIMG(GL_RENDERBUFFER, msaaSamples, GL_RGBA8, bufferWidth, bufferHeight);
 		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, msaaRenderBuffer);
 	}
 
 	glGenFramebuffersEXT(1, &viewFrameBuffer);
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, viewFrameBuffer);
+	glState->bindFramebuffer(viewFrameBuffer);
 
 	glGenRenderbuffersEXT(1, &viewRenderBuffer);
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, viewRenderBuffer);
+	glState->bindRenderbuffer(viewRenderBuffer);
 
 #else
 	if( msaaEnabled ) {
 		glGenFramebuffers(1, &msaaFrameBuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, msaaFrameBuffer);
+		glState->bindFramebuffer(msaaFrameBuffer);
 
 		glGenRenderbuffers(1, &msaaRenderBuffer);
-		glBindRenderbuffer(GL_RENDERBUFFER, msaaRenderBuffer);
+		glState->bindRenderbuffer(msaaRenderBuffer);
 
 		//glRenderbufferStorageMultisampleIMG(GL_RENDERBUFFER_OES, msaaSamples, GL_RGBA8_OES, bufferWidth, bufferHeight);
 		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, msaaRenderBuffer);
@@ -146,18 +167,18 @@ void EJCanvasContext::create()
 	//Code specific to EJCanvasContextScreen and EJCanvasContextTexture but kept here in order to respect Ejecta iOS architecture
 	if (getClassName() == "EJCanvasContextTexture") {
 		glGenFramebuffers(1, &viewFrameBuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, viewFrameBuffer);
+		glState->bindFramebuffer(viewFrameBuffer);
 
 		glGenRenderbuffers(1, &viewRenderBuffer);
-		glBindRenderbuffer(GL_RENDERBUFFER, viewRenderBuffer);
+		glState->bindRenderbuffer(viewRenderBuffer);
 	}
 	else {
 		viewFrameBuffer = (GLuint) 0;
 		viewRenderBuffer = (GLuint) 0;
 		
-		glBindFramebuffer(GL_FRAMEBUFFER, viewFrameBuffer);
+		glState->bindFramebuffer(viewFrameBuffer);
 
-		glBindRenderbuffer(GL_RENDERBUFFER, viewRenderBuffer);
+		glState->bindRenderbuffer(viewRenderBuffer);
 	}
 
 #endif
@@ -186,10 +207,11 @@ void EJCanvasContext::setScreenSize(int widthp, int heightp)
 void EJCanvasContext::createStencilBufferOnce()
 {
 	if( stencilBuffer ) { return; }
+	EJGLState * glState = EJGLState::getInstance();
 #ifdef _WINDOWS
 
 	glGenRenderbuffersEXT(1, &stencilBuffer);
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, stencilBuffer);
+	glState->bindRenderbuffer(stencilBuffer);
 	if( msaaEnabled ) {
 		glRenderbufferStorageMultisample(GL_RENDERBUFFER_EXT, msaaSamples, GL_DEPTH24_STENCIL8, bufferWidth, bufferHeight);
 	}
@@ -199,12 +221,12 @@ void EJCanvasContext::createStencilBufferOnce()
 	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER_EXT, stencilBuffer);
 	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER_EXT, stencilBuffer);
 
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, msaaEnabled ? msaaRenderBuffer : viewRenderBuffer );
+	glState->bindRenderbuffer(msaaEnabled ? msaaRenderBuffer : viewRenderBuffer);
 
 #else
 
 	glGenRenderbuffers(1, &stencilBuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, stencilBuffer);
+	glState->bindRenderbuffer(stencilBuffer);
 	if( msaaEnabled ) {
 		//glRenderbufferStorageMultisampleAPPLE(GL_RENDERBUFFER, msaaSamples, GL_DEPTH24_STENCIL8_OES, bufferWidth, bufferHeight);
 	}
@@ -214,59 +236,70 @@ void EJCanvasContext::createStencilBufferOnce()
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, stencilBuffer);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, stencilBuffer);
 
-	glBindRenderbuffer(GL_RENDERBUFFER, msaaEnabled ? msaaRenderBuffer : viewRenderBuffer );
+	glState->bindRenderbuffer(msaaEnabled ? msaaRenderBuffer : viewRenderBuffer);
 
 #endif
 
+	// The depth buffer starts out without any clip levels
+	glState->disable(GL_SCISSOR_TEST);
+	glState->setDepthMask(GL_TRUE);
 	glClear(GL_STENCIL_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glState->setDepthMask(GL_FALSE);
+	clipLevelsUsed = 0;
 }
 
 void EJCanvasContext::bindVertexBuffer()
 {
+	// Vertices are streamed into a VBO on each flush, so the attribute pointers
+	// are offsets into whichever buffer object is currently bound
+	sharedGLContext->bindVertexBufferObjects();
+	
 	glEnableVertexAttribArray(kEJGLProgram2DAttributePos);
-	glVertexAttribPointer(kEJGLProgram2DAttributePos, 2, GL_FLOAT, GL_FALSE, sizeof(EJVertex), (char *)vertexBuffer + offsetof(EJVertex, pos));
+	glVertexAttribPointer(kEJGLProgram2DAttributePos, 2, GL_FLOAT, GL_FALSE, sizeof(EJVertex), (GLvoid *)offsetof(EJVertex, pos));
 	
 	glEnableVertexAttribArray(kEJGLProgram2DAttributeUV);
-	glVertexAttribPointer(kEJGLProgram2DAttributeUV, 2, GL_FLOAT, GL_FALSE, sizeof(EJVertex), (char *)vertexBuffer + offsetof(EJVertex, uv));
+	glVertexAttribPointer(kEJGLProgram2DAttributeUV, 2, GL_FLOAT, GL_FALSE, sizeof(EJVertex), (GLvoid *)offsetof(EJVertex, uv));
 
 	glEnableVertexAttribArray(kEJGLProgram2DAttributeColor);
-	glVertexAttribPointer(kEJGLProgram2DAttributeColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(EJVertex), (char *)vertexBuffer + offsetof(EJVertex, color));
+	glVertexAttribPointer(kEJGLProgram2DAttributeColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(EJVertex), (GLvoid *)offsetof(EJVertex, color));
+	
+	glEnableVertexAttribArray(kEJGLProgram2DAttributeSlot);
+	glVertexAttribPointer(kEJGLProgram2DAttributeSlot, 1, GL_FLOAT, GL_FALSE, sizeof(EJVertex), (GLvoid *)offsetof(EJVertex, slot));
 }
 
 void EJCanvasContext::prepare()
 {
-	//Bind the frameBuffer and vertexBuffer array
-#ifdef _WINDOWS
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, msaaEnabled ? msaaFrameBuffer : viewFrameBuffer );
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, msaaEnabled ? msaaRenderBuffer : viewRenderBuffer );
-#else
-	glBindFramebuffer(GL_FRAMEBUFFER, msaaEnabled ? msaaFrameBuffer : viewFrameBuffer );
-	glBindRenderbuffer(GL_RENDERBUFFER, msaaEnabled ? msaaRenderBuffer : viewRenderBuffer );
-#endif	
+	//Bind the frameBuffer and vertexBuffer array; the state tracker skips
+	//everything that is already bound
+	EJGLState * glState = EJGLState::getInstance();
+	glState->bindFramebuffer(msaaEnabled ? msaaFrameBuffer : viewFrameBuffer);
+	glState->bindRenderbuffer(msaaEnabled ? msaaRenderBuffer : viewRenderBuffer);
 	glViewport(0, 0, width, height);
 	
 	
 	EJCompositeOperation op = state->globalCompositeOperation;
-	glBlendFunc( EJCompositeOperationFuncs[op].source, EJCompositeOperationFuncs[op].destination );
+	glState->blendFunc( EJCompositeOperationFuncs[op].source, EJCompositeOperationFuncs[op].destination );
+	glState->activeTexture(GL_TEXTURE0);
 	currentTexture = NULL;
 	currentProgram = NULL;
+	releaseTextureSlots();
 	EJTexture::setSmoothScaling(imageSmoothingEnabled);
 	
+	// The shared vertex buffer may have been grown (and moved) by another context
+	vertexBuffer = sharedGLContext->getVertexBuffer();
+	vertexBufferSize = sharedGLContext->getVertexBufferSize();
 	bindVertexBuffer();
-		
-	if( state->clipPath ) {
-		glDepthFunc(GL_EQUAL);
-	}
-	else {
-		glDepthFunc(GL_ALWAYS);
-	}
+	
+	applyClip(currentClipLevel(), state->scissor);
 }
 
 void EJCanvasContext::setWidth(short newWidth) {
 	if( newWidth == width ) {
 		// Same width as before? Just clear the canvas, as per the spec
 		flushBuffers();
+		EJGLState::getInstance()->disable(GL_SCISSOR_TEST);
 		glClear(GL_COLOR_BUFFER_BIT);
+		damageAll();
 		return;
 	}
 	resizeToWidth(newWidth, height);
@@ -280,7 +313,9 @@ void EJCanvasContext::setHeight(short newHeight) {
 	if( newHeight == height ) {
 		// Same height as before? Just clear the canvas, as per the spec
 		flushBuffers();
+		EJGLState::getInstance()->disable(GL_SCISSOR_TEST);
 		glClear(GL_COLOR_BUFFER_BIT);
+		damageAll();
 		return;
 	}
 	resizeToWidth(width, newHeight);
@@ -290,181 +325,784 @@ short EJCanvasContext::getHeight() const {
 	return height;
 }
 
+short EJCanvasContext::getBufferWidth() const {
+	return bufferWidth;
+}
+
+short EJCanvasContext::getBufferHeight() const {
+	return bufferHeight;
+}
+
 void EJCanvasContext::setTexture(EJTexture * newTexture) {
-	if( currentTexture == newTexture ) { return; }
+	// Images packed into the same atlas page don't need a texture switch
+	if( newTexture && newTexture->atlasPage ) {
+		newTexture = newTexture->atlasPage;
+	}
 	
-	flushBuffers();
+	// The multi texture shader samples in non-uniform control flow, where
+	// the derivatives that pick the mip level are undefined, so mipmapped
+	// textures are drawn with the single texture program
+	if(
+		newTexture && newTexture->hasMipmaps() &&
+		currentProgram && currentProgram->getTextureSlots() > 1
+	) {
+		currentProgram = sharedGLContext->getGlProgram2DTexture();
+	}
+	
+	// The multi texture program keeps several textures bound at once, so
+	// switching between those doesn't flush
+	if( currentProgram && currentProgram->getTextureSlots() > 1 ) {
+		currentTextureSlot = newTexture ? bindTextureSlot(newTexture) : 0;
+		return;
+	}
 	
+	// The texture is only bound when the commands using it are submitted
 	currentTexture = newTexture;
-	if(currentTexture)currentTexture->bind();
+}
+
+float EJCanvasContext::bindTextureSlot(EJTexture * texture) {
+	int slot = 0;
+	while( slot < textureSlotsUsed && textureSlots[slot] != texture ) {
+		slot++;
+	}
+	
+	if( slot == textureSlotsUsed ) {
+		// All units are taken? Draw what we have so far and start over
+		if( textureSlotsUsed == currentProgram->getTextureSlots() ) {
+			flushBuffers();
+			releaseTextureSlots();
+			slot = 0;
+		}
+		
+		// Keep the texture alive while it's referenced by a slot, so a new
+		// texture at the same address can't be mistaken for it
+		texture->retain();
+		textureSlots[slot] = texture;
+		textureSlotsUsed = slot + 1;
+		
+		EJGLState * glState = EJGLState::getInstance();
+		glState->activeTexture(GL_TEXTURE0 + slot);
+		texture->bind();
+		glState->activeTexture(GL_TEXTURE0);
+		
+		if( slot == 0 ) {
+			currentTexture = texture;
+		}
+	}
+	else if( texture->isEvicted() ) {
+		// Still in its slot from an earlier frame, but its GL texture is gone
+		EJGLState * glState = EJGLState::getInstance();
+		glState->activeTexture(GL_TEXTURE0 + slot);
+		texture->bind();
+		glState->activeTexture(GL_TEXTURE0);
+	}
+	else {
+		texture->markUsed();
+	}
+	
+	// Alpha textures (text) are marked by a negative slot
+	float vertexSlot = slot + 1;
+	return texture->getFormat() == GL_ALPHA ? -vertexSlot : vertexSlot;
+}
+
+void EJCanvasContext::releaseTextureSlots() {
+	for( int i = 0; i < textureSlotsUsed; i++ ) {
+		textureSlots[i]->release();
+	}
+	textureSlotsUsed = 0;
+}
+
+void EJCanvasContext::recycleTextureSlots() {
+	if( !textureSlotsUsed ) { return; }
+	
+	// The submitted commands no longer need their textures. A flush in the
+	// middle of a draw continues with the current texture though, so that
+	// one is bound again to the first slot
+	EJTexture * current = NULL;
+	if( currentProgram && currentProgram->getTextureSlots() > 1 && currentTextureSlot != 0 ) {
+		int slot = (int)(currentTextureSlot < 0 ? -currentTextureSlot : currentTextureSlot) - 1;
+		current = textureSlots[slot];
+		current->retain();
+	}
+	
+	releaseTextureSlots();
+	currentTextureSlot = 0;
+	
+	if( current ) {
+		currentTextureSlot = bindTextureSlot(current);
+		current->release();
+	}
 }
 
 void EJCanvasContext::setProgram(EJGLProgram2D *newProgram) {
-    if( currentProgram == newProgram ) { return; }
-    
-    flushBuffers();
-    currentProgram = newProgram;
-    
-    glUseProgram(currentProgram->getProgram());
-    glUniform2f(currentProgram->getScreen(), width, height * (upsideDown ? -1 : 1));
+	// Flat, textured and alpha textured geometry can all be drawn with the
+	// multi texture program, where the per-vertex slot picks the texture
+	if(
+		multiTextureBatchingEnabled && (
+			newProgram == sharedGLContext->getGlProgram2DFlat() ||
+			newProgram == sharedGLContext->getGlProgram2DTexture() ||
+			newProgram == sharedGLContext->getGlProgram2DAlphaTexture()
+		)
+	) {
+		EJGLProgram2D *multiTextureProgram = sharedGLContext->getGlProgram2DMultiTexture();
+		if( multiTextureProgram && multiTextureProgram->getTextureSlots() > 1 ) {
+			if( newProgram == sharedGLContext->getGlProgram2DFlat() ) {
+				currentTextureSlot = 0;
+			}
+			newProgram = multiTextureProgram;
+		}
+	}
+	
+	// Programs are switched in flushBuffers(), when the recorded commands
+	// are submitted
+	currentProgram = newProgram;
 }
 
-void EJCanvasContext::pushTri(float x1, float y1, float x2, float y2, float x3, float y3, EJColorRGBA color, CGAffineTransform transform)
+void EJCanvasContext::reserveVertices(int count)
 {
-	if( vertexBufferIndex >= vertexBufferSize - 3 ) {
+	if( vertexBufferIndex + count <= vertexBufferSize ) { return; }
+	
+	// Grow the shared buffer first and only flush once it reached its maximum size
+	if( vertexBufferSize < EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE ) {
+		vertexBuffer = sharedGLContext->growVertexBuffer(vertexBufferIndex + count);
+		vertexBufferSize = sharedGLContext->getVertexBufferSize();
+	}
+	if( vertexBufferIndex + count > vertexBufferSize ) {
 		flushBuffers();
 	}
+}
+
+void EJCanvasContext::pushTri(float x1, float y1, float x2, float y2, float x3, float y3, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind)
+{
+	reserveVertices(4);
 	
-	EJVector2 d1 = { x1, y1 };
-	EJVector2 d2 = { x2, y2 };
-	EJVector2 d3 = { x3, y3 };
-	
-	if( !CGAffineTransformIsIdentity(transform) ) {
-		d1 = EJVector2ApplyTransform( d1, transform );
-		d2 = EJVector2ApplyTransform( d2, transform );
-		d3 = EJVector2ApplyTransform( d3, transform );
-	}
+	EJVector2 d[4] = { { x1, y1 }, { x2, y2 }, { x3, y3 }, { x3, y3 } };
+	EJTransformPoints( d, d, 4, transform, transformKind );
 	
 	EJVertex * vb = &vertexBuffer[vertexBufferIndex];
 
-	EJVertex vb_0 = {d1, {0.5, 1}, color};
-	EJVertex vb_1 = { d2, {0.5, 0.5}, color };
-	EJVertex vb_2 = { d3, {0.5, 1}, color };
+	EJVertex vb_0 = { d[0], {0.5, 1}, color, currentTextureSlot };
+	EJVertex vb_1 = { d[1], {0.5, 0.5}, color, currentTextureSlot };
+	EJVertex vb_2 = { d[2], {0.5, 1}, color, currentTextureSlot };
 
+	// Triangles share the quad index buffer; repeating the last vertex makes
+	// the second triangle of the quad degenerate
 	vb[0] = vb_0;
 	vb[1] = vb_1;
 	vb[2] = vb_2;
+	vb[3] = vb_2;
 	
-	vertexBufferIndex += 3;
+	recordVertices(vertexBufferIndex, 4);
+	vertexBufferIndex += 4;
 }
 
-void EJCanvasContext::pushQuad(EJVector2 v1, EJVector2 v2, EJVector2 v3, EJVector2 v4, EJVector2 t1, EJVector2 t2, EJVector2 t3, EJVector2 t4, EJColorRGBA color, CGAffineTransform transform)
+void EJCanvasContext::pushQuad(EJVector2 v1, EJVector2 v2, EJVector2 v3, EJVector2 v4, EJVector2 t1, EJVector2 t2, EJVector2 t3, EJVector2 t4, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind)
 {
-	if( vertexBufferIndex >= vertexBufferSize - 6 ) {
-		flushBuffers();
-	}
+	reserveVertices(4);
 	
-	if( !CGAffineTransformIsIdentity(transform) ) {
-		v1 = EJVector2ApplyTransform( v1, transform );
-		v2 = EJVector2ApplyTransform( v2, transform );
-		v3 = EJVector2ApplyTransform( v3, transform );
-		v4 = EJVector2ApplyTransform( v4, transform );
-	}
+	EJVector2 d[4] = { v1, v2, v3, v4 };
+	EJTransformPoints( d, d, 4, transform, transformKind );
 	
 	EJVertex * vb = &vertexBuffer[vertexBufferIndex];
 
-	EJVertex vb_0 = { v1, t1, color };
-	EJVertex vb_1 = { v2, t2, color };
-	EJVertex vb_2 = { v3, t3, color };
-	EJVertex vb_3 = { v2, t2, color };
-	EJVertex vb_4 = { v3, t3, color };
-	EJVertex vb_5 = { v4, t4, color };
+	EJVertex vb_0 = { d[0], t1, color, currentTextureSlot };
+	EJVertex vb_1 = { d[1], t2, color, currentTextureSlot };
+	EJVertex vb_2 = { d[2], t3, color, currentTextureSlot };
+	EJVertex vb_3 = { d[3], t4, color, currentTextureSlot };
 
 	vb[0] = vb_0;
 	vb[1] = vb_1;
 	vb[2] = vb_2;
 	vb[3] = vb_3;
-	vb[4] = vb_4;
-	vb[5] = vb_5;
 	
-	vertexBufferIndex += 6;
+	recordVertices(vertexBufferIndex, 4);
+	vertexBufferIndex += 4;
 }
 
-void EJCanvasContext::pushRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform)
+void EJCanvasContext::pushRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind)
 {
-
-	if( vertexBufferIndex >= vertexBufferSize - 6 ) {
-		flushBuffers();
+	if( transformKind == kEJTransformKindUnknown ) {
+		transformKind = EJTransformGetKind(transform);
 	}
 	
-	EJVector2 d11 = { x, y };
-	EJVector2 d21 = { x+w, y };
-	EJVector2 d12 = { x, y+h };
-	EJVector2 d22 = { x+w, y+h };
+	// top left, top right, bottom left, bottom right
+	EJVector2 d[4] = { { x, y }, { x+w, y }, { x, y+h }, { x+w, y+h } };
+	EJTransformPoints( d, d, 4, transform, transformKind );
 	
-	if( !CGAffineTransformIsIdentity(transform) ) {
-		d11 = EJVector2ApplyTransform( d11, transform );
-		d21 = EJVector2ApplyTransform( d21, transform );
-		d12 = EJVector2ApplyTransform( d12, transform );
-		d22 = EJVector2ApplyTransform( d22, transform );
+	// Rotated or skewed rects get an anti-aliased fringe and shrink by half
+	// of it; axis aligned ones are left alone
+	if( edgeAntialiasingEnabled && transformKind == kEJTransformKindAffine ) {
+		EJVector2 polygon[4] = { d[0], d[1], d[3], d[2] }, inset[4];
+		pushFringe(polygon, 4, color, inset);
+		d[0] = inset[0]; d[1] = inset[1]; d[3] = inset[2]; d[2] = inset[3];
 	}
 	
+	reserveVertices(4);
+	EJVector2 d11 = d[0], d21 = d[1], d12 = d[2], d22 = d[3];
+	
 	EJVertex * vb = &vertexBuffer[vertexBufferIndex];
 
-	EJVertex vb_0 = { d11, {0, 0}, color };	// top left
-	EJVertex vb_1 = { d21, {0, 0}, color };	// top right
-	EJVertex vb_2 = { d12, {0, 0}, color };	// bottom left
-
-	EJVertex vb_3 = { d21, {0, 0}, color };	// top right
-	EJVertex vb_4 = { d12, {0, 0}, color };	// bottom left
-	EJVertex vb_5 = { d22, {0, 0}, color };// bottom right
+	EJVertex vb_0 = { d11, {0, 0}, color, currentTextureSlot };	// top left
+	EJVertex vb_1 = { d21, {0, 0}, color, currentTextureSlot };	// top right
+	EJVertex vb_2 = { d12, {0, 0}, color, currentTextureSlot };	// bottom left
+	EJVertex vb_3 = { d22, {0, 0}, color, currentTextureSlot };	// bottom right
 
 	vb[0] = vb_0;	// top left
 	vb[1] = vb_1;	// top right
 	vb[2] = vb_2;	// bottom left
-		
-	vb[3] = vb_3;	// top right
-	vb[4] = vb_4;	// bottom left
-	vb[5] = vb_5;// bottom right
+	vb[3] = vb_3;	// bottom right
 	
-	vertexBufferIndex += 6;
+	recordVertices(vertexBufferIndex, 4);
+	vertexBufferIndex += 4;
 }
 
-void EJCanvasContext::pushTexturedRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform)
+void EJCanvasContext::pushTexturedRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind)
 {
-
-	if( vertexBufferIndex >= vertexBufferSize - 6 ) {
-		flushBuffers();
+	if( transformKind == kEJTransformKindUnknown ) {
+		transformKind = EJTransformGetKind(transform);
 	}
 	
-	EJVector2 d11 = { x, y };
-	EJVector2 d21 = { x+w, y };
-	EJVector2 d12 = { x, y+h };
-	EJVector2 d22 = { x+w, y+h };
+	// top left, top right, bottom left, bottom right
+	EJVector2 d[4] = { { x, y }, { x+w, y }, { x, y+h }, { x+w, y+h } };
+	EJTransformPoints( d, d, 4, transform, transformKind );
 	
-	if( !CGAffineTransformIsIdentity(transform) ) {
-		d11 = EJVector2ApplyTransform( d11, transform );
-		d21 = EJVector2ApplyTransform( d21, transform );
-		d12 = EJVector2ApplyTransform( d12, transform );
-		d22 = EJVector2ApplyTransform( d22, transform );
+	// The fringe of rotated images repeats the texels along their edges
+	if( edgeAntialiasingEnabled && transformKind == kEJTransformKindAffine ) {
+		EJVector2 polygon[4] = { d[0], d[1], d[3], d[2] }, inset[4];
+		EJVector2 uvs[4] = { { tx, ty }, { tx+tw, ty }, { tx+tw, ty+th }, { tx, ty+th } };
+		pushFringe(polygon, 4, color, inset, uvs);
+		d[0] = inset[0]; d[1] = inset[1]; d[3] = inset[2]; d[2] = inset[3];
 	}
 	
+	reserveVertices(4);
+	EJVector2 d11 = d[0], d21 = d[1], d12 = d[2], d22 = d[3];
+	
 	EJVertex * vb = &vertexBuffer[vertexBufferIndex];
 
-	EJVertex vb_0 = { d11, {tx, ty}, color };	// top left
-	EJVertex vb_1 = { d21, {tx+tw, ty}, color };	// top right
-	EJVertex vb_2 = { d12, {tx, ty+th}, color };	// bottom left
-
-	EJVertex vb_3 = { d21, {tx+tw, ty}, color };	// top right
-	EJVertex vb_4 = { d12, {tx, ty+th}, color };	// bottom left
-	EJVertex vb_5 = { d22, {tx+tw, ty+th}, color };// bottom right
+	EJVertex vb_0 = { d11, {tx, ty}, color, currentTextureSlot };	// top left
+	EJVertex vb_1 = { d21, {tx+tw, ty}, color, currentTextureSlot };	// top right
+	EJVertex vb_2 = { d12, {tx, ty+th}, color, currentTextureSlot };	// bottom left
+	EJVertex vb_3 = { d22, {tx+tw, ty+th}, color, currentTextureSlot };// bottom right
 
 	vb[0] = vb_0;	// top left
 	vb[1] = vb_1;	// top right
 	vb[2] = vb_2;	// bottom left
+	vb[3] = vb_3;	// bottom right
+	
+	recordVertices(vertexBufferIndex, 4);
+	vertexBufferIndex += 4;
+}
+
+void EJCanvasContext::pushFringe(const EJVector2 * polygon, int count, EJColorRGBA color, EJVector2 * inset, const EJVector2 * uvs)
+{
+	// The polygon is in screen space. Each corner is moved inwards and
+	// outwards by half the fringe width along the miter of its edges; each
+	// edge then gets a quad from full coverage inside to none outside.
+	if( count < 3 ) {
+		memcpy(inset, polygon, count * sizeof(EJVector2));
+		return;
+	}
+	
+	float area = 0;
+	for( int i = 0; i < count; i++ ) {
+		EJVector2 a = polygon[i], b = polygon[(i+1) % count];
+		area += a.x * b.y - b.x * a.y;
+	}
+	
+	// The outward normal is the edge's left normal for clockwise polygons
+	float half = (EJ_CANVAS_EDGE_FEATHER / 2) / backingStoreRatio;
+	float outward = area > 0 ? -half : half;
+	
+	EJVector2 dirA = EJVector2Normalize(EJVector2Sub(polygon[0], polygon[count-1]));
+	for( int i = 0; i < count; i++ ) {
+		EJVector2 dirB = EJVector2Normalize(EJVector2Sub(polygon[(i+1) % count], polygon[i]));
+		EJVector2 normalA = { -dirA.y, dirA.x }, normalB = { -dirB.y, dirB.x };
 		
-	vb[3] = vb_3;	// top right
-	vb[4] = vb_4;	// bottom left
-	vb[5] = vb_5;// bottom right
+		float denominator = 1 + EJVector2Dot(dirA, dirB);
+		EJVector2 miter = normalB;
+		if( denominator > 1e-4f ) {
+			miter = EJVector2Make( (normalA.x + normalB.x) / denominator, (normalA.y + normalB.y) / denominator );
+			float length = sqrtf(EJVector2Dot(miter, miter));
+			if( length > EJ_CANVAS_EDGE_MITER_LIMIT ) {
+				miter.x *= EJ_CANVAS_EDGE_MITER_LIMIT / length;
+				miter.y *= EJ_CANVAS_EDGE_MITER_LIMIT / length;
+			}
+		}
+		inset[i] = EJVector2Make( polygon[i].x - miter.x * outward, polygon[i].y - miter.y * outward );
+		dirA = dirB;
+	}
+	
+	reserveVertices(count * 4);
 	
-	vertexBufferIndex += 6;
+	EJColorRGBA clear = { 0 };
+	EJVector2 uvZero = { 0, 0 };
+	EJVertex * vb = &vertexBuffer[vertexBufferIndex];
+	for( int i = 0; i < count; i++, vb += 4 ) {
+		int j = (i+1) % count;
+		
+		// The outer corner mirrors the inner one at the polygon's corner
+		EJVector2 outerI = EJVector2Make( 2 * polygon[i].x - inset[i].x, 2 * polygon[i].y - inset[i].y );
+		EJVector2 outerJ = EJVector2Make( 2 * polygon[j].x - inset[j].x, 2 * polygon[j].y - inset[j].y );
+		EJVector2 uvI = uvs ? uvs[i] : uvZero;
+		EJVector2 uvJ = uvs ? uvs[j] : uvZero;
+		
+		EJVertex vb_0 = { outerI, uvI, clear, currentTextureSlot };
+		EJVertex vb_1 = { inset[i], uvI, color, currentTextureSlot };
+		EJVertex vb_2 = { outerJ, uvJ, clear, currentTextureSlot };
+		EJVertex vb_3 = { inset[j], uvJ, color, currentTextureSlot };
+		vb[0] = vb_0;
+		vb[1] = vb_1;
+		vb[2] = vb_2;
+		vb[3] = vb_3;
+	}
+	
+	recordVertices(vertexBufferIndex, count * 4);
+	vertexBufferIndex += count * 4;
 }
 
-void EJCanvasContext::flushBuffers()
+static inline void EJCanvasWriteRibbonRow(EJVertex * vb, EJVector2 a, EJVector2 b, EJVector2 c, EJVector2 d, EJColorRGBA color, float slot)
+{
+	// The outer vertices of a row have no coverage; colors are premultiplied,
+	// so that's transparent black
+	EJColorRGBA clear = { 0 };
+	EJVertex vb_0 = { a, {0, 0}, clear, slot };
+	EJVertex vb_1 = { b, {0, 0}, color, slot };
+	EJVertex vb_2 = { c, {0, 0}, color, slot };
+	EJVertex vb_3 = { d, {0, 0}, clear, slot };
+	vb[0] = vb_0;
+	vb[1] = vb_1;
+	vb[2] = vb_2;
+	vb[3] = vb_3;
+}
+
+void EJCanvasContext::pushRibbon(const EJVector2 * rows, int rowCount, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind)
+{
+	// Ribbons are drawn with the ribbon index buffer, which connects each row
+	// of 4 vertices to the next. Consecutive ribbons in the vertex buffer are
+	// connected as well; to keep these connections invisible, each ribbon
+	// starts and ends with a row collapsed into a single point. The caller
+	// guarantees that its first and last rows are straight lines, which makes
+	// the triangles to the collapsed rows degenerate.
+	if( rowCount < 2 ) { return; }
+	if( transformKind == kEJTransformKindUnknown ) {
+		transformKind = EJTransformGetKind(transform);
+	}
+	
+	int maxRows = EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE / 4 - 6;
+	bool continued = false;
+	int row = 0;
+	while( row < rowCount - 1 ) {
+		int chunkRows = rowCount - row;
+		if( chunkRows > maxRows ) { chunkRows = maxRows; }
+		bool last = (row + chunkRows == rowCount);
+		
+		// Ribbons that don't fit into the buffer are split at an arbitrary row.
+		// These are collapsed in 3 steps, each shifting the row by one vertex,
+		// which keeps all connecting triangles degenerate for any shape.
+		int leadRows = continued ? 3 : 1;
+		int tailRows = last ? 1 : 3;
+		reserveVertices((leadRows + chunkRows + tailRows) * 4);
+		
+		int first = vertexBufferIndex;
+		EJVertex * vb = &vertexBuffer[first];
+		EJVector2 d[4];
+		
+		for( int i = 0; i < chunkRows; i++ ) {
+			EJTransformPoints( &rows[(row + i) * 4], d, 4, transform, transformKind );
+			
+			if( i == 0 ) {
+				if( continued ) {
+					EJCanvasWriteRibbonRow(vb, d[0], d[0], d[0], d[0], color, currentTextureSlot); vb += 4;
+					EJCanvasWriteRibbonRow(vb, d[0], d[0], d[0], d[1], color, currentTextureSlot); vb += 4;
+					EJCanvasWriteRibbonRow(vb, d[0], d[0], d[1], d[2], color, currentTextureSlot); vb += 4;
+				}
+				else {
+					EJCanvasWriteRibbonRow(vb, d[0], d[0], d[0], d[0], color, currentTextureSlot); vb += 4;
+				}
+			}
+			
+			EJCanvasWriteRibbonRow(vb, d[0], d[1], d[2], d[3], color, currentTextureSlot); vb += 4;
+			
+			if( i == chunkRows - 1 ) {
+				if( last ) {
+					EJCanvasWriteRibbonRow(vb, d[3], d[3], d[3], d[3], color, currentTextureSlot); vb += 4;
+				}
+				else {
+					EJCanvasWriteRibbonRow(vb, d[1], d[2], d[3], d[3], color, currentTextureSlot); vb += 4;
+					EJCanvasWriteRibbonRow(vb, d[2], d[3], d[3], d[3], color, currentTextureSlot); vb += 4;
+					EJCanvasWriteRibbonRow(vb, d[3], d[3], d[3], d[3], color, currentTextureSlot); vb += 4;
+				}
+			}
+		}
+		
+		int count = (leadRows + chunkRows + tailRows) * 4;
+		recordVertices(first, count, kEJIndexLayoutRibbon);
+		vertexBufferIndex += count;
+		
+		// The next chunk starts again with the last row of this one
+		row += chunkRows - 1;
+		continued = true;
+	}
+}
+
+void EJCanvasContext::recordVertices(int first, int count, EJIndexLayout layout)
+{
+	EJVertex * vb = &vertexBuffer[first];
+	EJVector2 min = vb[0].pos;
+	EJVector2 max = vb[0].pos;
+	for( int i = 1; i < count; i++ ) {
+		if( vb[i].pos.x < min.x ) { min.x = vb[i].pos.x; }
+		if( vb[i].pos.y < min.y ) { min.y = vb[i].pos.y; }
+		if( vb[i].pos.x > max.x ) { max.x = vb[i].pos.x; }
+		if( vb[i].pos.y > max.y ) { max.y = vb[i].pos.y; }
+	}
+	
+	// Flat and multi texture geometry doesn't depend on the texture bound
+	// to unit 0, so it shouldn't split commands either
+	EJTexture * texture = currentTexture;
+	if(
+		!currentProgram || currentProgram->getTextureSlots() > 1 ||
+		currentProgram == sharedGLContext->getGlProgram2DFlat()
+	) {
+		texture = NULL;
+	}
+	EJCompositeOperation op = EJCompositeOperationBlendGroup(state->globalCompositeOperation);
+	int clipLevel = clipWriting ? EJ_CANVAS_CLIP_LEVEL_KEEP : currentClipLevel();
+	EJCanvasScissor scissor = clipWriting ? EJCanvasScissorNone : state->scissor;
+	
+	// Clips only write to the depth buffer
+	if( !clipWriting ) {
+		addDamage(min, max);
+	}
+	
+	// Extend the last command if nothing changed since
+	if( !commands.empty() ) {
+		EJCanvasCommand &last = commands.back();
+		if(
+			last.program == currentProgram && last.texture == texture &&
+			last.compositeOperation == op && last.indexLayout == layout &&
+			last.clipLevel == clipLevel && EJCanvasScissorEqual(last.scissor, scissor) &&
+			last.firstVertex + last.vertexCount == first
+		) {
+			last.vertexCount += count;
+			if( min.x < last.min.x ) { last.min.x = min.x; }
+			if( min.y < last.min.y ) { last.min.y = min.y; }
+			if( max.x > last.max.x ) { last.max.x = max.x; }
+			if( max.y > last.max.y ) { last.max.y = max.y; }
+			return;
+		}
+	}
+	
+	if( texture ) { texture->retain(); }
+	EJCanvasCommand command = { currentProgram, texture, op, layout, clipLevel, scissor, first, count, min, max, -1 };
+	commands.push_back(command);
+}
+
+static inline bool EJCanvasCommandOverlaps(EJVector2 minA, EJVector2 maxA, EJVector2 minB, EJVector2 maxB) {
+	return minA.x < maxB.x && minB.x < maxA.x && minA.y < maxB.y && minB.y < maxA.y;
+}
+
+void EJCanvasContext::batchCommands()
+{
+	// Each command joins the closest earlier batch with the same program,
+	// texture, blend mode and clip, as long as it doesn't overlap any of the batches
+	// it is moved in front of. Where draws intersect, painter's order is kept.
+	int lookback = commandReorderingEnabled ? EJ_CANVAS_COMMAND_LOOKBACK : 1;
+	
+	commandBatches.clear();
+	for( int i = 0; i < (int)commands.size(); i++ ) {
+		EJCanvasCommand &command = commands[i];
+		command.next = -1;
+		
+		int target = -1;
+		for( int b = (int)commandBatches.size() - 1, steps = 0; b >= 0 && steps < lookback; b--, steps++ ) {
+			EJCanvasCommandBatch &batch = commandBatches[b];
+			EJCanvasCommand &head = commands[batch.first];
+			if(
+				head.program == command.program && head.texture == command.texture &&
+				head.compositeOperation == command.compositeOperation &&
+				head.indexLayout == command.indexLayout &&
+				head.clipLevel == command.clipLevel &&
+				EJCanvasScissorEqual(head.scissor, command.scissor)
+			) {
+				target = b;
+				break;
+			}
+			if( EJCanvasCommandOverlaps(batch.min, batch.max, command.min, command.max) ) {
+				break;
+			}
+		}
+		
+		if( target == -1 ) {
+			EJCanvasCommandBatch batch = { i, i, 0, command.vertexCount, command.min, command.max };
+			commandBatches.push_back(batch);
+			continue;
+		}
+		
+		EJCanvasCommandBatch &batch = commandBatches[target];
+		commands[batch.last].next = i;
+		batch.last = i;
+		batch.vertexCount += command.vertexCount;
+		if( command.min.x < batch.min.x ) { batch.min.x = command.min.x; }
+		if( command.min.y < batch.min.y ) { batch.min.y = command.min.y; }
+		if( command.max.x > batch.max.x ) { batch.max.x = command.max.x; }
+		if( command.max.y > batch.max.y ) { batch.max.y = command.max.y; }
+	}
+}
+
+static inline float EJCanvasClipDepth(int level) {
+	return 1.0f - (float)level / EJ_CANVAS_CLIP_DEPTH_LEVELS;
+}
+
+int EJCanvasContext::currentClipLevel()
+{
+	return state->clipEnd > state->clipStart ? clipPaths[state->clipEnd - 1].level : 0;
+}
+
+void EJCanvasContext::applyClip(int clipLevel, EJCanvasScissor scissor)
 {
-	if( vertexBufferIndex == 0 ) { return; }
+	// Levels are written with decreasing depth values, so a level passes
+	// inside its own clip and inside all clips nested in it. Level 0 is the
+	// cleared depth buffer, i.e. no clip at all.
+	EJGLState * glState = EJGLState::getInstance();
+	if( clipLevel > 0 ) {
+		glState->setDepthFunc(GL_GEQUAL);
+		glState->setDepthRange(EJCanvasClipDepth(clipLevel));
+	}
+	else if( clipLevel == 0 ) {
+		glState->setDepthFunc(GL_ALWAYS);
+	}
+	
+	if( scissor.width < 0 ) {
+		glState->disable(GL_SCISSOR_TEST);
+	}
+	else {
+		glState->enable(GL_SCISSOR_TEST);
+		glState->setScissor(scissor.x, scissor.y, scissor.width, scissor.height);
+	}
+}
 
-	glDrawArrays(GL_TRIANGLES, 0, vertexBufferIndex);
+void EJCanvasContext::addDamage(EJVector2 min, EJVector2 max)
+{
+	if( min.x < damageMin.x ) { damageMin.x = min.x; }
+	if( min.y < damageMin.y ) { damageMin.y = min.y; }
+	if( max.x > damageMax.x ) { damageMax.x = max.x; }
+	if( max.y > damageMax.y ) { damageMax.y = max.y; }
+}
+
+void EJCanvasContext::damageAll()
+{
+	damageMin = EJVector2Make(0, 0);
+	damageMax = EJVector2Make(width, height);
+}
+
+void EJCanvasContext::resetDamage()
+{
+	damageMin = EJVector2Make(INFINITY, INFINITY);
+	damageMax = EJVector2Make(-INFINITY, -INFINITY);
+}
+
+// FNV-1a
+static inline unsigned int EJCanvasHashBytes(unsigned int hash, const void * data, size_t length) {
+	const unsigned char * bytes = (const unsigned char *)data;
+	for( size_t i = 0; i < length; i++ ) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+unsigned int EJCanvasContext::hashCommands()
+{
+	// Everything that decides what the recorded commands draw, except for the
+	// contents of the textures; see EJTexture::contentGeneration
+	unsigned int hash = 2166136261u;
+	for( std::vector<EJCanvasCommand>::iterator command = commands.begin(); command != commands.end(); ++command ) {
+		hash = EJCanvasHashBytes(hash, &command->program, sizeof(command->program));
+		hash = EJCanvasHashBytes(hash, &command->texture, sizeof(command->texture));
+		hash = EJCanvasHashBytes(hash, &command->compositeOperation, sizeof(command->compositeOperation));
+		hash = EJCanvasHashBytes(hash, &command->indexLayout, sizeof(command->indexLayout));
+		hash = EJCanvasHashBytes(hash, &command->clipLevel, sizeof(command->clipLevel));
+		hash = EJCanvasHashBytes(hash, &command->scissor, sizeof(command->scissor));
+		hash = EJCanvasHashBytes(hash, &command->vertexCount, sizeof(command->vertexCount));
+	}
+	hash = EJCanvasHashBytes(hash, textureSlots, textureSlotsUsed * sizeof(EJTexture *));
+	hash = EJCanvasHashBytes(hash, vertexBuffer, vertexBufferIndex * sizeof(EJVertex));
+	
+	short size[] = { width, height, imageSmoothingEnabled };
+	return EJCanvasHashBytes(hash, size, sizeof(size));
+}
+
+bool EJCanvasContext::commandsCoverCanvas()
+{
+	// True if the first quad overwrites the whole canvas, either by clearing
+	// it or with an opaque flat color. Whatever is drawn on top then doesn't
+	// depend on what the canvas contained before.
+	if( commands.empty() || commands[0].vertexCount < 4 ) { return false; }
+	EJCanvasCommand &first = commands[0];
+	if(
+		first.indexLayout != kEJIndexLayoutQuads || first.clipLevel != 0 ||
+		first.scissor.width >= 0
+	) {
+		return false;
+	}
+	
+	bool flat = first.program && (
+		first.program == sharedGLContext->getGlProgram2DFlat() ||
+		first.program->getTextureSlots() > 1
+	);
+	bool clears = first.compositeOperation == kEJCompositeOperationDestinationOut;
+	if( !flat || (!clears && first.compositeOperation != kEJCompositeOperationSourceOver) ) {
+		return false;
+	}
+	
+	EJVertex * quad = &vertexBuffer[first.firstVertex];
+	EJVector2 min = quad[0].pos, max = quad[0].pos;
+	for( int i = 0; i < 4; i++ ) {
+		if( quad[i].slot != 0 || quad[i].color.rgba.a != 0xff ) { return false; }
+		if( quad[i].pos.x < min.x ) { min.x = quad[i].pos.x; }
+		if( quad[i].pos.y < min.y ) { min.y = quad[i].pos.y; }
+		if( quad[i].pos.x > max.x ) { max.x = quad[i].pos.x; }
+		if( quad[i].pos.y > max.y ) { max.y = quad[i].pos.y; }
+	}
+	
+	// The 4 vertices have to span an axis aligned rect, not just its bounds
+	for( int i = 0; i < 4; i++ ) {
+		if( (quad[i].pos.x != min.x && quad[i].pos.x != max.x) || (quad[i].pos.y != min.y && quad[i].pos.y != max.y) ) {
+			return false;
+		}
+	}
+	return
+		quad[0].pos.x != quad[3].pos.x && quad[0].pos.y != quad[3].pos.y &&
+		quad[1].pos.x != quad[2].pos.x && quad[1].pos.y != quad[2].pos.y &&
+		min.x <= 0 && min.y <= 0 && max.x >= width && max.y >= height;
+}
+
+void EJCanvasContext::discardCommands()
+{
+	for( std::vector<EJCanvasCommand>::iterator command = commands.begin(); command != commands.end(); ++command ) {
+		if( command->texture ) { command->texture->release(); }
+	}
+	commands.clear();
 	vertexBufferIndex = 0;
 }
 
-void EJCanvasContext::setGlobalCompositeOperation(EJCompositeOperation op) {
-	if(op == state->globalCompositeOperation) {
-		return;
+void EJCanvasContext::applyState(EJGLProgram2D *program, EJTexture *texture, EJCompositeOperation op, int clipLevel, EJCanvasScissor scissor)
+{
+	// Redundant changes are filtered by the state tracker; the screen size is
+	// only sent again if it differs from the one the program last got
+	EJGLState * glState = EJGLState::getInstance();
+	glState->useProgram(program->getProgram());
+	glState->uniform2f(program->getScreen(), width, height * (upsideDown ? -1 : 1));
+	
+	// The multi texture program expects slot 0 on unit 0, which a batch with
+	// a single texture may have replaced, and slot 1 on unit 1, where the alpha
+	// mask program binds its alpha texture
+	if( program->getTextureSlots() > 1 && textureSlotsUsed ) {
+		texture = textureSlots[0];
+		if( textureSlotsUsed > 1 ) {
+			glState->activeTexture(GL_TEXTURE1);
+			textureSlots[1]->bind();
+			glState->activeTexture(GL_TEXTURE0);
+		}
+	}
+	if( texture ) {
+		texture->bind();
+		if( texture->alphaTexture && program == sharedGLContext->getGlProgram2DAlphaMaskTexture() ) {
+			glState->activeTexture(GL_TEXTURE1);
+			texture->alphaTexture->bind();
+			glState->activeTexture(GL_TEXTURE0);
+		}
 	}
+	
+	glState->blendFunc(EJCompositeOperationFuncs[op].source, EJCompositeOperationFuncs[op].destination);
+	applyClip(clipLevel, scissor);
+}
 
-	flushBuffers();
-	glBlendFunc(EJCompositeOperationFuncs[op].source, EJCompositeOperationFuncs[op].destination);
+void EJCanvasContext::flushBuffers()
+{
+	if( vertexBufferIndex > 0 ) {
+		batchCommands();
+		
+		// If batches were merged, lay out the vertices in batch order, so that
+		// each batch is a single draw call
+		EJVertex * vertices = vertexBuffer;
+		EJVertex * sorted = NULL;
+		if( commandBatches.size() < commands.size() ) {
+			sorted = sharedGLContext->getScratchVertexBuffer(vertexBufferIndex);
+		}
+		
+		int index = 0;
+		for( std::vector<EJCanvasCommandBatch>::iterator batch = commandBatches.begin(); batch != commandBatches.end(); ++batch ) {
+			if( !sorted ) {
+				batch->firstVertex = commands[batch->first].firstVertex;
+				continue;
+			}
+			
+			batch->firstVertex = index;
+			for( int c = batch->first; c != -1; c = commands[c].next ) {
+				memcpy(&sorted[index], &vertexBuffer[commands[c].firstVertex], commands[c].vertexCount * sizeof(EJVertex));
+				index += commands[c].vertexCount;
+			}
+		}
+		if( sorted ) {
+			vertices = sorted;
+		}
+		else if( commandBatches.size() < commands.size() ) {
+			// No memory for reordering; draw the commands as recorded
+			commandBatches.clear();
+			for( int i = 0; i < (int)commands.size(); i++ ) {
+				EJCanvasCommandBatch batch = { i, i, commands[i].firstVertex, commands[i].vertexCount, commands[i].min, commands[i].max };
+				commandBatches.push_back(batch);
+			}
+		}
+		
+		// Upload into the next buffer of the ring; the attribute pointers have
+		// to be set again, since they refer to the bound buffer object
+		sharedGLContext->uploadVertexBuffer(vertexBufferIndex, vertices);
+		bindVertexBuffer();
+		
+		EJIndexLayout boundLayout = kEJIndexLayoutQuads;
+		for( std::vector<EJCanvasCommandBatch>::iterator batch = commandBatches.begin(); batch != commandBatches.end(); ++batch ) {
+			EJCanvasCommand &head = commands[batch->first];
+			applyState(head.program, head.texture, head.compositeOperation, head.clipLevel, head.scissor);
+			if( head.indexLayout != boundLayout ) {
+				sharedGLContext->bindIndexBuffer(head.indexLayout);
+				boundLayout = head.indexLayout;
+			}
+			
+			// Quads use 6 indices per 4 vertices; ribbons 18 per row of 4
+			// vertices, except for the last row, which isn't connected further
+			int rows = batch->vertexCount / 4, firstRow = batch->firstVertex / 4;
+			if( head.indexLayout == kEJIndexLayoutRibbon ) {
+				glDrawElements(GL_TRIANGLES, (rows - 1) * 18, GL_UNSIGNED_SHORT, (GLvoid *)(firstRow * 18 * sizeof(GLushort)));
+			}
+			else {
+				glDrawElements(GL_TRIANGLES, rows * 6, GL_UNSIGNED_SHORT, (GLvoid *)(firstRow * 6 * sizeof(GLushort)));
+			}
+		}
+		if( boundLayout != kEJIndexLayoutQuads ) {
+			sharedGLContext->bindIndexBuffer(kEJIndexLayoutQuads);
+		}
+		
+		discardCommands();
+		
+		// Drawing into an offscreen canvas changes its texture
+		EJTexture::contentGeneration++;
+	}
+	
+	recycleTextureSlots();
+	
+	// Leave GL in the state of the current context state, for callers drawing
+	// with GL directly after a flush (e.g. the stencil passes of EJPath)
+	if( currentProgram ) {
+		applyState(currentProgram, NULL, state->globalCompositeOperation,
+			clipWriting ? EJ_CANVAS_CLIP_LEVEL_KEEP : currentClipLevel(),
+			clipWriting ? EJCanvasScissorNone : state->scissor);
+	}
+}
+
+void EJCanvasContext::setGlobalCompositeOperation(EJCompositeOperation op) {
+	// Recorded with each command and applied when it is submitted
 	state->globalCompositeOperation = op;
 }
 
@@ -483,7 +1121,6 @@ void EJCanvasContext::save()
 	stateIndex++;
 	state = &stateStack[stateIndex];
 	state->font->retain();
-	if(state->clipPath)state->clipPath->retain();
 }
 
 void EJCanvasContext::restore()
@@ -494,63 +1131,68 @@ void EJCanvasContext::restore()
 	}
 	
 	EJCompositeOperation oldCompositeOp = state->globalCompositeOperation;
-	EJPath * oldClipPath = state->clipPath;
+	int oldClipStart = state->clipStart;
 	
 	// Clean up current state
 	state->font->release();
-
-	if( state->clipPath && state->clipPath != stateStack[stateIndex-1].clipPath ) {
-		resetClip();
-	}
-	if( state->clipPath )state->clipPath->release();
 	
 	// Load state from stack
 	stateIndex--;
 	state = &stateStack[stateIndex];
 	
-    path->transform = state->transform;
+	transformChanged();
     
 	// Set Composite op, if different
 	if( state->globalCompositeOperation != oldCompositeOp ) {
 		setGlobalCompositeOperation(state->globalCompositeOperation);
 	}
 	
-	// Render clip path, if present and different
-	if( state->clipPath && state->clipPath != oldClipPath ) {
-		setProgram(sharedGLContext->getGlProgram2DFlat());
-		state->clipPath->drawPolygonsToContext(this,kEJPathPolygonTargetDepth);
+	// The restored clip is still in the depth buffer and the scissor box is
+	// recorded with each command, so nothing has to be drawn again. Only if
+	// the clip was reset and replaced in the popped state, the new clips may
+	// have written their levels outside of the restored ones.
+	if( oldClipStart != state->clipStart && state->clipEnd > state->clipStart ) {
+		flushBuffers();
+		rewriteClips();
 	}
 }
 
+void EJCanvasContext::transformChanged()
+{
+	state->transformKind = EJTransformGetKind(state->transform);
+	path->transform = state->transform;
+	path->transformKind = state->transformKind;
+}
+
 void EJCanvasContext::rotate(float angle)
 {
 	state->transform = CGAffineTransformRotate( state->transform, angle );
-    path->transform = state->transform;
+	transformChanged();
 }
 
 void EJCanvasContext::translate(float x, float y)
 {
 	state->transform = CGAffineTransformTranslate( state->transform, x, y );
-    path->transform = state->transform;
+	transformChanged();
 }
 
 void EJCanvasContext::scale(float x, float y)
 {
 	state->transform = CGAffineTransformScale( state->transform, x, y );
-	path->transform = state->transform;
+	transformChanged();
 }
 
 void EJCanvasContext::transform(float m11, float m12, float m21, float m22, float dx, float dy)
 {
 	CGAffineTransform t = CGAffineTransformMake( m11, m12, m21, m22, dx, dy );
 	state->transform = CGAffineTransformConcat( t, state->transform );
-	path->transform = state->transform;
+	transformChanged();
 }
 
 void EJCanvasContext::setTransform(float m11, float m12, float m21, float m22, float dx, float dy)
 {
 	state->transform = CGAffineTransformMake( m11, m12, m21, m22, dx, dy );
-	path->transform = state->transform;
+	transformChanged();
 }
 
 void EJCanvasContext::drawImage(EJTexture * texture, float sx, float sy, float sw, float sh, float dx, float dy, float dw, float dh)
@@ -560,9 +1202,18 @@ void EJCanvasContext::drawImage(EJTexture * texture, float sx, float sy, float s
 		float tw = texture->realWidth;
 		float th = texture->realHeight;
 
-		setProgram(sharedGLContext->getGlProgram2DTexture());
+		// Move the source rect into the atlas page, if the image was packed
+		sx += texture->atlasX;
+		sy += texture->atlasY;
+
+		// ETC1 images with a separate alpha texture need their own program,
+		// which can't be batched with the multi texture program
+		setProgram(texture->alphaTexture
+			? sharedGLContext->getGlProgram2DAlphaMaskTexture()
+			: sharedGLContext->getGlProgram2DTexture()
+		);
 		setTexture(texture);
-		pushTexturedRect(dx, dy, dw, dh, sx/tw, sy/th, sw/tw, sh/th, EJCanvasBlendWhiteColor(state), state->transform);
+		pushTexturedRect(dx, dy, dw, dh, sx/tw, sy/th, sw/tw, sh/th, EJCanvasBlendWhiteColor(state), state->transform, state->transformKind);
 	}
 }
 
@@ -572,7 +1223,7 @@ void EJCanvasContext::fillRect(float x, float y, float w, float h)
 	
 	setProgram(sharedGLContext->getGlProgram2DFlat());
 	EJColorRGBA cc = EJCanvasBlendFillColor(state);
-	pushRect(x, y, w, h, 0, 0, 0, 0, cc, state->transform);
+	pushRect(x, y, w, h, 0, 0, 0, 0, cc, state->transform, state->transformKind);
 }
 
 void EJCanvasContext::strokeRect(float x, float y, float w, float h)
@@ -602,7 +1253,7 @@ void EJCanvasContext::clearRect(float x, float y, float w, float h)
 	setGlobalCompositeOperation(kEJCompositeOperationDestinationOut);
 	
 	static EJColorRGBA white = {0xffffffff};
-	pushRect(x, y, w, h, 0, 0, 0, 0, white, state->transform);
+	pushRect(x, y, w, h, 0, 0, 0, 0, white, state->transform, state->transformKind);
 	
 	setGlobalCompositeOperation(oldOp);
 }
@@ -612,6 +1263,7 @@ EJImageData* EJCanvasContext::getImageData(float sx, float sy, float sw, float s
 	flushBuffers();
 	GLubyte * pixels = (GLubyte*)malloc( (size_t)sw * (size_t)sh * 4 * sizeof(GLubyte));
 	glReadPixels((GLint)sx, (GLint)sy, (GLsizei)sw, (GLsizei)sh, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	EJUnpremultiplyPixels(pixels, (size_t)sw * (size_t)sh);
 	EJImageData* imageData = new EJImageData((int)sw, (int)sh, pixels);
 	imageData->autorelease();
 	return imageData;
@@ -628,7 +1280,7 @@ void EJCanvasContext::putImageData(EJImageData* imageData, float dx, float dy)
 	
 	static EJColorRGBA white = {0xffffffff};
 	
-	pushTexturedRect(dx, dy, tw, th, 0, 0, 1, 1, white, CGAffineTransformIdentity);
+	pushTexturedRect(dx, dy, tw, th, 0, 0, 1, 1, white, CGAffineTransformIdentity, kEJTransformKindIdentity);
 	flushBuffers();
 }
 
@@ -654,6 +1306,18 @@ void EJCanvasContext::stroke()
 	path->drawLinesToContext(this);
 }
 
+void EJCanvasContext::fill(EJPath * untransformedPath)
+{
+	setProgram(sharedGLContext->getGlProgram2DFlat());
+	untransformedPath->drawPolygonsToContext(this, kEJPathPolygonTargetColor, state->transform);
+}
+
+void EJCanvasContext::stroke(EJPath * untransformedPath)
+{
+	setProgram(sharedGLContext->getGlProgram2DFlat());
+	untransformedPath->drawLinesToContext(this, state->transform);
+}
+
 void EJCanvasContext::moveTo(float x, float y)
 {
 	path->moveTo(x, y);
@@ -667,7 +1331,7 @@ void EJCanvasContext::lineTo(float x, float y)
 void EJCanvasContext::bezierCurveTo(float cpx, float cpy, float cpx2, float cpy2, float x, float y)
 {
 	float scale = CGAffineTransformGetScale( state->transform );
-	path->quadraticCurveTo(cpx, cpy, x, y, scale);
+	path->bezierCurveTo(cpx, cpy, cpx2, cpy2, x, y, scale);
 }
 
 void EJCanvasContext::quadraticCurveTo(float cpx, float cpy, float x, float y)
@@ -687,12 +1351,14 @@ void EJCanvasContext::rect(float x, float y, float w, float h)
 
 void EJCanvasContext::arcTo(float x1, float y1, float x2, float y2, float radius)
 {
-	path->arcTo(x1, y1, x2, y2, radius);
+	float scale = CGAffineTransformGetScale( state->transform );
+	path->arcTo(x1, y1, x2, y2, radius, scale);
 }
 
 void EJCanvasContext::arc(float x, float y, float radius, float startAngle, float endAngle, BOOL antiClockwise)
 {
-	path->arc(x, y, radius, startAngle, endAngle, antiClockwise);
+	float scale = CGAffineTransformGetScale( state->transform );
+	path->arc(x, y, radius, startAngle, endAngle, antiClockwise, scale);
 }
 
 EJFont* EJCanvasContext::acquireFont(NSString* fontName , float pointSize ,BOOL fill ,float contentScale) {	
@@ -733,25 +1399,126 @@ float EJCanvasContext::measureText(NSString * text)
 
 void EJCanvasContext::clip()
 {
+	clip(path);
+}
+
+void EJCanvasContext::clip(EJPath * newClipPath)
+{
+	// Rects that are still axis aligned on screen only narrow the scissor box
+	EJVector2 min, max;
+	if( newClipPath->getAxisAlignedRect(min, max) ) {
+		clipToRect(min, max);
+		return;
+	}
+	
 	flushBuffers();
-	state->clipPath->release();
-	state->clipPath = NULL;
+	createStencilBufferOnce();
+	
+	// Drop the clips of restored states
+	while( (int)clipPaths.size() > state->clipEnd ) {
+		clipPaths.back().path->release();
+		clipPaths.pop_back();
+	}
+	
+	// Out of levels: start over with the clips that are still active
+	if( clipLevelsUsed == EJ_CANVAS_CLIP_DEPTH_LEVELS - 1 ) {
+		rewriteClips();
+	}
+	
+	EJCanvasClip clip = { (EJPath*)(newClipPath->copy()), ++clipLevelsUsed };
+	clipPaths.push_back(clip);
+	state->clipEnd++;
+	writeClip(state->clipEnd - 1);
+}
+
+void EJCanvasContext::rewriteClips()
+{
+	// Clears the depth buffer and writes the clips of the current state with
+	// new levels. Clips of saved states that aren't part of the current
+	// state's range are written again when they're restored.
+	EJGLState * glState = EJGLState::getInstance();
+	glState->disable(GL_SCISSOR_TEST);
+	glState->setDepthMask(GL_TRUE);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glState->setDepthMask(GL_FALSE);
+	
+	clipLevelsUsed = 0;
+	for( int i = state->clipStart; i < state->clipEnd; i++ ) {
+		clipPaths[i].level = ++clipLevelsUsed;
+		writeClip(i);
+	}
+	applyClip(currentClipLevel(), state->scissor);
+}
+
+void EJCanvasContext::clipToRect(EJVector2 min, EJVector2 max)
+{
+	// Snap to pixels and convert to viewport coordinates, which start at the
+	// bottom for the screen
+	short x1 = (short)floorf((min.x < 0 ? 0 : (min.x > width ? width : min.x)) + 0.5f);
+	short x2 = (short)floorf((max.x < 0 ? 0 : (max.x > width ? width : max.x)) + 0.5f);
+	short y1 = (short)floorf((min.y < 0 ? 0 : (min.y > height ? height : min.y)) + 0.5f);
+	short y2 = (short)floorf((max.y < 0 ? 0 : (max.y > height ? height : max.y)) + 0.5f);
 	
-	state->clipPath = (EJPath*)(path->copy());
+	EJCanvasScissor scissor;
+	scissor.x = x1;
+	scissor.y = upsideDown ? height - y2 : y1;
+	scissor.width = x2 - x1;
+	scissor.height = y2 - y1;
+	
+	// Nested rect clips intersect
+	EJCanvasScissor current = state->scissor;
+	if( current.width >= 0 ) {
+		short left = scissor.x > current.x ? scissor.x : current.x;
+		short bottom = scissor.y > current.y ? scissor.y : current.y;
+		short right = scissor.x + scissor.width < current.x + current.width
+			? scissor.x + scissor.width : current.x + current.width;
+		short top = scissor.y + scissor.height < current.y + current.height
+			? scissor.y + scissor.height : current.y + current.height;
+		scissor.x = left;
+		scissor.y = bottom;
+		scissor.width = right > left ? right - left : 0;
+		scissor.height = top > bottom ? top - bottom : 0;
+	}
+	state->scissor = scissor;
+}
+
+void EJCanvasContext::writeClip(int index)
+{
+	// Only the parts of the path inside the parent clip get the new level:
+	// the path is marked in the stencil buffer where the parent's level
+	// passes, and the mark is then covered with the new depth value
+	EJCanvasClip &clip = clipPaths[index];
+	EJVector2 min, max;
+	if( !clip.path->getBounds(min, max) ) {
+		return; // Nothing to fill; no draw will pass the unwritten level
+	}
+	
+	EJGLState * glState = EJGLState::getInstance();
+	clipWriting = true;
 	setProgram(sharedGLContext->getGlProgram2DFlat());
-	state->clipPath->drawPolygonsToContext(this, kEJPathPolygonTargetDepth);
+	applyClip(index > state->clipStart ? clipPaths[index-1].level : 0, EJCanvasScissorNone);
+	clip.path->drawPolygonsToContext(this, kEJPathPolygonTargetStencil);
+	
+	glState->setStencilFunc(GL_NOTEQUAL, 0x00, 0xff);
+	glState->setStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+	glState->setDepthFunc(GL_ALWAYS);
+	glState->setDepthRange(EJCanvasClipDepth(clip.level));
+	glState->setDepthMask(GL_TRUE);
+	pushRect(min.x, min.y, max.x - min.x, max.y - min.y, 0, 0, 0, 0, state->fillColor, CGAffineTransformIdentity, kEJTransformKindIdentity);
+	flushBuffers();
+	
+	glState->setDepthMask(GL_FALSE);
+	glState->disable(GL_STENCIL_TEST);
+	glState->setColorMask(GL_TRUE);
+	glState->enable(GL_BLEND);
+	clipWriting = false;
+	applyClip(currentClipLevel(), state->scissor);
 }
 
 void EJCanvasContext::resetClip()
 {
-	if( state->clipPath ) {
-		flushBuffers();
-		state->clipPath->release();
-		state->clipPath = NULL;
-		
-		glDepthMask(GL_TRUE);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glDepthMask(GL_FALSE);
-		glDepthFunc(GL_ALWAYS);
-	}
+	// Levels of dropped clips are never used again, so the depth buffer
+	// doesn't need to be cleared. The clips of saved states are kept.
+	state->clipStart = state->clipEnd;
+	state->scissor = EJCanvasScissorNone;
 }
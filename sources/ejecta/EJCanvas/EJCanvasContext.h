@@ -16,17 +16,38 @@
 #include "../EJCocoa/support/nsMacros.h"
 #include "EJTexture.h"
 #include "EJImageData.h"
-#include "EJPath.h"
 #include "EJCanvas2DTypes.h"
+#include "EJVertexTransform.h"
 #include "EJFont.h"
 #include "../EJCocoa/NSDictionary.h"
 #include "../EJCocoa/NSCache.h"
 #include "../EJCocoa/UIFont.h"
 #include "EJSharedOpenGLContext.h"
+#include <vector>
 
 
 #define EJ_CANVAS_STATE_STACK_SIZE 16
 
+// How many batches back a draw command may be moved when it is submitted.
+// Keeps the reordering linear in the number of commands.
+#define EJ_CANVAS_COMMAND_LOOKBACK 32
+
+// Width in pixels of the fringe that anti-aliased edges fade out across. It is
+// centered on the edge, so shapes keep their size.
+#define EJ_CANVAS_EDGE_FEATHER 1.0f
+
+// Fringe corners are offset along the miter of their edges; for sharp corners
+// the offset is limited to this many times the half fringe width
+#define EJ_CANVAS_EDGE_MITER_LIMIT 2.0f
+
+// Path clips are written into the depth buffer, each with its own level below
+// the one of the clip it's nested in. Once all levels were handed out, the
+// depth buffer is cleared and the active clips are written again.
+#define EJ_CANVAS_CLIP_DEPTH_LEVELS 4096
+
+// Commands recorded while a clip is written leave the depth state alone
+#define EJ_CANVAS_CLIP_LEVEL_KEEP -1
+
 class EJPath;
 
 typedef enum {
@@ -68,11 +89,12 @@ typedef enum {
 	kEJCompositeOperationXOR
 } EJCompositeOperation;
 
+// Blend funcs for premultiplied sources; textures and vertex colors are
+// premultiplied. Lighter uses the source-over funcs with a source alpha of 0,
+// which turns GL_ONE_MINUS_SRC_ALPHA into GL_ONE for an additive blend.
 static const struct { GLenum source; GLenum destination; float alphaFactor; } EJCompositeOperationFuncs[] = {
-	//Two first blend functions different from iOS
-	{GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, 1},
-	//Based on Ejecta iOS, alphaFactor should be 0 for lighter but doesn't seem to work
-	{GL_SRC_ALPHA, GL_ONE, 1},
+	{GL_ONE, GL_ONE_MINUS_SRC_ALPHA, 1},
+	{GL_ONE, GL_ONE_MINUS_SRC_ALPHA, 0},
 	{GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA, 1},
 	{GL_ZERO, GL_ONE_MINUS_SRC_ALPHA, 1},
 	{GL_ONE_MINUS_DST_ALPHA, GL_ONE, 1},
@@ -80,9 +102,62 @@ static const struct { GLenum source; GLenum destination; float alphaFactor; } EJ
 	{GL_ONE_MINUS_DST_ALPHA, GL_ONE_MINUS_SRC_ALPHA, 1}
 };
 
+// The first operation with the same blend funcs as op. Commands are recorded
+// with it, so that e.g. source-over and lighter draws can share a batch.
+static inline EJCompositeOperation EJCompositeOperationBlendGroup( EJCompositeOperation op ) {
+	for( int i = 0; i < op; i++ ) {
+		if(
+			EJCompositeOperationFuncs[i].source == EJCompositeOperationFuncs[op].source &&
+			EJCompositeOperationFuncs[i].destination == EJCompositeOperationFuncs[op].destination
+		) {
+			return (EJCompositeOperation)i;
+		}
+	}
+	return op;
+}
+
+
+// Rect clips that stay axis aligned on screen are applied as a scissor box,
+// in viewport pixels. A width < 0 means no scissor.
+typedef struct {
+	short x, y, width, height;
+} EJCanvasScissor;
+
+static const EJCanvasScissor EJCanvasScissorNone = { 0, 0, -1, -1 };
+
+static inline bool EJCanvasScissorEqual( EJCanvasScissor a, EJCanvasScissor b ) {
+	return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+typedef struct {
+	EJPath * path; // retained
+	int level;
+} EJCanvasClip;
+
+// A run of vertices drawn with the same program, texture, blend mode and clip,
+// together with their bounding box. Commands are recorded by the push
+// functions and only submitted to GL in flushBuffers().
+typedef struct {
+	EJGLProgram2D * program;
+	EJTexture * texture; // retained; NULL for flat and multi texture geometry
+	EJCompositeOperation compositeOperation; // see EJCompositeOperationBlendGroup()
+	EJIndexLayout indexLayout;
+	int clipLevel;
+	EJCanvasScissor scissor;
+	int firstVertex, vertexCount;
+	EJVector2 min, max;
+	int next; // next command in the same batch
+} EJCanvasCommand;
+
+typedef struct {
+	int first, last;
+	int firstVertex, vertexCount;
+	EJVector2 min, max;
+} EJCanvasCommandBatch;
 
 typedef struct {
 	CGAffineTransform transform;
+	EJTransformKind transformKind;
 	
 	EJCompositeOperation globalCompositeOperation;
 	EJColorRGBA fillColor;
@@ -98,7 +173,11 @@ typedef struct {
 	EJTextBaseline textBaseline;
 	UIFont* font;
 	
-	EJPath * clipPath;
+	// Range of the context's clip paths that apply to this state; each is
+	// nested in the one before it and the last one determines the depth level
+	// to draw with
+	int clipStart, clipEnd;
+	EJCanvasScissor scissor;
 } EJCanvasState;
 
 static inline EJColorRGBA EJCanvasBlendColor( EJCanvasState *state, EJColorRGBA color ) {
@@ -134,21 +213,59 @@ protected:
 	
 	EJTexture * currentTexture;
 	
+	// Textures bound to the units sampled by the multi texture program; slot n
+	// is texture unit n. currentTextureSlot is written into each pushed vertex.
+	EJTexture * textureSlots[EJ_OPENGL_MAX_TEXTURE_SLOTS];
+	int textureSlotsUsed;
+	float currentTextureSlot;
+	
 	EJPath * path;
 	
 	EJVertex *vertexBuffer;
 	int vertexBufferSize;
 	int vertexBufferIndex;
 	
+	std::vector<EJCanvasCommand> commands;
+	std::vector<EJCanvasCommandBatch> commandBatches;
+	
 	int stateIndex;
 	EJCanvasState stateStack[EJ_CANVAS_STATE_STACK_SIZE];
 	
+	// Clip paths of the current state and the states it was saved from;
+	// entries past state->clipEnd belong to restored states and are dropped
+	// when the next clip is added
+	std::vector<EJCanvasClip> clipPaths;
+	int clipLevelsUsed;
+	bool clipWriting;
+	
+	// Bounds of everything drawn since resetDamage(), in canvas pixels
+	EJVector2 damageMin, damageMax;
+	
 	bool upsideDown;
 
 	EJGLProgram2D *currentProgram;
 	EJSharedOpenGLContext *sharedGLContext;
 
 	void setProgram(EJGLProgram2D *program);
+	void reserveVertices(int count);
+	float bindTextureSlot(EJTexture * texture);
+	void releaseTextureSlots();
+	void recycleTextureSlots();
+	void recordVertices(int first, int count, EJIndexLayout layout = kEJIndexLayoutQuads);
+	void batchCommands();
+	void applyState(EJGLProgram2D *program, EJTexture *texture, EJCompositeOperation op, int clipLevel, EJCanvasScissor scissor);
+	void applyClip(int clipLevel, EJCanvasScissor scissor);
+	int currentClipLevel();
+	void clipToRect(EJVector2 min, EJVector2 max);
+	void writeClip(int index);
+	void rewriteClips();
+	void addDamage(EJVector2 min, EJVector2 max);
+	void damageAll();
+	void resetDamage();
+	unsigned int hashCommands();
+	bool commandsCoverCanvas();
+	void discardCommands();
+	void transformChanged();
 
 public:
 	NSCache * fontCache;
@@ -159,6 +276,9 @@ public:
 	bool msaaEnabled;
 	int msaaSamples;
 	bool imageSmoothingEnabled;
+	bool multiTextureBatchingEnabled;
+	bool commandReorderingEnabled;
+	bool edgeAntialiasingEnabled;
 
 	EJCanvasContext();
 	EJCanvasContext(short widthp, short heightp);
@@ -170,10 +290,12 @@ public:
 	void bindVertexBuffer();
 	virtual void prepare();
 	void setTexture(EJTexture * newTexture);
-	void pushTri(float x1, float y1, float x2, float y2, float x3, float y3, EJColorRGBA color, CGAffineTransform transform);
-	void pushQuad(EJVector2 v1, EJVector2 v2, EJVector2 v3, EJVector2 v4, EJVector2 t1, EJVector2 t2, EJVector2 t3, EJVector2 t4, EJColorRGBA color, CGAffineTransform transform);
-	void pushRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform);
-	void pushTexturedRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform);
+	void pushTri(float x1, float y1, float x2, float y2, float x3, float y3, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind = kEJTransformKindUnknown);
+	void pushQuad(EJVector2 v1, EJVector2 v2, EJVector2 v3, EJVector2 v4, EJVector2 t1, EJVector2 t2, EJVector2 t3, EJVector2 t4, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind = kEJTransformKindUnknown);
+	void pushRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind = kEJTransformKindUnknown);
+	void pushTexturedRect(float x, float y, float w, float h, float tx, float ty, float tw, float th, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind = kEJTransformKindUnknown);
+	void pushFringe(const EJVector2 * polygon, int count, EJColorRGBA color, EJVector2 * inset, const EJVector2 * uvs = NULL);
+	void pushRibbon(const EJVector2 * rows, int rowCount, EJColorRGBA color, CGAffineTransform transform, EJTransformKind transformKind = kEJTransformKindUnknown);
 	void flushBuffers();
 	
 	void save();
@@ -193,6 +315,10 @@ public:
 	void closePath();
 	void fill();
 	void stroke();
+	// Draw a retained path whose points were recorded without a transform;
+	// the current transform is applied to its cached geometry on submit
+	void fill(EJPath * untransformedPath);
+	void stroke(EJPath * untransformedPath);
 	void moveTo(float x, float y);
 	void lineTo(float x, float y);
 	void rect(float x, float y, float w, float h);
@@ -206,6 +332,7 @@ public:
 	float measureText(NSString * text);
 
 	void clip();
+	void clip(EJPath * newClipPath);
 	void resetClip();
 
 	//返回类名
@@ -217,6 +344,9 @@ public:
 	short getWidth() const;
 	void setHeight(short h);
 	short getHeight() const;
+	// Size of the backing store in pixels
+	short getBufferWidth() const;
+	short getBufferHeight() const;
 };
 
 #endif // __EJ_CANVAS_CONTEXT_H__
\ No newline at end of file
@@ -1,16 +1,24 @@
 #include "EJCanvasContextScreen.h"
 #include "../EJApp.h"
+#include "EJGLState.h"
+#include "EJPremultiply.h"
 
+#ifndef _WINDOWS
+#include <EGL/egl.h>
+#endif
 
-EJCanvasContextScreen::EJCanvasContextScreen()
-{
 
+EJCanvasContextScreen::EJCanvasContextScreen() : swapSurface(NULL),
+	lastFrameHash(0), lastFrameHashValid(false), lastTextureGeneration(0)
+{
+	memset(&damageStats, 0, sizeof(damageStats));
 }
 
 
-EJCanvasContextScreen::EJCanvasContextScreen(short widthp, short heightp) : EJCanvasContext( widthp, heightp)
+EJCanvasContextScreen::EJCanvasContextScreen(short widthp, short heightp) : EJCanvasContext( widthp, heightp), swapSurface(NULL),
+	lastFrameHash(0), lastFrameHashValid(false), lastTextureGeneration(0)
 {
-
+	memset(&damageStats, 0, sizeof(damageStats));
 }
 
 EJCanvasContextScreen::~EJCanvasContextScreen()
@@ -22,16 +30,30 @@ void EJCanvasContextScreen::present()
 {
 	glViewport(0, 0, width, height);
 
-#ifdef _WINDOWS
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0 );
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0 );
-#else
-	glBindFramebuffer(GL_FRAMEBUFFER, 0 );
-	glBindRenderbuffer(GL_RENDERBUFFER, 0 );
-#endif	
+	EJGLState * glState = EJGLState::getInstance();
+	glState->bindFramebuffer(0);
+	glState->bindRenderbuffer(0);
 
+	// Only what was drawn this frame changed; the rest of the surface has
+	// to survive the swap
+	enablePreservedSwap();
+	
+	if( skipIdenticalFrame() ) {
+		discardCommands();
+		resetDamage();
+		damageStats.skippedFrames++;
+	}
+	
 	// [self flushBuffers];
 	EJCanvasContext::flushBuffers();
+	lastTextureGeneration = EJTexture::contentGeneration;
+	
+	// Nothing is drawn in between frames; don't keep the textures of this
+	// one alive until the next
+	releaseTextureSlots();
+	currentTextureSlot = 0;
+	
+	recordDamage();
 	
 	if( msaaEnabled ) {
 #ifdef _WINDOWS
@@ -40,22 +62,22 @@ void EJCanvasContextScreen::present()
 		glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, viewFrameBuffer);
 		//glResolveMultisampleFramebufferAPPLE();
 
-		glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, viewRenderBuffer);
+		glState->bindRenderbuffer(viewRenderBuffer);
 		// [[EJApp instance].glContext presentRenderbuffer:GL_RENDERBUFFER];
 		// EJApp::instance()->glContext->presentRenderbuffer(GL_RENDERBUFFER_OES);
 		// presentRenderbuffer(GL_RENDERBUFFER_OES);
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, msaaFrameBuffer);
+		glState->bindFramebuffer(msaaFrameBuffer);
 #else
 		//Bind the MSAA and View frameBuffers and resolve
-		glBindFramebuffer(GL_FRAMEBUFFER, msaaFrameBuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, viewFrameBuffer);
+		glState->bindFramebuffer(msaaFrameBuffer);
+		glState->bindFramebuffer(viewFrameBuffer);
 		// glResolveMultisampleFramebufferAPPLE();
 
-		glBindRenderbuffer(GL_RENDERBUFFER, viewRenderBuffer);
+		glState->bindRenderbuffer(viewRenderBuffer);
 		// [[EJApp instance].glContext presentRenderbuffer:GL_RENDERBUFFER];
 		// EJApp::instance()->glContext->presentRenderbuffer(GL_RENDERBUFFER_OES);
 		// presentRenderbuffer(GL_RENDERBUFFER_OES);
-		glBindFramebuffer(GL_FRAMEBUFFER, msaaFrameBuffer);
+		glState->bindFramebuffer(msaaFrameBuffer);
 #endif
 	}
 	else {
@@ -67,6 +89,103 @@ void EJCanvasContextScreen::finish()
 	glFinish();	
 }
 
+void EJCanvasContextScreen::enablePreservedSwap()
+{
+#ifndef _WINDOWS
+	// The buffers are swapped by the GLSurfaceView after each frame. Its
+	// surface is recreated when the app comes back from the background, so
+	// the swap behavior is checked again whenever it changes.
+	EGLSurface surface = eglGetCurrentSurface(EGL_DRAW);
+	if( surface == EGL_NO_SURFACE || surface == (EGLSurface)swapSurface ) { return; }
+	swapSurface = (void *)surface;
+	
+	// A new surface doesn't contain the last frame
+	lastFrameHashValid = false;
+	
+	EGLDisplay display = eglGetCurrentDisplay();
+	EGLint configId = 0, surfaceType = 0, numConfigs = 0;
+	EGLConfig config;
+	eglQuerySurface(display, surface, EGL_CONFIG_ID, &configId);
+	EGLint attribs[] = { EGL_CONFIG_ID, configId, EGL_NONE };
+	if( eglChooseConfig(display, attribs, &config, 1, &numConfigs) && numConfigs == 1 ) {
+		eglGetConfigAttrib(display, config, EGL_SURFACE_TYPE, &surfaceType);
+	}
+	if( surfaceType & EGL_SWAP_BEHAVIOR_PRESERVED_BIT ) {
+		eglSurfaceAttrib(display, surface, EGL_SWAP_BEHAVIOR, EGL_BUFFER_PRESERVED);
+	}
+	
+	EGLint behavior = EGL_BUFFER_DESTROYED;
+	eglQuerySurface(display, surface, EGL_SWAP_BEHAVIOR, &behavior);
+	damageStats.preservedSwap = (behavior == EGL_BUFFER_PRESERVED);
+	NSLOG("ScreenCanvas: swap behavior %s", damageStats.preservedSwap ? "preserved" : "destroyed");
+#endif
+}
+
+void EJCanvasContextScreen::recordDamage()
+{
+	damageStats.frames++;
+	damageStats.totalPixels += (double)width * height;
+	
+	// Snap outwards to whole pixels and clamp to the canvas
+	float minX = floorf(damageMin.x), minY = floorf(damageMin.y);
+	float maxX = ceilf(damageMax.x), maxY = ceilf(damageMax.y);
+	minX = minX < 0 ? 0 : minX;
+	minY = minY < 0 ? 0 : minY;
+	maxX = maxX > width ? width : maxX;
+	maxY = maxY > height ? height : maxY;
+	
+	if( minX < maxX && minY < maxY ) {
+		damageStats.x = (int)minX;
+		damageStats.y = (int)minY;
+		damageStats.width = (int)(maxX - minX);
+		damageStats.height = (int)(maxY - minY);
+		damageStats.damagedPixels += (double)damageStats.width * damageStats.height;
+	}
+	else {
+		damageStats.x = damageStats.y = damageStats.width = damageStats.height = 0;
+		damageStats.idleFrames++;
+	}
+	resetDamage();
+}
+
+bool EJCanvasContextScreen::skipIdenticalFrame()
+{
+	// Games often redraw the same scene while nothing happens. If the frame
+	// starts by painting over the whole canvas, records exactly the same
+	// commands as the last one and no texture changed in between, it would
+	// produce the same pixels that are already on screen.
+	// Frames that were flushed early (e.g. for getImageData or drawing into
+	// another canvas) bump the texture generation and are never compared.
+	// The buffers are swapped after every frame anyway, so this is only
+	// safe if the surface keeps its contents across swaps; otherwise the
+	// skipped frame would present an undefined back buffer.
+	bool comparable = (
+		damageStats.preservedSwap &&
+		vertexBufferIndex > 0 &&
+		EJTexture::contentGeneration == lastTextureGeneration
+	);
+	if( !comparable ) {
+		lastFrameHashValid = false;
+		return false;
+	}
+	
+	unsigned int hash = hashCommands();
+	bool identical = lastFrameHashValid && hash == lastFrameHash;
+	lastFrameHash = hash;
+	lastFrameHashValid = true;
+	return identical && commandsCoverCanvas();
+}
+
+bool EJCanvasContextScreen::isIdle() const
+{
+	return damageStats.width == 0 || damageStats.height == 0;
+}
+
+EJCanvasDamageStats EJCanvasContextScreen::getDamageStats() const
+{
+	return damageStats;
+}
+
 void EJCanvasContextScreen::create()
 {
 
@@ -106,6 +225,10 @@ void EJCanvasContextScreen::create()
 // 	// Create the OpenGL UIView with final screen size and content scaling (retina)
 // 	glview = [[EAGLView alloc] initWithFrame:frame contentScale:contentScale];
 	
+	// Start from a clean slate; nothing about the GL state is known yet
+	EJGLState * glState = EJGLState::getInstance();
+	glState->invalidate();
+
 // 	// This creates the frame- and renderbuffers
 // 	[super create];
 	EJCanvasContext::create();
@@ -115,12 +238,12 @@ void EJCanvasContextScreen::create()
 // 	glFramebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, viewRenderBuffer);
 	
 
-	glDisable(GL_CULL_FACE);
-	glDisable(GL_DITHER);
+	glState->disable(GL_CULL_FACE);
+	glState->disable(GL_DITHER);
 
-	glEnable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_ALWAYS);
+	glState->enable(GL_BLEND);
+	glState->enable(GL_DEPTH_TEST);
+	glState->setDepthFunc(GL_ALWAYS);
 
     upsideDown = true;
 
@@ -179,6 +302,9 @@ EJImageData* EJCanvasContextScreen::getImageData(float sx, float sy, float sw, f
 	}
 	free(internalPixels);
 	
+	// The canvas stores premultiplied alpha; ImageData has straight alpha
+	EJUnpremultiplyPixels(pixels, (size_t)sw * (size_t)sh);
+	
 	EJImageData* m_EJImageDate = new EJImageData(sw, sh, pixels);
 	m_EJImageDate->autorelease();
 	return m_EJImageDate;
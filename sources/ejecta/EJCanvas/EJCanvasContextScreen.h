@@ -24,11 +24,34 @@ typedef struct {
 	CGSize size;
 } CGRect;
 
+// What changed on screen per frame, for debugging and for measuring how much
+// of the surface actually had to be drawn
+typedef struct {
+	int frames;
+	int idleFrames;				// Frames without any damage
+	int x, y, width, height;	// Damage of the last frame, in canvas pixels
+	double damagedPixels;		// Sum over all frames
+	double totalPixels;			// Canvas size times frames
+	bool preservedSwap;			// The surface keeps its contents across swaps
+	int skippedFrames;			// Identical frames that were not drawn again
+} EJCanvasDamageStats;
+
 class EJCanvasContextScreen : public EJCanvasContext {
 	//EAGLView * glview;
 	GLuint colorRenderbuffer;
 	
 	float backingStoreRatio;
+	
+	EJCanvasDamageStats damageStats;
+	void * swapSurface;
+	
+	unsigned int lastFrameHash;
+	bool lastFrameHashValid;
+	unsigned int lastTextureGeneration;
+	
+	void enablePreservedSwap();
+	void recordDamage();
+	bool skipIdenticalFrame();
 
 
 public:
@@ -46,6 +69,9 @@ public:
 	virtual void prepare();
 	virtual void present();
 	void finish();
+	EJCanvasDamageStats getDamageStats() const;
+	// True if the last presented frame didn't change anything on screen
+	bool isIdle() const;
 	virtual EJImageData* getImageData(float sx, float sy, float sw, float sh);
 };
 
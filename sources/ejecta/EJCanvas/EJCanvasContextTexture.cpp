@@ -9,6 +9,14 @@
 #include <GLES2/gl2ext.h>
 #endif
 #include "EJCanvasContextTexture.h"
+#include "EJGLState.h"
+
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
+
+#define EJ_MIPMAP_BENCHMARK_IMAGE_SIZE 1024
+#define EJ_MIPMAP_BENCHMARK_CANVAS_SIZE 512
 
 void EJCanvasContextTexture::create() 
 {
@@ -45,17 +53,13 @@ void EJCanvasContextTexture::resizeToWidth(short newWidth, short newHeight) {
 	bufferWidth = texture->realWidth;
 	bufferHeight = texture->realHeight;
 
-#ifdef _WINDOWS
-	glBindFramebuffer(GL_FRAMEBUFFER, viewFrameBuffer);
+	EJGLState::getInstance()->bindFramebuffer(viewFrameBuffer);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->textureId, 0);
-#else
-	glBindFramebuffer(GL_FRAMEBUFFER, viewFrameBuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->textureId, 0);
-#endif
 
 	prepare();
 
-	// Clear to transparent
+	// Clear to transparent; prepare() restored the scissor box of a rect clip
+	EJGLState::getInstance()->disable(GL_SCISSOR_TEST);
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 }
@@ -83,26 +87,23 @@ const char* EJCanvasContextTexture::getClassName()
 EJTexture* EJCanvasContextTexture::getTexture() 
 {
 	if( msaaNeedsResolving ) {	
-		GLint boundFrameBuffer;
+		// The binding is answered by the state tracker instead of a (stalling)
+		// glGetIntegerv(GL_FRAMEBUFFER_BINDING)
+		EJGLState * glState = EJGLState::getInstance();
+		GLuint boundFrameBuffer = glState->getFramebuffer();
 
 #ifdef _WINDOWS
-		glGetIntegerv( GL_FRAMEBUFFER_BINDING, &boundFrameBuffer );
-		
 		//not support  Android MSAA
 
 		//Bind the MSAA and View frameBuffers and resolve
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, msaaFrameBuffer);
+		glState->bindFramebuffer(msaaFrameBuffer);
 		glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, viewFrameBuffer);
 		//glResolveMultisampleFramebufferAPPLE();
-#else
-		glGetIntegerv( GL_FRAMEBUFFER_BINDING, &boundFrameBuffer );
 #endif
 
-#ifdef _WINDOWS
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, boundFrameBuffer);
-#else
-		glBindFramebuffer(GL_FRAMEBUFFER, boundFrameBuffer);
-#endif
+		if( boundFrameBuffer != EJ_GL_STATE_UNKNOWN ) {
+			glState->bindFramebuffer(boundFrameBuffer);
+		}
 		
 		msaaNeedsResolving = false;
 	}
@@ -114,4 +115,77 @@ void EJCanvasContextTexture::prepare()
 {
 	EJCanvasContext::prepare();
 	msaaNeedsResolving = msaaEnabled;
-}
\ No newline at end of file
+}
+
+static double EJMipmapBenchmarkTime() {
+#ifdef _WINDOWS
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return now.QuadPart * 1000.0 / freq.QuadPart;
+#else
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec * 1000.0 + time.tv_usec / 1000.0;
+#endif
+}
+
+static EJTexture * EJMipmapBenchmarkTexture(bool mipmaps) {
+	// Per pixel noise is the worst case for sampling a minified texture
+	// without mipmaps
+	int size = EJ_MIPMAP_BENCHMARK_IMAGE_SIZE;
+	GLubyte * pixels = (GLubyte *)malloc(size * size * 4);
+	unsigned int seed = 1;
+	for( int i = 0; i < size * size; i++ ) {
+		seed = seed * 1103515245 + 12345;
+		pixels[i*4+0] = (GLubyte)(seed >> 24);
+		pixels[i*4+1] = (GLubyte)(seed >> 16);
+		pixels[i*4+2] = (GLubyte)(seed >> 8);
+		pixels[i*4+3] = 0xff;
+	}
+	bool levels = mipmaps && EJTexture::appendMipmaps(&pixels, size, size, false);
+	return new EJTexture(NSStringMake("[Mipmap Benchmark]"), pixels, size, size, false, 1, 0, mipmaps, levels);
+}
+
+static double EJMipmapBenchmarkRun(EJCanvasContextTexture * context, EJTexture * texture, int sprites, int frames, float scale) {
+	float size = EJ_MIPMAP_BENCHMARK_IMAGE_SIZE;
+	float range = EJ_MIPMAP_BENCHMARK_CANVAS_SIZE - size * scale;
+	double start = 0;
+
+	// The first frame isn't timed, as it includes the first use of the texture
+	for( int frame = -1; frame < frames; frame++ ) {
+		if( frame == 0 ) {
+			start = EJMipmapBenchmarkTime();
+		}
+		unsigned int seed = 1;
+		for( int i = 0; i < sprites; i++ ) {
+			seed = seed * 1103515245 + 12345;
+			float x = (float)((seed >> 8) & 0xff) / 255.0f * range;
+			float y = (float)((seed >> 16) & 0xff) / 255.0f * range;
+			context->drawImage(texture, 0, 0, size, size, x, y, size * scale, size * scale);
+		}
+		context->flushBuffers();
+		glFinish();
+	}
+	return EJMipmapBenchmarkTime() - start;
+}
+
+EJMipmapBenchmarkResult EJCanvasContextTexture::benchmarkMipmaps(int sprites, int frames, float scale) {
+	EJMipmapBenchmarkResult result;
+	result.sprites = sprites;
+	result.frames = frames;
+	result.scale = scale;
+
+	EJCanvasContextTexture * context = new EJCanvasContextTexture(EJ_MIPMAP_BENCHMARK_CANVAS_SIZE, EJ_MIPMAP_BENCHMARK_CANVAS_SIZE);
+	context->create();
+
+	EJTexture * plain = EJMipmapBenchmarkTexture(false);
+	EJTexture * mipmapped = EJMipmapBenchmarkTexture(true);
+	result.plainTime = EJMipmapBenchmarkRun(context, plain, sprites, frames, scale);
+	result.mipmapTime = EJMipmapBenchmarkRun(context, mipmapped, sprites, frames, scale);
+
+	plain->release();
+	mipmapped->release();
+	context->release();
+	return result;
+}
@@ -8,6 +8,14 @@
 #include "EJCanvasContext.h"
 #include "EJTexture.h"
 
+typedef struct {
+	int sprites;
+	int frames;
+	float scale;
+	double plainTime;	// ms
+	double mipmapTime;	// ms
+} EJMipmapBenchmarkResult;
+
 class EJCanvasContextTexture : public EJCanvasContext {
 private:
 	bool msaaNeedsResolving;
@@ -30,6 +38,12 @@ public:
 	virtual void prepare();
 
 	virtual const char* getClassName();
+
+	// Draws sprites copies of a noisy 1024x1024 image, scaled by scale, into
+	// an offscreen canvas for each of frames frames, once without and once
+	// with mipmaps, and waits for the GPU after each frame. The current
+	// rendering context has to be prepared again afterwards.
+	static EJMipmapBenchmarkResult benchmarkMipmaps(int sprites, int frames, float scale);
 };
 
 #endif // __EJ_CANVAS_CONTEXT_TEXTURE_H__
\ No newline at end of file
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EJCompressedTexture.h"
+
+#define EJ_PKM_HEADER_SIZE 16
+#define EJ_KTX_HEADER_SIZE 64
+
+static const unsigned char EJKTXIdentifier[12] = {
+	0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+// Block sizes of the ASTC formats, from GL_COMPRESSED_RGBA_ASTC_4x4_KHR on
+static const unsigned char EJCompressedTextureASTCBlocks[][2] = {
+	{4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6}, {8, 8},
+	{10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}
+};
+
+static bool EJCompressedTextureIsASTC( GLenum format ) {
+	return format >= EJ_COMPRESSED_TEXTURE_ASTC_FIRST && format <= EJ_COMPRESSED_TEXTURE_ASTC_LAST;
+}
+
+static bool EJCompressedTextureIsETC2( GLenum format ) {
+	return (
+		format == GL_COMPRESSED_RGB8_ETC2 ||
+		format == GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 ||
+		format == GL_COMPRESSED_RGBA8_ETC2_EAC
+	);
+}
+
+static bool EJCompressedTextureHasExtension( const char * path, const char * extension ) {
+	size_t length = strlen(path);
+	size_t extensionLength = strlen(extension);
+	if( length < extensionLength ) { return false; }
+
+	const char * end = path + length - extensionLength;
+	for( size_t i = 0; i < extensionLength; i++ ) {
+		char c = end[i];
+		if( c >= 'A' && c <= 'Z' ) { c += 'a' - 'A'; }
+		if( c != extension[i] ) { return false; }
+	}
+	return true;
+}
+
+bool EJCompressedTextureIsPath( const char * path ) {
+	return EJCompressedTextureHasExtension(path, ".pkm") || EJCompressedTextureHasExtension(path, ".ktx");
+}
+
+char * EJCompressedTextureAlphaPath( const char * path ) {
+	const char * dot = strrchr(path, '.');
+	size_t base = dot ? (size_t)(dot - path) : strlen(path);
+	size_t suffix = strlen(EJ_COMPRESSED_TEXTURE_ALPHA_SUFFIX);
+
+	char * alphaPath = (char *)malloc(strlen(path) + suffix + 1);
+	memcpy(alphaPath, path, base);
+	memcpy(alphaPath + base, EJ_COMPRESSED_TEXTURE_ALPHA_SUFFIX, suffix);
+	strcpy(alphaPath + base + suffix, path + base);
+	return alphaPath;
+}
+
+size_t EJCompressedTextureDataSize( GLenum format, unsigned int width, unsigned int height ) {
+	unsigned int blockWidth = 4, blockHeight = 4;
+	size_t blockBytes = 0;
+	if( format == GL_ETC1_RGB8_OES || format == GL_COMPRESSED_RGB8_ETC2 || format == GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 ) {
+		blockBytes = 8;
+	}
+	else if( format == GL_COMPRESSED_RGBA8_ETC2_EAC ) {
+		blockBytes = 16;
+	}
+	else if( EJCompressedTextureIsASTC(format) ) {
+		blockWidth = EJCompressedTextureASTCBlocks[format - EJ_COMPRESSED_TEXTURE_ASTC_FIRST][0];
+		blockHeight = EJCompressedTextureASTCBlocks[format - EJ_COMPRESSED_TEXTURE_ASTC_FIRST][1];
+		blockBytes = 16;
+	}
+	else {
+		return 0;
+	}
+	return (size_t)((width + blockWidth - 1) / blockWidth) * ((height + blockHeight - 1) / blockHeight) * blockBytes;
+}
+
+bool EJCompressedTextureIsSupported( GLenum format, EJCompressedTextureSupport support ) {
+	if( format == GL_ETC1_RGB8_OES ) {
+		return support.etc1 || support.etc2;
+	}
+	else if( EJCompressedTextureIsETC2(format) ) {
+		return support.etc2;
+	}
+	else if( EJCompressedTextureIsASTC(format) ) {
+		return support.astc;
+	}
+	return false;
+}
+
+GLenum EJCompressedTextureUploadFormat( GLenum format, EJCompressedTextureSupport support ) {
+	if( format == GL_ETC1_RGB8_OES && !support.etc1 && support.etc2 ) {
+		return GL_COMPRESSED_RGB8_ETC2;
+	}
+	return format;
+}
+
+bool EJCompressedTextureCanDecode( GLenum format ) {
+	return format == GL_ETC1_RGB8_OES || EJCompressedTextureIsETC2(format);
+}
+
+
+// Containers
+
+static unsigned int EJReadUInt16BE( const unsigned char * p ) {
+	return (p[0] << 8) | p[1];
+}
+
+static unsigned int EJReadUInt32( const unsigned char * p, bool swap ) {
+	return swap
+		? ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+		: ((unsigned int)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static bool EJCompressedTextureParsePKM( EJCompressedImage * image, const unsigned char * data, size_t size ) {
+	if( size < EJ_PKM_HEADER_SIZE || memcmp(data, "PKM ", 4) != 0 ) { return false; }
+
+	// Version "10" only has ETC1; "20" adds the ETC2 formats
+	switch( EJReadUInt16BE(data + 6) ) {
+		case 0: image->internalFormat = GL_ETC1_RGB8_OES; break;
+		case 1: image->internalFormat = GL_COMPRESSED_RGB8_ETC2; break;
+		case 3: image->internalFormat = GL_COMPRESSED_RGBA8_ETC2_EAC; break;
+		case 4: image->internalFormat = GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2; break;
+		default: return false;
+	}
+
+	// The header also has the size padded to whole blocks at 8 and 10
+	image->width = EJReadUInt16BE(data + 12);
+	image->height = EJReadUInt16BE(data + 14);
+	image->levels = 1;
+	image->data = data + EJ_PKM_HEADER_SIZE;
+	image->dataSize = EJCompressedTextureDataSize(image->internalFormat, image->width, image->height);
+	return image->dataSize <= size - EJ_PKM_HEADER_SIZE;
+}
+
+static bool EJCompressedTextureParseKTX( EJCompressedImage * image, const unsigned char * data, size_t size ) {
+	if( size < EJ_KTX_HEADER_SIZE || memcmp(data, EJKTXIdentifier, sizeof(EJKTXIdentifier)) != 0 ) { return false; }
+
+	// The endianness field reads as 0x04030201 in the file's byte order
+	unsigned int endianness = EJReadUInt32(data + 12, false);
+	if( endianness != 0x04030201 && endianness != 0x01020304 ) { return false; }
+	bool swap = (endianness == 0x01020304);
+
+	const unsigned char * header = data + 16;
+	unsigned int glType = EJReadUInt32(header, swap);
+	unsigned int internalFormat = EJReadUInt32(header + 12, swap);
+	unsigned int width = EJReadUInt32(header + 24, swap);
+	unsigned int height = EJReadUInt32(header + 28, swap);
+	unsigned int depth = EJReadUInt32(header + 32, swap);
+	unsigned int arrayElements = EJReadUInt32(header + 36, swap);
+	unsigned int faces = EJReadUInt32(header + 40, swap);
+	unsigned int levels = EJReadUInt32(header + 44, swap);
+	unsigned int keyValueBytes = EJReadUInt32(header + 48, swap);
+
+	// Only compressed 2D textures
+	if( glType != 0 || depth > 1 || arrayElements > 0 || faces != 1 || !width || !height ) {
+		return false;
+	}
+
+	size_t offset = EJ_KTX_HEADER_SIZE + (size_t)keyValueBytes;
+	if( keyValueBytes > size || offset + 4 > size ) { return false; }
+	size_t imageSize = EJReadUInt32(data + offset, swap);
+
+	image->internalFormat = internalFormat;
+	image->width = width;
+	image->height = height;
+	image->levels = levels ? levels : 1;
+	image->data = data + offset + 4;
+	image->dataSize = EJCompressedTextureDataSize(internalFormat, width, height);
+	return (
+		image->dataSize &&
+		image->dataSize <= imageSize &&
+		imageSize <= size - offset - 4
+	);
+}
+
+bool EJCompressedTextureParse( EJCompressedImage * image, const unsigned char * data, size_t size ) {
+	memset(image, 0, sizeof(EJCompressedImage));
+	if( EJCompressedTextureParsePKM(image, data, size) || EJCompressedTextureParseKTX(image, data, size) ) {
+		return true;
+	}
+	memset(image, 0, sizeof(EJCompressedImage));
+	return false;
+}
+
+bool EJCompressedTextureLoad( EJCompressedImage * image, const char * path ) {
+	memset(image, 0, sizeof(EJCompressedImage));
+
+	FILE * file = fopen(path, "rb");
+	if( !file ) { return false; }
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+
+	unsigned char * data = size > 0 ? (unsigned char *)malloc((size_t)size) : NULL;
+	size_t read = data ? fread(data, 1, (size_t)size, file) : 0;
+	fclose(file);
+
+	if( !data || read != (size_t)size || !EJCompressedTextureParse(image, data, read) ) {
+		free(data);
+		return false;
+	}
+	image->file = data;
+	return true;
+}
+
+void EJCompressedTextureFree( EJCompressedImage * image ) {
+	free(image->file);
+	memset(image, 0, sizeof(EJCompressedImage));
+}
+
+
+// ETC1/ETC2 decoder, as specified in the appendix of the OpenGL ES 3.0 spec.
+// Blocks are 4x4 pixels; the 32 low bits of a color block hold the 2 bit
+// index of each pixel, in column major order, split into its MSB and LSB.
+
+static const int EJETCModifiers[8][2] = {
+	{2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}
+};
+
+static const int EJETCDistances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+static const int EJEACModifiers[16][8] = {
+	{-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12},
+	{-2, -5, -8, -13, 1, 4, 7, 12}, {-2, -4, -6, -13, 1, 3, 5, 12},
+	{-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10},
+	{-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10},
+	{-2, -6, -8, -10, 1, 5, 7, 9}, {-2, -5, -8, -10, 1, 4, 7, 9},
+	{-2, -4, -8, -10, 1, 3, 7, 9}, {-2, -5, -7, -10, 1, 4, 6, 9},
+	{-3, -4, -7, -10, 2, 3, 6, 9}, {-1, -2, -3, -10, 0, 1, 2, 9},
+	{-4, -6, -8, -9, 3, 5, 7, 8}, {-3, -5, -7, -9, 2, 4, 6, 8}
+};
+
+static inline unsigned char EJETCClamp( int value ) {
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline int EJETCExtend4( unsigned int value ) { return (value << 4) | value; }
+static inline int EJETCExtend5( unsigned int value ) { return (value << 3) | (value >> 2); }
+static inline int EJETCExtend6( unsigned int value ) { return (value << 2) | (value >> 4); }
+static inline int EJETCExtend7( unsigned int value ) { return (value << 1) | (value >> 6); }
+
+static inline unsigned int EJETCBits( unsigned int word, int high, int low ) {
+	return (word >> low) & ((1u << (high - low + 1)) - 1);
+}
+
+static inline int EJETCPixelIndex( unsigned int indices, int x, int y ) {
+	int i = x * 4 + y;
+	return (((indices >> (16 + i)) & 1) << 1) | ((indices >> i) & 1);
+}
+
+static void EJETCSetPixel( unsigned char * block, int x, int y, int r, int g, int b, int a ) {
+	unsigned char * p = &block[(y * 4 + x) * 4];
+	p[0] = EJETCClamp(r);
+	p[1] = EJETCClamp(g);
+	p[2] = EJETCClamp(b);
+	p[3] = a;
+}
+
+// Decodes an 8 byte color block into 4x4 RGBA pixels. With punchthrough
+// alpha, the differential bit is the opaque bit instead and there is no
+// individual mode.
+static void EJETCDecodeColorBlock( const unsigned char * data, unsigned char * block, bool etc2, bool punchthrough ) {
+	unsigned int high = ((unsigned int)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+	unsigned int indices = ((unsigned int)data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+
+	bool diff = EJETCBits(high, 1, 1) != 0;
+	bool opaque = true;
+	if( punchthrough ) {
+		opaque = diff;
+		diff = true;
+	}
+
+	int base[2][3];
+	if( !diff ) {
+		// Individual mode: two 4 bit colors
+		for( int c = 0; c < 3; c++ ) {
+			base[0][c] = EJETCExtend4(EJETCBits(high, 31 - c * 8, 28 - c * 8));
+			base[1][c] = EJETCExtend4(EJETCBits(high, 27 - c * 8, 24 - c * 8));
+		}
+	}
+	else {
+		// Differential mode: a 5 bit color and a signed 3 bit delta for the
+		// second one. In ETC2, an overflowing delta selects another mode.
+		int first[3], second[3];
+		for( int c = 0; c < 3; c++ ) {
+			first[c] = EJETCBits(high, 31 - c * 8, 27 - c * 8);
+			int delta = EJETCBits(high, 26 - c * 8, 24 - c * 8);
+			second[c] = first[c] + (delta >= 4 ? delta - 8 : delta);
+		}
+
+		if( etc2 && (second[0] < 0 || second[0] > 31) ) {
+			// T mode: one 4 bit color and another with a distance to either side
+			int c0[3] = {
+				EJETCExtend4((EJETCBits(high, 28, 27) << 2) | EJETCBits(high, 25, 24)),
+				EJETCExtend4(EJETCBits(high, 23, 20)),
+				EJETCExtend4(EJETCBits(high, 19, 16))
+			};
+			int c1[3] = {
+				EJETCExtend4(EJETCBits(high, 15, 12)),
+				EJETCExtend4(EJETCBits(high, 11, 8)),
+				EJETCExtend4(EJETCBits(high, 7, 4))
+			};
+			int d = EJETCDistances[(EJETCBits(high, 3, 2) << 1) | EJETCBits(high, 0, 0)];
+			int paint[4][3];
+			for( int c = 0; c < 3; c++ ) {
+				paint[0][c] = c0[c];
+				paint[1][c] = c1[c] + d;
+				paint[2][c] = c1[c];
+				paint[3][c] = c1[c] - d;
+			}
+			for( int y = 0; y < 4; y++ ) {
+				for( int x = 0; x < 4; x++ ) {
+					int i = EJETCPixelIndex(indices, x, y);
+					if( !opaque && i == 2 ) { EJETCSetPixel(block, x, y, 0, 0, 0, 0); continue; }
+					EJETCSetPixel(block, x, y, paint[i][0], paint[i][1], paint[i][2], 255);
+				}
+			}
+			return;
+		}
+		else if( etc2 && (second[1] < 0 || second[1] > 31) ) {
+			// H mode: two 4 bit colors, each with a distance to either side
+			int c0[3] = {
+				EJETCExtend4(EJETCBits(high, 30, 27)),
+				EJETCExtend4((EJETCBits(high, 26, 24) << 1) | EJETCBits(high, 20, 20)),
+				EJETCExtend4((EJETCBits(high, 19, 19) << 3) | EJETCBits(high, 17, 15))
+			};
+			int c1[3] = {
+				EJETCExtend4(EJETCBits(high, 14, 11)),
+				EJETCExtend4(EJETCBits(high, 10, 7)),
+				EJETCExtend4(EJETCBits(high, 6, 3))
+			};
+
+			// The LSB of the distance index is the order of the two colors
+			unsigned int v0 = (EJETCBits(high, 30, 27) << 8) | (((EJETCBits(high, 26, 24) << 1) | EJETCBits(high, 20, 20)) << 4) | ((EJETCBits(high, 19, 19) << 3) | EJETCBits(high, 17, 15));
+			unsigned int v1 = (EJETCBits(high, 14, 11) << 8) | (EJETCBits(high, 10, 7) << 4) | EJETCBits(high, 6, 3);
+			int d = EJETCDistances[(EJETCBits(high, 2, 2) << 2) | (EJETCBits(high, 0, 0) << 1) | (v0 >= v1 ? 1 : 0)];
+			int paint[4][3];
+			for( int c = 0; c < 3; c++ ) {
+				paint[0][c] = c0[c] + d;
+				paint[1][c] = c0[c] - d;
+				paint[2][c] = c1[c] + d;
+				paint[3][c] = c1[c] - d;
+			}
+			for( int y = 0; y < 4; y++ ) {
+				for( int x = 0; x < 4; x++ ) {
+					int i = EJETCPixelIndex(indices, x, y);
+					if( !opaque && i == 2 ) { EJETCSetPixel(block, x, y, 0, 0, 0, 0); continue; }
+					EJETCSetPixel(block, x, y, paint[i][0], paint[i][1], paint[i][2], 255);
+				}
+			}
+			return;
+		}
+		else if( etc2 && (second[2] < 0 || second[2] > 31) ) {
+			// Planar mode: origin, horizontal and vertical color, interpolated;
+			// uses the index bits as well
+			int o[3] = {
+				EJETCExtend6(EJETCBits(high, 30, 25)),
+				EJETCExtend7((EJETCBits(high, 24, 24) << 6) | EJETCBits(high, 22, 17)),
+				EJETCExtend6((EJETCBits(high, 16, 16) << 5) | (EJETCBits(high, 12, 11) << 3) | EJETCBits(high, 9, 7))
+			};
+			int h[3] = {
+				EJETCExtend6((EJETCBits(high, 6, 2) << 1) | EJETCBits(high, 0, 0)),
+				EJETCExtend7(EJETCBits(indices, 31, 25)),
+				EJETCExtend6(EJETCBits(indices, 24, 19))
+			};
+			int v[3] = {
+				EJETCExtend6(EJETCBits(indices, 18, 13)),
+				EJETCExtend7(EJETCBits(indices, 12, 6)),
+				EJETCExtend6(EJETCBits(indices, 5, 0))
+			};
+			for( int y = 0; y < 4; y++ ) {
+				for( int x = 0; x < 4; x++ ) {
+					EJETCSetPixel(block, x, y,
+						(x * (h[0] - o[0]) + y * (v[0] - o[0]) + 4 * o[0] + 2) >> 2,
+						(x * (h[1] - o[1]) + y * (v[1] - o[1]) + 4 * o[1] + 2) >> 2,
+						(x * (h[2] - o[2]) + y * (v[2] - o[2]) + 4 * o[2] + 2) >> 2,
+						255
+					);
+				}
+			}
+			return;
+		}
+
+		for( int c = 0; c < 3; c++ ) {
+			base[0][c] = EJETCExtend5(first[c]);
+			base[1][c] = EJETCExtend5(second[c] & 31);
+		}
+	}
+
+	// Individual and differential mode: each half of the block modulates its
+	// base color with one row of the modifier table
+	const int * tables[2] = {
+		EJETCModifiers[EJETCBits(high, 7, 5)],
+		EJETCModifiers[EJETCBits(high, 4, 2)]
+	};
+	bool flip = EJETCBits(high, 0, 0) != 0;
+	for( int y = 0; y < 4; y++ ) {
+		for( int x = 0; x < 4; x++ ) {
+			int half = flip ? (y >= 2) : (x >= 2);
+			int i = EJETCPixelIndex(indices, x, y);
+			if( !opaque && i == 2 ) { EJETCSetPixel(block, x, y, 0, 0, 0, 0); continue; }
+
+			// 0 and 1 add the small and large modifier, 2 and 3 subtract them;
+			// without the opaque bit the small one is 0
+			int modifier = (i & 1) ? tables[half][1] : (opaque ? tables[half][0] : 0);
+			if( i & 2 ) { modifier = -modifier; }
+			EJETCSetPixel(block, x, y, base[half][0] + modifier, base[half][1] + modifier, base[half][2] + modifier, 255);
+		}
+	}
+}
+
+// Decodes the 8 byte EAC alpha block in front of an ETC2 RGBA color block
+static void EJEACDecodeAlphaBlock( const unsigned char * data, unsigned char * block ) {
+	int base = data[0];
+	int multiplier = data[1] >> 4;
+	const int * modifiers = EJEACModifiers[data[1] & 0xf];
+
+	// 3 bit indices, column major, starting with the MSB of byte 2
+	unsigned int high = ((unsigned int)data[2] << 16) | (data[3] << 8) | data[4];
+	unsigned int low = ((unsigned int)data[5] << 16) | (data[6] << 8) | data[7];
+	for( int i = 0; i < 16; i++ ) {
+		int index = i < 8 ? (high >> (21 - i * 3)) & 7 : (low >> (21 - (i - 8) * 3)) & 7;
+		int x = i / 4, y = i % 4;
+		block[(y * 4 + x) * 4 + 3] = EJETCClamp(base + modifiers[index] * multiplier);
+	}
+}
+
+unsigned char * EJCompressedTextureDecode( const EJCompressedImage * image, unsigned int realWidth, unsigned int realHeight ) {
+	GLenum format = image->internalFormat;
+	if( !EJCompressedTextureCanDecode(format) || realWidth < image->width || realHeight < image->height ) {
+		return NULL;
+	}
+
+	unsigned char * pixels = (unsigned char *)calloc((size_t)realWidth * realHeight * 4, 1);
+	if( !pixels ) { return NULL; }
+
+	bool etc2 = (format != GL_ETC1_RGB8_OES);
+	bool punchthrough = (format == GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2);
+	bool eac = (format == GL_COMPRESSED_RGBA8_ETC2_EAC);
+
+	const unsigned char * data = image->data;
+	unsigned char block[4 * 4 * 4];
+	for( unsigned int by = 0; by < image->height; by += 4 ) {
+		for( unsigned int bx = 0; bx < image->width; bx += 4 ) {
+			if( eac ) {
+				EJETCDecodeColorBlock(data + 8, block, etc2, false);
+				EJEACDecodeAlphaBlock(data, block);
+				data += 16;
+			}
+			else {
+				EJETCDecodeColorBlock(data, block, etc2, punchthrough);
+				data += 8;
+			}
+
+			// Blocks at the right and bottom edge may be cut off
+			unsigned int w = (image->width - bx < 4) ? image->width - bx : 4;
+			unsigned int h = (image->height - by < 4) ? image->height - by : 4;
+			for( unsigned int y = 0; y < h; y++ ) {
+				memcpy(&pixels[((by + y) * realWidth + bx) * 4], &block[y * 4 * 4], w * 4);
+			}
+		}
+	}
+	return pixels;
+}
+
+void EJCompressedTextureApplyAlpha( unsigned char * pixels, const unsigned char * alphaPixels, unsigned int realWidth, unsigned int realHeight ) {
+	size_t count = (size_t)realWidth * realHeight;
+	for( size_t i = 0; i < count; i++ ) {
+		pixels[i * 4 + 3] = alphaPixels[i * 4];
+	}
+}
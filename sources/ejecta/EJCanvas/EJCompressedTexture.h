@@ -0,0 +1,98 @@
+#ifndef __EJ_COMPRESSED_TEXTURE_H__
+#define __EJ_COMPRESSED_TEXTURE_H__
+
+#include <stddef.h>
+
+#ifdef _WINDOWS
+#include <windows.h>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#else
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#endif
+
+// Block compressed texture data from PKM (ETC1, ETC2) and KTX (ETC1, ETC2,
+// ASTC) files. Parsing and the CPU decoder for ETC1/ETC2 don't touch any GL
+// state and can be used in any thread.
+
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+#ifndef GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2
+#define GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9276
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#endif
+#ifndef GL_COMPRESSED_TEXTURE_FORMATS
+#define GL_COMPRESSED_TEXTURE_FORMATS 0x86A3
+#endif
+#ifndef GL_NUM_COMPRESSED_TEXTURE_FORMATS
+#define GL_NUM_COMPRESSED_TEXTURE_FORMATS 0x86A2
+#endif
+
+// GL_COMPRESSED_RGBA_ASTC_4x4_KHR up to 12x12, in the order of the
+// EJCompressedTextureASTCBlocks table
+#define EJ_COMPRESSED_TEXTURE_ASTC_FIRST 0x93B0
+#define EJ_COMPRESSED_TEXTURE_ASTC_LAST 0x93BD
+
+// ETC1 images can't store transparency; the alpha channel is instead loaded
+// from a second ETC1 image with this suffix, e.g. sprite_alpha.pkm for
+// sprite.pkm, and sampled from its red channel
+#define EJ_COMPRESSED_TEXTURE_ALPHA_SUFFIX "_alpha"
+
+// Compressed formats the GL implementation can sample from. ETC1 data is
+// also valid ETC2 data, so it can be uploaded with ETC2 support alone.
+typedef struct {
+	bool etc1;
+	bool etc2;
+	bool astc;
+} EJCompressedTextureSupport;
+
+typedef struct {
+	GLenum internalFormat;
+	unsigned int width, height;
+	unsigned int levels;			// Mipmap levels in the file; only the first is used
+	const unsigned char * data;		// First mipmap level, points into file
+	size_t dataSize;
+	unsigned char * file;			// Owned; NULL if parsed from a caller's buffer
+} EJCompressedImage;
+
+// True for .pkm and .ktx files
+bool EJCompressedTextureIsPath( const char * path );
+
+// Path of the separate alpha image for an ETC1 image; the caller frees it
+char * EJCompressedTextureAlphaPath( const char * path );
+
+// Size of the texture data for the format, or 0 if it isn't known
+size_t EJCompressedTextureDataSize( GLenum internalFormat, unsigned int width, unsigned int height );
+
+// Whether the texture can be uploaded as is; ETC1 is uploaded as ETC2 if
+// only ETC2 is supported
+bool EJCompressedTextureIsSupported( GLenum internalFormat, EJCompressedTextureSupport support );
+GLenum EJCompressedTextureUploadFormat( GLenum internalFormat, EJCompressedTextureSupport support );
+
+// Whether the format can be decoded by EJCompressedTextureDecode()
+bool EJCompressedTextureCanDecode( GLenum internalFormat );
+
+// Parses a PKM or KTX file in memory. The image points into data, which has
+// to outlive it. Returns false if the file is invalid or the format unknown.
+bool EJCompressedTextureParse( EJCompressedImage * image, const unsigned char * data, size_t size );
+
+// Reads and parses the file; the image owns the file contents
+bool EJCompressedTextureLoad( EJCompressedImage * image, const char * path );
+void EJCompressedTextureFree( EJCompressedImage * image );
+
+// Decodes an ETC1/ETC2 image into RGBA pixels in the upper left corner of
+// a zeroed realWidth x realHeight buffer. Returns NULL for other formats.
+unsigned char * EJCompressedTextureDecode( const EJCompressedImage * image, unsigned int realWidth, unsigned int realHeight );
+
+// Copies the red channel of a decoded alpha image into the alpha channel of
+// the pixels; both have the same real size
+void EJCompressedTextureApplyAlpha( unsigned char * pixels, const unsigned char * alphaPixels, unsigned int realWidth, unsigned int realHeight );
+
+#endif // __EJ_COMPRESSED_TEXTURE_H__
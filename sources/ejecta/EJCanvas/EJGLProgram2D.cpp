@@ -1,21 +1,25 @@
 #include "EJGLProgram2D.h"
 
 #include "../EJApp.h"
+#include "EJGLState.h"
 
-EJGLProgram2D::EJGLProgram2D(): program(0), screen(0) {
+EJGLProgram2D::EJGLProgram2D(): program(0), screen(0), textureSlots(1) {
 
 }
 
 EJGLProgram2D::~EJGLProgram2D() {
 	if(program) {
-		glDeleteProgram(program);
+		EJGLState::getInstance()->deleteProgram(program);
 	}
 }
 
-bool EJGLProgram2D::initWithVertexShader(NSString *vertexShaderFile, NSString *fragmentShaderFile) {
+bool EJGLProgram2D::initWithVertexShader(NSString *vertexShaderFile, NSString *fragmentShaderFile, int textureSlotsp) {
+	textureSlots = textureSlotsp;
+	NSString *defines = NSString::createWithFormat("#define EJ_TEXTURE_SLOTS %d\n", textureSlots);
+	
 	program = glCreateProgram();
-	GLuint vertexShader = compileShaderFile(vertexShaderFile, GL_VERTEX_SHADER);
-	GLuint fragmentShader = compileShaderFile(fragmentShaderFile, GL_FRAGMENT_SHADER);
+	GLuint vertexShader = compileShaderFile(vertexShaderFile, GL_VERTEX_SHADER, defines);
+	GLuint fragmentShader = compileShaderFile(fragmentShaderFile, GL_FRAGMENT_SHADER, defines);
 
 	glAttachShader(program, vertexShader);
 	glAttachShader(program, fragmentShader);
@@ -39,13 +43,36 @@ void EJGLProgram2D::bindAttributeLocations() {
 	glBindAttribLocation(program, kEJGLProgram2DAttributePos, "pos");
 	glBindAttribLocation(program, kEJGLProgram2DAttributeUV, "uv");
 	glBindAttribLocation(program, kEJGLProgram2DAttributeColor, "color");
+	glBindAttribLocation(program, kEJGLProgram2DAttributeSlot, "slot");
 }
 
 void EJGLProgram2D::getUniforms() {
 	screen = glGetUniformLocation(program, "screen");
+	
+	// Assign texture unit n to the sampler textures[n] and unit 1 to the
+	// alpha texture of the alpha mask program. This only has to be done once,
+	// so restore the previously active program afterwards.
+	GLint alphaTexture = glGetUniformLocation(program, "alphaTexture");
+	if( textureSlots > 1 || alphaTexture >= 0 ) {
+		EJGLState * glState = EJGLState::getInstance();
+		GLuint currentProgram = glState->getProgram();
+		glState->useProgram(program);
+		
+		char name[16];
+		for( int i = 0; textureSlots > 1 && i < textureSlots; i++ ) {
+			snprintf(name, sizeof(name), "textures[%d]", i);
+			glState->uniform1i(glGetUniformLocation(program, name), i);
+		}
+		if( alphaTexture >= 0 ) {
+			glState->uniform1i(alphaTexture, 1);
+		}
+		if( currentProgram != EJ_GL_STATE_UNKNOWN ) {
+			glState->useProgram(currentProgram);
+		}
+	}
 }
 
-GLint EJGLProgram2D::compileShaderFile(NSString *file, GLenum type) {
+GLint EJGLProgram2D::compileShaderFile(NSString *file, GLenum type, NSString *defines) {
 	NSString *path = EJApp::instance()->pathForResource(file);
 	NSString *source = NSString::createWithContentsOfFile(path->getCString());
 	if(!source) {
@@ -53,7 +80,7 @@ GLint EJGLProgram2D::compileShaderFile(NSString *file, GLenum type) {
 		return 0;
 	}
 
-	return compileShaderSource(source, type);
+	return compileShaderSource(NSString::createWithFormat("%s%s", defines->getCString(), source->getCString()), type);
 }
 
 GLint EJGLProgram2D::compileShaderSource(NSString *source, GLenum type) {
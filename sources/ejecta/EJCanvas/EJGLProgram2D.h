@@ -13,18 +13,20 @@
 enum {
 	kEJGLProgram2DAttributePos,
 	kEJGLProgram2DAttributeUV,
-	kEJGLProgram2DAttributeColor
+	kEJGLProgram2DAttributeColor,
+	kEJGLProgram2DAttributeSlot
 };
 
 class EJGLProgram2D : public NSObject {
 private:
 	GLuint program;
 	GLuint screen;
+	int textureSlots;
 	
 	void bindAttributeLocations();
 	void getUniforms();
 
-	static GLint compileShaderFile(NSString *file, GLenum type);
+	static GLint compileShaderFile(NSString *file, GLenum type, NSString *defines);
 	static GLint compileShaderSource(NSString *source, GLenum type);
 	static void linkProgram(GLuint program);
 
@@ -32,11 +34,15 @@ public:
 	EJGLProgram2D();
 	~EJGLProgram2D();
 
-	bool initWithVertexShader(NSString *vertexShaderFile, NSString *fragmentShaderFile);
+	bool initWithVertexShader(NSString *vertexShaderFile, NSString *fragmentShaderFile, int textureSlots = 1);
 
 	GLuint getProgram() const { return program; }
 
 	GLuint getScreen() const { return screen; }
+
+	// Number of texture units sampled by this program; more than one for the
+	// multi texture program, which picks the unit through the vertex slot
+	int getTextureSlots() const { return textureSlots; }
 	//TODO: const GLuint getTranslate() { return translate; }
 };
 
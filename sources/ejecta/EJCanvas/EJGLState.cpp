@@ -0,0 +1,540 @@
+#include "EJGLState.h"
+#include <string.h>
+#include <stdlib.h>
+#include "../EJCocoa/support/nsMacros.h"
+
+EJGLState *EJGLState::instance = NULL;
+
+EJGLState::EJGLState() :
+	maxTextureSize(0),
+	maxTextureImageUnits(0),
+	npotSupport(-1),
+	compressedSupportQueried(false),
+	validationEnabled(EJ_GL_STATE_VALIDATE)
+{
+	invalidate();
+}
+
+EJGLState::~EJGLState() {
+	instance = NULL;
+}
+
+EJGLState *EJGLState::getInstance() {
+	if( instance == NULL ) {
+		instance = new EJGLState();
+	}
+	return instance;
+}
+
+void EJGLState::invalidate() {
+	// Forget everything; the next call for each piece of state goes through
+	// to GL. Needed whenever GL state was changed behind our back.
+	activeTextureUnit = EJ_GL_STATE_UNKNOWN;
+	for( int i = 0; i < EJ_GL_STATE_MAX_TEXTURE_UNITS; i++ ) {
+		boundTextures[i] = EJ_GL_STATE_UNKNOWN;
+	}
+	program = EJ_GL_STATE_UNKNOWN;
+	blendSource = blendDestination = EJ_GL_STATE_UNKNOWN;
+	framebuffer = renderbuffer = EJ_GL_STATE_UNKNOWN;
+	for( int i = 0; i < kEJGLStateCapCount; i++ ) {
+		caps[i] = -1;
+	}
+
+	depthFunc = EJ_GL_STATE_UNKNOWN;
+	depthWriteMask = -1;
+	depthRange = -1;
+	scissorBox[0] = scissorBox[1] = scissorBox[2] = scissorBox[3] = -1;
+	colorWriteMask = -1;
+	stencilFunction = EJ_GL_STATE_UNKNOWN;
+	stencilRef = 0;
+	stencilValueMask = 0;
+	for( int i = 0; i < 2; i++ ) {
+		stencilFail[i] = stencilDepthFail[i] = stencilDepthPass[i] = EJ_GL_STATE_UNKNOWN;
+	}
+	stencilWriteMask = EJ_GL_STATE_UNKNOWN;
+	unpackAlignment = -1;
+
+	uniforms.clear();
+}
+
+int EJGLState::capIndex(GLenum cap) {
+	switch( cap ) {
+		case GL_BLEND: return kEJGLStateCapBlend;
+		case GL_DEPTH_TEST: return kEJGLStateCapDepthTest;
+		case GL_STENCIL_TEST: return kEJGLStateCapStencilTest;
+		case GL_CULL_FACE: return kEJGLStateCapCullFace;
+		case GL_SCISSOR_TEST: return kEJGLStateCapScissorTest;
+		case GL_DITHER: return kEJGLStateCapDither;
+		default: return -1;
+	}
+}
+
+
+// Textures
+
+void EJGLState::activeTexture(GLenum unit) {
+	if( unit == activeTextureUnit ) { return; }
+	activeTextureUnit = unit;
+	glActiveTexture(unit);
+}
+
+void EJGLState::bindTexture(GLuint texture) {
+	int unit = activeTextureUnit - GL_TEXTURE0;
+	if( activeTextureUnit == EJ_GL_STATE_UNKNOWN || unit < 0 || unit >= EJ_GL_STATE_MAX_TEXTURE_UNITS ) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		return;
+	}
+
+	if( boundTextures[unit] == texture ) { return; }
+	boundTextures[unit] = texture;
+	glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+GLuint EJGLState::getBoundTexture() const {
+	int unit = activeTextureUnit - GL_TEXTURE0;
+	if( activeTextureUnit == EJ_GL_STATE_UNKNOWN || unit < 0 || unit >= EJ_GL_STATE_MAX_TEXTURE_UNITS ) {
+		return EJ_GL_STATE_UNKNOWN;
+	}
+	return boundTextures[unit];
+}
+
+void EJGLState::deleteTexture(GLuint texture) {
+	if( !texture ) { return; }
+
+	// Deleting a texture unbinds it from all units
+	for( int i = 0; i < EJ_GL_STATE_MAX_TEXTURE_UNITS; i++ ) {
+		if( boundTextures[i] == texture ) {
+			boundTextures[i] = 0;
+		}
+	}
+	glDeleteTextures(1, &texture);
+}
+
+
+// Programs and uniforms
+
+void EJGLState::useProgram(GLuint newProgram) {
+	if( newProgram == program ) { return; }
+	program = newProgram;
+	glUseProgram(newProgram);
+}
+
+GLuint EJGLState::getProgram() const {
+	return program;
+}
+
+void EJGLState::deleteProgram(GLuint oldProgram) {
+	if( !oldProgram ) { return; }
+
+	uniforms.erase(oldProgram);
+	if( program == oldProgram ) {
+		program = 0;
+	}
+	glDeleteProgram(oldProgram);
+}
+
+bool EJGLState::setUniform(GLint location, int count, const GLfloat * values) {
+	// Uniforms are stored per program; returns true if the value changed
+	if( location < 0 || program == EJ_GL_STATE_UNKNOWN ) { return true; }
+
+	EJGLStateUniformMap &programUniforms = uniforms[program];
+	EJGLStateUniformMap::iterator it = programUniforms.find(location);
+	if( it != programUniforms.end() && it->second.count == count ) {
+		bool same = true;
+		for( int i = 0; i < count && same; i++ ) {
+			same = (it->second.values[i] == values[i]);
+		}
+		if( same ) { return false; }
+	}
+
+	EJGLStateUniform uniform;
+	uniform.count = count;
+	for( int i = 0; i < count; i++ ) {
+		uniform.values[i] = values[i];
+	}
+	programUniforms[location] = uniform;
+	return true;
+}
+
+void EJGLState::uniform1i(GLint location, GLint value) {
+	GLfloat values[1] = { (GLfloat)value };
+	if( setUniform(location, 1, values) ) {
+		glUniform1i(location, value);
+	}
+}
+
+void EJGLState::uniform2f(GLint location, GLfloat x, GLfloat y) {
+	GLfloat values[2] = { x, y };
+	if( setUniform(location, 2, values) ) {
+		glUniform2f(location, x, y);
+	}
+}
+
+
+// Blending
+
+void EJGLState::blendFunc(GLenum source, GLenum destination) {
+	if( source == blendSource && destination == blendDestination ) { return; }
+	blendSource = source;
+	blendDestination = destination;
+	glBlendFunc(source, destination);
+}
+
+
+// Frame- and renderbuffers
+
+void EJGLState::bindFramebuffer(GLuint newFramebuffer) {
+	if( newFramebuffer == framebuffer ) { return; }
+	framebuffer = newFramebuffer;
+#ifdef _WINDOWS
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, newFramebuffer);
+#else
+	glBindFramebuffer(GL_FRAMEBUFFER, newFramebuffer);
+#endif
+}
+
+GLuint EJGLState::getFramebuffer() const {
+	return framebuffer;
+}
+
+void EJGLState::bindRenderbuffer(GLuint newRenderbuffer) {
+	if( newRenderbuffer == renderbuffer ) { return; }
+	renderbuffer = newRenderbuffer;
+#ifdef _WINDOWS
+	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, newRenderbuffer);
+#else
+	glBindRenderbuffer(GL_RENDERBUFFER, newRenderbuffer);
+#endif
+}
+
+GLuint EJGLState::getRenderbuffer() const {
+	return renderbuffer;
+}
+
+void EJGLState::deleteFramebuffer(GLuint oldFramebuffer) {
+	if( !oldFramebuffer ) { return; }
+	if( framebuffer == oldFramebuffer ) {
+		framebuffer = 0;
+	}
+#ifdef _WINDOWS
+	glDeleteFramebuffersEXT(1, &oldFramebuffer);
+#else
+	glDeleteFramebuffers(1, &oldFramebuffer);
+#endif
+}
+
+void EJGLState::deleteRenderbuffer(GLuint oldRenderbuffer) {
+	if( !oldRenderbuffer ) { return; }
+	if( renderbuffer == oldRenderbuffer ) {
+		renderbuffer = 0;
+	}
+#ifdef _WINDOWS
+	glDeleteRenderbuffersEXT(1, &oldRenderbuffer);
+#else
+	glDeleteRenderbuffers(1, &oldRenderbuffer);
+#endif
+}
+
+
+// Capabilities
+
+void EJGLState::enable(GLenum cap) {
+	int index = capIndex(cap);
+	if( index != -1 ) {
+		if( caps[index] == 1 ) { return; }
+		caps[index] = 1;
+	}
+	glEnable(cap);
+}
+
+void EJGLState::disable(GLenum cap) {
+	int index = capIndex(cap);
+	if( index != -1 ) {
+		if( caps[index] == 0 ) { return; }
+		caps[index] = 0;
+	}
+	glDisable(cap);
+}
+
+
+// Depth and stencil
+
+void EJGLState::setDepthFunc(GLenum func) {
+	if( func == depthFunc ) { return; }
+	depthFunc = func;
+	glDepthFunc(func);
+}
+
+void EJGLState::setDepthMask(GLboolean mask) {
+	if( depthWriteMask == (mask ? 1 : 0) ) { return; }
+	depthWriteMask = mask ? 1 : 0;
+	glDepthMask(mask);
+}
+
+void EJGLState::setDepthRange(GLfloat depth) {
+	// Collapsing the range to a single value makes all geometry write and test
+	// with that depth, without having to pass it to the shaders
+	if( depth == depthRange ) { return; }
+	depthRange = depth;
+#ifdef _WINDOWS
+	glDepthRange(depth, depth);
+#else
+	glDepthRangef(depth, depth);
+#endif
+}
+
+void EJGLState::setScissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+	if( x == scissorBox[0] && y == scissorBox[1] && width == scissorBox[2] && height == scissorBox[3] ) { return; }
+	scissorBox[0] = x;
+	scissorBox[1] = y;
+	scissorBox[2] = width;
+	scissorBox[3] = height;
+	glScissor(x, y, width, height);
+}
+
+void EJGLState::setColorMask(GLboolean mask) {
+	if( colorWriteMask == (mask ? 1 : 0) ) { return; }
+	colorWriteMask = mask ? 1 : 0;
+	glColorMask(mask, mask, mask, mask);
+}
+
+void EJGLState::setStencilFunc(GLenum func, GLint ref, GLuint mask) {
+	if( func == stencilFunction && ref == stencilRef && mask == stencilValueMask ) { return; }
+	stencilFunction = func;
+	stencilRef = ref;
+	stencilValueMask = mask;
+	glStencilFunc(func, ref, mask);
+}
+
+void EJGLState::setStencilOp(GLenum fail, GLenum depthFail, GLenum depthPass) {
+	bool same = true;
+	for( int i = 0; i < 2; i++ ) {
+		same = same && fail == stencilFail[i] && depthFail == stencilDepthFail[i] && depthPass == stencilDepthPass[i];
+		stencilFail[i] = fail;
+		stencilDepthFail[i] = depthFail;
+		stencilDepthPass[i] = depthPass;
+	}
+	if( same ) { return; }
+	glStencilOp(fail, depthFail, depthPass);
+}
+
+void EJGLState::setStencilOpSeparate(GLenum face, GLenum fail, GLenum depthFail, GLenum depthPass) {
+	int i = (face == GL_BACK) ? 1 : 0;
+	if( face == GL_FRONT_AND_BACK ) {
+		setStencilOp(fail, depthFail, depthPass);
+		return;
+	}
+	if( fail == stencilFail[i] && depthFail == stencilDepthFail[i] && depthPass == stencilDepthPass[i] ) { return; }
+	stencilFail[i] = fail;
+	stencilDepthFail[i] = depthFail;
+	stencilDepthPass[i] = depthPass;
+	glStencilOpSeparate(face, fail, depthFail, depthPass);
+}
+
+void EJGLState::setStencilMask(GLuint mask) {
+	if( mask == stencilWriteMask ) { return; }
+	stencilWriteMask = mask;
+	glStencilMask(mask);
+}
+
+void EJGLState::setUnpackAlignment(GLint alignment) {
+	if( alignment == unpackAlignment ) { return; }
+	unpackAlignment = alignment;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+}
+
+
+// Limits; these never change, so they are only queried once
+
+GLint EJGLState::getMaxTextureSize() {
+	if( !maxTextureSize ) {
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	}
+	return maxTextureSize;
+}
+
+GLint EJGLState::getMaxTextureImageUnits() {
+	if( !maxTextureImageUnits ) {
+		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &maxTextureImageUnits);
+	}
+	return maxTextureImageUnits;
+}
+
+EJGLNPOTSupport EJGLState::getNPOTSupport() {
+	if( npotSupport < 0 ) {
+#ifdef _WINDOWS
+		npotSupport = (GLEW_VERSION_2_0 || GLEW_ARB_texture_non_power_of_two)
+			? kEJGLNPOTFull
+			: kEJGLNPOTNone;
+#else
+		// Every GLES2 implementation supports the limited form
+		const char * extensions = (const char *)glGetString(GL_EXTENSIONS);
+		const char * version = (const char *)glGetString(GL_VERSION);
+		bool full = (
+			(extensions && strstr(extensions, "GL_OES_texture_npot")) ||
+			(extensions && strstr(extensions, "GL_ARB_texture_non_power_of_two")) ||
+			(version && strncmp(version, "OpenGL ES 3", 11) == 0)
+		);
+		npotSupport = full ? kEJGLNPOTFull : kEJGLNPOTLimited;
+#endif
+		static const char * names[] = {"none", "limited", "full"};
+		NSLOG("EJGLState: NPOT texture support: %s", names[npotSupport]);
+	}
+	return (EJGLNPOTSupport)npotSupport;
+}
+
+EJCompressedTextureSupport EJGLState::getCompressedTextureSupport() {
+	if( !compressedSupportQueried ) {
+		memset(&compressedSupport, 0, sizeof(compressedSupport));
+		const char * extensions = (const char *)glGetString(GL_EXTENSIONS);
+#ifdef _WINDOWS
+		// The bundled GLEW predates both extensions, so check the string
+		compressedSupport.etc2 = extensions && strstr(extensions, "GL_ARB_ES3_compatibility");
+		compressedSupport.astc = extensions && strstr(extensions, "GL_KHR_texture_compression_astc_ldr");
+#else
+		// GLES3 implementations have to support ETC2, even in a GLES2 context,
+		// but not all of them list it in the extension string
+		const char * version = (const char *)glGetString(GL_VERSION);
+		compressedSupport.etc1 = extensions && strstr(extensions, "GL_OES_compressed_ETC1_RGB8_texture");
+		compressedSupport.etc2 = version && strncmp(version, "OpenGL ES 3", 11) == 0;
+		compressedSupport.astc = extensions && strstr(extensions, "GL_KHR_texture_compression_astc_ldr");
+#endif
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+		if( count > 0 ) {
+			GLint * formats = (GLint *)malloc(count * sizeof(GLint));
+			glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats);
+			for( int i = 0; i < count; i++ ) {
+				if( formats[i] == GL_ETC1_RGB8_OES ) { compressedSupport.etc1 = true; }
+				if( formats[i] == GL_COMPRESSED_RGBA8_ETC2_EAC ) { compressedSupport.etc2 = true; }
+				if( formats[i] == EJ_COMPRESSED_TEXTURE_ASTC_FIRST ) { compressedSupport.astc = true; }
+			}
+			free(formats);
+		}
+		compressedSupportQueried = true;
+		NSLOG("EJGLState: compressed textures: ETC1 %d, ETC2 %d, ASTC %d",
+			compressedSupport.etc1, compressedSupport.etc2, compressedSupport.astc);
+	}
+	return compressedSupport;
+}
+
+
+// Debug validation
+
+#define EJ_GL_STATE_CHECK(NAME, SHADOW, REAL) \
+	if( (GLuint)(SHADOW) != EJ_GL_STATE_UNKNOWN && (GLuint)(SHADOW) != (GLuint)(REAL) ) { \
+		NSLOG("EJGLState: %s is 0x%x, but shadowed as 0x%x", NAME, (GLuint)(REAL), (GLuint)(SHADOW)); \
+		errors++; \
+	}
+
+void EJGLState::validate() {
+	if( !validationEnabled ) { return; }
+
+	int errors = 0;
+	GLint value = 0;
+
+	GLint realActiveTexture = 0;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &realActiveTexture);
+	EJ_GL_STATE_CHECK("GL_ACTIVE_TEXTURE", activeTextureUnit, realActiveTexture);
+
+	GLint units = getMaxTextureImageUnits();
+	if( units > EJ_GL_STATE_MAX_TEXTURE_UNITS ) { units = EJ_GL_STATE_MAX_TEXTURE_UNITS; }
+	for( int i = 0; i < units; i++ ) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &value);
+		EJ_GL_STATE_CHECK("GL_TEXTURE_BINDING_2D", boundTextures[i], value);
+	}
+	glActiveTexture(realActiveTexture);
+
+	glGetIntegerv(GL_CURRENT_PROGRAM, &value);
+	EJ_GL_STATE_CHECK("GL_CURRENT_PROGRAM", program, value);
+	glGetIntegerv(GL_BLEND_SRC_RGB, &value);
+	EJ_GL_STATE_CHECK("GL_BLEND_SRC_RGB", blendSource, value);
+	glGetIntegerv(GL_BLEND_DST_RGB, &value);
+	EJ_GL_STATE_CHECK("GL_BLEND_DST_RGB", blendDestination, value);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &value);
+	EJ_GL_STATE_CHECK("GL_FRAMEBUFFER_BINDING", framebuffer, value);
+	glGetIntegerv(GL_RENDERBUFFER_BINDING, &value);
+	EJ_GL_STATE_CHECK("GL_RENDERBUFFER_BINDING", renderbuffer, value);
+
+	static const struct { GLenum cap; const char * name; } capNames[] = {
+		{GL_BLEND, "GL_BLEND"},
+		{GL_DEPTH_TEST, "GL_DEPTH_TEST"},
+		{GL_STENCIL_TEST, "GL_STENCIL_TEST"},
+		{GL_CULL_FACE, "GL_CULL_FACE"},
+		{GL_SCISSOR_TEST, "GL_SCISSOR_TEST"},
+		{GL_DITHER, "GL_DITHER"}
+	};
+	for( int i = 0; i < kEJGLStateCapCount; i++ ) {
+		int shadow = caps[capIndex(capNames[i].cap)];
+		EJ_GL_STATE_CHECK(capNames[i].name, shadow, glIsEnabled(capNames[i].cap) ? 1 : 0);
+	}
+
+	glGetIntegerv(GL_DEPTH_FUNC, &value);
+	EJ_GL_STATE_CHECK("GL_DEPTH_FUNC", depthFunc, value);
+	GLboolean mask[4];
+	glGetBooleanv(GL_DEPTH_WRITEMASK, mask);
+	EJ_GL_STATE_CHECK("GL_DEPTH_WRITEMASK", depthWriteMask, mask[0] ? 1 : 0);
+	GLfloat range[2];
+	glGetFloatv(GL_DEPTH_RANGE, range);
+	if( depthRange >= 0 && depthRange != range[0] ) {
+		NSLOG("EJGLState: GL_DEPTH_RANGE is %f, but shadowed as %f", range[0], depthRange);
+		errors++;
+	}
+	GLint box[4];
+	glGetIntegerv(GL_SCISSOR_BOX, box);
+	for( int i = 0; i < 4; i++ ) {
+		EJ_GL_STATE_CHECK("GL_SCISSOR_BOX", scissorBox[i], box[i]);
+	}
+	glGetBooleanv(GL_COLOR_WRITEMASK, mask);
+	EJ_GL_STATE_CHECK("GL_COLOR_WRITEMASK", colorWriteMask, mask[0] ? 1 : 0);
+
+	if( stencilFunction != EJ_GL_STATE_UNKNOWN ) {
+		glGetIntegerv(GL_STENCIL_FUNC, &value);
+		EJ_GL_STATE_CHECK("GL_STENCIL_FUNC", stencilFunction, value);
+		glGetIntegerv(GL_STENCIL_REF, &value);
+		EJ_GL_STATE_CHECK("GL_STENCIL_REF", stencilRef, value);
+		glGetIntegerv(GL_STENCIL_VALUE_MASK, &value);
+		EJ_GL_STATE_CHECK("GL_STENCIL_VALUE_MASK", stencilValueMask & 0xff, value & 0xff);
+	}
+	glGetIntegerv(GL_STENCIL_FAIL, &value);
+	EJ_GL_STATE_CHECK("GL_STENCIL_FAIL", stencilFail[0], value);
+	glGetIntegerv(GL_STENCIL_PASS_DEPTH_FAIL, &value);
+	EJ_GL_STATE_CHECK("GL_STENCIL_PASS_DEPTH_FAIL", stencilDepthFail[0], value);
+	glGetIntegerv(GL_STENCIL_PASS_DEPTH_PASS, &value);
+	EJ_GL_STATE_CHECK("GL_STENCIL_PASS_DEPTH_PASS", stencilDepthPass[0], value);
+	glGetIntegerv(GL_STENCIL_BACK_FAIL, &value);
+	EJ_GL_STATE_CHECK("GL_STENCIL_BACK_FAIL", stencilFail[1], value);
+	glGetIntegerv(GL_STENCIL_BACK_PASS_DEPTH_FAIL, &value);
+	EJ_GL_STATE_CHECK("GL_STENCIL_BACK_PASS_DEPTH_FAIL", stencilDepthFail[1], value);
+	glGetIntegerv(GL_STENCIL_BACK_PASS_DEPTH_PASS, &value);
+	EJ_GL_STATE_CHECK("GL_STENCIL_BACK_PASS_DEPTH_PASS", stencilDepthPass[1], value);
+	if( stencilWriteMask != EJ_GL_STATE_UNKNOWN ) {
+		glGetIntegerv(GL_STENCIL_WRITEMASK, &value);
+		EJ_GL_STATE_CHECK("GL_STENCIL_WRITEMASK", stencilWriteMask & 0xff, value & 0xff);
+	}
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &value);
+	EJ_GL_STATE_CHECK("GL_UNPACK_ALIGNMENT", unpackAlignment, value);
+
+	std::map<GLuint, EJGLStateUniformMap>::iterator programUniforms = uniforms.find(program);
+	if( programUniforms != uniforms.end() ) {
+		for( EJGLStateUniformMap::iterator it = programUniforms->second.begin(); it != programUniforms->second.end(); ++it ) {
+			GLfloat values[16];
+			glGetUniformfv(program, it->first, values);
+			for( int i = 0; i < it->second.count; i++ ) {
+				if( values[i] != it->second.values[i] ) {
+					NSLOG("EJGLState: uniform %d of program %d is %f, but shadowed as %f", it->first, program, values[i], it->second.values[i]);
+					errors++;
+				}
+			}
+		}
+	}
+
+	// Continue with the real state, so a single mismatch isn't reported
+	// over and over again
+	if( errors ) {
+		invalidate();
+	}
+}
+
+#undef EJ_GL_STATE_CHECK
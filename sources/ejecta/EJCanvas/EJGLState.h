@@ -0,0 +1,142 @@
+#ifndef __EJ_GL_STATE_H__
+#define __EJ_GL_STATE_H__
+
+#ifdef _WINDOWS
+#include <windows.h>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#else
+#include <GLES2/gl2.h>
+#endif
+
+#include <map>
+#include "../EJCocoa/NSObject.h"
+#include "EJCompressedTexture.h"
+
+// Number of texture units whose bindings are shadowed; must not be smaller
+// than EJ_OPENGL_MAX_TEXTURE_SLOTS
+#define EJ_GL_STATE_MAX_TEXTURE_UNITS 8
+
+// Set to 1 to compare the shadow state against the real GL state once per
+// frame. Can also be switched on at runtime through Ejecta.glStateValidation.
+#ifndef EJ_GL_STATE_VALIDATE
+#define EJ_GL_STATE_VALIDATE 0
+#endif
+
+// Marks a shadowed value that isn't known, e.g. after invalidate()
+#define EJ_GL_STATE_UNKNOWN 0xffffffff
+
+typedef enum {
+	kEJGLStateCapBlend,
+	kEJGLStateCapDepthTest,
+	kEJGLStateCapStencilTest,
+	kEJGLStateCapCullFace,
+	kEJGLStateCapScissorTest,
+	kEJGLStateCapDither,
+	kEJGLStateCapCount
+} EJGLStateCap;
+
+// How well non power of two texture sizes are supported
+typedef enum {
+	kEJGLNPOTNone,		// Textures have to be padded to a power of two
+	kEJGLNPOTLimited,	// Any size with CLAMP_TO_EDGE and without mipmaps (GLES2)
+	kEJGLNPOTFull		// Any size, including GL_REPEAT and mipmaps
+} EJGLNPOTSupport;
+
+typedef struct {
+	int count;
+	GLfloat values[4];
+} EJGLStateUniform;
+
+typedef std::map<GLint, EJGLStateUniform> EJGLStateUniformMap;
+
+// Shadows the GL state that is changed by the canvas implementation, so
+// that redundant state changes can be filtered and bindings can be read
+// back without a synchronous glGet* call. All GL calls that change any of
+// the tracked state have to go through this class.
+class EJGLState : public NSObject {
+	GLenum activeTextureUnit;
+	GLuint boundTextures[EJ_GL_STATE_MAX_TEXTURE_UNITS];
+	GLuint program;
+	GLenum blendSource, blendDestination;
+	GLuint framebuffer, renderbuffer;
+	int caps[kEJGLStateCapCount];
+
+	GLenum depthFunc;
+	int depthWriteMask;
+	GLfloat depthRange; // near and far are always the same
+	GLint scissorBox[4];
+	int colorWriteMask;
+	GLenum stencilFunction;
+	GLint stencilRef;
+	GLuint stencilValueMask;
+	GLenum stencilFail[2], stencilDepthFail[2], stencilDepthPass[2]; // front, back
+	GLuint stencilWriteMask;
+	GLint unpackAlignment;
+
+	std::map<GLuint, EJGLStateUniformMap> uniforms;
+
+	GLint maxTextureSize;
+	GLint maxTextureImageUnits;
+	int npotSupport;
+	bool compressedSupportQueried;
+	EJCompressedTextureSupport compressedSupport;
+
+	static EJGLState *instance;
+
+	EJGLState();
+
+	static int capIndex(GLenum cap);
+	bool setUniform(GLint location, int count, const GLfloat * values);
+
+public:
+	bool validationEnabled;
+
+	~EJGLState();
+
+	static EJGLState *getInstance();
+
+	void invalidate();
+	void validate();
+
+	void activeTexture(GLenum unit);
+	void bindTexture(GLuint texture);
+	GLuint getBoundTexture() const;
+	void deleteTexture(GLuint texture);
+
+	void useProgram(GLuint newProgram);
+	GLuint getProgram() const;
+	void deleteProgram(GLuint oldProgram);
+	void uniform1i(GLint location, GLint value);
+	void uniform2f(GLint location, GLfloat x, GLfloat y);
+
+	void blendFunc(GLenum source, GLenum destination);
+
+	void bindFramebuffer(GLuint newFramebuffer);
+	GLuint getFramebuffer() const;
+	void bindRenderbuffer(GLuint newRenderbuffer);
+	GLuint getRenderbuffer() const;
+	void deleteFramebuffer(GLuint oldFramebuffer);
+	void deleteRenderbuffer(GLuint oldRenderbuffer);
+
+	void enable(GLenum cap);
+	void disable(GLenum cap);
+
+	void setDepthFunc(GLenum func);
+	void setDepthMask(GLboolean mask);
+	void setDepthRange(GLfloat depth);
+	void setScissor(GLint x, GLint y, GLsizei width, GLsizei height);
+	void setColorMask(GLboolean mask);
+	void setStencilFunc(GLenum func, GLint ref, GLuint mask);
+	void setStencilOp(GLenum fail, GLenum depthFail, GLenum depthPass);
+	void setStencilOpSeparate(GLenum face, GLenum fail, GLenum depthFail, GLenum depthPass);
+	void setStencilMask(GLuint mask);
+	void setUnpackAlignment(GLint alignment);
+
+	GLint getMaxTextureSize();
+	GLint getMaxTextureImageUnits();
+	EJGLNPOTSupport getNPOTSupport();
+	EJCompressedTextureSupport getCompressedTextureSupport();
+};
+
+#endif // __EJ_GL_STATE_H__
@@ -0,0 +1,185 @@
+#include <string.h>
+#include <stdint.h>
+#include "EJGLUploadContext.h"
+
+// Returned by insertFence() if the upload thread already waited for the GPU
+#define EJ_GL_UPLOAD_FINISHED ((void *)1)
+
+#ifdef _WINDOWS
+
+#define EJ_GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define EJ_GL_ALREADY_SIGNALED 0x911A
+#define EJ_GL_CONDITION_SATISFIED 0x911C
+
+// Some drivers return small integers instead of NULL for missing functions
+static PROC EJGLUploadGetProcAddress(const char * name) {
+	PROC proc = wglGetProcAddress(name);
+	intptr_t value = (intptr_t)proc;
+	return (value >= -1 && value <= 3) ? NULL : proc;
+}
+
+EJGLUploadContext::EJGLUploadContext() :
+	deviceContext(NULL), context(NULL),
+	fenceSync(NULL), clientWaitSync(NULL), deleteSync(NULL), fences(false)
+{
+}
+
+EJGLUploadContext::~EJGLUploadContext() {
+	if( context ) {
+		wglDeleteContext(context);
+	}
+}
+
+EJGLUploadContext * EJGLUploadContext::createSharedWithCurrent() {
+	HDC currentDC = wglGetCurrentDC();
+	HGLRC currentContext = wglGetCurrentContext();
+	if( !currentDC || !currentContext ) { return NULL; }
+
+	HGLRC shared = wglCreateContext(currentDC);
+	if( !shared ) { return NULL; }
+	if( !wglShareLists(currentContext, shared) ) {
+		wglDeleteContext(shared);
+		return NULL;
+	}
+
+	EJGLUploadContext * upload = new EJGLUploadContext();
+	upload->deviceContext = currentDC;
+	upload->context = shared;
+	
+	// Function pointers from wglGetProcAddress() are only valid for contexts
+	// with the same pixel format, which the shared context has
+	const char * extensions = (const char *)glGetString(GL_EXTENSIONS);
+	if( extensions && strstr(extensions, "GL_ARB_sync") ) {
+		upload->fenceSync = (EJPFNGLFENCESYNCPROC)EJGLUploadGetProcAddress("glFenceSync");
+		upload->clientWaitSync = (EJPFNGLCLIENTWAITSYNCPROC)EJGLUploadGetProcAddress("glClientWaitSync");
+		upload->deleteSync = (EJPFNGLDELETESYNCPROC)EJGLUploadGetProcAddress("glDeleteSync");
+		upload->fences = (upload->fenceSync && upload->clientWaitSync && upload->deleteSync);
+	}
+	return upload;
+}
+
+bool EJGLUploadContext::makeCurrent() {
+	return wglMakeCurrent(deviceContext, context) != FALSE;
+}
+
+void EJGLUploadContext::clearCurrent() {
+	wglMakeCurrent(NULL, NULL);
+}
+
+void * EJGLUploadContext::insertFence() {
+	if( fences ) {
+		EJGLSync sync = fenceSync(EJ_GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if( sync ) {
+			glFlush();
+			return sync;
+		}
+	}
+	glFinish();
+	return EJ_GL_UPLOAD_FINISHED;
+}
+
+bool EJGLUploadContext::isFenceSignaled(void * fence) {
+	if( fence == EJ_GL_UPLOAD_FINISHED ) { return true; }
+	GLenum result = clientWaitSync((EJGLSync)fence, 0, 0);
+	return (result == EJ_GL_ALREADY_SIGNALED || result == EJ_GL_CONDITION_SATISFIED);
+}
+
+void EJGLUploadContext::deleteFence(void * fence) {
+	if( fence == EJ_GL_UPLOAD_FINISHED ) { return; }
+	deleteSync((EJGLSync)fence);
+}
+
+#else
+
+EJGLUploadContext::EJGLUploadContext() :
+	display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE),
+	createSync(NULL), destroySync(NULL), clientWaitSync(NULL), fences(false)
+{
+}
+
+EJGLUploadContext::~EJGLUploadContext() {
+	if( surface != EGL_NO_SURFACE ) {
+		eglDestroySurface(display, surface);
+	}
+	if( context != EGL_NO_CONTEXT ) {
+		eglDestroyContext(display, context);
+	}
+}
+
+EJGLUploadContext * EJGLUploadContext::createSharedWithCurrent() {
+	EGLDisplay display = eglGetCurrentDisplay();
+	EGLContext currentContext = eglGetCurrentContext();
+	if( display == EGL_NO_DISPLAY || currentContext == EGL_NO_CONTEXT ) { return NULL; }
+
+	// The upload context never draws; a 1x1 pbuffer is enough to make it
+	// current on implementations without surfaceless contexts
+	EGLint attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if( !eglChooseConfig(display, attribs, &config, 1, &numConfigs) || numConfigs < 1 ) {
+		return NULL;
+	}
+
+	EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+	EGLContext shared = eglCreateContext(display, config, currentContext, contextAttribs);
+	if( shared == EGL_NO_CONTEXT ) { return NULL; }
+
+	EGLint surfaceAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+	if( surface == EGL_NO_SURFACE ) {
+		eglDestroyContext(display, shared);
+		return NULL;
+	}
+
+	EJGLUploadContext * upload = new EJGLUploadContext();
+	upload->display = display;
+	upload->context = shared;
+	upload->surface = surface;
+
+	const char * extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if( extensions && strstr(extensions, "EGL_KHR_fence_sync") ) {
+		upload->createSync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+		upload->destroySync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+		upload->clientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+		upload->fences = (upload->createSync && upload->destroySync && upload->clientWaitSync);
+	}
+	return upload;
+}
+
+bool EJGLUploadContext::makeCurrent() {
+	return eglMakeCurrent(display, surface, surface, context) == EGL_TRUE;
+}
+
+void EJGLUploadContext::clearCurrent() {
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void * EJGLUploadContext::insertFence() {
+	if( fences ) {
+		EGLSyncKHR sync = createSync(display, EGL_SYNC_FENCE_KHR, NULL);
+		if( sync != EGL_NO_SYNC_KHR ) {
+			// The fence only signals once the commands were submitted
+			glFlush();
+			return sync;
+		}
+	}
+	glFinish();
+	return EJ_GL_UPLOAD_FINISHED;
+}
+
+bool EJGLUploadContext::isFenceSignaled(void * fence) {
+	if( fence == EJ_GL_UPLOAD_FINISHED ) { return true; }
+	EGLint result = clientWaitSync(display, (EGLSyncKHR)fence, 0, 0);
+	return (result == EGL_CONDITION_SATISFIED_KHR);
+}
+
+void EJGLUploadContext::deleteFence(void * fence) {
+	if( fence == EJ_GL_UPLOAD_FINISHED ) { return; }
+	destroySync(display, (EGLSyncKHR)fence);
+}
+
+#endif
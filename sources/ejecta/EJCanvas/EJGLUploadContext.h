@@ -0,0 +1,68 @@
+#ifndef __EJ_GL_UPLOAD_CONTEXT_H__
+#define __EJ_GL_UPLOAD_CONTEXT_H__
+
+#ifdef _WINDOWS
+#include <windows.h>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+// The bundled GLEW predates ARB_sync; its entry points are loaded with
+// wglGetProcAddress() instead
+typedef struct __EJGLSync * EJGLSync;
+typedef EJGLSync (APIENTRY * EJPFNGLFENCESYNCPROC)(GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRY * EJPFNGLCLIENTWAITSYNCPROC)(EJGLSync sync, GLbitfield flags, unsigned __int64 timeout);
+typedef void (APIENTRY * EJPFNGLDELETESYNCPROC)(EJGLSync sync);
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#endif
+
+// A GL context in the same share group as the canvas context, for uploading
+// textures in another thread. Wraps EGL on Android and WGL on Windows.
+//
+// Objects created in the upload context are only safe to use in the canvas
+// context once the GPU finished the commands that created them. A fence is
+// inserted after each upload and polled from the GL thread; without fence
+// support the upload thread waits with glFinish() instead.
+class EJGLUploadContext {
+#ifdef _WINDOWS
+	HDC deviceContext;
+	HGLRC context;
+	EJPFNGLFENCESYNCPROC fenceSync;
+	EJPFNGLCLIENTWAITSYNCPROC clientWaitSync;
+	EJPFNGLDELETESYNCPROC deleteSync;
+#else
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface surface;
+	PFNEGLCREATESYNCKHRPROC createSync;
+	PFNEGLDESTROYSYNCKHRPROC destroySync;
+	PFNEGLCLIENTWAITSYNCKHRPROC clientWaitSync;
+#endif
+	bool fences;
+
+	EJGLUploadContext();
+
+public:
+	~EJGLUploadContext();
+
+	// Must be called on the GL thread, with the canvas context current.
+	// Returns NULL if no shared context could be created.
+	static EJGLUploadContext * createSharedWithCurrent();
+
+	// Called once on the upload thread
+	bool makeCurrent();
+	void clearCurrent();
+
+	// Upload thread: marks the end of the commands issued so far
+	void * insertFence();
+
+	// GL thread: doesn't block
+	bool isFenceSignaled(void * fence);
+	void deleteFence(void * fence);
+
+	bool hasFences() const { return fences; }
+};
+
+#endif // __EJ_GL_UPLOAD_CONTEXT_H__
@@ -4,13 +4,15 @@
 #include "EJPath.h"
 #include "../EJCocoa/support/nsMacros.h"
 #include "EJCanvasContext.h"
-
-//Necessary for call to OpenGLES 1 functions such as glDisableClientState
-#include <GLES/gl.h>
+#include "EJGLState.h"
 
 EJPath::EJPath() :
-		transform(CGAffineTransformIdentity), 
-		stencilMask(0x1) {
+		fillQuadsValid(false),
+		fillQuadsComputed(false),
+		strokeCoverage(1),
+		strokeRowsComputed(false),
+		transform(CGAffineTransformIdentity),
+		transformKind(kEJTransformKindIdentity) {
 	reset();
 }
 
@@ -24,9 +26,21 @@ EJPath* EJPath::copyWithZone(NSZone * zone) {
 	copy->maxPos = maxPos;
 	copy->longestSubpath = longestSubpath;
 	copy->transform = transform;
+	copy->transformKind = transformKind;
 
 	copy->currentPath = currentPath;
 	copy->paths = paths;
+	
+	copy->fillIndices = fillIndices;
+	copy->fillOutline = fillOutline;
+	copy->fillOutlineCounts = fillOutlineCounts;
+	copy->fillQuadsValid = fillQuadsValid;
+	copy->fillQuadsComputed = fillQuadsComputed;
+	copy->strokeRows = strokeRows;
+	copy->strokeRibbons = strokeRibbons;
+	copy->strokeCoverage = strokeCoverage;
+	copy->strokeStyle = strokeStyle;
+	copy->strokeRowsComputed = strokeRowsComputed;
 	return copy;
 }
 
@@ -37,6 +51,8 @@ void EJPath::push(EJVector2 v) {
 		return;
 	}
 	lastPushed = v;
+	fillQuadsComputed = false;
+	strokeRowsComputed = false;
 
 	minPos.x = MIN(minPos.x, v.x);
 	minPos.y = MIN(minPos.y, v.y);
@@ -46,6 +62,8 @@ void EJPath::push(EJVector2 v) {
 }
 
 void EJPath::reset() {
+	fillQuadsComputed = false;
+	strokeRowsComputed = false;
 	longestSubpath = 0;
 	paths.clear();
 	currentPath.isClosed = false;
@@ -60,6 +78,7 @@ void EJPath::reset() {
 
 void EJPath::close() {
 	currentPath.isClosed = true;
+	strokeRowsComputed = false;
 	push(startPos);
 	currentPos = startPos;
 	endSubPath();
@@ -77,152 +96,120 @@ void EJPath::endSubPath() {
 
 void EJPath::moveTo(float x, float y) {
 	endSubPath();
-	currentPos = startPos = EJVector2ApplyTransform( EJVector2Make( x, y ), transform);
+	currentPos = startPos = EJVector2ApplyTransformKind( EJVector2Make( x, y ), transform, transformKind );
 	push(currentPos);
 }
 
 void EJPath::lineTo(float x, float y) {
-	currentPos = EJVector2ApplyTransform( EJVector2Make(x, y), transform);
+	currentPos = EJVector2ApplyTransformKind( EJVector2Make(x, y), transform, transformKind );
 	push(currentPos);
 }
 
+// Number of line segments needed to flatten a curve with the given maximum
+// second difference of its control points (Wang's formula) without deviating
+// more than tolerance from it
+static inline int EJPathSegmentsForCurve(float degreeFactor, float maxSecondDifference, float tolerance) {
+	int segments = (int)ceilf(sqrtf(degreeFactor * maxSecondDifference / tolerance));
+	if( segments < 1 ) { return 1; }
+	if( segments > EJ_PATH_MAX_CURVE_SEGMENTS ) { return EJ_PATH_MAX_CURVE_SEGMENTS; }
+	return segments;
+}
+
+float EJPath::toleranceForScale(float scale) {
+	// The tolerance is given in screen pixels. Points of paths recorded with
+	// the context's transform are already in screen space, while Path2D points
+	// are untransformed and need the tolerance scaled down.
+	float pointsScale = CGAffineTransformGetScale(transform);
+	if( scale <= 0 || pointsScale <= 0 ) {
+		return EJ_PATH_FLATTEN_TOLERANCE;
+	}
+	return EJ_PATH_FLATTEN_TOLERANCE * pointsScale / scale;
+}
+
 void EJPath::bezierCurveTo(float cpx1, float cpy1, float cpx2, float cpy2, float x,
 		float y, float scale) {
-	distanceTolerance = EJ_PATH_DISTANCE_EPSILON / scale;
-	distanceTolerance *= distanceTolerance;
+	EJVector2 p0 = currentPos;
+	EJVector2 p1 = EJVector2ApplyTransformKind(EJVector2Make(cpx1, cpy1), transform, transformKind);
+	EJVector2 p2 = EJVector2ApplyTransformKind(EJVector2Make(cpx2, cpy2), transform, transformKind);
+	EJVector2 p3 = EJVector2ApplyTransformKind(EJVector2Make(x, y), transform, transformKind);
 	
-	EJVector2 cp1 = EJVector2ApplyTransform(EJVector2Make(cpx1, cpy1), transform);
-	EJVector2 cp2 = EJVector2ApplyTransform(EJVector2Make(cpx2, cpy2), transform);
-	EJVector2 p = EJVector2ApplyTransform(EJVector2Make(x, y), transform);
+	// Second differences of the control points
+	EJVector2
+		a = EJVector2Make(p0.x - 2*p1.x + p2.x, p0.y - 2*p1.y + p2.y),
+		b = EJVector2Make(p1.x - 2*p2.x + p3.x, p1.y - 2*p2.y + p3.y);
+	float maxDifference = sqrtf(EJVector2LengthSquared(a) > EJVector2LengthSquared(b)
+		? EJVector2LengthSquared(a)
+		: EJVector2LengthSquared(b));
+	int segments = EJPathSegmentsForCurve(0.75f, maxDifference, toleranceForScale(scale));
 	
-	recursiveBezier(currentPos.x, currentPos.y, cp1.x, cp1.y, cp2.x, cp2.y, p.x, p.y, 0);
-	currentPos = p;
-	push(currentPos);
-}
-
-void EJPath::recursiveBezier(float x1, float y1, float x2, float y2, float x3,
-		float y3, float x4, float y4, int level) {
-	// Based on http://www.antigrain.com/research/adaptive_bezier/index.html
-	
-	// Calculate all the mid-points of the line segments
-	float x12   = (x1 + x2) / 2;
-	float y12   = (y1 + y2) / 2;
-	float x23   = (x2 + x3) / 2;
-	float y23   = (y2 + y3) / 2;
-	float x34   = (x3 + x4) / 2;
-	float y34   = (y3 + y4) / 2;
-	float x123  = (x12 + x23) / 2;
-	float y123  = (y12 + y23) / 2;
-	float x234  = (x23 + x34) / 2;
-	float y234  = (y23 + y34) / 2;
-	float x1234 = (x123 + x234) / 2;
-	float y1234 = (y123 + y234) / 2;
-	
-	if( level > 0 ) {
-		// Enforce subdivision first time
-		// Try to approximate the full cubic curve by a single straight line
-		float dx = x4-x1;
-		float dy = y4-y1;
-		
-		float d2 = fabsf(((x2 - x4) * dy - (y2 - y4) * dx));
-		float d3 = fabsf(((x3 - x4) * dy - (y3 - y4) * dx));
-		
-		if( d2 > EJ_PATH_COLLINEARITY_EPSILON && d3 > EJ_PATH_COLLINEARITY_EPSILON ) {
-			// Regular care
-			if((d2 + d3)*(d2 + d3) <= distanceTolerance * (dx*dx + dy*dy)) {
-				// If the curvature doesn't exceed the distance_tolerance value
-				// we tend to finish subdivisions.
-				push(EJVector2Make(x1234, y1234));
-				return;
-			}
-		}
-		else {
-			if( d2 > EJ_PATH_COLLINEARITY_EPSILON ) {
-				// p1,p3,p4 are collinear, p2 is considerable
-				if( d2 * d2 <= distanceTolerance * (dx*dx + dy*dy) ) {
-					push(EJVector2Make(x1234, y1234));
-					return;
-				}
-			}
-			else if( d3 > EJ_PATH_COLLINEARITY_EPSILON ) {
-				// p1,p2,p4 are collinear, p3 is considerable
-				if( d3 * d3 <= distanceTolerance * (dx*dx + dy*dy) ) {
-					push(EJVector2Make(x1234, y1234));
-					return;
-				}
-			}
-			else {
-				// Collinear case
-				dx = x1234 - (x1 + x4) / 2;
-				dy = y1234 - (y1 + y4) / 2;
-				if( dx*dx + dy*dy <= distanceTolerance ) {
-					push(EJVector2Make(x1234, y1234));
-					return;
-				}
-			}
-		}
-	}
+	// Forward differencing: the curve is evaluated at uniform steps of h with
+	// only additions in the loop
+	float h = 1.0f / segments, h2 = h * h, h3 = h2 * h;
+	EJVector2
+		c1 = EJVector2Make(3 * (p1.x - p0.x), 3 * (p1.y - p0.y)),
+		c2 = EJVector2Make(3 * a.x, 3 * a.y),
+		c3 = EJVector2Make(p3.x - p0.x + 3 * (p1.x - p2.x), p3.y - p0.y + 3 * (p1.y - p2.y));
 	
-	if( level <= EJ_PATH_RECURSION_LIMIT ) {
-		// Continue subdivision
-		recursiveBezier(x1, y1, x12, y12, x123, y123, x1234, y1234, level + 1);
-		recursiveBezier(x1234, y1234, x234, y234, x34, y34, x4, y4, level + 1);
+	EJVector2
+		f = p0,
+		df = EJVector2Make(c1.x * h + c2.x * h2 + c3.x * h3, c1.y * h + c2.y * h2 + c3.y * h3),
+		ddf = EJVector2Make(2 * c2.x * h2 + 6 * c3.x * h3, 2 * c2.y * h2 + 6 * c3.y * h3),
+		dddf = EJVector2Make(6 * c3.x * h3, 6 * c3.y * h3);
+	
+	for( int i = 1; i < segments; i++ ) {
+		f = EJVector2Add(f, df);
+		df = EJVector2Add(df, ddf);
+		ddf = EJVector2Add(ddf, dddf);
+		push(f);
 	}
+	
+	currentPos = p3;
+	push(currentPos);
 }
 
 void EJPath::quadraticCurveTo(float cpx, float cpy, float x, float y, float scale) {
-	distanceTolerance = EJ_PATH_DISTANCE_EPSILON / scale;
-	distanceTolerance *= distanceTolerance;
+	EJVector2 p0 = currentPos;
+	EJVector2 p1 = EJVector2ApplyTransformKind(EJVector2Make(cpx, cpy), transform, transformKind);
+	EJVector2 p2 = EJVector2ApplyTransformKind(EJVector2Make(x, y), transform, transformKind);
 	
-	EJVector2 cp = EJVector2ApplyTransform(EJVector2Make(cpx, cpy), transform);
-	EJVector2 p = EJVector2ApplyTransform(EJVector2Make(x, y), transform);
+	EJVector2 a = EJVector2Make(p0.x - 2*p1.x + p2.x, p0.y - 2*p1.y + p2.y);
+	int segments = EJPathSegmentsForCurve(0.25f, EJVector2Length(a), toleranceForScale(scale));
 	
-	recursiveQuadratic(currentPos.x, currentPos.y, cp.x, cp.y, p.x, p.y, 0);
-	currentPos = p;
+	float h = 1.0f / segments, h2 = h * h;
+	EJVector2
+		f = p0,
+		df = EJVector2Make(2 * (p1.x - p0.x) * h + a.x * h2, 2 * (p1.y - p0.y) * h + a.y * h2),
+		ddf = EJVector2Make(2 * a.x * h2, 2 * a.y * h2);
+	
+	for( int i = 1; i < segments; i++ ) {
+		f = EJVector2Add(f, df);
+		df = EJVector2Add(df, ddf);
+		push(f);
+	}
+	
+	currentPos = p2;
 	push(currentPos);
 }
 
-void EJPath::recursiveQuadratic(float x1, float y1, float x2, float y2, float x3,
-		float y3, int level) {
-	// Based on http://www.antigrain.com/research/adaptive_bezier/index.html
+// Number of line segments for an arc spanning angle with the given on-screen
+// radius, so that no segment deviates more than EJ_PATH_FLATTEN_TOLERANCE
+// pixels from the true arc
+static int EJPathStepsForArc(float angle, float radius) {
+	float minStepAngle = (float)(2 * M_PI) / EJ_PATH_MAX_STEPS_FOR_CIRCLE;
+	float maxStepAngle = (float)(2 * M_PI) / EJ_PATH_MIN_STEPS_FOR_CIRCLE;
 	
-	// Calculate all the mid-points of the line segments
-	float x12   = (x1 + x2) / 2;
-	float y12   = (y1 + y2) / 2;
-	float x23   = (x2 + x3) / 2;
-	float y23   = (y2 + y3) / 2;
-	float x123  = (x12 + x23) / 2;
-	float y123  = (y12 + y23) / 2;
-	
-	float dx = x3-x1;
-	float dy = y3-y1;
-	float d = fabsf(((x2 - x3) * dy - (y2 - y3) * dx));
-	
-	if( d > EJ_PATH_COLLINEARITY_EPSILON ) {
-		// Regular care
-		if( d * d <= distanceTolerance * (dx*dx + dy*dy) ) {
-			push(EJVector2Make(x123, y123));
-			return;
-		}
-	}
-	else {
-		// Collinear case
-		dx = x123 - (x1 + x3) / 2;
-		dy = y123 - (y1 + y3) / 2;
-		if( dx*dx + dy*dy <= distanceTolerance ) {
-			push(EJVector2Make(x123, y123));
-			return;
-		}
+	float stepAngle = maxStepAngle;
+	if( radius > EJ_PATH_FLATTEN_TOLERANCE ) {
+		stepAngle = 2 * acosf(1 - EJ_PATH_FLATTEN_TOLERANCE / radius);
+		if( stepAngle < minStepAngle ) { stepAngle = minStepAngle; }
+		if( stepAngle > maxStepAngle ) { stepAngle = maxStepAngle; }
 	}
 	
-	if( level <= EJ_PATH_RECURSION_LIMIT ) {
-		// Continue subdivision
-		recursiveQuadratic(x1, y1, x12, y12, x123, y123, level + 1);
-		recursiveQuadratic(x123, y123, x23, y23, x3, y3, level + 1);
-	}
+	int steps = (int)ceilf(angle / stepAngle);
+	return steps < 1 ? 1 : steps;
 }
 
-void EJPath::arcTo(float x1, float y1, float x2, float y2, float radius) {
+void EJPath::arcTo(float x1, float y1, float x2, float y2, float radius, float scale) {
 	// Lifted from http://code.google.com/p/fxcanvas/
 	// I have no idea what this code is doing, but it seems to work.
 	
@@ -255,12 +242,12 @@ void EJPath::arcTo(float x1, float y1, float x2, float y2, float radius) {
 		float startAngle = atan2f(py - cy, px - cx);
 		float endAngle = atan2f(qy - cy, qx - cx);
 		
-		arc(cx + x1, cy + y1, radius, startAngle, endAngle, (b1 * a2 > b2 * a1));
+		arc(cx + x1, cy + y1, radius, startAngle, endAngle, (b1 * a2 > b2 * a1), scale);
 	}
 }
 
 void EJPath::arc(float x, float y, float radius, float startAngle, float endAngle,
-		bool antiClockwise) {
+		bool antiClockwise, float scale) {
 	startAngle = fmodf(startAngle, (float)(2 * M_PI));
     endAngle = fmodf(endAngle, (float)(2 * M_PI));
 
@@ -275,454 +262,814 @@ void EJPath::arc(float x, float y, float radius, float startAngle, float endAngl
         ? (startAngle - endAngle) *-1
         : (endAngle - startAngle);
 	
-	int steps = (int)ceil(fabsf(span) * (EJ_PATH_STEPS_FOR_CIRCLE / (2 * M_PI)) );
+	int steps = EJPathStepsForArc(fabsf(span), fabsf(radius) * scale);
 	float stepSize = span / (float)steps;
 	
-	float angle = startAngle;
-	for( int i = 0; i <= steps; i++, angle += stepSize ) {
-		currentPos = EJVector2ApplyTransform( EJVector2Make( x + cosf(angle) * radius, y + sinf(angle) * radius ), transform);
-		push(currentPos);
+	// Generate all points first, so they can be transformed in one batch. The
+	// radius vector is rotated by the step angle instead of calling cosf and
+	// sinf for each point.
+	points_t arcPoints(steps + 1);
+	float stepCos = cosf(stepSize), stepSin = sinf(stepSize);
+	float rx = cosf(startAngle) * radius, ry = sinf(startAngle) * radius;
+	for( int i = 0; i < steps; i++ ) {
+		arcPoints[i] = EJVector2Make( x + rx, y + ry );
+		float nrx = rx * stepCos - ry * stepSin;
+		ry = rx * stepSin + ry * stepCos;
+		rx = nrx;
+	}
+	arcPoints[steps] = EJVector2Make( x + cosf(endAngle) * radius, y + sinf(endAngle) * radius );
+	EJTransformPoints(&arcPoints.front(), &arcPoints.front(), steps + 1, transform, transformKind);
+	
+	for( int i = 0; i <= steps; i++ ) {
+		push(arcPoints[i]);
+	}
+	currentPos = arcPoints[steps];
+}
+
+static inline float EJPathCross(EJVector2 a, EJVector2 b, EJVector2 c) {
+	return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+static bool EJPathIsConvex(const points_t &points) {
+	// A polygon is convex if it always turns in the same direction and its
+	// edges change their x and y direction no more than twice each. The
+	// latter rules out self-intersecting shapes like a pentagram.
+	int count = points.size();
+	int turn = 0;
+	int xSign = 0, ySign = 0, xFirstSign = 0, yFirstSign = 0, xFlips = 0, yFlips = 0;
+	
+	EJVector2 a = points[count-2], b = points[count-1];
+	for( int i = 0; i < count; i++ ) {
+		EJVector2 c = points[i];
+		float dx = c.x - b.x;
+		float dy = c.y - b.y;
+		
+		int sx = dx > 0 ? 1 : (dx < 0 ? -1 : 0);
+		if( sx ) {
+			if( !xSign ) { xFirstSign = sx; }
+			else if( sx != xSign ) { xFlips++; }
+			xSign = sx;
+		}
+		int sy = dy > 0 ? 1 : (dy < 0 ? -1 : 0);
+		if( sy ) {
+			if( !ySign ) { yFirstSign = sy; }
+			else if( sy != ySign ) { yFlips++; }
+			ySign = sy;
+		}
+		
+		float cross = EJPathCross(a, b, c);
+		if( cross > 0 ) {
+			if( turn < 0 ) { return false; }
+			turn = 1;
+		}
+		else if( cross < 0 ) {
+			if( turn > 0 ) { return false; }
+			turn = -1;
+		}
+		
+		a = b;
+		b = c;
+	}
+	
+	if( xSign && xSign != xFirstSign ) { xFlips++; }
+	if( ySign && ySign != yFirstSign ) { yFlips++; }
+	return turn != 0 && xFlips <= 2 && yFlips <= 2;
+}
+
+static bool EJPathSegmentsIntersect(EJVector2 a, EJVector2 b, EJVector2 c, EJVector2 d) {
+	// Touching counts as intersecting here
+	float d1 = EJPathCross(c, d, a);
+	float d2 = EJPathCross(c, d, b);
+	float d3 = EJPathCross(a, b, c);
+	float d4 = EJPathCross(a, b, d);
+	return
+		((d1 <= 0 && d2 >= 0) || (d1 >= 0 && d2 <= 0)) &&
+		((d3 <= 0 && d4 >= 0) || (d3 >= 0 && d4 <= 0));
+}
+
+static bool EJPathIsSimple(const points_t &points) {
+	int count = points.size();
+	for( int i = 0; i < count; i++ ) {
+		EJVector2 a = points[i], b = points[(i+1) % count];
+		for( int j = i + 2; j < count; j++ ) {
+			if( i == 0 && j == count - 1 ) { continue; } // adjacent
+			
+			EJVector2 c = points[j], d = points[(j+1) % count];
+			if(
+				(a.x < c.x && a.x < d.x && b.x < c.x && b.x < d.x) ||
+				(a.x > c.x && a.x > d.x && b.x > c.x && b.x > d.x) ||
+				(a.y < c.y && a.y < d.y && b.y < c.y && b.y < d.y) ||
+				(a.y > c.y && a.y > d.y && b.y > c.y && b.y > d.y)
+			) {
+				continue;
+			}
+			if( EJPathSegmentsIntersect(a, b, c, d) ) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static inline void EJPathPushTriangle(std::vector<int> &quads, int a, int b, int c) {
+	// Single triangles repeat their last vertex, see EJCanvasContext::pushTri()
+	quads.push_back(a);
+	quads.push_back(b);
+	quads.push_back(c);
+	quads.push_back(c);
+}
+
+bool EJPath::triangulateSubpath(const points_t &input) {
+	// Subpaths are filled as if they were closed; drop the closing point
+	points_t points(input);
+	if( points.size() > 1 && points.front().x == points.back().x && points.front().y == points.back().y ) {
+		points.pop_back();
+	}
+	int count = points.size();
+	if( count < 3 ) { return true; }
+	
+	// The triangles refer to the points of the outline by index, so that the
+	// outline can be moved for anti-aliasing without triangulating again
+	int base = fillOutline.size();
+	
+	// Convex polygons are a simple fan. Two fan triangles (0,i,i+1) and
+	// (0,i+1,i+2) are stored as one quad (i,0,i+1,i+2), which the quad
+	// indices (0,1,2 and 1,2,3) draw as exactly these triangles.
+	if( EJPathIsConvex(points) ) {
+		for( int i = 1; i + 1 < count; i += 2 ) {
+			if( i + 2 < count ) {
+				fillIndices.push_back(base + i);
+				fillIndices.push_back(base);
+				fillIndices.push_back(base + i+1);
+				fillIndices.push_back(base + i+2);
+			}
+			else {
+				EJPathPushTriangle(fillIndices, base, base + i, base + i+1);
+			}
+		}
+		fillOutline.insert(fillOutline.end(), points.begin(), points.end());
+		fillOutlineCounts.push_back(count);
+		return true;
+	}
+	
+	// Concave polygons are ear clipped, as long as they don't intersect
+	// themselves
+	if( count > EJ_PATH_MAX_TRIANGULATION_POINTS || !EJPathIsSimple(points) ) {
+		return false;
+	}
+	
+	float area = 0;
+	for( int i = 0; i < count; i++ ) {
+		EJVector2 a = points[i], b = points[(i+1) % count];
+		area += a.x * b.y - b.x * a.y;
+	}
+	
+	// Walk the polygon counter-clockwise, so that convex corners have a
+	// positive cross product
+	std::vector<int> ring(count);
+	for( int i = 0; i < count; i++ ) {
+		ring[i] = area > 0 ? i : count - 1 - i;
+	}
+	
+	int i = 0, sinceLastEar = 0;
+	while( ring.size() > 3 ) {
+		int m = ring.size();
+		if( sinceLastEar > m ) {
+			return false; // No ear left; shouldn't happen for simple polygons
+		}
+		
+		i %= m;
+		EJVector2 prev = points[ring[(i + m - 1) % m]];
+		EJVector2 cur = points[ring[i]];
+		EJVector2 next = points[ring[(i + 1) % m]];
+		float cross = EJPathCross(prev, cur, next);
+		
+		// Collinear points don't contribute any area
+		if( cross == 0 ) {
+			ring.erase(ring.begin() + i);
+			sinceLastEar = 0;
+			continue;
+		}
+		
+		bool isEar = cross > 0;
+		for( int k = 0; k < m && isEar; k++ ) {
+			int index = ring[k];
+			if( index == ring[(i + m - 1) % m] || index == ring[i] || index == ring[(i + 1) % m] ) {
+				continue;
+			}
+			EJVector2 p = points[index];
+			isEar = !(
+				EJPathCross(prev, cur, p) >= 0 &&
+				EJPathCross(cur, next, p) >= 0 &&
+				EJPathCross(next, prev, p) >= 0
+			);
+		}
+		
+		if( isEar ) {
+			EJPathPushTriangle(fillIndices, base + ring[(i + m - 1) % m], base + ring[i], base + ring[(i + 1) % m]);
+			ring.erase(ring.begin() + i);
+			sinceLastEar = 0;
+		}
+		else {
+			i++;
+			sinceLastEar++;
+		}
+	}
+	
+	if( EJPathCross(points[ring[0]], points[ring[1]], points[ring[2]]) != 0 ) {
+		EJPathPushTriangle(fillIndices, base + ring[0], base + ring[1], base + ring[2]);
+	}
+	fillOutline.insert(fillOutline.end(), points.begin(), points.end());
+	fillOutlineCounts.push_back(count);
+	return true;
+}
+
+bool EJPath::triangulate() {
+	if( fillQuadsComputed ) { return fillQuadsValid; }
+	fillQuadsComputed = true;
+	fillQuadsValid = false;
+	fillIndices.clear();
+	fillOutline.clear();
+	fillOutlineCounts.clear();
+	
+	if( paths.size() > EJ_PATH_MAX_TRIANGULATION_SUBPATHS ) { return false; }
+	
+	// With the nonzero winding rule, overlapping subpaths form unions or holes.
+	// Only subpaths whose bounds don't overlap can be filled on their own.
+	int count = paths.size();
+	std::vector<EJVector2> mins(count), maxs(count);
+	for( int i = 0; i < count; i++ ) {
+		const points_t &points = paths[i].points;
+		mins[i] = maxs[i] = points.front();
+		for( points_t::const_iterator p = points.begin(); p != points.end(); ++p ) {
+			if( p->x < mins[i].x ) { mins[i].x = p->x; }
+			if( p->y < mins[i].y ) { mins[i].y = p->y; }
+			if( p->x > maxs[i].x ) { maxs[i].x = p->x; }
+			if( p->y > maxs[i].y ) { maxs[i].y = p->y; }
+		}
+		for( int j = 0; j < i; j++ ) {
+			if(
+				mins[i].x < maxs[j].x && mins[j].x < maxs[i].x &&
+				mins[i].y < maxs[j].y && mins[j].y < maxs[i].y
+			) {
+				return false;
+			}
+		}
+	}
+	
+	for( path_t::iterator sp = paths.begin(); sp != paths.end(); ++sp ) {
+		if( !triangulateSubpath(sp->points) ) {
+			fillIndices.clear();
+			fillOutline.clear();
+			fillOutlineCounts.clear();
+			return false;
+		}
+	}
+	
+	fillQuadsValid = true;
+	return true;
+}
+
+bool EJPath::getBounds(EJVector2 &min, EJVector2 &max) {
+	endSubPath();
+	if( longestSubpath < 3 ) { return false; }
+	
+	min = minPos;
+	max = maxPos;
+	return true;
+}
+
+bool EJPath::getAxisAlignedRect(EJVector2 &min, EJVector2 &max) {
+	endSubPath();
+	if( paths.size() != 1 ) { return false; }
+	
+	// A closing point on top of the first one doesn't count
+	const points_t &points = paths.front().points;
+	int count = points.size();
+	if( count == 5 && points[4].x == points[0].x && points[4].y == points[0].y ) {
+		count = 4;
+	}
+	if( count != 4 ) { return false; }
+	
+	// Edges have to alternate between horizontal and vertical
+	EJVector2 p0 = points[0], p1 = points[1], p2 = points[2], p3 = points[3];
+	if(
+		!(p0.y == p1.y && p1.x == p2.x && p2.y == p3.y && p3.x == p0.x) &&
+		!(p0.x == p1.x && p1.y == p2.y && p2.x == p3.x && p3.y == p0.y)
+	) {
+		return false;
+	}
+	
+	min = EJVector2Make( p0.x < p2.x ? p0.x : p2.x, p0.y < p2.y ? p0.y : p2.y );
+	max = EJVector2Make( p0.x > p2.x ? p0.x : p2.x, p0.y > p2.y ? p0.y : p2.y );
+	return true;
+}
+
+void EJPath::pushFill(EJCanvasContext * context, const EJVector2 * outline,
+		EJColorRGBA color, CGAffineTransform transform) {
+	EJVector2 vecZero = { 0.0f, 0.0f };
+	for( size_t i = 0; i + 3 < fillIndices.size(); i += 4 ) {
+		context->pushQuad(
+			outline[fillIndices[i]], outline[fillIndices[i+1]], outline[fillIndices[i+2]], outline[fillIndices[i+3]],
+			vecZero, vecZero, vecZero, vecZero,
+			color, transform
+		);
 	}
 }
 
 void EJPath::drawPolygonsToContext(EJCanvasContext * context,
-		EJPathPolygonTarget target) {
+		EJPathPolygonTarget target, CGAffineTransform pointsTransform) {
 	endSubPath();
 	if( longestSubpath < 3 ) { return; }
 	
 	EJCanvasState * state = context->state;
 	EJColorRGBA color = EJCanvasBlendFillColor(state);
+	EJGLState * glState = EJGLState::getInstance();
 	
 	
-	// For potentially concave polygons (those with more than 3 unique vertices), we
-	// need to draw to the context twice: first to create a stencil mask, and then again
-	// to fill the created mask with the polygons color.
-	// TODO: add a fast path for polygons that only have 3 vertices
+	// Simple polygons are triangulated on the CPU and pushed like any other
+	// geometry, without a flush
+	if( target == kEJPathPolygonTargetColor && triangulate() ) {
+		// Anti-aliased edges are built in screen space: the outline is moved
+		// inwards by half the fringe, which then fades out across the edge
+		const EJVector2 * outline = &fillOutline.front();
+		CGAffineTransform quadTransform = pointsTransform;
+		if( context->edgeAntialiasingEnabled ) {
+			points_t screenOutline(fillOutline.size());
+			EJTransformPoints(outline, &screenOutline.front(), fillOutline.size(), pointsTransform, kEJTransformKindUnknown);
+			
+			fillInset.resize(fillOutline.size());
+			int first = 0;
+			for( std::vector<int>::iterator count = fillOutlineCounts.begin(); count != fillOutlineCounts.end(); ++count ) {
+				context->pushFringe(&screenOutline[first], *count, color, &fillInset[first]);
+				first += *count;
+			}
+			outline = &fillInset.front();
+			quadTransform = CGAffineTransformIdentity;
+		}
+		
+		pushFill(context, outline, color, quadTransform);
+		return;
+	}
+	
+	// Clip paths only need their area marked in the stencil buffer; the
+	// cached triangles do that in a single pass, without a winding count
+	if( target == kEJPathPolygonTargetStencil && triangulate() ) {
+		context->flushBuffers();
+		context->createStencilBufferOnce();
+		
+		glState->disable(GL_BLEND);
+		glState->enable(GL_STENCIL_TEST);
+		glState->setStencilMask(0xff);
+		glState->setStencilFunc(GL_ALWAYS, 0x01, 0xff);
+		glState->setStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		glState->setColorMask(GL_FALSE);
+		
+		pushFill(context, &fillOutline.front(), color, pointsTransform);
+		context->flushBuffers();
+		return;
+	}
+	
+	
+	// Self-intersecting polygons need to be drawn to the context twice: first to
+	// create a stencil mask, and then again to fill the created mask with the
+	// polygons color.
 	
 	context->flushBuffers();
 	context->createStencilBufferOnce();
 	
 	
 	// Disable drawing to the color buffer, enable the stencil buffer
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	glDisableClientState(GL_COLOR_ARRAY);
+	glState->disable(GL_BLEND);
+	glState->enable(GL_STENCIL_TEST);
+	glState->setStencilMask(0xff);
 	
-	glDisable(GL_BLEND);
-	glEnable(GL_STENCIL_TEST);
-	glStencilMask(0xff);
-	
-	glStencilFunc(GL_ALWAYS, 0, 0xff);
-	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glState->setStencilFunc(GL_ALWAYS, 0, 0xff);
+	glState->setColorMask(GL_FALSE);
 	
 	
 	// Clear the needed area in the stencil buffer
 	
-	glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+	glState->setStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
 	 context->
 	 	pushRect(minPos.x,minPos.y,maxPos.x-minPos.x ,maxPos.y-minPos.y
-	 	,0 ,0 ,0 ,0 ,color	,CGAffineTransformIdentity);
+	 	,0 ,0 ,0 ,0 ,color	,pointsTransform);
 	context->flushBuffers();
 	
 	
-	// For each subpath, draw to the stencil buffer twice:
+	// Draw each subpath to the stencil buffer in a single pass, with separate
+	// stencil ops for both faces:
 	// 1) for all back-facing polygons, increase the stencil value
 	// 2) for all front-facing polygons, decrease the stencil value
 	
-	glEnable(GL_CULL_FACE);
-	for( path_t::iterator sp = paths.begin(); sp != paths.end(); ++sp ) {
-		subpath_t &path = sp==paths.end()?currentPath:*sp;
-		
-		glVertexAttribPointer(kEJGLProgram2DAttributePos, 2, GL_FLOAT, GL_FALSE, 0, &(path.points).front());
-		
+	// The subpaths are drawn straight from client memory, so make sure the
+	// vertex buffer object isn't bound while doing so. The uv, color and slot
+	// arrays still point into the VBO and would be read past its end.
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisableVertexAttribArray(kEJGLProgram2DAttributeUV);
+	glDisableVertexAttribArray(kEJGLProgram2DAttributeColor);
+	glDisableVertexAttribArray(kEJGLProgram2DAttributeSlot);
+	
 #ifdef _WINDOWS
-		glCullFace(GL_BACK);
-		glStencilOp(GL_INCR_WRAP_EXT, GL_KEEP, GL_INCR_WRAP_EXT);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, sp->points.size());
-
-		glCullFace(GL_FRONT);
-		glStencilOp(GL_DECR_WRAP_EXT, GL_KEEP, GL_DECR_WRAP_EXT);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, sp->points.size());
+	glState->setStencilOpSeparate(GL_BACK, GL_INCR_WRAP_EXT, GL_KEEP, GL_INCR_WRAP_EXT);
+	glState->setStencilOpSeparate(GL_FRONT, GL_DECR_WRAP_EXT, GL_KEEP, GL_DECR_WRAP_EXT);
 #else
-		glCullFace(GL_BACK);
-		glStencilOp(GL_INCR_WRAP, GL_KEEP, GL_INCR_WRAP);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, path.points.size());
-
-		glCullFace(GL_FRONT);
-		glStencilOp(GL_DECR_WRAP, GL_KEEP, GL_DECR_WRAP);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, path.points.size());
+	glState->setStencilOpSeparate(GL_BACK, GL_INCR_WRAP, GL_KEEP, GL_INCR_WRAP);
+	glState->setStencilOpSeparate(GL_FRONT, GL_DECR_WRAP, GL_KEEP, GL_DECR_WRAP);
 #endif
-		if(sp==paths.end()) break;
+	bool transformPoints = !CGAffineTransformIsIdentity(pointsTransform);
+	points_t transformed;
+	for( path_t::iterator sp = paths.begin(); sp != paths.end(); ++sp ) {
+		const EJVector2 * points = &(sp->points).front();
+		if( transformPoints ) {
+			transformed.resize(sp->points.size());
+			EJTransformPoints(points, &transformed.front(), sp->points.size(), pointsTransform, kEJTransformKindUnknown);
+			points = &transformed.front();
+		}
+		glVertexAttribPointer(kEJGLProgram2DAttributePos, 2, GL_FLOAT, GL_FALSE, 0, points);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, sp->points.size());
 	}
-	glDisable(GL_CULL_FACE);
 	context->bindVertexBuffer();
 	
+	if( target == kEJPathPolygonTargetStencil ) {
+		return;
+	}
+	
 	
-	// Enable drawing to the color or depth buffer and push a rect with the correct
+	// Enable drawing to the color buffer and push a rect with the correct
 	// size and color to the context. This rect will also clear the stencil buffer
 	// again.
 	
-	if( target == kEJPathPolygonTargetDepth ) {
-		glDepthFunc(GL_ALWAYS);
-		glDepthMask(GL_TRUE);
-		glClear(GL_DEPTH_BUFFER_BIT);
-	}
-	else if( target == kEJPathPolygonTargetColor ) {
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		glEnable(GL_BLEND);
-	}
+	glState->setColorMask(GL_TRUE);
+	glState->enable(GL_BLEND);
 	
-	glStencilFunc(GL_NOTEQUAL, 0x00, 0xff);
-    glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+	glState->setStencilFunc(GL_NOTEQUAL, 0x00, 0xff);
+    glState->setStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
 
 	 context->
 	 	pushRect(minPos.x,minPos.y ,maxPos.x-minPos.x ,maxPos.y-minPos.y
 	 	,0 ,0 ,0 ,0
-	 	,color	,CGAffineTransformIdentity);
+	 	,color	,pointsTransform);
 	context->flushBuffers();
-	glDisable(GL_STENCIL_TEST);
-	
-	if( target == kEJPathPolygonTargetDepth ) {
-		glDepthMask(GL_FALSE);
-		glDepthFunc(GL_EQUAL);
-		
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		glEnable(GL_BLEND);
+	glState->disable(GL_STENCIL_TEST);
+}
+
+// A row of the stroke ribbon across point p: outer feather, edge, edge, outer
+// feather, from the left to the right side of the line. ext points to the left
+// and is scaled by the half width of the opaque core (inner) and the half width
+// including the feather (outer).
+static inline void EJPathPushRow(points_t &rows, EJVector2 a, EJVector2 b, EJVector2 c, EJVector2 d) {
+	rows.push_back(a);
+	rows.push_back(b);
+	rows.push_back(c);
+	rows.push_back(d);
+}
+
+static inline void EJPathPushSymmetricRow(points_t &rows, EJVector2 p, EJVector2 ext, float inner, float outer) {
+	EJPathPushRow(rows,
+		EJVector2Make( p.x + ext.x * outer, p.y + ext.y * outer ),
+		EJVector2Make( p.x + ext.x * inner, p.y + ext.y * inner ),
+		EJVector2Make( p.x - ext.x * inner, p.y - ext.y * inner ),
+		EJVector2Make( p.x - ext.x * outer, p.y - ext.y * outer )
+	);
+}
+
+// Pushes the rows for one point of a join or cap. The inner side is the one
+// the line turns towards (side > 0: left); its points stay fixed while the
+// outer points sweep around the join.
+static inline void EJPathPushJoinRow(points_t &rows, float side,
+		EJVector2 innerFeather, EJVector2 inner, EJVector2 outer, EJVector2 outerFeather) {
+	if( side > 0 ) {
+		EJPathPushRow(rows, innerFeather, inner, outer, outerFeather);
+	}
+	else {
+		EJPathPushRow(rows, outerFeather, outer, inner, innerFeather);
 	}
 }
 
-void EJPath::drawArcToContext(EJCanvasContext * context, EJVector2 point, EJVector2 p1,
-		EJVector2 p2, EJColorRGBA color) {
-	EJCanvasState * state = context->state;
-	float width2 = state->lineWidth/2;
+static inline EJVector2 EJPathNormal(EJVector2 dir) {
+	return EJVector2Make( -dir.y, dir.x );
+}
+
+void EJPath::tessellateCap(EJVector2 point, EJVector2 dir, bool start,
+		EJLineCap cap, float inner, float outer, float pxScale) {
+	EJVector2 normal = EJPathNormal(dir);
+	float width2 = (inner + outer) / 2;
 	
-	EJVector2
-		v1 = EJVector2Normalize(EJVector2Sub(p1, point)),
-		v2 = EJVector2Normalize(EJVector2Sub(p2, point));
+	if( cap == kEJLineCapSquare ) {
+		float ext = start ? -width2 : width2;
+		EJVector2 p = EJVector2Make( point.x + dir.x * ext, point.y + dir.y * ext );
+		EJPathPushSymmetricRow(strokeRows, p, normal, inner, outer);
+		return;
+	}
+	else if( cap != kEJLineCapRound ) {
+		EJPathPushSymmetricRow(strokeRows, point, normal, inner, outer);
+		return;
+	}
 	
-	// calculate starting angle for arc
-	float angle1 = atan2(1.0f,0.0f) - atan2(v1.x,-v1.y);
+	// Round caps are a fan around the end point, from the right side around
+	// the back to the left (start) or from the left around the front to the
+	// right (end). The center takes the place of the right edge, so the
+	// fan's rows connect to the rows of the line.
+	int numSteps = EJPathStepsForArc((float)M_PI, outer * pxScale);
+	float step = (float)-M_PI / numSteps;
+	float stepCos = cosf(step), stepSin = sinf(step);
+	float rx = start ? -normal.x : normal.x;
+	float ry = start ? -normal.y : normal.y;
 	
-	// calculate smalles angle between both vectors
-	// colinear vectors (for caps) need to be handled seperately
-	float angle2;
-	if( v1.x == -v2.x && v1.y == -v2.y ) {
-		angle2 = 3.14f;
+	if( !start ) {
+		EJPathPushSymmetricRow(strokeRows, point, normal, inner, outer);
 	}
-	else {
-		angle2 = acosf( v1.x * v2.x + v1.y * v2.y );
+	for( int i = 0; i <= numSteps; i++ ) {
+		EJPathPushRow(strokeRows,
+			EJVector2Make( point.x + rx * outer, point.y + ry * outer ),
+			EJVector2Make( point.x + rx * inner, point.y + ry * inner ),
+			point, point
+		);
+		float nrx = rx * stepCos - ry * stepSin;
+		ry = rx * stepSin + ry * stepCos;
+		rx = nrx;
 	}
+	if( start ) {
+		EJPathPushSymmetricRow(strokeRows, point, normal, inner, outer);
+	}
+}
+
+void EJPath::tessellateJoin(EJVector2 point, EJVector2 dirA, EJVector2 dirB,
+		float lenA, float lenB, EJLineJoin join, float miterLimit,
+		float inner, float outer, float pxScale) {
+	EJVector2 normalA = EJPathNormal(dirA), normalB = EJPathNormal(dirB);
+	float dot = EJVector2Dot(dirA, dirB);
+	float cross = dirA.x * dirB.y - dirA.y * dirB.x;
 	
-	// 1 step per 5 pixel
-	float pxScale = CGAffineTransformGetScale(state->transform) * context->backingStoreRatio;
-	int numSteps = (int)(MAX( 1, (angle2 * width2 * pxScale) / 5.0f ));
-	
-	if(numSteps==1) {
-		 context->
-		 	pushTri(p1.x	,p1.y ,point.x ,point.y ,p2.x ,p2.y
-		 	,color ,transform);
+	// Straight continuation; a single row across the point
+	if( fabsf(cross) < 1e-6f && dot > 0 ) {
+		EJPathPushSymmetricRow(strokeRows, point, normalA, inner, outer);
 		return;
 	}
 	
-	// calculate direction
-	float direction = (v2.x*v1.y - v2.y*v1.x < 0) ? -1.0f : 1.0f;
-	
-	// calculate angle step
-	float step = (angle2/numSteps) * direction;
+	// The miter vector m satisfies m.normalA = m.normalB = 1, so point + m * w
+	// is where both edges at distance w meet
+	float side = cross > 0 ? 1 : -1;
+	float denominator = 1 + dot;
+	bool miterValid = denominator > 1e-4f;
+	EJVector2 miter = EJVector2Make(0, 0);
+	float miterLength = INFINITY;
+	if( miterValid ) {
+		miter = EJVector2Make( (normalA.x + normalB.x) / denominator, (normalA.y + normalB.y) / denominator );
+		miterLength = sqrtf(EJVector2Dot(miter, miter));
+	}
 	
-	// starting point
-	float angle = angle1;
+	// On the inside of the turn both segments end at the inner miter point,
+	// so they don't overlap. This only works if the point doesn't reach past
+	// either segment, i.e. if the line isn't wider than the curve it follows.
+	// Otherwise the segments end with a butt at the point and overlap there.
+	float reach = miterValid ? (fabsf(cross) / denominator) * outer : INFINITY;
+	bool sharedInner = reach <= 0.5f * (lenA < lenB ? lenA : lenB);
 	
-	EJVector2 arcP1 = {point.x + cosf(angle) * width2, point.y - sinf(angle) * width2 };
-	EJVector2 arcP2;
+	EJVector2 innerFeather = point, innerEdge = point;
+	if( sharedInner ) {
+		innerFeather = EJVector2Make( point.x + miter.x * side * outer, point.y + miter.y * side * outer );
+		innerEdge = EJVector2Make( point.x + miter.x * side * inner, point.y + miter.y * side * inner );
+	}
+	else {
+		EJPathPushSymmetricRow(strokeRows, point, normalA, inner, outer);
+	}
 	
-	for( int i = 0; i < numSteps; i++ ) {
-		angle += step;
-		arcP2 = EJVector2Make( point.x + cosf(angle) * width2, point.y - sinf(angle) * width2 );
-		
-		context->
-		 	pushTri(arcP1.x ,arcP1.y ,point.x ,point.y ,arcP2.x ,arcP2.y
-		 	,color ,transform);
+	// Outer side; the points on both segments' edges are emitted by all joins
+	// but a miter within its limit
+	float outerSide = -side;
+	if( join == kEJLineJoinMiter && miterValid && miterLength <= miterLimit ) {
+		if( !sharedInner ) {
+			EJPathPushJoinRow(strokeRows, side, innerFeather, innerEdge,
+				EJVector2Make( point.x + normalA.x * outerSide * inner, point.y + normalA.y * outerSide * inner ),
+				EJVector2Make( point.x + normalA.x * outerSide * outer, point.y + normalA.y * outerSide * outer ));
+		}
+		EJPathPushJoinRow(strokeRows, side, innerFeather, innerEdge,
+			EJVector2Make( point.x + miter.x * outerSide * inner, point.y + miter.y * outerSide * inner ),
+			EJVector2Make( point.x + miter.x * outerSide * outer, point.y + miter.y * outerSide * outer ));
+		if( !sharedInner ) {
+			EJPathPushJoinRow(strokeRows, side, innerFeather, innerEdge,
+				EJVector2Make( point.x + normalB.x * outerSide * inner, point.y + normalB.y * outerSide * inner ),
+				EJVector2Make( point.x + normalB.x * outerSide * outer, point.y + normalB.y * outerSide * outer ));
+		}
+	}
+	else {
+		// Bevel: a single step from one edge to the other. Round: rotate the
+		// outer radius from normalA to normalB in the direction of the turn.
+		int numSteps = 1;
+		float angle = atan2f(fabsf(cross), dot);
+		if( join == kEJLineJoinRound ) {
+			numSteps = EJPathStepsForArc(angle, outer * pxScale);
+		}
+		float step = side * angle / numSteps;
+		float stepCos = cosf(step), stepSin = sinf(step);
+		float rx = normalA.x * outerSide, ry = normalA.y * outerSide;
 		
-		arcP1 = arcP2;
+		for( int i = 0; i <= numSteps; i++ ) {
+			if( i == numSteps ) {
+				// Land exactly on the next segment's edge
+				rx = normalB.x * outerSide;
+				ry = normalB.y * outerSide;
+			}
+			EJPathPushJoinRow(strokeRows, side, innerFeather, innerEdge,
+				EJVector2Make( point.x + rx * inner, point.y + ry * inner ),
+				EJVector2Make( point.x + rx * outer, point.y + ry * outer ));
+			
+			float nrx = rx * stepCos - ry * stepSin;
+			ry = rx * stepSin + ry * stepCos;
+			rx = nrx;
+		}
+	}
+	
+	if( !sharedInner ) {
+		EJPathPushSymmetricRow(strokeRows, point, normalB, inner, outer);
 	}
 }
 
-void EJPath::drawLinesToContext(EJCanvasContext * context) {
-	endSubPath();
-	
-	EJCanvasState * state = context->state;
-	EJVector2 vecZero = { 0.0f, 0.0f };
+void EJPath::tessellateHairline(const points_t &points, bool closed,
+		EJLineCap cap, float inner, float outer) {
+	// Thin lines skip joins and caps; each point gets a single row along the
+	// miter vector, which is clamped for sharp turns. Square and round caps
+	// just extend the line by half its width.
+	size_t count = points.size();
+	size_t segments = closed ? count : count - 1;
+	float capExt = (cap == kEJLineCapButt) ? 0 : (inner + outer) / 2;
 	
-	// Find the width of the line as it is projected onto the screen.
-	float projectedLineWidth = CGAffineTransformGetScale( state->transform ) * state->lineWidth;
-	
-	// Figure out if we need to add line caps and set the cap texture coord for square or round caps.
-	// For thin lines we disable texturing and line caps.
-	float width2 = state->lineWidth/2;
-	BOOL addCaps = (projectedLineWidth > 2 && (state->lineCap == kEJLineCapRound || state->lineCap == kEJLineCapSquare));
-	
-	// The miter limit is the maximum allowed ratio of the miter length to half the line width.
-	BOOL addMiter = (state->lineJoin == kEJLineJoinMiter);
-	float miterLimit = (state->miterLimit * width2);
-	
-	EJColorRGBA color = EJCanvasBlendStrokeColor(state);
+	EJVector2 firstDir = EJVector2Normalize(EJVector2Sub(points[1], points[0]));
+	EJVector2 prevDir = closed
+		? EJVector2Normalize(EJVector2Sub(points[0], points[count-1]))
+		: firstDir;
 	
-	// Enable stencil test when drawing transparent lines.
-	// Cycle through all bits, so that the stencil buffer only has to be cleared after eight stroke operations
-	if( color.rgba.a < 0xff ) {
-		context->flushBuffers();
-		context->createStencilBufferOnce();
-		
-		glEnable(GL_STENCIL_TEST);
+	for( size_t i = 0; i <= segments; i++ ) {
+		EJVector2 p = points[i % count];
+		EJVector2 dir = (i < segments)
+			? EJVector2Normalize(EJVector2Sub(points[(i+1) % count], p))
+			: (closed ? firstDir : prevDir);
 		
-		glStencilMask(stencilMask);
+		if( !closed && i == 0 ) {
+			p = EJVector2Make( p.x - dir.x * capExt, p.y - dir.y * capExt );
+		}
+		else if( !closed && i == segments ) {
+			p = EJVector2Make( p.x + dir.x * capExt, p.y + dir.y * capExt );
+		}
 		
-		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-		glStencilFunc(GL_NOTEQUAL, stencilMask, stencilMask);
+		EJVector2 normalA = EJPathNormal(prevDir), normalB = EJPathNormal(dir);
+		float denominator = 1 + EJVector2Dot(prevDir, dir);
+		EJVector2 ext = normalB;
+		if( denominator > 1e-4f ) {
+			ext = EJVector2Make( (normalA.x + normalB.x) / denominator, (normalA.y + normalB.y) / denominator );
+			float length = sqrtf(EJVector2Dot(ext, ext));
+			if( length > EJ_PATH_HAIRLINE_MITER_LIMIT ) {
+				ext.x *= EJ_PATH_HAIRLINE_MITER_LIMIT / length;
+				ext.y *= EJ_PATH_HAIRLINE_MITER_LIMIT / length;
+			}
+		}
+		EJPathPushSymmetricRow(strokeRows, p, ext, inner, outer);
+		prevDir = dir;
 	}
+}
+
+void EJPath::tessellateLines(EJCanvasState * state, float pxScale, bool antialias) {
+	strokeRows.clear();
+	strokeRibbons.clear();
 	
-	// To draw the line correctly with transformations, we need to construct the line
-	// vertices from the untransformed points and only apply the transformation in
-	// the last step (pushQuad) again.	
+	// All geometry is constructed in untransformed space, so that the line
+	// width and the miters come out right; the transform is applied when the
+	// rows are pushed to the context.
 	CGAffineTransform inverseTransform = CGAffineTransformIsIdentity(transform)
 		? transform
 		: CGAffineTransformInvert(transform);
+	EJTransformKind inverseKind = EJTransformGetKind(inverseTransform);
 	
+	// Edges are anti-aliased by a feather of EJ_CANVAS_EDGE_FEATHER pixels
+	// centered on them, that fades from full coverage to 0. Lines thinner than
+	// EJ_PATH_HAIRLINE_WIDTH pixels have no opaque core that is worth joining
+	// properly; their coverage is scaled down instead, so that the total
+	// intensity still matches the width. Without anti-aliasing the feather
+	// collapses onto the edge.
+	float feather = antialias ? EJ_CANVAS_EDGE_FEATHER / pxScale : 0;
+	float projectedLineWidth = state->lineWidth * pxScale;
+	bool hairline = antialias && projectedLineWidth < EJ_PATH_HAIRLINE_WIDTH;
+	float inner, outer;
+	if( hairline ) {
+		float core = projectedLineWidth - EJ_CANVAS_EDGE_FEATHER;
+		inner = core > 0 ? (core / 2) / pxScale : 0;
+		outer = inner + feather;
+		strokeCoverage = core > 0 ? 1 : projectedLineWidth / EJ_CANVAS_EDGE_FEATHER;
+	}
+	else {
+		inner = state->lineWidth / 2 - feather / 2;
+		outer = state->lineWidth / 2 + feather / 2;
+		strokeCoverage = 1;
+	}
 	
-	// Oh god, I'm so sorry... This code sucks quite a bit. I'd be surprised if I
-	// will understand what I've written in 3 days :/
-	// Calculating line miters for potentially closed paths is serious business!
-	// And it doesn't even handle all the edge cases.
-			
-	EJVector2
-		*transCurrent, *transNext,	// Pointers to current and next vertices on the line
-		current, next,				// Untransformed current and next points
-		firstMiter1, firstMiter2,	// First miter vertices (left, right) needed for closed paths
-		miter11, miter12,			// Current miter vertices (left, right)
-		miter21, miter22,			// Next miter vertices (left, right)
-		currentEdge, currentExt,	// Current edge and its normal * width/2
-		nextEdge = { 0.0f, 0.0f }, nextExt = { 0.0f, 0.0f };			// Next edge and its normal * width/2
+	points_t points;
+	std::vector<EJVector2> dirs;
+	std::vector<float> lengths;
 	
 	for( path_t::iterator sp = paths.begin(); sp != paths.end(); ++sp ) {
-		BOOL subPathIsClosed = sp->isClosed;
-		BOOL ignoreFirstSegment = addMiter && subPathIsClosed;
-		BOOL firstInSubPath = true;
-		BOOL miterLimitExceeded = false, firstMiterLimitExceeded = false;
-		
-		transCurrent = transNext = NULL;
+		points.resize(sp->points.size());
+		EJTransformPoints(&sp->points.front(), &points.front(), sp->points.size(), inverseTransform, inverseKind);
 		
-		// If this subpath is closed, initialize the first vertex for the loop ("next")
-		// to the last vertex in the subpath. This way, the miter between the last and
-		// the first segment will be computed and used to draw the first segment's first
-		// miter, as well as the last segment's last miter outside the loop.
-		if( addMiter && subPathIsClosed ) {
-			transNext = &sp->points.at(sp->points.size()-2);
-			next = EJVector2ApplyTransform( *transNext, inverseTransform );
+		// Closed subpaths end with their first point; the loop below wraps
+		// around instead
+		bool closed = sp->isClosed;
+		if( closed && points.size() > 2 && points.front().x == points.back().x && points.front().y == points.back().y ) {
+			points.pop_back();
 		}
-
-		for( points_t::iterator vertex = sp->points.begin(); vertex != sp->points.end(); ++vertex) {
-			transCurrent = transNext;
-			transNext = &(*vertex);
-			
-			current = next;
-			next = EJVector2ApplyTransform( *transNext, inverseTransform );
-			
-			if( !transCurrent ) { continue;	}
-			
-			currentEdge	= nextEdge;
-			currentExt = nextExt;
-			nextEdge = EJVector2Normalize(EJVector2Sub(next, current));
-			nextExt = EJVector2Make( -nextEdge.y * width2, nextEdge.x * width2 );
-			
-			if( firstInSubPath ) {
-				firstMiter1 = miter21 = EJVector2Add( current, nextExt );
-				firstMiter2 = miter22 = EJVector2Sub( current, nextExt );
-				firstInSubPath = false;
-				
-				// Start cap
-				if( addCaps && !subPathIsClosed ) {
-					if( state->lineCap == kEJLineCapSquare ) {
-						EJVector2 capExt = { -nextExt.y, nextExt.x };
-						EJVector2 cap11 = EJVector2Add( miter21, capExt );
-						EJVector2 cap12 = EJVector2Add( miter22, capExt );
-						
-						 context->
-						 	 pushQuad(cap11 ,cap12 ,miter21 ,miter22
-						 	 ,vecZero ,vecZero ,vecZero ,vecZero
-						 	 ,color ,transform);
-					}
-					else {
-						drawArcToContext(context, current, miter22, miter21, color);
-					}
-				}
-				
-				continue;
-			}
-			
-			
-			miter11 = miter21;
-			miter12 = miter22;
-			
-			BOOL miterAdded = false;
-			if( addMiter ) {
-				EJVector2 miterEdge = EJVector2Add( currentEdge, nextEdge );
-				float miterExt = (1/EJVector2Dot(miterEdge, miterEdge)) * state->lineWidth;
-				
-				if( miterExt < miterLimit ) {
-					miterEdge.x *= miterExt;
-					miterEdge.y *= miterExt;
-					miter21 = EJVector2Make( current.x - miterEdge.y, current.y + miterEdge.x );
-					miter22 = EJVector2Make( current.x + miterEdge.y, current.y - miterEdge.x );
-					
-					miterAdded = true;
-					miterLimitExceeded = false;
-				}
-				else {
-					miterLimitExceeded = true;
-				}
-			}
-			
-			// No miter added? Calculate the butt for the current segment
-			if( !miterAdded ) {
-				miter21 = EJVector2Add(current, currentExt);
-				miter22 = EJVector2Sub(current, currentExt);
-			}
-			
-			if( ignoreFirstSegment ) {
-				// True when starting from the back vertex of a closed path. This run was just
-				// to calculate the first miter.
-				firstMiter1 = miter21;
-				firstMiter2 = miter22;
-				if( !miterAdded ) {
-					// Flip miter21 <> miter22 if it's the butt for the first segment
-					miter21 = firstMiter2;
-					miter22 = firstMiter1;
-				}
-				firstMiterLimitExceeded = miterLimitExceeded;
-				ignoreFirstSegment = false;
-				continue;
-			}
-			
-			if( !addMiter || miterLimitExceeded ) {
-				// previous point can be approximated, good enough for distance comparison
-				EJVector2 prev = EJVector2Sub(current, currentEdge);
-				EJVector2 p1, p2;
-				float d1, d2;
-					
-				// calculate points to use for bevel
-				// two points are possible for each edge - the one farthest away from the other line has to be used
-				
-				// calculate point for current edge
-				d1 = EJDistanceToLineSegmentSquared(miter21, current, next);
-				d2 = EJDistanceToLineSegmentSquared(miter22, current, next);
-				p1 = ( d1 > d2 ) ? miter21 : miter22;
-				
-				// calculate point for next edge
-				d1 = EJDistanceToLineSegmentSquared(EJVector2Add(current, nextExt), current, prev);
-				d2 = EJDistanceToLineSegmentSquared(EJVector2Sub(current, nextExt), current, prev);
-				p2 = ( d1 > d2 ) ? EJVector2Add(current, nextExt) : EJVector2Sub(current, nextExt);
-				
-				if( state->lineJoin==kEJLineJoinRound ) {
-					drawArcToContext(context, current, p1, p2, color);
-				}
-				else {
-					 context->
-					  pushTri(p1.x	,p1.y ,current.x,current.y ,p2.x ,p2.y
-					  ,color ,transform);
-				}
-			}
-
-			 context->
-			 	pushQuad(miter11 ,miter12 ,miter21 ,miter22
-			 	,vecZero ,vecZero ,vecZero ,vecZero
-			 	,color ,transform);
-
-			// No miter added? The "miter" for the next segment needs to be the butt for the next segment,
-			// not the butt for the current one.
-			if( !miterAdded ) {
-				miter21 = EJVector2Add(current, nextExt);
-				miter22 = EJVector2Sub(current, nextExt);
-			}
-		} // for each subpath
-		
+		if( points.size() < 2 ) { continue; }
 		
-		// The last segment, not handled in the loop
-		if( !firstMiterLimitExceeded && addMiter && subPathIsClosed ) {
-			miter11 = firstMiter1;
-			miter12 = firstMiter2;
+		size_t firstRow = strokeRows.size();
+		if( hairline ) {
+			tessellateHairline(points, closed, state->lineCap, inner, outer);
+			strokeRibbons.push_back((int)(strokeRows.size() - firstRow) / 4);
+			continue;
 		}
-		else {
-			EJVector2 untransformedBack = EJVector2ApplyTransform(sp->points.back(), inverseTransform);
-			miter11 = EJVector2Add(untransformedBack, nextExt);
-			miter12 = EJVector2Sub(untransformedBack, nextExt);
+		
+		size_t count = points.size();
+		size_t segments = closed ? count : count - 1;
+		dirs.resize(segments);
+		lengths.resize(segments);
+		for( size_t i = 0; i < segments; i++ ) {
+			EJVector2 edge = EJVector2Sub(points[(i+1) % count], points[i]);
+			lengths[i] = sqrtf(EJVector2Dot(edge, edge));
+			dirs[i] = EJVector2Normalize(edge);
 		}
 		
-		if( (!addMiter || firstMiterLimitExceeded) && subPathIsClosed ) {
-			float d1,d2;
-			EJVector2 p1,p2,
-			firstNormal = EJVector2Sub(firstMiter1,firstMiter2),							// unnormalized line normal for first edge
-			second		= EJVector2Add(next,EJVector2Make(firstNormal.y,-firstNormal.x));	// approximated second point
-			
-			// calculate points to use for bevel
-			// two points are possible for each edge - the one farthest away from the other line has to be used
-			
-			// calculate point for current edge
-			d1 = EJDistanceToLineSegmentSquared(miter12, next, second);
-			d2 = EJDistanceToLineSegmentSquared(miter11, next, second);
-			p2 = ( d1 > d2 )?miter12:miter11;
-			
-			// calculate point for next edge
-			d1 = EJDistanceToLineSegmentSquared(firstMiter1, current, next);
-			d2 = EJDistanceToLineSegmentSquared(firstMiter2, current, next);
-			p1 = (d1>d2)?firstMiter1:firstMiter2;
-			
-			if( state->lineJoin==kEJLineJoinRound ) {
-				drawArcToContext(context, next, p1, p2, color);
-			}
-			else {
-				 context->
-				  pushTri(p1.x	,p1.y ,next.x ,next.y ,p2.x,p2.y
-				  ,color ,transform);
+		// Closed subpaths start and end in the middle of the first segment,
+		// so that all points get a join
+		if( closed ) {
+			EJVector2 mid = EJVector2Make( (points[0].x + points[1].x) / 2, (points[0].y + points[1].y) / 2 );
+			EJPathPushSymmetricRow(strokeRows, mid, EJPathNormal(dirs[0]), inner, outer);
+			for( size_t i = 1; i <= count; i++ ) {
+				tessellateJoin(points[i % count], dirs[i-1], dirs[i % segments],
+					lengths[i-1], lengths[i % segments], state->lineJoin,
+					state->miterLimit, inner, outer, pxScale);
 			}
+			EJPathPushSymmetricRow(strokeRows, mid, EJPathNormal(dirs[0]), inner, outer);
 		}
-
-		 context->
-		 	pushQuad(miter11,miter12,miter21,miter22
-		 	,vecZero ,vecZero ,vecZero ,vecZero
-		 	,color ,transform);
-
-		// End cap
-		if( addCaps && !subPathIsClosed ) {
-			if( state->lineCap == kEJLineCapSquare ) {
-				EJVector2 capExt = { nextExt.y, -nextExt.x };
-				EJVector2 cap11 = EJVector2Add( miter11, capExt );
-				EJVector2 cap12 = EJVector2Add( miter12, capExt );
-				
-				 context->
-				 	pushQuad(cap11,cap12,miter11,miter12
-				 	,vecZero,vecZero,vecZero ,vecZero
-				 	,color ,transform);
-			}
-			else {
-				drawArcToContext(context, next, miter11, miter12, color);
+		else {
+			tessellateCap(points[0], dirs[0], true, state->lineCap, inner, outer, pxScale);
+			for( size_t i = 1; i < segments; i++ ) {
+				tessellateJoin(points[i], dirs[i-1], dirs[i], lengths[i-1], lengths[i],
+					state->lineJoin, state->miterLimit, inner, outer, pxScale);
 			}
+			tessellateCap(points[count-1], dirs[segments-1], false, state->lineCap, inner, outer, pxScale);
 		}
-	} // for each path
+		strokeRibbons.push_back((int)(strokeRows.size() - firstRow) / 4);
+	}
+}
+
+void EJPath::drawLinesToContext(EJCanvasContext * context,
+		CGAffineTransform pointsTransform) {
+	endSubPath();
 	
-	// disable stencil test when drawing transparent lines
-	if( color.rgba.a < 0xff ) {
-		context->flushBuffers();
-		glDisable(GL_STENCIL_TEST);
-		
-		if( stencilMask == (1<<7) ) {
-			stencilMask = (1<<0);
-			
-			glStencilMask(0xff);
-			glClearStencil(0x0);
-			glClear(GL_STENCIL_BUFFER_BIT);
-		}
-		else {
-			stencilMask <<= 1;
-		}
+	EJCanvasState * state = context->state;
+	
+	// The stroke geometry only depends on the line style, the scale of the
+	// context's transform and the transform the points were recorded with;
+	// anything else is applied when submitting the vertices
+	EJPathStrokeStyle style;
+	style.transform = transform;
+	style.lineWidth = state->lineWidth;
+	style.lineCap = state->lineCap;
+	style.lineJoin = state->lineJoin;
+	style.miterLimit = state->miterLimit;
+	style.scale = CGAffineTransformGetScale(state->transform);
+	style.antialias = context->edgeAntialiasingEnabled;
+	
+	if(
+		!strokeRowsComputed ||
+		style.lineWidth != strokeStyle.lineWidth ||
+		style.lineCap != strokeStyle.lineCap ||
+		style.lineJoin != strokeStyle.lineJoin ||
+		style.miterLimit != strokeStyle.miterLimit ||
+		style.scale != strokeStyle.scale ||
+		style.antialias != strokeStyle.antialias ||
+		!CGAffineTransformEqualToTransform(style.transform, strokeStyle.transform)
+	) {
+		tessellateLines(state, style.scale * context->backingStoreRatio, style.antialias);
+		strokeStyle = style;
+		strokeRowsComputed = true;
+	}
+	
+	// Colors are premultiplied, so coverage scales all components
+	EJColorRGBA color = EJCanvasBlendStrokeColor(state);
+	if( strokeCoverage < 1 ) {
+		color.rgba.r = (unsigned char)(color.rgba.r * strokeCoverage);
+		color.rgba.g = (unsigned char)(color.rgba.g * strokeCoverage);
+		color.rgba.b = (unsigned char)(color.rgba.b * strokeCoverage);
+		color.rgba.a = (unsigned char)(color.rgba.a * strokeCoverage);
+	}
+	
+	// The ribbons don't overlap themselves at joins, so transparent lines
+	// don't need the stencil buffer to avoid blending twice
+	CGAffineTransform rowTransform = CGAffineTransformConcat(transform, pointsTransform);
+	EJTransformKind rowTransformKind = EJTransformGetKind(rowTransform);
+	const EJVector2 * rows = strokeRows.empty() ? NULL : &strokeRows.front();
+	for( std::vector<int>::iterator ribbon = strokeRibbons.begin(); ribbon != strokeRibbons.end(); ++ribbon ) {
+		context->pushRibbon(rows, *ribbon, color, rowTransform, rowTransformKind);
+		rows += *ribbon * 4;
 	}
-}
\ No newline at end of file
+}
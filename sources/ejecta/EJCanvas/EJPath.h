@@ -4,17 +4,37 @@
 #include <math.h>
 #include <vector>
 #include "EJCanvas2DTypes.h"
+#include "EJVertexTransform.h"
 #include "EJCanvasContext.h"
 #include "../EJCocoa/support/NSPlatformMacros.h"
 
-#define EJ_PATH_RECURSION_LIMIT 8
-#define EJ_PATH_DISTANCE_EPSILON 1.0f
-#define EJ_PATH_COLLINEARITY_EPSILON FLT_EPSILON
-#define EJ_PATH_STEPS_FOR_CIRCLE 48.0f
-
+// Maximum distance in screen pixels between a flattened curve or arc and the
+// real one. Segment counts are derived from this and the on-screen size, so
+// small circles get few vertices and big ones stay smooth.
+#define EJ_PATH_FLATTEN_TOLERANCE 0.25f
+#define EJ_PATH_MAX_CURVE_SEGMENTS 256
+#define EJ_PATH_MIN_STEPS_FOR_CIRCLE 8
+#define EJ_PATH_MAX_STEPS_FOR_CIRCLE 512
+
+// Fills of simple polygons are triangulated on the CPU instead of going
+// through the stencil buffer; clips mark the stencil with the same triangles
+// instead of counting windings. Concave subpaths with more points than this
+// (ear clipping is quadratic) and paths with more subpaths still use the
+// winding count.
+#define EJ_PATH_MAX_TRIANGULATION_POINTS 128
+#define EJ_PATH_MAX_TRIANGULATION_SUBPATHS 32
+
+// Anti-aliased lines thinner than this many pixels are drawn without joins
+// and caps and with their coverage scaled to their width.
+#define EJ_PATH_HAIRLINE_WIDTH 2.0f
+#define EJ_PATH_HAIRLINE_MITER_LIMIT 2.0f
+
+// The stencil target only marks the filled area in the stencil buffer and
+// leaves the stencil test enabled, for the caller to cover it (see
+// EJCanvasContext::clip())
 typedef enum {
 	kEJPathPolygonTargetColor,
-	kEJPathPolygonTargetDepth
+	kEJPathPolygonTargetStencil
 } EJPathPolygonTarget;
 
 
@@ -27,6 +47,16 @@ typedef struct {
 } subpath_t;
 typedef std::vector<subpath_t> path_t;
 
+typedef struct {
+	float lineWidth;
+	EJLineCap lineCap;
+	EJLineJoin lineJoin;
+	float miterLimit;
+	float scale;
+	bool antialias;
+	CGAffineTransform transform;
+} EJPathStrokeStyle;
+
 class EJCanvasContext;
 
 class EJPath: public NSObject {
@@ -38,16 +68,44 @@ private:
 	EJVector2 minPos, maxPos;
 	int longestSubpath;
 
-	GLubyte stencilMask;
-
-	float distanceTolerance;
+	// Triangulated fill, stored as 4 indices per quad like the context's
+	// vertex buffer, into the outlines of all subpaths; only valid if the path
+	// could be triangulated at all
+	std::vector<int> fillIndices;
+	points_t fillOutline;
+	std::vector<int> fillOutlineCounts;
+	points_t fillInset;
+	bool fillQuadsValid;
+	bool fillQuadsComputed;
+
+	// Stroke geometry in untransformed space, as ribbons of rows with 4
+	// vertices each (see EJCanvasContext::pushRibbon()); strokeRibbons holds
+	// the number of rows of each ribbon. It's only rebuilt when the path or
+	// the line style changes.
+	points_t strokeRows;
+	std::vector<int> strokeRibbons;
+	float strokeCoverage;
+	EJPathStrokeStyle strokeStyle;
+	bool strokeRowsComputed;
 
 	EJPath* copyWithZone(NSZone * zone);
-	void drawArcToContext(EJCanvasContext * context, EJVector2 point,
-			EJVector2 p1, EJVector2 p2, EJColorRGBA color);
+	float toleranceForScale(float scale);
+	bool triangulate();
+	bool triangulateSubpath(const points_t &points);
+	void pushFill(EJCanvasContext * context, const EJVector2 * outline,
+			EJColorRGBA color, CGAffineTransform transform);
+	void tessellateLines(EJCanvasState * state, float pxScale, bool antialias);
+	void tessellateCap(EJVector2 point, EJVector2 dir, bool start,
+			EJLineCap cap, float inner, float outer, float pxScale);
+	void tessellateJoin(EJVector2 point, EJVector2 dirA, EJVector2 dirB,
+			float lenA, float lenB, EJLineJoin join, float miterLimit,
+			float inner, float outer, float pxScale);
+	void tessellateHairline(const points_t &points, bool closed,
+			EJLineCap cap, float inner, float outer);
 
 public:
 	CGAffineTransform transform;
+	EJTransformKind transformKind;
 
 	EJPath();
 
@@ -59,19 +117,26 @@ public:
 	void lineTo(float x, float y);
 	void bezierCurveTo(float cpx1, float cpy1, float cpx2, float cpy2,
 			float x, float y, float scale);
-	void recursiveBezier(float x1, float y1, float x2, float y2, float x3,
-			float y3, float x4, float y4, int level);
 	void quadraticCurveTo(float cpx, float cpy, float x, float y,
 			float scale);
-	void recursiveQuadratic(float x1, float y1, float x2, float y2, float x3,
-			float y3, int level);
-	void arcTo(float x1, float y1, float x2, float y2, float radius);
+	void arcTo(float x1, float y1, float x2, float y2, float radius,
+			float scale);
 	void arc(float x, float y, float radius, float startAngle, float endAngle,
-			bool antiClockwise);
+			bool antiClockwise, float scale);
+
+	// Bounds of the stored points; false if there's nothing to fill
+	bool getBounds(EJVector2 &min, EJVector2 &max);
+	// True if the path is a single rect with edges parallel to the axes
+	bool getAxisAlignedRect(EJVector2 &min, EJVector2 &max);
 
+	// The pointsTransform is applied to the stored points when submitting them,
+	// so that paths recorded in untransformed space (Path2D) can be drawn with
+	// the context's current transform without being tessellated again.
 	void drawPolygonsToContext(EJCanvasContext * context,
-			EJPathPolygonTarget target);
-	void drawLinesToContext(EJCanvasContext * context);
+			EJPathPolygonTarget target,
+			CGAffineTransform pointsTransform = CGAffineTransformIdentity);
+	void drawLinesToContext(EJCanvasContext * context,
+			CGAffineTransform pointsTransform = CGAffineTransformIdentity);
 
 };
 
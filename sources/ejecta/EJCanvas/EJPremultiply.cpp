@@ -0,0 +1,124 @@
+#include <pthread.h>
+
+#include "EJPremultiply.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EJ_PREMULTIPLY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(EJ_PREMULTIPLY_NEON) && defined(__ANDROID__)
+#include <cpu-features.h>
+#endif
+
+typedef void (*EJPremultiplyFunction)( unsigned char * pixels, size_t count );
+
+
+// Exact rounded division by 255 for products of two bytes
+static inline unsigned char EJPremultiplyDiv255( unsigned int value ) {
+	value += 128;
+	return (unsigned char)((value + (value >> 8)) >> 8);
+}
+
+void EJPremultiplyPixelsScalar( unsigned char * pixels, size_t count ) {
+	for( size_t i = 0; i < count; i++, pixels += 4 ) {
+		unsigned int a = pixels[3];
+		if( a == 255 ) { continue; }
+		pixels[0] = EJPremultiplyDiv255(pixels[0] * a);
+		pixels[1] = EJPremultiplyDiv255(pixels[1] * a);
+		pixels[2] = EJPremultiplyDiv255(pixels[2] * a);
+	}
+}
+
+#ifdef EJ_PREMULTIPLY_SSE2
+static void EJPremultiplyPixelsSSE2( unsigned char * pixels, size_t count ) {
+	// Each pixel's components are widened to 16 bit and multiplied with
+	// a,a,a,255; the alpha lane divides back to itself
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i keepAlpha = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	const __m128i opaque = _mm_set1_epi32(0xff000000);
+	const __m128i round = _mm_set1_epi16(128);
+
+	size_t i = 0;
+	for( ; i + 4 <= count; i += 4, pixels += 16 ) {
+		__m128i p = _mm_loadu_si128((const __m128i *)pixels);
+
+		// Nothing to do for four opaque pixels, the common case in most images
+		if( _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(p, opaque), opaque)) == 0xffff ) {
+			continue;
+		}
+
+		__m128i lo = _mm_unpacklo_epi8(p, zero);
+		__m128i hi = _mm_unpackhi_epi8(p, zero);
+		__m128i alphaLo = _mm_or_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff), keepAlpha);
+		__m128i alphaHi = _mm_or_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff), keepAlpha);
+
+		lo = _mm_add_epi16(_mm_mullo_epi16(lo, alphaLo), round);
+		hi = _mm_add_epi16(_mm_mullo_epi16(hi, alphaHi), round);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128((__m128i *)pixels, _mm_packus_epi16(lo, hi));
+	}
+	EJPremultiplyPixelsScalar(pixels, count - i);
+}
+#endif
+
+static EJPremultiplyFunction EJPremultiplySelectedFunction = EJPremultiplyPixelsScalar;
+static pthread_once_t EJPremultiplySelectOnce = PTHREAD_ONCE_INIT;
+
+static void EJPremultiplySelectFunction() {
+	EJPremultiplyFunction function = EJPremultiplyPixelsScalar;
+#if defined(EJ_PREMULTIPLY_NEON)
+	#if defined(__ANDROID__)
+	if(
+		android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM &&
+		(android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON)
+	) {
+		function = EJPremultiplyPixelsNEON;
+	}
+	#else
+	function = EJPremultiplyPixelsNEON;
+	#endif
+#elif defined(EJ_PREMULTIPLY_SSE2)
+	function = EJPremultiplyPixelsSSE2;
+#endif
+	EJPremultiplySelectedFunction = function;
+}
+
+static EJPremultiplyFunction EJPremultiplySIMDFunction() {
+	// Called from the texture loader threads as well as the GL thread
+	pthread_once(&EJPremultiplySelectOnce, EJPremultiplySelectFunction);
+	return EJPremultiplySelectedFunction;
+}
+
+void EJPremultiplyPixels( unsigned char * pixels, size_t count ) {
+	EJPremultiplySIMDFunction()(pixels, count);
+}
+
+void EJPremultiplyImage( unsigned char * pixels, unsigned int width, unsigned int height, unsigned int stride ) {
+	EJPremultiplyFunction function = EJPremultiplySIMDFunction();
+	if( width == stride ) {
+		function(pixels, (size_t)width * height);
+		return;
+	}
+	for( unsigned int y = 0; y < height; y++ ) {
+		function(pixels + (size_t)y * stride * 4, width);
+	}
+}
+
+void EJUnpremultiplyPixels( unsigned char * pixels, size_t count ) {
+	// Only used when reading pixels back, which isn't worth a SIMD kernel
+	for( size_t i = 0; i < count; i++, pixels += 4 ) {
+		unsigned int a = pixels[3];
+		if( a == 255 ) { continue; }
+		if( a == 0 ) {
+			pixels[0] = pixels[1] = pixels[2] = 0;
+			continue;
+		}
+		for( int c = 0; c < 3; c++ ) {
+			unsigned int value = (pixels[c] * 255 + a / 2) / a;
+			pixels[c] = (unsigned char)(value > 255 ? 255 : value);
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef __EJ_PREMULTIPLY_H__
+#define __EJ_PREMULTIPLY_H__
+
+#include <stddef.h>
+
+// Textures and the canvas store RGBA pixels with premultiplied alpha, so
+// that filtering doesn't bleed the color of transparent pixels into edges
+// and all composite operations work with the same blend math. Image pixels
+// are premultiplied once, when they are decoded or put into the canvas, and
+// unpremultiplied when they are read back for getImageData().
+
+// Premultiplies count RGBA pixels in place, rounding like (c * a + 127) / 255.
+// Uses NEON or SSE2 kernels that process 8 and 4 pixels per iteration where
+// available.
+void EJPremultiplyPixels( unsigned char * pixels, size_t count );
+
+// Premultiplies the upper left width x height pixels of an image with rows
+// of stride pixels, e.g. a texture padded to a power of two
+void EJPremultiplyImage( unsigned char * pixels, unsigned int width, unsigned int height, unsigned int stride );
+
+// Plain C version, used for the remainder of a row and if no SIMD kernel is
+// available
+void EJPremultiplyPixelsScalar( unsigned char * pixels, size_t count );
+
+// Reverses EJPremultiplyPixels() as far as the precision allows; the color
+// of fully transparent pixels is lost and becomes black
+void EJUnpremultiplyPixels( unsigned char * pixels, size_t count );
+
+#ifdef EJ_PREMULTIPLY_NEON
+// Implemented in EJPremultiplyNEON.cpp, which is compiled with NEON enabled;
+// only called if the CPU supports it
+void EJPremultiplyPixelsNEON( unsigned char * pixels, size_t count );
+#endif
+
+#endif // __EJ_PREMULTIPLY_H__
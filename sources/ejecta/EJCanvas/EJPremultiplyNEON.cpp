@@ -0,0 +1,24 @@
+#include "EJPremultiply.h"
+
+#if defined(EJ_PREMULTIPLY_NEON) && defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+// Rounded division by 255 of the 16 bit products: (p + ((p + 128) >> 8) + 128) >> 8
+static inline uint8x8_t EJPremultiplyDiv255NEON( uint16x8_t p ) {
+	return vraddhn_u16(p, vrshrq_n_u16(p, 8));
+}
+
+void EJPremultiplyPixelsNEON( unsigned char * pixels, size_t count ) {
+	size_t i = 0;
+	for( ; i + 8 <= count; i += 8, pixels += 32 ) {
+		// De-interleaved load: val[0..3] hold r, g, b and a of 8 pixels
+		uint8x8x4_t p = vld4_u8(pixels);
+		p.val[0] = EJPremultiplyDiv255NEON(vmull_u8(p.val[0], p.val[3]));
+		p.val[1] = EJPremultiplyDiv255NEON(vmull_u8(p.val[1], p.val[3]));
+		p.val[2] = EJPremultiplyDiv255NEON(vmull_u8(p.val[2], p.val[3]));
+		vst4_u8(pixels, p);
+	}
+	EJPremultiplyPixelsScalar(pixels, count - i);
+}
+
+#endif
@@ -1,12 +1,119 @@
-#include <math.h>
 #include "EJTexture.h"
 #include "../lodepng/lodepng.h"
 #include "../lodejpeg/lodejpeg.h"
+#include "EJTextureAtlas.h"
+#include "EJTextureCache.h"
+#include "EJGLState.h"
+#include "EJPremultiply.h"
 
 
 // Textures check this global filter state when binding
 static GLint EJTextureGlobalFilter = GL_LINEAR;
 
+unsigned int EJTexture::contentGeneration = 0;
+
+EJTexture * EJTexture::lruHead = NULL;
+EJTexture * EJTexture::lruTail = NULL;
+
+static EJTextureMemoryStats EJTextureMemory = {0, 0, EJ_TEXTURE_MEMORY_BUDGET, 0, 0, 0};
+static float EJTextureDownscaleLimit = EJ_TEXTURE_DOWNSCALE_LIMIT;
+static unsigned int EJTextureFrame = 0;
+static bool EJTextureMipmaps = EJ_TEXTURE_MIPMAPS;
+
+bool EJTexture::allowsNPOT(bool mipmaps) {
+	// All textures use CLAMP_TO_EDGE, which even the limited NPOT support that
+	// GLES2 guarantees allows, but only full NPOT support includes mipmaps
+	EJGLNPOTSupport support = EJGLState::getInstance()->getNPOTSupport();
+	return EJ_TEXTURE_NPOT && (mipmaps ? support == kEJGLNPOTFull : support != kEJGLNPOTNone);
+}
+
+static int EJTextureNextPowerOfTwo(int value) {
+	int pot = 1;
+	while( pot < value ) {
+		pot <<= 1;
+	}
+	return pot;
+}
+
+float EJTexture::getDownscaleLimit() {
+	return EJTextureDownscaleLimit;
+}
+
+void EJTexture::setDownscaleLimit(float limit) {
+	EJTextureDownscaleLimit = limit;
+}
+
+int EJTexture::downscaleFactor(int width, int height, int maxSize) {
+	int size = width > height ? width : height;
+	int factor = 1;
+	while( maxSize > 0 && factor < EJ_TEXTURE_MAX_DOWNSCALE && (size + factor - 1) / factor > maxSize ) {
+		factor *= 2;
+	}
+	return factor;
+}
+
+// Averages blocks of factor x factor pixels, weighted by their alpha so that
+// transparent pixels don't darken the edges. Works in place; the reduced
+// image ends up at the start of the buffer, as no block reads from before
+// the pixel it is written to.
+static void EJTextureBoxReduce(GLubyte * pixels, unsigned int width, unsigned int height, int factor,
+	unsigned int * reducedWidth, unsigned int * reducedHeight
+) {
+	unsigned int rw = (width + factor - 1) / factor;
+	unsigned int rh = (height + factor - 1) / factor;
+
+	for( unsigned int y = 0; y < rh; y++ ) {
+		unsigned int y0 = y * factor;
+		unsigned int y1 = (y0 + factor < height) ? y0 + factor : height;
+		for( unsigned int x = 0; x < rw; x++ ) {
+			unsigned int x0 = x * factor;
+			unsigned int x1 = (x0 + factor < width) ? x0 + factor : width;
+
+			unsigned int r = 0, g = 0, b = 0, a = 0;
+			for( unsigned int sy = y0; sy < y1; sy++ ) {
+				GLubyte * p = &pixels[(sy * width + x0) * 4];
+				for( unsigned int sx = x0; sx < x1; sx++, p += 4 ) {
+					r += p[0] * p[3];
+					g += p[1] * p[3];
+					b += p[2] * p[3];
+					a += p[3];
+				}
+			}
+
+			GLubyte * out = &pixels[(y * rw + x) * 4];
+			out[0] = a ? r / a : 0;
+			out[1] = a ? g / a : 0;
+			out[2] = a ? b / a : 0;
+			out[3] = a / ((y1 - y0) * (x1 - x0));
+		}
+	}
+
+	*reducedWidth = rw;
+	*reducedHeight = rh;
+}
+
+static GLubyte * EJTextureDownscaleAndPad(GLubyte * pixels, unsigned int * w, unsigned int * h,
+	int factor, bool powerOfTwo
+) {
+	if( factor > 1 ) {
+		EJTextureBoxReduce(pixels, *w, *h, factor, w, h);
+		GLubyte * reduced = (GLubyte *)realloc(pixels, (*w) * (*h) * 4);
+		if( reduced ) {
+			pixels = reduced;
+		}
+	}
+	if( powerOfTwo ) {
+		pixels = EJTexture::padPixels(pixels, *w, *h, EJTextureNextPowerOfTwo(*w), EJTextureNextPowerOfTwo(*h));
+	}
+	return pixels;
+}
+
+// Textures store premultiplied alpha. Decoders premultiply last, after the box
+// filter, which needs straight alpha to weight the colors.
+static void EJTexturePremultiply(GLubyte * pixels, unsigned int w, unsigned int h, bool powerOfTwo) {
+	EJPremultiplyImage(pixels, w, h, powerOfTwo ? EJTextureNextPowerOfTwo(w) : w);
+}
+
 bool EJTexture::smoothScaling() {
 	return (EJTextureGlobalFilter == GL_LINEAR);
 }
@@ -15,46 +122,209 @@ void EJTexture::setSmoothScaling(bool smoothScaling) {
 	EJTextureGlobalFilter = smoothScaling ? GL_LINEAR : GL_NEAREST;
 }
 
-EJTexture::EJTexture() : textureId(0), width(0), height(0), realWidth(0), realHeight(0) {
+bool EJTexture::mipmapsEnabled() {
+	return EJTextureMipmaps;
+}
+
+void EJTexture::setMipmapsEnabled(bool enabled) {
+	EJTextureMipmaps = enabled;
+}
+
+GLint EJTexture::minFilterFor(GLint filter, bool mipmaps) {
+	// Trilinear filtering when smoothing; without it, minified pixel art still
+	// picks the closest level instead of skipping texels
+	if( !mipmaps ) {
+		return filter;
+	}
+	return filter == GL_NEAREST ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
+}
+
+int EJTexture::mipmapPixels(int width, int height) {
+	int pixels = width * height;
+	while( width > 1 || height > 1 ) {
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		pixels += width * height;
+	}
+	return pixels;
+}
+
+// Averages 2x2 blocks of the level above. The row and column left over for
+// odd sizes are merged into the last block, so that no pixel is skipped. The
+// pixels are premultiplied, so a plain average is correct.
+static void EJTextureReduceMipmap(const GLubyte * src, int width, int height, GLubyte * dst) {
+	int dw = width > 1 ? width / 2 : 1;
+	int dh = height > 1 ? height / 2 : 1;
+	int stride = width * 4;
+
+	for( int y = 0; y < dh; y++ ) {
+		int ny = height == 1 ? 1 : ((y == dh - 1 && (height & 1)) ? 3 : 2);
+		const GLubyte * row = &src[(height > 1 ? y * 2 : 0) * stride];
+		for( int x = 0; x < dw; x++, dst += 4 ) {
+			int nx = width == 1 ? 1 : ((x == dw - 1 && (width & 1)) ? 3 : 2);
+			const GLubyte * p = &row[(width > 1 ? x * 2 : 0) * 4];
+			if( nx == 2 && ny == 2 ) {
+				for( int c = 0; c < 4; c++ ) {
+					dst[c] = (p[c] + p[c + 4] + p[c + stride] + p[c + stride + 4] + 2) >> 2;
+				}
+				continue;
+			}
+
+			int n = nx * ny;
+			for( int c = 0; c < 4; c++ ) {
+				int sum = 0;
+				for( int sy = 0; sy < ny; sy++ ) {
+					for( int sx = 0; sx < nx; sx++ ) {
+						sum += p[sy * stride + sx * 4 + c];
+					}
+				}
+				dst[c] = (sum + n / 2) / n;
+			}
+		}
+	}
+}
+
+bool EJTexture::appendMipmaps(GLubyte ** pixels, int width, int height, bool powerOfTwo) {
+	int w = powerOfTwo ? EJTextureNextPowerOfTwo(width) : width;
+	int h = powerOfTwo ? EJTextureNextPowerOfTwo(height) : height;
+	GLubyte * chain = (GLubyte *)realloc(*pixels, (size_t)mipmapPixels(w, h) * 4);
+	if( !chain ) {
+		return false;
+	}
+	*pixels = chain;
+
+	GLubyte * level = chain;
+	while( w > 1 || h > 1 ) {
+		GLubyte * next = level + (size_t)w * h * 4;
+		EJTextureReduceMipmap(level, w, h, next);
+		level = next;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	return true;
+}
+
+void EJTexture::uploadPixels(GLubyte * pixels, GLenum format, int realWidth, int realHeight,
+	bool mipmaps, bool mipmapLevels
+) {
+	glTexImage2D(GL_TEXTURE_2D, 0, format, realWidth, realHeight, 0, format, GL_UNSIGNED_BYTE, pixels);
+	if( !mipmaps ) {
+		return;
+	}
+	if( !mipmapLevels || !pixels ) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+		return;
+	}
+
+	// The levels follow each other in the buffer, as added by appendMipmaps()
+	int bytesPerPixel = (format == GL_ALPHA || format == GL_LUMINANCE) ? 1 : 4;
+	int w = realWidth, h = realHeight;
+	for( int level = 1; w > 1 || h > 1; level++ ) {
+		pixels += (size_t)w * h * bytesPerPixel;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+		glTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, format, GL_UNSIGNED_BYTE, pixels);
+	}
+}
+
+EJTexture::EJTexture() : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(0), mipmaps(false),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
 }
 
-EJTexture::EJTexture(NSString * path) : textureId(0), width(0), height(0), realWidth(0), realHeight(0) {
+EJTexture::EJTexture(NSString * path) : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(0), mipmaps(false),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
 	// For loading on the main thread (blocking)
 	contentScale = 1;
 	path->retain();
 	fullPath = path;
+
+	EJCompressedImage image, alphaImage;
+	if( loadCompressedFromPath(path->getCString(), EJGLState::getInstance()->getCompressedTextureSupport(),
+		allowsNPOT(), &image, &alphaImage)
+	) {
+		initWithCompressedImage(&image, &alphaImage);
+		EJCompressedTextureFree(&image);
+		EJCompressedTextureFree(&alphaImage);
+		return;
+	}
+
 	GLubyte * pixels = loadPixelsFromPath(path);
 	createTextureWithPixels(pixels, GL_RGBA);
+	reloadable = (pixels != NULL);
+	markUsed();
 	free(pixels);
 }
 
-EJTexture::EJTexture(NSString * path, NSObject* sharegroup) : textureId(0), width(0), height(0), realWidth(0), realHeight(0) {
-	//For loading in a background thread
-
-	// If we're running on the main thread for some reason, take care
-	// to not corrupt the current EAGLContext
-	bool isMainThread = true;
+EJTexture::EJTexture(NSString * path, GLubyte * pixels, int widthp, int heightp, bool allowAtlas, float scale, int maxSizep, bool mipmapsp, bool mipmapLevels) : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(maxSizep), mipmaps(mipmapsp),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
+	// For pixels that were decoded in a background thread; only the upload
+	// happens here
 
-	contentScale = 1;
+	contentScale = scale;
 	path->retain();
 	fullPath = path;
-	GLubyte * pixels = loadPixelsFromPath(path);
 
 	if( pixels ) {
-
-		
-		createTextureWithPixels(pixels, GL_RGBA);
-
-		if( !isMainThread ) {
-			glFlush();
-			//[context release];
+		setWidthAndHeight(widthp, heightp);
+
+		// Small images are packed into a shared atlas page, so that drawing
+		// them doesn't require a texture switch. Mipmaps would bleed into the
+		// neighbouring images.
+		if( mipmaps || !allowAtlas || !EJTextureAtlas::getInstance()->insertTexture(this, pixels) ) {
+			createTextureWithPixels(pixels, GL_RGBA, mipmapLevels);
+			reloadable = true;
+			markUsed();
 		}
 
 		free(pixels);
 	}
 }
 
-EJTexture::EJTexture(int widthp, int heightp, GLenum formatp) : textureId(0), width(0), height(0), realWidth(0), realHeight(0) {
+EJTexture::EJTexture(NSString * path, GLuint uploadedTextureId, int widthp, int heightp, GLint filter, float scale, int maxSizep, bool mipmapsp) : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(maxSizep), mipmaps(mipmapsp),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
+	// For textures uploaded by the EJTextureLoader's upload thread; the
+	// texture is complete once its fence signaled
+
+	contentScale = scale;
+	path->retain();
+	fullPath = path;
+	setWidthAndHeight(widthp, heightp);
+
+	format = GL_RGBA;
+	textureFilter = filter;
+	textureId = uploadedTextureId;
+	trackMemory();
+	contentGeneration++;
+
+	reloadable = true;
+	markUsed();
+}
+
+EJTexture::EJTexture(NSString * path, const EJCompressedImage * image, const EJCompressedImage * alphaImage) : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(0), mipmaps(false),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
+	// For compressed files that were read in a background thread
+	contentScale = 1;
+	path->retain();
+	fullPath = path;
+	initWithCompressedImage(image, alphaImage);
+}
+
+void EJTexture::initWithCompressedImage(const EJCompressedImage * image, const EJCompressedImage * alphaImage) {
+	createTextureWithCompressedImage(image);
+	reloadable = true;
+	markUsed();
+
+	// The alpha image is a texture of its own, so it's evicted and reloaded
+	// independently
+	if( alphaImage && alphaImage->data ) {
+		char * alphaPath = EJCompressedTextureAlphaPath(fullPath->getCString());
+		alphaTexture = new EJTexture(NSStringMake(alphaPath), alphaImage, NULL);
+		free(alphaPath);
+	}
+}
+
+EJTexture::EJTexture(int widthp, int heightp, GLenum formatp) : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(0), mipmaps(false),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
 	// Create an empty texture
 	contentScale = 1;
 	NSString* empty = NSStringMake("[Empty]");
@@ -64,7 +334,8 @@ EJTexture::EJTexture(int widthp, int heightp, GLenum formatp) : textureId(0), wi
 	createTextureWithPixels(NULL, formatp);
 }
 
-EJTexture::EJTexture(int widthp, int heightp) : textureId(0), width(0), height(0), realWidth(0), realHeight(0) {
+EJTexture::EJTexture(int widthp, int heightp) : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(0), mipmaps(false),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
 	// Create an empty RGBA texture
 	//EJTexture(widthp, heightp, GL_RGBA);
 	contentScale = 1;
@@ -75,8 +346,10 @@ EJTexture::EJTexture(int widthp, int heightp) : textureId(0), width(0), height(0
 	createTextureWithPixels(NULL, GL_RGBA);
 }
 
-EJTexture::EJTexture(int widthp, int heightp, GLubyte * pixels) : textureId(0), width(0), height(0), realWidth(0), realHeight(0) {
-	// Creates a texture with the given pixels
+EJTexture::EJTexture(int widthp, int heightp, GLubyte * pixels) : memoryBytes(0), reloadable(false), evicted(false), lastUseFrame(0), lruPrev(NULL), lruNext(NULL), cacheKey(NULL), maxSize(0), mipmaps(false),
+	textureId(0), width(0), height(0), realWidth(0), realHeight(0), atlasPage(NULL), atlasX(0), atlasY(0), alphaTexture(NULL) {
+	// Creates a texture with the given pixels. They have straight alpha, like
+	// ImageData, and are left untouched; the texture gets a premultiplied copy.
 
 	contentScale = 1;
 	NSString* empty = NSStringMake("[From Pixels]");
@@ -84,67 +357,226 @@ EJTexture::EJTexture(int widthp, int heightp, GLubyte * pixels) : textureId(0),
 	fullPath = empty;
 	setWidthAndHeight(widthp, heightp);
 	
-	if( width != realWidth || height != realHeight ) {
-		GLubyte * pixelsPow2 = (GLubyte *)calloc( realWidth * realHeight * 4, sizeof(GLubyte) );
-		for( int y = 0; y < height; y++ ) {
-			memcpy( &pixelsPow2[y*realWidth*4], &pixels[y*width*4], width * 4 );
-		}
-		createTextureWithPixels(pixelsPow2, GL_RGBA);
-		free(pixelsPow2);
-	}
-	else {
-		createTextureWithPixels(pixels, GL_RGBA);
+	GLubyte * premultiplied = (width != realWidth || height != realHeight)
+		? (GLubyte *)calloc( realWidth * realHeight * 4, sizeof(GLubyte) )
+		: (GLubyte *)malloc( realWidth * realHeight * 4 );
+	for( int y = 0; y < height; y++ ) {
+		memcpy( &premultiplied[y*realWidth*4], &pixels[y*width*4], width * 4 );
 	}
+	EJPremultiplyImage(premultiplied, width, height, realWidth);
+	createTextureWithPixels(premultiplied, GL_RGBA);
+	free(premultiplied);
 }
 
 EJTexture::~EJTexture() {
+	if( cacheKey ) {
+		EJTextureCache::getInstance()->removeTexture(this);
+	}
 	if(fullPath)fullPath->release();
-	glDeleteTextures( 1, &textureId );
+	if( alphaTexture ) {
+		alphaTexture->release();
+	}
+	if( atlasPage ) {
+		atlasPage->release();
+	}
+	else {
+		releaseMemory();
+	}
+	lruUnlink();
 }
 
 void EJTexture::setWidthAndHeight(int widthp, int heightp) {
 	width = widthp;
 	height = heightp;
 
-	// The internal (real) size of the texture needs to be a power of two
-	realWidth = pow(2, ceil(log10((double)width)/log10(2.0)));
-	realHeight = pow(2, ceil(log10((double)height)/log10(2.0)));
+	realWidth = realSizeFor(width, mipmaps);
+	realHeight = realSizeFor(height, mipmaps);
 }
 
-void EJTexture::createTextureWithPixels(GLubyte * pixels, GLenum formatp) {
-	// Release previous texture if we had one
-	if (textureId) {
-		glDeleteTextures(1, &textureId);
-		textureId = 0;
+int EJTexture::realSizeFor(int size, bool mipmaps) {
+	// Without NPOT support the internal (real) size of the texture needs to
+	// be a power of two
+	return allowsNPOT(mipmaps) ? size : EJTextureNextPowerOfTwo(size);
+}
+
+GLubyte * EJTexture::padPixels(GLubyte * pixels, int width, int height, int realWidth, int realHeight) {
+	// Exact size textures are uploaded straight from the decoder's buffer
+	if( width == realWidth && height == realHeight ) {
+		return pixels;
 	}
 
-	GLint maxTextureSize;
-	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	// Copy the original pixels into the upper left corner of a larger
+	// (power of 2) pixel buffer, free the original pixels and return
+	// the larger buffer
+	GLubyte * padded = (GLubyte *)calloc( realWidth * realHeight * 4, sizeof(GLubyte) );
+	for( int y = 0; y < height; y++ ) {
+		memcpy( &padded[y*realWidth*4], &pixels[y*width*4], width*4 );
+	}
+
+	free( pixels );
+	return padded;
+}
+
+void EJTexture::createTextureWithPixels(GLubyte * pixels, GLenum formatp, bool mipmapLevels) {
+	// Release previous texture if we had one
+	EJGLState * glState = EJGLState::getInstance();
+	releaseMemory();
+
+	GLint maxTextureSize = glState->getMaxTextureSize();
 
 	if (realWidth > maxTextureSize || realHeight > maxTextureSize) {
 		NSLOG("Warning: Image %s larger than MAX_TEXTURE_SIZE (%d)", fullPath->getCString(), maxTextureSize);
 	}
 	format = formatp;
 
-	GLint boundTexture = 0;
-	glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+	GLuint boundTexture = glState->getBoundTexture();
 
 	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	glState->bindTexture(textureId);
 
 	setFilter(EJTextureGlobalFilter);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, format, realWidth, realHeight, 0, format,
-			GL_UNSIGNED_BYTE, pixels);
+	// Rows are tightly packed, e.g. for GL_ALPHA font bitmaps of any width
+	glState->setUnpackAlignment(1);
+	uploadPixels(pixels, format, realWidth, realHeight, mipmaps, mipmapLevels);
+	contentGeneration++;
+	trackMemory();
+
+	if (boundTexture != EJ_GL_STATE_UNKNOWN) {
+		glState->bindTexture(boundTexture);
+	}
+}
+
+void EJTexture::createTextureWithCompressedImage(const EJCompressedImage * image) {
+	EJGLState * glState = EJGLState::getInstance();
+	releaseMemory();
+
+	// Compressed textures can't be padded, so they always have their exact
+	// size; loadCompressedFromPath() only accepts NPOT sizes if allowed
+	width = realWidth = image->width;
+	height = realHeight = image->height;
+	format = EJCompressedTextureUploadFormat(image->internalFormat, glState->getCompressedTextureSupport());
+
+	GLuint boundTexture = glState->getBoundTexture();
+
+	glGenTextures(1, &textureId);
+	glState->bindTexture(textureId);
+
+	setFilter(EJTextureGlobalFilter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glCompressedTexImage2D(GL_TEXTURE_2D, 0, format, realWidth, realHeight, 0, image->dataSize, image->data);
+	contentGeneration++;
+	trackMemory();
+
+	if (boundTexture != EJ_GL_STATE_UNKNOWN) {
+		glState->bindTexture(boundTexture);
+	}
+}
+
+void EJTexture::trackMemory() {
+	int bytesPerPixel = (format == GL_ALPHA || format == GL_LUMINANCE) ? 1 : (format == GL_RGB ? 3 : 4);
+	memoryBytes = isCompressed()
+		? EJCompressedTextureDataSize(format, realWidth, realHeight)
+		: (mipmaps ? mipmapPixels(realWidth, realHeight) : realWidth * realHeight) * bytesPerPixel;
+	EJTextureMemory.usedBytes += memoryBytes;
+	EJTextureMemory.textures++;
+	if( EJTextureMemory.usedBytes > EJTextureMemory.highWaterBytes ) {
+		EJTextureMemory.highWaterBytes = EJTextureMemory.usedBytes;
+	}
+}
+
+void EJTexture::releaseMemory() {
+	if( !textureId ) { return; }
+	
+	EJGLState::getInstance()->deleteTexture(textureId);
+	textureId = 0;
+	
+	EJTextureMemory.usedBytes -= memoryBytes;
+	EJTextureMemory.textures--;
+	memoryBytes = 0;
+}
+
+void EJTexture::evict() {
+	releaseMemory();
+	lruUnlink();
+	evicted = true;
+	EJTextureMemory.evictions++;
+}
+
+void EJTexture::reload() {
+	// Blocks, but only happens for textures that weren't drawn for a while
+	if( isCompressed() ) {
+		EJCompressedImage image;
+		if( EJCompressedTextureLoad(&image, fullPath->getCString()) ) {
+			createTextureWithCompressedImage(&image);
+			EJCompressedTextureFree(&image);
+		}
+		evicted = false;
+		EJTextureMemory.reloads++;
+		NSLOG("Reloaded evicted texture %s", fullPath->getCString());
+		return;
+	}
+
+	GLubyte * pixels = loadPixelsFromPath(fullPath);
+	if( pixels ) {
+		createTextureWithPixels(pixels, format);
+		free(pixels);
+	}
+	evicted = false;
+	EJTextureMemory.reloads++;
+	NSLOG("Reloaded evicted texture %s", fullPath->getCString());
+}
+
+void EJTexture::lruUnlink() {
+	if( lruPrev ) { lruPrev->lruNext = lruNext; }
+	else if( lruHead == this ) { lruHead = lruNext; }
+	
+	if( lruNext ) { lruNext->lruPrev = lruPrev; }
+	else if( lruTail == this ) { lruTail = lruPrev; }
+	
+	lruPrev = lruNext = NULL;
+}
+
+void EJTexture::markUsed() {
+	lastUseFrame = EJTextureFrame;
+	if( !reloadable || evicted || lruHead == this ) { return; }
+	
+	// Move to the front of the list
+	lruUnlink();
+	lruNext = lruHead;
+	if( lruHead ) { lruHead->lruPrev = this; }
+	lruHead = this;
+	if( !lruTail ) { lruTail = this; }
+}
 
-	glBindTexture(GL_TEXTURE_2D, boundTexture);
+void EJTexture::enforceMemoryBudget() {
+	// Textures used in this frame are never evicted; if those alone exceed
+	// the budget there's nothing we can do
+	while(
+		EJTextureMemory.usedBytes > EJTextureMemory.budgetBytes &&
+		lruTail && lruTail->lastUseFrame != EJTextureFrame
+	) {
+		NSLOG("Evicting texture %s (%d bytes)", lruTail->fullPath->getCString(), lruTail->memoryBytes);
+		lruTail->evict();
+	}
+	EJTextureFrame++;
+}
+
+void EJTexture::setMemoryBudget(int bytes) {
+	EJTextureMemory.budgetBytes = bytes;
+}
+
+EJTextureMemoryStats EJTexture::getMemoryStats() {
+	return EJTextureMemory;
 }
 
 void EJTexture::setFilter(GLint filter) {
 	textureFilter = filter;
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, textureFilter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilterFor(textureFilter, mipmaps));
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, textureFilter);
 }
 
@@ -155,94 +587,294 @@ void EJTexture::updateTextureWithPixels(GLubyte * pixels, int x, int y,
 		return;
 	}
 
-	int boundTexture = 0;
-	glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+	EJGLState * glState = EJGLState::getInstance();
+	GLuint boundTexture = glState->getBoundTexture();
 
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	glState->bindTexture(textureId);
+	glState->setUnpackAlignment(1);
 	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, subWidth, subHeight, format,
 			GL_UNSIGNED_BYTE, pixels);
+	contentGeneration++;
 
-	glBindTexture(GL_TEXTURE_2D, boundTexture);
+	if (boundTexture != EJ_GL_STATE_UNKNOWN) {
+		glState->bindTexture(boundTexture);
+	}
 }
 
 GLubyte * EJTexture::loadPixelsFromPath(NSString * path) {
+	unsigned int w, h;
+	float scale;
+	GLubyte * pixels = decodePixelsFromPath(path->getCString(), &w, &h, !allowsNPOT(mipmaps), maxSize, &scale);
+	if( !pixels ) {
+		return NULL;
+	}
+
+	contentScale = scale;
+	setWidthAndHeight(w, h);
+	return pixels;
+}
+
+GLubyte * EJTexture::decodePixelsFromPath(const char * path, unsigned int * w, unsigned int * h,
+	bool powerOfTwo, int maxSize, float * scale, LodePNGScratch * scratch
+) {
 	
 	// All CGImage functions return pixels with premultiplied alpha and there's no
 	// way to opt-out - thanks Apple, awesome idea.
 	// So, for PNG images we use the lodepng library instead.
 	
-	return (std::string(path->getCString()).find(".png") == std::string::npos)?
-		loadPixelsWithCGImageFromPath(path):loadPixelsWithLodePNGFromPath(path);
+	*scale = 1;
+	if( EJCompressedTextureIsPath(path) ) {
+		return loadPixelsWithETCDecoderFromPath(path, w, h, powerOfTwo, maxSize, scale);
+	}
+	if( std::string(path).find(".png") != std::string::npos ) {
+		return loadPixelsWithLodePNGFromPath(path, w, h, powerOfTwo, maxSize, scale, scratch);
+	}
+	return loadPixelsWithCGImageFromPath(path, w, h, powerOfTwo, maxSize, scale);
 }
 
-GLubyte * EJTexture::loadPixelsWithCGImageFromPath(NSString * path) {
-	unsigned int w, h;
-	unsigned char * origPixels = NULL;
-	unsigned int error = lodejpeg_decode32_file(&origPixels, &w, &h, path->getCString());
+GLubyte * EJTexture::loadPixelsWithCGImageFromPath(const char * path, unsigned int * w, unsigned int * h,
+	bool powerOfTwo, int maxSize, float * scale
+) {
+	// The file is mapped instead of read and, unless the box filter has to
+	// downscale it further, decoded straight into the final buffer
+	LodeJPEGMappedFile file;
+	GLubyte * pixels = NULL;
+	unsigned int imageWidth = 0, imageHeight = 0;
+
+	unsigned int error = lodejpeg_map_file(&file, path);
+	if( !error ) {
+		error = lodejpeg_inspect(&imageWidth, &imageHeight, file.data, file.size);
+	}
+	if( !error ) {
+		// libjpeg scales by up to 1/8 while decoding, which also saves most of
+		// the decoding time; the box filter does the rest
+		int factor = downscaleFactor(imageWidth, imageHeight, maxSize);
+		int dctFactor = factor > 8 ? 8 : factor;
+		if( factor == dctFactor ) {
+			*w = imageWidth;
+			*h = imageHeight;
+			lodejpeg_scaled_size(w, h, dctFactor);
+			size_t realWidth = powerOfTwo ? EJTextureNextPowerOfTwo(*w) : *w;
+			size_t realHeight = powerOfTwo ? EJTextureNextPowerOfTwo(*h) : *h;
+
+			// The padding has to be transparent
+			pixels = (realWidth != *w || realHeight != *h)
+				? (GLubyte *)calloc(realWidth * realHeight * 4, sizeof(GLubyte))
+				: (GLubyte *)malloc(realWidth * realHeight * 4);
+			if( !pixels ) {
+				error = 83; // Allocation failed
+			}
+			else {
+				// JPEGs are opaque and need no premultiplication
+				error = lodejpeg_decode_into(pixels, realWidth * 4, *w, *h, file.data, file.size, dctFactor);
+			}
+		}
+		else {
+			error = lodejpeg_decode_scaled_memory(&pixels, w, h, file.data, file.size, dctFactor);
+			if( !error ) {
+				pixels = EJTextureDownscaleAndPad(pixels, w, h, factor / dctFactor, powerOfTwo);
+			}
+		}
+		if( !error ) {
+			*scale = (float)*w / imageWidth;
+		}
+	}
+	lodejpeg_unmap_file(&file);
+
 	if( error ) {
-		NSLOG("Error Loading image %s - %u: %s", path->getCString(), error, lodejpeg_error_text(error));
-		return origPixels;
+		NSLOG("Error Loading image %s - %u: %s", path, error, lodejpeg_error_text(error));
+		free(pixels);
+		return NULL;
 	}
+	return pixels;
+}
 
-	setWidthAndHeight(w, h);
+GLubyte * EJTexture::loadPixelsWithLodePNGFromPath(const char * path, unsigned int * w, unsigned int * h,
+	bool powerOfTwo, int maxSize, float * scale, LodePNGScratch * scratch
+) {
+	// Scanlines are decoded straight into the final, possibly padded buffer,
+	// unless the image has to be downscaled
+	unsigned char * file = NULL;
+	size_t fileSize = 0;
+	GLubyte * pixels = NULL;
+	unsigned int imageWidth = 0;
+	int factor = 1;
+
+	LodePNGState state;
+	lodepng_state_init(&state);
+	LodePNGScratch localScratch;
+	lodepng_scratch_init(&localScratch);
+
+	unsigned int error = lodepng_load_file(&file, &fileSize, path);
+	if( !error ) {
+		error = lodepng_inspect(w, h, &state, file, fileSize);
+	}
+	if( !error ) {
+		imageWidth = *w;
+		factor = downscaleFactor(*w, *h, maxSize);
+		bool pad = powerOfTwo && factor == 1;
+		size_t realWidth = pad ? EJTextureNextPowerOfTwo(*w) : *w;
+		size_t realHeight = pad ? EJTextureNextPowerOfTwo(*h) : *h;
+
+		// The padding has to be transparent
+		pixels = (realWidth != *w || realHeight != *h)
+			? (GLubyte *)calloc(realWidth * realHeight * 4, sizeof(GLubyte))
+			: (GLubyte *)malloc(realWidth * realHeight * 4);
+		if( !pixels ) {
+			error = 83; // Allocation failed
+		}
+		else {
+			error = lodepng_decode_into(pixels, realWidth * 4, w, h, &state, file, fileSize,
+				scratch ? scratch : &localScratch);
+		}
+	}
+	if( !error && factor > 1 ) {
+		pixels = EJTextureDownscaleAndPad(pixels, w, h, factor, powerOfTwo);
+		*scale = (float)*w / imageWidth;
+	}
+	if( !error && lodepng_can_have_alpha(&state.info_png.color) ) {
+		EJTexturePremultiply(pixels, *w, *h, powerOfTwo);
+	}
 
-	// If the image is already in the correct (power of 2) size, just return
-	// the original pixels unmodified
+	lodepng_scratch_cleanup(&localScratch);
+	lodepng_state_cleanup(&state);
+	free(file);
 
-	if( width == realWidth && height == realHeight ) {
-		return origPixels;
+	if( error ) {
+		NSLOG("Error Loading image %s - %u: %s", path, error, lodepng_error_text(error));
+		free(pixels);
+		return NULL;
 	}
+	return pixels;
+}
 
-	// Copy the original pixels into the upper left corner of a larger
-	// (power of 2) pixel buffer, free the original pixels and return
-	// the larger buffer
-	else {
-		GLubyte * pixels = (GLubyte *)calloc( realWidth * realHeight * 4, sizeof(GLubyte) );
+GLubyte * EJTexture::loadPixelsWithETCDecoderFromPath(const char * path, unsigned int * w, unsigned int * h,
+	bool powerOfTwo, int maxSize, float * scale
+) {
+	// For compressed files the GPU can't sample from
+	EJCompressedImage image;
+	if( !EJCompressedTextureLoad(&image, path) ) {
+		NSLOG("Error Loading image %s - not a valid PKM or KTX file", path);
+		return NULL;
+	}
+	if( !EJCompressedTextureCanDecode(image.internalFormat) ) {
+		NSLOG("Error Loading image %s - format 0x%x is not supported", path, image.internalFormat);
+		EJCompressedTextureFree(&image);
+		return NULL;
+	}
 
-		for( int y = 0; y < height; y++ ) {
-			memcpy( &pixels[y*realWidth*4], &origPixels[y*width*4], width*4 );
+	unsigned int imageWidth = image.width;
+	*w = image.width;
+	*h = image.height;
+	int factor = downscaleFactor(*w, *h, maxSize);
+	bool pad = powerOfTwo && factor == 1;
+	unsigned int realWidth = pad ? EJTextureNextPowerOfTwo(*w) : *w;
+	unsigned int realHeight = pad ? EJTextureNextPowerOfTwo(*h) : *h;
+	GLubyte * pixels = EJCompressedTextureDecode(&image, realWidth, realHeight);
+
+	// ETC1 has no alpha; it comes from the red channel of the alpha image.
+	// ETC2 files with alpha are expected to be premultiplied already, as
+	// they're uploaded as is when the GPU supports them. Punchthrough alpha
+	// decodes transparent pixels as black anyway.
+	bool separateAlpha = false;
+	if( pixels && image.internalFormat == GL_ETC1_RGB8_OES ) {
+		char * alphaPath = EJCompressedTextureAlphaPath(path);
+		EJCompressedImage alphaImage;
+		if( EJCompressedTextureLoad(&alphaImage, alphaPath) ) {
+			if( alphaImage.width == image.width && alphaImage.height == image.height ) {
+				GLubyte * alphaPixels = EJCompressedTextureDecode(&alphaImage, realWidth, realHeight);
+				if( alphaPixels ) {
+					EJCompressedTextureApplyAlpha(pixels, alphaPixels, realWidth, realHeight);
+					free(alphaPixels);
+					separateAlpha = true;
+				}
+			}
+			EJCompressedTextureFree(&alphaImage);
 		}
+		free(alphaPath);
+	}
+	EJCompressedTextureFree(&image);
 
-		free( origPixels );
-		return pixels;
+	if( !pixels ) {
+		NSLOG("Error Loading image %s - allocation failed", path);
+		return NULL;
+	}
+	if( factor > 1 ) {
+		pixels = EJTextureDownscaleAndPad(pixels, w, h, factor, powerOfTwo);
+		*scale = (float)*w / imageWidth;
 	}
+	if( separateAlpha ) {
+		EJTexturePremultiply(pixels, *w, *h, powerOfTwo);
+	}
+	return pixels;
 }
 
-GLubyte * EJTexture::loadPixelsWithLodePNGFromPath(NSString * path) {
-	unsigned int w, h;
-	unsigned char * origPixels = NULL;
-	unsigned int error = lodepng_decode32_file(&origPixels, &w, &h, path->getCString());
-	if( error ) {
-		NSLOG("Error Loading image %s - %u: %s", path->getCString(), error, lodepng_error_text(error));
-		return origPixels;
+bool EJTexture::loadCompressedFromPath(const char * path, EJCompressedTextureSupport support, bool npot,
+	EJCompressedImage * image, EJCompressedImage * alphaImage
+) {
+	memset(image, 0, sizeof(EJCompressedImage));
+	memset(alphaImage, 0, sizeof(EJCompressedImage));
+	if( !EJCompressedTextureIsPath(path) || !EJCompressedTextureLoad(image, path) ) {
+		return false;
 	}
 
-	setWidthAndHeight(w, h);
-
-	// If the image is already in the correct (power of 2) size, just return
-	// the original pixels unmodified
-
-	if( width == realWidth && height == realHeight ) {
-		return origPixels;
+	// Compressed data can't be padded to a power of two
+	bool pot = (
+		EJTextureNextPowerOfTwo(image->width) == (int)image->width &&
+		EJTextureNextPowerOfTwo(image->height) == (int)image->height
+	);
+	if( !EJCompressedTextureIsSupported(image->internalFormat, support) || (!npot && !pot) ) {
+		EJCompressedTextureFree(image);
+		return false;
 	}
 
-	// Copy the original pixels into the upper left corner of a larger
-	// (power of 2) pixel buffer, free the original pixels and return
-	// the larger buffer
-	else {
-		GLubyte * pixels = (GLubyte *)calloc( realWidth * realHeight * 4, sizeof(GLubyte) );
-
-		for( int y = 0; y < height; y++ ) {
-			memcpy( &pixels[y*realWidth*4], &origPixels[y*width*4], width*4 );
+	if( image->internalFormat == GL_ETC1_RGB8_OES ) {
+		char * alphaPath = EJCompressedTextureAlphaPath(path);
+		if(
+			EJCompressedTextureLoad(alphaImage, alphaPath) && (
+				alphaImage->internalFormat != GL_ETC1_RGB8_OES ||
+				alphaImage->width != image->width || alphaImage->height != image->height
+			)
+		) {
+			NSLOG("Warning: Ignoring alpha image %s, it has to be ETC1 with the same size", alphaPath);
+			EJCompressedTextureFree(alphaImage);
 		}
+		free(alphaPath);
+	}
+	return true;
+}
 
-		free( origPixels );
-		return pixels;
+void EJTexture::setAtlasPage(EJTexture * page, short x, short y) {
+	if( !atlasPage ) {
+		releaseMemory();
+		lruUnlink();
+		reloadable = false;
 	}
+	page->retain();
+	if( atlasPage ) { atlasPage->release(); }
+	
+	atlasPage = page;
+	atlasX = x;
+	atlasY = y;
+	
+	textureId = page->textureId;
+	format = page->format;
+	realWidth = page->realWidth;
+	realHeight = page->realHeight;
 }
 
 void EJTexture::bind() {
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	if( atlasPage ) {
+		atlasPage->bind();
+		return;
+	}
+	
+	if( evicted ) {
+		reload();
+	}
+	markUsed();
+	
+	EJGLState::getInstance()->bindTexture(textureId);
 	if (EJTextureGlobalFilter != textureFilter) {
 		setFilter(EJTextureGlobalFilter);
 	}
@@ -13,6 +13,53 @@
 #include <GLES2/gl2ext.h>
 #endif
 #include "../EJCocoa/NSString.h"
+#include "EJCompressedTexture.h"
+
+struct LodePNGScratch;
+
+// Set to 0 to always pad textures to a power of two, e.g. for drivers with
+// broken NPOT support
+#ifndef EJ_TEXTURE_NPOT
+#define EJ_TEXTURE_NPOT 1
+#endif
+
+// Default budget for the GPU memory of all textures, in bytes. Textures
+// loaded from a file that weren't used recently are evicted when it is
+// exceeded and loaded again when they're drawn.
+#ifndef EJ_TEXTURE_MEMORY_BUDGET
+#define EJ_TEXTURE_MEMORY_BUDGET (96 * 1024 * 1024)
+#endif
+
+// Images are downscaled by powers of two while decoding if they are larger
+// than this factor times the larger side of the screen canvas' backing
+// store; 0 turns this off. Images can set their own maxSize instead.
+#ifndef EJ_TEXTURE_DOWNSCALE_LIMIT
+#define EJ_TEXTURE_DOWNSCALE_LIMIT 0
+#endif
+
+#define EJ_TEXTURE_MAX_DOWNSCALE 16
+
+// Default for images that don't set their mipmaps property. Mipmaps make
+// minified images look smooth instead of shimmering and keep the texture
+// fetches local, for a third more memory.
+#ifndef EJ_TEXTURE_MIPMAPS
+#define EJ_TEXTURE_MIPMAPS 0
+#endif
+
+// Set to 0 to generate mipmaps with glGenerateMipmap() when uploading instead
+// of on the CPU in the decoder threads
+#ifndef EJ_TEXTURE_CPU_MIPMAPS
+#define EJ_TEXTURE_CPU_MIPMAPS 1
+#endif
+
+typedef struct {
+	int usedBytes;
+	int highWaterBytes;		// Largest usedBytes so far
+	int budgetBytes;
+	int textures;			// Textures that own GPU memory
+	int evictions;
+	int reloads;
+} EJTextureMemoryStats;
 
 class EJTexture : public NSObject {
 
@@ -20,7 +67,34 @@ class EJTexture : public NSObject {
 	GLenum format;
 	GLint textureFilter;
 
+	// Only textures loaded from a file can be evicted; render targets and
+	// textures created from pixels are pinned
+	int memoryBytes;
+	bool reloadable;
+	bool evicted;
+	unsigned int lastUseFrame;
+	EJTexture * lruPrev, * lruNext;
+
+	static EJTexture * lruHead, * lruTail; // Most and least recently used
+
+	// Set while the texture is shared through the EJTextureCache
+	NSString * cacheKey;
+	friend class EJTextureCache;
+
+	// Largest size the image was decoded with, 0 for its full size
+	int maxSize;
+
+	// Mipmapped textures are never packed into an atlas and need full NPOT
+	// support for their exact size; otherwise they're padded
+	bool mipmaps;
+
 	void setFilter(GLint filter);
+	void initWithCompressedImage(const EJCompressedImage * image, const EJCompressedImage * alphaImage);
+	void trackMemory();
+	void releaseMemory();
+	void evict();
+	void reload();
+	void lruUnlink();
 
 public:
 
@@ -28,27 +102,125 @@ public:
 	GLuint textureId;
 	short width, height, realWidth, realHeight;
 
+	// Textures packed into a shared atlas page reference the page's GL texture;
+	// atlasX and atlasY are the image's offset in the page in pixels
+	EJTexture * atlasPage;
+	short atlasX, atlasY;
+
+	// ETC1 textures with a separate alpha image sample their alpha from the
+	// red channel of this texture
+	EJTexture * alphaTexture;
+
 	EJTexture();
 	EJTexture(NSString * path);
-	EJTexture(NSString * path, NSObject* sharegroup);
+	// Takes ownership of pixels, as returned by decodePixelsFromPath() with
+	// powerOfTwo set to !allowsNPOT(mipmaps). Downscaled images pass the scale
+	// and maxSize they were decoded with. With mipmapLevels, the pixels are
+	// followed by all mipmap levels, as added by appendMipmaps().
+	EJTexture(NSString * path, GLubyte * pixels, int widthp, int heightp, bool allowAtlas = false,
+		float scale = 1, int maxSizep = 0, bool mipmapsp = false, bool mipmapLevels = false);
+	// Adopts a texture that was uploaded in a shared context with the given
+	// filter and the real size for widthp, heightp
+	EJTexture(NSString * path, GLuint uploadedTextureId, int widthp, int heightp, GLint filter,
+		float scale, int maxSizep, bool mipmapsp);
+	// Uploads compressed data as returned by loadCompressedFromPath(); doesn't
+	// take ownership of the images. alphaImage may be NULL.
+	EJTexture(NSString * path, const EJCompressedImage * image, const EJCompressedImage * alphaImage);
 	EJTexture(int widthp, int heightp, GLenum format);
 	EJTexture(int widthp, int heightp);
 	EJTexture(int widthp, int heightp, GLubyte * pixels);
 	~EJTexture();
 
 	void setWidthAndHeight(int width, int height);
-	void createTextureWithPixels(GLubyte * pixels, GLenum format);
+	void createTextureWithPixels(GLubyte * pixels, GLenum format, bool mipmapLevels = false);
+	void createTextureWithCompressedImage(const EJCompressedImage * image);
 	void updateTextureWithPixels(GLubyte * pixels, int atx, int aty,
 			int subWidth, int subHeight);
+	void setAtlasPage(EJTexture * page, short x, short y);
 
 	GLubyte * loadPixelsFromPath(NSString * path);
-	GLubyte * loadPixelsWithCGImageFromPath(NSString * path);
-	GLubyte * loadPixelsWithLodePNGFromPath(NSString * path);
+
+	// Decoding doesn't touch any GL or NSObject state and can be done in any
+	// thread. Returns RGBA pixels with premultiplied alpha or NULL; with
+	// powerOfTwo, the pixels are padded to the next power of two in both
+	// dimensions. The scratch buffers can be passed in to reuse them for
+	// sequential PNG decodes.
+	// Images larger than maxSize (if not 0) are downscaled; w and h are the
+	// decoded size and scale is the decoded width divided by the image's.
+	static GLubyte * decodePixelsFromPath(const char * path, unsigned int * w, unsigned int * h,
+		bool powerOfTwo, int maxSize, float * scale, LodePNGScratch * scratch = NULL);
+	static GLubyte * loadPixelsWithCGImageFromPath(const char * path, unsigned int * w, unsigned int * h,
+		bool powerOfTwo, int maxSize, float * scale);
+	static GLubyte * loadPixelsWithLodePNGFromPath(const char * path, unsigned int * w, unsigned int * h,
+		bool powerOfTwo, int maxSize, float * scale, LodePNGScratch * scratch);
+	static GLubyte * loadPixelsWithETCDecoderFromPath(const char * path, unsigned int * w, unsigned int * h,
+		bool powerOfTwo, int maxSize, float * scale);
+
+	// Loads a PKM or KTX file (and the separate alpha image of an ETC1 file)
+	// if its format can be uploaded as is; any thread. Returns false if the
+	// file has to go through decodePixelsFromPath() instead, which decodes
+	// ETC1/ETC2 on the CPU. Free the images with EJCompressedTextureFree().
+	static bool loadCompressedFromPath(const char * path, EJCompressedTextureSupport support, bool npot,
+		EJCompressedImage * image, EJCompressedImage * alphaImage);
+
+	// The power of two an image has to be divided by to fit into maxSize
+	static int downscaleFactor(int width, int height, int maxSize);
+
+	// Adds all mipmap levels after the RGBA pixels returned by
+	// decodePixelsFromPath(), each half the size of the previous one, down to
+	// 1x1; any thread. Returns false, leaving the pixels as they are, if the
+	// buffer couldn't be grown.
+	static bool appendMipmaps(GLubyte ** pixels, int width, int height, bool powerOfTwo);
+	// Number of pixels in all mipmap levels of an image, including level 0
+	static int mipmapPixels(int width, int height);
+	// Uploads the pixels to the bound texture; with mipmaps, the other levels
+	// are taken from the buffer if mipmapLevels is set or generated by GL.
+	// Used by the GL and the upload thread.
+	static void uploadPixels(GLubyte * pixels, GLenum format, int realWidth, int realHeight,
+		bool mipmaps, bool mipmapLevels);
+	// The minification filter for the magnification filter
+	static GLint minFilterFor(GLint filter, bool mipmaps);
 
 	void bind();
+	// Marks the texture as used in this frame without binding it
+	void markUsed();
+	bool isEvicted() const { return evicted; }
+	// Loaded, possibly evicted at the moment
+	bool isLoaded() const { return textureId || evicted; }
+	GLenum getFormat() const { return format; }
+	bool isCompressed() const { return EJCompressedTextureDataSize(format, 1, 1) != 0; }
+	bool hasMipmaps() const { return mipmaps; }
+
+	// Incremented whenever the pixels of a texture may have changed, including
+	// drawing into the texture of an offscreen canvas
+	static unsigned int contentGeneration;
+
+	// Whether textures can be created with their exact size; mipmapped
+	// textures need full NPOT support
+	static bool allowsNPOT(bool mipmaps = false);
+	// The internal size of a texture for the given image size; GL thread only
+	static int realSizeFor(int size, bool mipmaps = false);
+	// Copies pixels into the upper left corner of a zeroed realWidth x
+	// realHeight buffer and frees them. Can be called from any thread.
+	static GLubyte * padPixels(GLubyte * pixels, int width, int height, int realWidth, int realHeight);
+
+	// Evicts least recently used textures until the budget is met; called
+	// once per frame, after everything was drawn
+	static void enforceMemoryBudget();
+	static void setMemoryBudget(int bytes);
+	static EJTextureMemoryStats getMemoryStats();
+
+	// Factor of the screen size for the downscale policy, 0 for none
+	static float getDownscaleLimit();
+	static void setDownscaleLimit(float limit);
 
 	static bool smoothScaling();
 	static void setSmoothScaling(bool smoothScaling);
+
+	// Whether images are mipmapped unless they set their own mipmaps property;
+	// only affects images loaded afterwards
+	static bool mipmapsEnabled();
+	static void setMipmapsEnabled(bool enabled);
 };
 
 #endif // __EJTEXTURE_H__
\ No newline at end of file
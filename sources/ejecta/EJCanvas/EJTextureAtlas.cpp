@@ -0,0 +1,158 @@
+#include "EJTextureAtlas.h"
+
+EJTextureAtlas *EJTextureAtlas::instance = NULL;
+
+EJTextureAtlas::EJTextureAtlas() : rejectedImages(0) {
+}
+
+EJTextureAtlas::~EJTextureAtlas() {
+	instance = NULL;
+	for( std::vector<EJTextureAtlasPage>::iterator page = pages.begin(); page != pages.end(); ++page ) {
+		page->texture->release();
+	}
+}
+
+EJTextureAtlas *EJTextureAtlas::getInstance() {
+	if( instance == NULL ) {
+		instance = new EJTextureAtlas();
+	}
+	return instance;
+}
+
+bool EJTextureAtlas::allocateRegion(EJTextureAtlasPage &page, int w, int h, int * x, int * y) {
+	// Find the first shelf that is high enough, but not too high, and still
+	// has room for this image
+	for( std::vector<EJTextureAtlasShelf>::iterator shelf = page.shelves.begin(); shelf != page.shelves.end(); ++shelf ) {
+		if(
+			h <= shelf->height && h >= shelf->height * EJ_TEXTURE_ATLAS_SHELF_FIT &&
+			shelf->x + w <= EJ_TEXTURE_ATLAS_PAGE_SIZE
+		) {
+			*x = shelf->x;
+			*y = shelf->y;
+			shelf->x += w;
+			return true;
+		}
+	}
+
+	// Open a new shelf below the last one
+	if( page.shelvesHeight + h > EJ_TEXTURE_ATLAS_PAGE_SIZE ) {
+		return false;
+	}
+
+	EJTextureAtlasShelf shelf = { page.shelvesHeight, h, w };
+	page.shelves.push_back(shelf);
+	page.shelvesHeight += h;
+
+	*x = 0;
+	*y = shelf.y;
+	return true;
+}
+
+void EJTextureAtlas::recyclePages() {
+	// A page that is only retained by the atlas itself doesn't have any images
+	// that are still in use. Reset it, so its space can be reused. Only one
+	// empty page is kept around.
+	bool keptEmptyPage = false;
+	for( std::vector<EJTextureAtlasPage>::iterator page = pages.begin(); page != pages.end(); ) {
+		if( page->texture->retainCount() > 1 ) {
+			++page;
+			continue;
+		}
+
+		if( keptEmptyPage ) {
+			page->texture->release();
+			page = pages.erase(page);
+			continue;
+		}
+
+		page->shelves.clear();
+		page->shelvesHeight = 0;
+		page->imageCount = 0;
+		page->usedPixels = 0;
+		keptEmptyPage = true;
+		++page;
+	}
+}
+
+bool EJTextureAtlas::insertTexture(EJTexture * texture, GLubyte * pixels) {
+	int w = texture->width;
+	int h = texture->height;
+	if( w <= 0 || h <= 0 || w > EJ_TEXTURE_ATLAS_MAX_IMAGE_SIZE || h > EJ_TEXTURE_ATLAS_MAX_IMAGE_SIZE ) {
+		rejectedImages++;
+		return false;
+	}
+
+	int paddedWidth = w + EJ_TEXTURE_ATLAS_PADDING * 2;
+	int paddedHeight = h + EJ_TEXTURE_ATLAS_PADDING * 2;
+
+	// Try all existing pages first, then the ones freed up since the last
+	// insert and finally open a new page
+	int x = 0, y = 0;
+	EJTextureAtlasPage * page = NULL;
+	for( int attempt = 0; attempt < 2 && !page; attempt++ ) {
+		if( attempt == 1 ) {
+			recyclePages();
+		}
+		for( std::vector<EJTextureAtlasPage>::iterator p = pages.begin(); p != pages.end(); ++p ) {
+			if( allocateRegion(*p, paddedWidth, paddedHeight, &x, &y) ) {
+				page = &(*p);
+				break;
+			}
+		}
+	}
+
+	if( !page ) {
+		EJTextureAtlasPage newPage;
+		newPage.texture = new EJTexture(EJ_TEXTURE_ATLAS_PAGE_SIZE, EJ_TEXTURE_ATLAS_PAGE_SIZE);
+		newPage.shelvesHeight = 0;
+		newPage.imageCount = 0;
+		newPage.usedPixels = 0;
+		if( !newPage.texture->textureId ) {
+			newPage.texture->release();
+			rejectedImages++;
+			return false;
+		}
+
+		pages.push_back(newPage);
+		page = &pages.back();
+		allocateRegion(*page, paddedWidth, paddedHeight, &x, &y);
+	}
+
+	// Copy the image into a padded buffer, repeating the outermost pixels
+	// into the border
+	int stride = texture->realWidth * 4;
+	GLubyte * padded = (GLubyte *)malloc( paddedWidth * paddedHeight * 4 );
+	for( int row = 0; row < paddedHeight; row++ ) {
+		int srcRow = row - EJ_TEXTURE_ATLAS_PADDING;
+		if( srcRow < 0 ) { srcRow = 0; }
+		else if( srcRow > h - 1 ) { srcRow = h - 1; }
+		GLubyte * src = &pixels[srcRow * stride];
+		GLubyte * dst = &padded[row * paddedWidth * 4];
+
+		for( int i = 0; i < EJ_TEXTURE_ATLAS_PADDING; i++ ) {
+			memcpy( &dst[i * 4], src, 4 );
+			memcpy( &dst[(EJ_TEXTURE_ATLAS_PADDING + w + i) * 4], &src[(w - 1) * 4], 4 );
+		}
+		memcpy( &dst[EJ_TEXTURE_ATLAS_PADDING * 4], src, w * 4 );
+	}
+
+	page->texture->updateTextureWithPixels(padded, x, y, paddedWidth, paddedHeight);
+	free(padded);
+
+	page->imageCount++;
+	page->usedPixels += paddedWidth * paddedHeight;
+
+	texture->setAtlasPage(page->texture, x + EJ_TEXTURE_ATLAS_PADDING, y + EJ_TEXTURE_ATLAS_PADDING);
+	return true;
+}
+
+EJTextureAtlasStats EJTextureAtlas::getStats() {
+	EJTextureAtlasStats stats = { 0, 0, rejectedImages, 0, 0 };
+	for( std::vector<EJTextureAtlasPage>::iterator page = pages.begin(); page != pages.end(); ++page ) {
+		stats.pages++;
+		stats.images += page->imageCount;
+		stats.usedPixels += page->usedPixels;
+		stats.totalPixels += EJ_TEXTURE_ATLAS_PAGE_SIZE * EJ_TEXTURE_ATLAS_PAGE_SIZE;
+	}
+	return stats;
+}
@@ -0,0 +1,60 @@
+#ifndef __EJ_TEXTURE_ATLAS_H__
+#define __EJ_TEXTURE_ATLAS_H__
+
+#include <vector>
+#include "EJTexture.h"
+
+#define EJ_TEXTURE_ATLAS_PAGE_SIZE 1024
+#define EJ_TEXTURE_ATLAS_MAX_IMAGE_SIZE 256
+
+// Every image is surrounded by a 1px border of its own edge pixels, so that
+// linear filtering never samples a neighbouring image
+#define EJ_TEXTURE_ATLAS_PADDING 1
+
+// Shelf packing: images are placed left to right on horizontal shelves. An
+// image only goes on a shelf that isn't much higher than itself, to keep
+// the wasted space per shelf small.
+#define EJ_TEXTURE_ATLAS_SHELF_FIT 0.7f
+
+typedef struct {
+	int y, height;
+	int x;
+} EJTextureAtlasShelf;
+
+typedef struct {
+	EJTexture * texture;
+	std::vector<EJTextureAtlasShelf> shelves;
+	int shelvesHeight;
+	int imageCount;
+	int usedPixels;
+} EJTextureAtlasPage;
+
+typedef struct {
+	int pages;
+	int images;
+	int rejectedImages;
+	int usedPixels;
+	int totalPixels;
+} EJTextureAtlasStats;
+
+class EJTextureAtlas : public NSObject {
+	std::vector<EJTextureAtlasPage> pages;
+	int rejectedImages;
+
+	static EJTextureAtlas *instance;
+
+	EJTextureAtlas();
+
+	bool allocateRegion(EJTextureAtlasPage &page, int w, int h, int * x, int * y);
+	void recyclePages();
+
+public:
+	~EJTextureAtlas();
+
+	static EJTextureAtlas *getInstance();
+
+	bool insertTexture(EJTexture * texture, GLubyte * pixels);
+	EJTextureAtlasStats getStats();
+};
+
+#endif // __EJ_TEXTURE_ATLAS_H__
@@ -0,0 +1,72 @@
+#include "EJTextureCache.h"
+
+EJTextureCache *EJTextureCache::instance = NULL;
+
+EJTextureCache::EJTextureCache() {
+	memset(&stats, 0, sizeof(stats));
+}
+
+EJTextureCache::~EJTextureCache() {
+	instance = NULL;
+	for( std::map<std::string, EJTexture *>::iterator it = textures.begin(); it != textures.end(); ++it ) {
+		it->second->cacheKey->release();
+		it->second->cacheKey = NULL;
+	}
+}
+
+EJTextureCache *EJTextureCache::getInstance() {
+	if( instance == NULL ) {
+		instance = new EJTextureCache();
+	}
+	return instance;
+}
+
+std::string EJTextureCache::keyForPath(NSString * path, bool allowAtlas, int maxSize, bool mipmaps) {
+	// The filter mode isn't part of the key, as it is applied when a texture
+	// is bound. Images packed into an atlas are distinct from standalone
+	// ones, though, and so are downscaled and mipmapped ones.
+	std::string key = std::string(mipmaps ? "mipmap:" : (allowAtlas ? "atlas:" : "single:")) + path->getCString();
+	if( maxSize ) {
+		char size[16];
+		sprintf(size, "@%d", maxSize);
+		key += size;
+	}
+	return key;
+}
+
+EJTexture * EJTextureCache::textureForPath(NSString * path, bool allowAtlas, int maxSize, bool mipmaps) {
+	stats.lookups++;
+	std::map<std::string, EJTexture *>::iterator it = textures.find(keyForPath(path, allowAtlas, maxSize, mipmaps));
+	if( it == textures.end() ) {
+		return NULL;
+	}
+
+	EJTexture * texture = it->second;
+	stats.hits++;
+	stats.savedBytes += (double)texture->width * texture->height * 4;
+	return texture;
+}
+
+void EJTextureCache::insertTexture(EJTexture * texture, NSString * path, bool allowAtlas, int maxSize, bool mipmaps) {
+	if( texture->cacheKey ) { return; }
+
+	std::string key = keyForPath(path, allowAtlas, maxSize, mipmaps);
+	if( textures.find(key) != textures.end() ) { return; }
+
+	textures[key] = texture;
+	texture->cacheKey = new NSString(key.c_str());
+	stats.entries++;
+}
+
+void EJTextureCache::removeTexture(EJTexture * texture) {
+	if( !texture->cacheKey ) { return; }
+
+	textures.erase(texture->cacheKey->getCString());
+	texture->cacheKey->release();
+	texture->cacheKey = NULL;
+	stats.entries--;
+}
+
+EJTextureCacheStats EJTextureCache::getStats() {
+	return stats;
+}
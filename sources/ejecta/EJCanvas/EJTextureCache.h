@@ -0,0 +1,40 @@
+#ifndef __EJ_TEXTURE_CACHE_H__
+#define __EJ_TEXTURE_CACHE_H__
+
+#include <map>
+#include <string>
+#include "EJTexture.h"
+
+typedef struct {
+	int entries;
+	int lookups;
+	int hits;
+	double savedBytes;		// Decoded pixels that didn't have to be uploaded again
+} EJTextureCacheStats;
+
+// Images with the same path share one texture. The cache only holds weak
+// references; a texture removes itself when it is released by its last
+// image.
+class EJTextureCache : public NSObject {
+	std::map<std::string, EJTexture *> textures;
+	EJTextureCacheStats stats;
+
+	static EJTextureCache *instance;
+
+	EJTextureCache();
+
+	static std::string keyForPath(NSString * path, bool allowAtlas, int maxSize, bool mipmaps);
+
+public:
+	~EJTextureCache();
+
+	static EJTextureCache *getInstance();
+
+	// Returns the cached texture for this file, not retained, or NULL
+	EJTexture * textureForPath(NSString * path, bool allowAtlas, int maxSize, bool mipmaps);
+	void insertTexture(EJTexture * texture, NSString * path, bool allowAtlas, int maxSize, bool mipmaps);
+	void removeTexture(EJTexture * texture);
+	EJTextureCacheStats getStats();
+};
+
+#endif // __EJ_TEXTURE_CACHE_H__
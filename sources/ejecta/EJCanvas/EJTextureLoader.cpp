@@ -0,0 +1,494 @@
+#include <algorithm>
+#include "EJTextureLoader.h"
+#include "EJTextureCache.h"
+#include "EJTextureAtlas.h"
+#include "EJGLState.h"
+#include "../lodepng/lodepng.h"
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+EJTextureLoader *EJTextureLoader::instance = NULL;
+
+static double EJTextureLoaderTime() {
+#ifdef _WINDOWS
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return now.QuadPart * 1000.0 / freq.QuadPart;
+#else
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec * 1000.0 + time.tv_usec / 1000.0;
+#endif
+}
+
+static int EJTextureLoaderCPUCount() {
+#ifdef _WINDOWS
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+EJTextureLoader::EJTextureLoader() : threadCount(0), quit(false),
+	uploadContext(NULL), uploadContextCreated(false), uploadContextFailed(false)
+{
+	memset(&stats, 0, sizeof(stats));
+	pthread_mutex_init(&decodeMutex, NULL);
+	pthread_mutex_init(&uploadMutex, NULL);
+	pthread_mutex_init(&sharedMutex, NULL);
+	pthread_cond_init(&decodeCondition, NULL);
+	pthread_cond_init(&sharedCondition, NULL);
+}
+
+EJTextureLoader::~EJTextureLoader() {
+	instance = NULL;
+
+	pthread_mutex_lock(&decodeMutex);
+	pthread_mutex_lock(&sharedMutex);
+	quit = true;
+	pthread_cond_broadcast(&decodeCondition);
+	pthread_cond_broadcast(&sharedCondition);
+	pthread_mutex_unlock(&sharedMutex);
+	pthread_mutex_unlock(&decodeMutex);
+	for( int i = 0; i < threadCount; i++ ) {
+		pthread_join(threads[i], NULL);
+	}
+	if( uploadContext ) {
+		pthread_join(uploadThread, NULL);
+	}
+
+	// Jobs are in exactly one of the queues or were delivered already
+	for( std::vector<Job *>::iterator job = pendingJobs.begin(); job != pendingJobs.end(); ++job ) {
+		free((*job)->pixels);
+		if( (*job)->texture ) { (*job)->texture->release(); }
+		delete *job;
+	}
+
+	delete uploadContext;
+
+	pthread_cond_destroy(&sharedCondition);
+	pthread_cond_destroy(&decodeCondition);
+	pthread_mutex_destroy(&sharedMutex);
+	pthread_mutex_destroy(&uploadMutex);
+	pthread_mutex_destroy(&decodeMutex);
+}
+
+EJTextureLoader *EJTextureLoader::getInstance() {
+	if( instance == NULL ) {
+		instance = new EJTextureLoader();
+	}
+	return instance;
+}
+
+void EJTextureLoader::loadTexture(NSString * path, bool allowAtlas, int maxSize, bool mipmaps, EJTextureLoaderDelegate * delegate) {
+	allowAtlas = allowAtlas && !mipmaps;
+
+	// Another image is already waiting for the same file?
+	for( std::vector<Job *>::iterator it = pendingJobs.begin(); it != pendingJobs.end(); ++it ) {
+		Job * pending = *it;
+		if(
+			!pending->delegates.empty() && pending->allowAtlas == allowAtlas && pending->maxSize == maxSize &&
+			pending->mipmaps == mipmaps && pending->path == path->getCString()
+		) {
+			pending->delegates.push_back(delegate);
+			stats.coalesced++;
+			return;
+		}
+	}
+
+	Job * job = new Job();
+	job->path = path->getCString();
+	job->allowAtlas = allowAtlas;
+	job->powerOfTwo = !EJTexture::allowsNPOT(mipmaps);
+	job->maxSize = maxSize;
+	job->mipmaps = mipmaps;
+	job->mipmapLevels = false;
+	job->scale = 1;
+	job->delegates.push_back(delegate);
+	job->pixels = NULL;
+	job->width = job->height = 0;
+	job->compressedSupport = EJGLState::getInstance()->getCompressedTextureSupport();
+	memset(&job->compressed, 0, sizeof(EJCompressedImage));
+	memset(&job->compressedAlpha, 0, sizeof(EJCompressedImage));
+	job->cancelled = false;
+	job->realWidth = job->realHeight = 0;
+	job->filter = GL_LINEAR;
+	job->textureId = 0;
+	job->fence = NULL;
+	pendingJobs.push_back(job);
+
+	// Cached textures don't need decoding, but are still delivered from the
+	// frame loop, so that onload is never called from within the src setter
+	job->texture = EJTextureCache::getInstance()->textureForPath(path, allowAtlas, maxSize, mipmaps);
+	if( job->texture ) {
+		job->texture->retain();
+		pthread_mutex_lock(&uploadMutex);
+		uploadQueue.push_back(job);
+		pthread_mutex_unlock(&uploadMutex);
+		return;
+	}
+
+	if( !threadCount ) {
+		int cpus = EJTextureLoaderCPUCount();
+		threadCount = cpus - 1;
+		threadCount = threadCount > EJ_TEXTURE_LOADER_MAX_THREADS ? EJ_TEXTURE_LOADER_MAX_THREADS : threadCount;
+		threadCount = threadCount < 1 ? 1 : threadCount;
+		for( int i = 0; i < threadCount; i++ ) {
+			pthread_create(&threads[i], NULL, decodeThread, this);
+		}
+		NSLOG("EJTextureLoader: %d decoder threads", threadCount);
+	}
+
+	pthread_mutex_lock(&decodeMutex);
+	decodeQueue.push_back(job);
+	pthread_cond_signal(&decodeCondition);
+	pthread_mutex_unlock(&decodeMutex);
+}
+
+void EJTextureLoader::cancel(EJTextureLoaderDelegate * delegate) {
+	for( std::vector<Job *>::iterator it = pendingJobs.begin(); it != pendingJobs.end(); ++it ) {
+		Job * job = *it;
+		std::vector<EJTextureLoaderDelegate *>::iterator found = std::find(job->delegates.begin(), job->delegates.end(), delegate);
+		if( found == job->delegates.end() ) { continue; }
+
+		job->delegates.erase(found);
+		if( job->delegates.empty() ) {
+			// Not decoded yet? Then it never will be. The job itself is
+			// dropped when it arrives in the upload queue.
+			pthread_mutex_lock(&decodeMutex);
+			job->cancelled = true;
+			pthread_mutex_unlock(&decodeMutex);
+		}
+	}
+}
+
+void * EJTextureLoader::decodeThread(void * loader) {
+	((EJTextureLoader *)loader)->decodeJobs();
+	return NULL;
+}
+
+void EJTextureLoader::decodeJobs() {
+	// Reused for all PNGs decoded in a row by this thread, released once the
+	// queue runs empty
+	LodePNGScratch scratch;
+	lodepng_scratch_init(&scratch);
+
+	while( true ) {
+		pthread_mutex_lock(&decodeMutex);
+		if( decodeQueue.empty() ) {
+			lodepng_scratch_cleanup(&scratch);
+		}
+		while( decodeQueue.empty() && !quit ) {
+			pthread_cond_wait(&decodeCondition, &decodeMutex);
+		}
+		if( quit ) {
+			pthread_mutex_unlock(&decodeMutex);
+			lodepng_scratch_cleanup(&scratch);
+			return;
+		}
+		Job * job = decodeQueue.front();
+		decodeQueue.pop_front();
+		bool cancelled = job->cancelled;
+		pthread_mutex_unlock(&decodeMutex);
+
+		double time = 0;
+		if( !cancelled ) {
+			double start = EJTextureLoaderTime();
+			if( !EJTexture::loadCompressedFromPath(job->path.c_str(), job->compressedSupport, !job->powerOfTwo, &job->compressed, &job->compressedAlpha) ) {
+				job->pixels = EJTexture::decodePixelsFromPath(job->path.c_str(), &job->width, &job->height, job->powerOfTwo, job->maxSize, &job->scale, &scratch);
+#if EJ_TEXTURE_CPU_MIPMAPS
+				// Saves the GL thread the glGenerateMipmap() call
+				if( job->pixels && job->mipmaps ) {
+					job->mipmapLevels = EJTexture::appendMipmaps(&job->pixels, job->width, job->height, job->powerOfTwo);
+				}
+#endif
+			}
+			time = EJTextureLoaderTime() - start;
+		}
+
+		pthread_mutex_lock(&uploadMutex);
+		uploadQueue.push_back(job);
+		stats.decodeTime += time;
+		pthread_mutex_unlock(&uploadMutex);
+	}
+}
+
+void * EJTextureLoader::uploadThreadMain(void * loader) {
+	((EJTextureLoader *)loader)->uploadJobs();
+	return NULL;
+}
+
+void EJTextureLoader::uploadJobs() {
+	bool current = uploadContext->makeCurrent();
+
+	pthread_mutex_lock(&sharedMutex);
+	if( !current ) {
+		// Jobs are handed back without a texture and created on the GL thread
+		NSLOG("EJTextureLoader: Couldn't make the upload context current");
+		uploadContextFailed = true;
+	}
+	while( true ) {
+		while( sharedQueue.empty() && !quit ) {
+			pthread_cond_wait(&sharedCondition, &sharedMutex);
+		}
+		if( quit ) { break; }
+
+		Job * job = sharedQueue.front();
+		sharedQueue.pop_front();
+		if( uploadContextFailed ) {
+			fenceQueue.push_back(job);
+			continue;
+		}
+		pthread_mutex_unlock(&sharedMutex);
+
+		// Decoded with the padding for realWidth, realHeight already
+		GLubyte * pixels = job->pixels;
+		job->pixels = NULL;
+
+		glGenTextures(1, &job->textureId);
+		glBindTexture(GL_TEXTURE_2D, job->textureId);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, EJTexture::minFilterFor(job->filter, job->mipmaps));
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, job->filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		EJTexture::uploadPixels(pixels, GL_RGBA, job->realWidth, job->realHeight, job->mipmaps, job->mipmapLevels);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		free(pixels);
+
+		void * fence = uploadContext->insertFence();
+
+		pthread_mutex_lock(&sharedMutex);
+		job->fence = fence;
+		fenceQueue.push_back(job);
+	}
+	pthread_mutex_unlock(&sharedMutex);
+
+	if( current ) {
+		uploadContext->clearCurrent();
+	}
+}
+
+bool EJTextureLoader::canUploadShared(Job * job) {
+#if EJ_TEXTURE_LOADER_SHARED_CONTEXT
+	// Compressed textures are small and don't need any conversion, so they're
+	// always created on the GL thread
+	if( job->compressed.data ) {
+		return false;
+	}
+
+	// Images that may go into the atlas are copied into an atlas page, which
+	// is owned by the GL thread
+	if(
+		job->allowAtlas &&
+		job->width <= EJ_TEXTURE_ATLAS_MAX_IMAGE_SIZE &&
+		job->height <= EJ_TEXTURE_ATLAS_MAX_IMAGE_SIZE
+	) {
+		return false;
+	}
+
+	// Created lazily, as this has to happen on the GL thread
+	if( !uploadContextCreated ) {
+		uploadContextCreated = true;
+		uploadContext = EJGLUploadContext::createSharedWithCurrent();
+		if( uploadContext ) {
+			pthread_create(&uploadThread, NULL, uploadThreadMain, this);
+			NSLOG("EJTextureLoader: Uploading textures in a shared context (%s)",
+				uploadContext->hasFences() ? "fences" : "glFinish");
+		}
+		else {
+			NSLOG("EJTextureLoader: No shared context, uploading on the GL thread");
+		}
+	}
+	if( !uploadContext ) {
+		return false;
+	}
+
+	pthread_mutex_lock(&sharedMutex);
+	bool failed = uploadContextFailed;
+	pthread_mutex_unlock(&sharedMutex);
+	return !failed;
+#else
+	return false;
+#endif
+}
+
+void EJTextureLoader::collectSharedUploads() {
+	if( !uploadContext ) { return; }
+
+	while( true ) {
+		// Fences signal in order; stop at the first one still pending
+		pthread_mutex_lock(&sharedMutex);
+		if( fenceQueue.empty() || (fenceQueue.front()->fence && !uploadContext->isFenceSignaled(fenceQueue.front()->fence)) ) {
+			pthread_mutex_unlock(&sharedMutex);
+			break;
+		}
+		Job * job = fenceQueue.front();
+		fenceQueue.pop_front();
+		pthread_mutex_unlock(&sharedMutex);
+
+		if( job->fence ) {
+			uploadContext->deleteFence(job->fence);
+			job->fence = NULL;
+		}
+
+		if( job->delegates.empty() ) {
+			drop(job);
+			continue;
+		}
+
+		EJTexture * texture = createTexture(job);
+		deliver(job, texture);
+		if( texture ) {
+			texture->release();
+		}
+	}
+}
+
+void EJTextureLoader::update() {
+	if( pendingJobs.empty() ) { return; }
+
+	collectSharedUploads();
+
+	double start = EJTextureLoaderTime();
+	int uploads = 0;
+	while( true ) {
+		pthread_mutex_lock(&uploadMutex);
+		if( uploadQueue.empty() || (uploads > 0 && EJTextureLoaderTime() - start > EJ_TEXTURE_LOADER_UPLOAD_BUDGET) ) {
+			pthread_mutex_unlock(&uploadMutex);
+			break;
+		}
+		Job * job = uploadQueue.front();
+		uploadQueue.pop_front();
+		pthread_mutex_unlock(&uploadMutex);
+
+		// Superseded or cancelled while it was decoded
+		if( job->delegates.empty() ) {
+			drop(job);
+			continue;
+		}
+
+		EJTexture * texture = job->texture;
+		if( !texture && (job->pixels || job->compressed.data) ) {
+			if( canUploadShared(job) ) {
+				// The real size depends on the GL thread's NPOT support
+				job->realWidth = EJTexture::realSizeFor(job->width, job->mipmaps);
+				job->realHeight = EJTexture::realSizeFor(job->height, job->mipmaps);
+				job->filter = EJTexture::smoothScaling() ? GL_LINEAR : GL_NEAREST;
+
+				pthread_mutex_lock(&sharedMutex);
+				sharedQueue.push_back(job);
+				pthread_cond_signal(&sharedCondition);
+				pthread_mutex_unlock(&sharedMutex);
+				continue;
+			}
+
+			texture = createTexture(job);
+			uploads++;
+		}
+
+		deliver(job, texture);
+		if( texture ) {
+			texture->release();
+		}
+	}
+}
+
+EJTexture * EJTextureLoader::createTexture(Job * job) {
+	double uploadStart = EJTextureLoaderTime();
+	NSString * path = NSStringMake(job->path.c_str());
+	EJTexture * texture = NULL;
+	if( job->textureId ) {
+		texture = new EJTexture(path, job->textureId, job->width, job->height, job->filter, job->scale, job->maxSize, job->mipmaps);
+		job->textureId = 0;
+		stats.sharedUploads++;
+	}
+	else if( job->pixels ) {
+		// Also for jobs the upload thread handed back
+		texture = new EJTexture(path, job->pixels, job->width, job->height, job->allowAtlas, job->scale, job->maxSize,
+			job->mipmaps, job->mipmapLevels);
+		job->pixels = NULL;
+	}
+	else if( job->compressed.data ) {
+		texture = new EJTexture(path, &job->compressed, &job->compressedAlpha);
+		EJCompressedTextureFree(&job->compressed);
+		EJCompressedTextureFree(&job->compressedAlpha);
+	}
+	else {
+		return NULL;
+	}
+
+	if( texture->isLoaded() ) {
+		EJTextureCache::getInstance()->insertTexture(texture, path, job->allowAtlas, job->maxSize, job->mipmaps);
+	}
+	stats.uploadTime += EJTextureLoaderTime() - uploadStart;
+	return texture;
+}
+
+void EJTextureLoader::drop(Job * job) {
+	pendingJobs.erase(std::find(pendingJobs.begin(), pendingJobs.end(), job));
+	free(job->pixels);
+	EJCompressedTextureFree(&job->compressed);
+	EJCompressedTextureFree(&job->compressedAlpha);
+	if( job->texture ) { job->texture->release(); }
+	if( job->textureId ) { glDeleteTextures(1, &job->textureId); }
+	delete job;
+	stats.cancelled++;
+}
+
+void EJTextureLoader::deliver(Job * job, EJTexture * texture) {
+	if( texture && !texture->isLoaded() ) {
+		texture = NULL;
+	}
+	stats.loaded++;
+
+	// The job stays pending while the delegates are called. A callback may
+	// cancel another delegate of this job (e.g. when the JS garbage collector
+	// finalizes an image) or join it by loading the same file again.
+	while( !job->delegates.empty() ) {
+		EJTextureLoaderDelegate * delegate = job->delegates.front();
+		job->delegates.erase(job->delegates.begin());
+		delegate->textureLoaded(texture);
+	}
+
+	pendingJobs.erase(std::find(pendingJobs.begin(), pendingJobs.end(), job));
+	delete job;
+}
+
+bool EJTextureLoader::hasDecodedImages() {
+	pthread_mutex_lock(&uploadMutex);
+	bool decoded = !uploadQueue.empty();
+	pthread_mutex_unlock(&uploadMutex);
+
+	// Uploads finish within a few ms; keep polling their fences
+	pthread_mutex_lock(&sharedMutex);
+	decoded = decoded || !fenceQueue.empty();
+	pthread_mutex_unlock(&sharedMutex);
+	return decoded;
+}
+
+EJTextureLoaderStats EJTextureLoader::getStats() {
+	pthread_mutex_lock(&decodeMutex);
+	int decodeQueueSize = decodeQueue.size();
+	pthread_mutex_unlock(&decodeMutex);
+
+	pthread_mutex_lock(&uploadMutex);
+	EJTextureLoaderStats current = stats;
+	current.uploadQueue = uploadQueue.size();
+	pthread_mutex_unlock(&uploadMutex);
+
+	pthread_mutex_lock(&sharedMutex);
+	current.sharedQueue = sharedQueue.size() + fenceQueue.size();
+	pthread_mutex_unlock(&sharedMutex);
+
+	current.decodeQueue = decodeQueueSize;
+	return current;
+}
@@ -0,0 +1,131 @@
+#ifndef __EJ_TEXTURE_LOADER_H__
+#define __EJ_TEXTURE_LOADER_H__
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include "EJTexture.h"
+#include "EJGLUploadContext.h"
+
+// Upper bound for the number of decoder threads; the actual number also
+// depends on the number of CPU cores
+#define EJ_TEXTURE_LOADER_MAX_THREADS 3
+
+// Time per frame that may be spent creating textures from decoded images,
+// in ms. At least one texture is created per frame.
+#define EJ_TEXTURE_LOADER_UPLOAD_BUDGET 4.0
+
+// Set to 0 to always create textures on the GL thread, e.g. for drivers that
+// mishandle shared contexts
+#ifndef EJ_TEXTURE_LOADER_SHARED_CONTEXT
+#define EJ_TEXTURE_LOADER_SHARED_CONTEXT 1
+#endif
+
+class EJTextureLoaderDelegate {
+public:
+	virtual ~EJTextureLoaderDelegate() {}
+	// Called from the frame loop; texture is NULL if the image couldn't be
+	// loaded
+	virtual void textureLoaded(EJTexture * texture) = 0;
+};
+
+typedef struct {
+	int decodeQueue;	// Waiting for a decoder thread
+	int uploadQueue;	// Decoded, waiting for their GL upload
+	int sharedQueue;	// In the upload thread or waiting for their fence
+	int loaded;
+	int cancelled;
+	int coalesced;		// Loads that joined a pending load of the same file
+	int sharedUploads;	// Textures uploaded in the shared context
+	double decodeTime;	// ms, summed over all decoder threads
+	double uploadTime;	// ms
+} EJTextureLoaderStats;
+
+// Decodes images on a pool of worker threads. If a GL context sharing with
+// the canvas context can be created, textures are uploaded by another thread
+// in that context; the GL thread only picks them up once their fence was
+// signaled. Otherwise, and for images packed into the atlas, textures are
+// created on the GL thread in update(), spread over frames. Either way they
+// are handed to the delegates from update().
+class EJTextureLoader : public NSObject {
+	struct Job {
+		std::string path;
+		bool allowAtlas;
+		bool powerOfTwo;		// Decode into a buffer padded to a power of two
+		int maxSize;			// Downscale larger images, 0 for none
+		bool mipmaps;
+		bool mipmapLevels;		// The pixels are followed by all mipmap levels
+		float scale;			// Decoded size divided by the image's
+		std::vector<EJTextureLoaderDelegate *> delegates;
+		EJTexture * texture;	// Set for textures that were already cached
+		GLubyte * pixels;
+		unsigned int width, height;
+
+		// Compressed files the GPU can sample from are uploaded as is
+		EJCompressedTextureSupport compressedSupport;
+		EJCompressedImage compressed, compressedAlpha;
+		bool cancelled;			// Only accessed with the decode mutex held
+
+		// Shared context uploads
+		int realWidth, realHeight;
+		GLint filter;
+		GLuint textureId;		// 0 if the upload thread couldn't upload it
+		void * fence;
+	};
+
+	std::deque<Job *> decodeQueue;
+	std::deque<Job *> uploadQueue;
+	std::vector<Job *> pendingJobs;	// All jobs not yet delivered
+	pthread_t threads[EJ_TEXTURE_LOADER_MAX_THREADS];
+	int threadCount;
+	pthread_mutex_t decodeMutex;
+	pthread_mutex_t uploadMutex;
+	pthread_cond_t decodeCondition;
+	bool quit;
+	EJTextureLoaderStats stats;
+
+	EJGLUploadContext * uploadContext;
+	bool uploadContextCreated;
+	bool uploadContextFailed;		// Guarded by the shared mutex
+	pthread_t uploadThread;
+	std::deque<Job *> sharedQueue;	// For the upload thread
+	std::deque<Job *> fenceQueue;	// Uploaded, in the order of their fences
+	pthread_mutex_t sharedMutex;
+	pthread_cond_t sharedCondition;
+
+	static EJTextureLoader *instance;
+
+	EJTextureLoader();
+
+	static void * decodeThread(void * loader);
+	void decodeJobs();
+	static void * uploadThreadMain(void * loader);
+	void uploadJobs();
+	bool canUploadShared(Job * job);
+	void collectSharedUploads();
+	EJTexture * createTexture(Job * job);
+	void drop(Job * job);
+	void deliver(Job * job, EJTexture * texture);
+
+public:
+	~EJTextureLoader();
+
+	static EJTextureLoader *getInstance();
+
+	// Loads the image at path and calls delegate->textureLoaded() from a
+	// later update(). Images larger than maxSize, if not 0, are downscaled.
+	// Mipmapped images are never packed into the atlas.
+	void loadTexture(NSString * path, bool allowAtlas, int maxSize, bool mipmaps, EJTextureLoaderDelegate * delegate);
+	// Drops all loads for this delegate; it won't be called anymore
+	void cancel(EJTextureLoaderDelegate * delegate);
+
+	// Creates textures from decoded images within the time budget and
+	// delivers them; called once per frame
+	void update();
+	bool hasPendingLoads() const { return !pendingJobs.empty(); }
+	bool hasDecodedImages();
+	EJTextureLoaderStats getStats();
+};
+
+#endif // __EJ_TEXTURE_LOADER_H__
@@ -0,0 +1,181 @@
+#include "EJVertexTransform.h"
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define EJ_VERTEX_TRANSFORM_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#if defined(EJ_VERTEX_TRANSFORM_NEON) && defined(__ANDROID__)
+#include <cpu-features.h>
+#endif
+
+typedef void (*EJTransformPointsFunction)( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind );
+
+
+void EJTransformPointsScalar( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind ) {
+	switch( kind ) {
+		case kEJTransformKindIdentity:
+			if( in != out ) {
+				memcpy(out, in, count * sizeof(EJVector2));
+			}
+			break;
+		case kEJTransformKindTranslate:
+			for( int i = 0; i < count; i++ ) {
+				out[i].x = in[i].x + t.tx;
+				out[i].y = in[i].y + t.ty;
+			}
+			break;
+		case kEJTransformKindScale:
+			for( int i = 0; i < count; i++ ) {
+				out[i].x = t.a * in[i].x + t.tx;
+				out[i].y = t.d * in[i].y + t.ty;
+			}
+			break;
+		default:
+			for( int i = 0; i < count; i++ ) {
+				out[i] = EJVector2ApplyTransform(in[i], t);
+			}
+			break;
+	}
+}
+
+#ifdef EJ_VERTEX_TRANSFORM_SSE
+static void EJTransformPointsSSE( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind ) {
+	const float * src = &in->x;
+	float * dst = &out->x;
+	int i = 0;
+
+	if( kind != kEJTransformKindIdentity && kind != kEJTransformKindUnknown ) {
+		// Two interleaved points per register: x0,y0,x1,y1
+		__m128 offset = _mm_setr_ps(t.tx, t.ty, t.tx, t.ty);
+		__m128 diagonal = _mm_setr_ps(t.a, t.d, t.a, t.d);
+		__m128 crossed = _mm_setr_ps(t.c, t.b, t.c, t.b);
+
+		for( ; i + 4 <= count; i += 4, src += 8, dst += 8 ) {
+			__m128 p0 = _mm_loadu_ps(src);
+			__m128 p1 = _mm_loadu_ps(src + 4);
+			if( kind == kEJTransformKindTranslate ) {
+				p0 = _mm_add_ps(p0, offset);
+				p1 = _mm_add_ps(p1, offset);
+			}
+			else if( kind == kEJTransformKindScale ) {
+				p0 = _mm_add_ps(_mm_mul_ps(p0, diagonal), offset);
+				p1 = _mm_add_ps(_mm_mul_ps(p1, diagonal), offset);
+			}
+			else {
+				// x' = a*x + c*y + tx, y' = d*y + b*x + ty; the swapped y,x,y,x
+				// register provides the cross terms
+				__m128 s0 = _mm_shuffle_ps(p0, p0, _MM_SHUFFLE(2, 3, 0, 1));
+				__m128 s1 = _mm_shuffle_ps(p1, p1, _MM_SHUFFLE(2, 3, 0, 1));
+				p0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, diagonal), _mm_mul_ps(s0, crossed)), offset);
+				p1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p1, diagonal), _mm_mul_ps(s1, crossed)), offset);
+			}
+			_mm_storeu_ps(dst, p0);
+			_mm_storeu_ps(dst + 4, p1);
+		}
+	}
+
+	if( i < count ) {
+		EJTransformPointsScalar(in + i, out + i, count - i, t, kind);
+	}
+}
+#endif
+
+static EJTransformPointsFunction EJTransformPointsSIMDFunction() {
+	static EJTransformPointsFunction function = NULL;
+	if( !function ) {
+		function = EJTransformPointsScalar;
+#if defined(EJ_VERTEX_TRANSFORM_NEON)
+	#if defined(__ANDROID__)
+		if(
+			android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM &&
+			(android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON)
+		) {
+			function = EJTransformPointsNEON;
+		}
+	#else
+		function = EJTransformPointsNEON;
+	#endif
+#elif defined(EJ_VERTEX_TRANSFORM_SSE)
+		function = EJTransformPointsSSE;
+#endif
+	}
+	return function;
+}
+
+void EJTransformPoints( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind ) {
+	if( kind == kEJTransformKindUnknown ) {
+		kind = EJTransformGetKind(t);
+	}
+
+	// Not worth the call for a handful of points or if there's nothing to do
+	if( kind == kEJTransformKindIdentity || count < 4 ) {
+		EJTransformPointsScalar(in, out, count, t, kind);
+		return;
+	}
+	EJTransformPointsSIMDFunction()(in, out, count, t, kind);
+}
+
+static double EJTransformBenchmarkTime() {
+#ifdef _WINDOWS
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return now.QuadPart * 1000.0 / freq.QuadPart;
+#else
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec * 1000.0 + time.tv_usec / 1000.0;
+#endif
+}
+
+static double EJTransformBenchmarkRun( EJTransformPointsFunction function, const EJVector2 * in, EJVector2 * out, int points, int iterations, CGAffineTransform t ) {
+	double start = EJTransformBenchmarkTime();
+	for( int i = 0; i < iterations; i++ ) {
+		function(in, out, points, t, kEJTransformKindAffine);
+	}
+	return EJTransformBenchmarkTime() - start;
+}
+
+EJTransformBenchmarkResult EJTransformBenchmark( int points, int iterations ) {
+	EJTransformBenchmarkResult result;
+	result.points = points;
+	result.iterations = iterations;
+
+	EJVector2 * in = (EJVector2 *)malloc(points * sizeof(EJVector2));
+	EJVector2 * out = (EJVector2 *)malloc(points * sizeof(EJVector2));
+	for( int i = 0; i < points; i++ ) {
+		in[i] = EJVector2Make( (float)(i % 1024), (float)(i / 1024) );
+	}
+
+	CGAffineTransform t = CGAffineTransformMake(0.8f, 0.6f, -0.6f, 0.8f, 12.5f, -3.0f);
+	EJTransformPointsFunction simd = EJTransformPointsSIMDFunction();
+
+	result.scalarTime = EJTransformBenchmarkRun(EJTransformPointsScalar, in, out, points, iterations, t);
+	result.simdTime = EJTransformBenchmarkRun(simd, in, out, points, iterations, t);
+
+	if( simd == EJTransformPointsScalar ) {
+		result.simdKernel = "scalar";
+	}
+#ifdef EJ_VERTEX_TRANSFORM_NEON
+	else if( simd == EJTransformPointsNEON ) {
+		result.simdKernel = "neon";
+	}
+#endif
+	else {
+		result.simdKernel = "sse";
+	}
+
+	free(in);
+	free(out);
+	return result;
+}
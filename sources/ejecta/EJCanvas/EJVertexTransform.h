@@ -0,0 +1,67 @@
+#ifndef __EJ_VERTEX_TRANSFORM_H__
+#define __EJ_VERTEX_TRANSFORM_H__
+
+#include "EJCanvas2DTypes.h"
+
+// The kind of a transform is determined once when it changes, so that points
+// can be pushed through a kernel that only does the work the transform needs
+typedef enum {
+	kEJTransformKindIdentity,
+	kEJTransformKindTranslate,
+	kEJTransformKindScale,		// Scale and translate
+	kEJTransformKindAffine,
+	kEJTransformKindUnknown		// Not classified yet; classify on use
+} EJTransformKind;
+
+typedef struct {
+	int points;
+	int iterations;
+	double scalarTime;	// ms
+	double simdTime;	// ms
+	const char * simdKernel;
+} EJTransformBenchmarkResult;
+
+static inline EJTransformKind EJTransformGetKind( CGAffineTransform t ) {
+	if( t.b != 0 || t.c != 0 ) {
+		return kEJTransformKindAffine;
+	}
+	else if( t.a != 1 || t.d != 1 ) {
+		return kEJTransformKindScale;
+	}
+	else if( t.tx != 0 || t.ty != 0 ) {
+		return kEJTransformKindTranslate;
+	}
+	return kEJTransformKindIdentity;
+}
+
+static inline EJVector2 EJVector2ApplyTransformKind( EJVector2 p, CGAffineTransform t, EJTransformKind kind ) {
+	switch( kind ) {
+		case kEJTransformKindIdentity:
+			return p;
+		case kEJTransformKindTranslate:
+			return EJVector2Make( p.x + t.tx, p.y + t.ty );
+		case kEJTransformKindScale:
+			return EJVector2Make( t.a * p.x + t.tx, t.d * p.y + t.ty );
+		default:
+			return EJVector2ApplyTransform( p, t );
+	}
+}
+
+// Transforms count points from in to out; in and out may be the same. Uses
+// NEON or SSE kernels that process 4 points per iteration where available.
+void EJTransformPoints( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind );
+
+// Plain C version, used for the remainder of a batch and if no SIMD kernel is
+// available
+void EJTransformPointsScalar( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind );
+
+#ifdef EJ_VERTEX_TRANSFORM_NEON
+// Implemented in EJVertexTransformNEON.cpp, which is the only file compiled
+// with NEON enabled; only called if the CPU supports it
+void EJTransformPointsNEON( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind );
+#endif
+
+// Times the scalar and the SIMD kernel for a general affine transform
+EJTransformBenchmarkResult EJTransformBenchmark( int points, int iterations );
+
+#endif // __EJ_VERTEX_TRANSFORM_H__
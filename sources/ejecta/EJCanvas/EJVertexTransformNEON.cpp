@@ -0,0 +1,53 @@
+#include "EJVertexTransform.h"
+
+#if defined(EJ_VERTEX_TRANSFORM_NEON) && defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+void EJTransformPointsNEON( const EJVector2 * in, EJVector2 * out, int count, CGAffineTransform t, EJTransformKind kind ) {
+	const float * src = &in->x;
+	float * dst = &out->x;
+	int i = 0;
+
+	if( kind == kEJTransformKindTranslate || kind == kEJTransformKindScale ) {
+		// The points can stay interleaved: x,y,x,y * a,d,a,d + tx,ty,tx,ty
+		float offsetValues[4] = { t.tx, t.ty, t.tx, t.ty };
+		float scaleValues[4] = { t.a, t.d, t.a, t.d };
+		float32x4_t offset = vld1q_f32(offsetValues);
+		float32x4_t scale = vld1q_f32(scaleValues);
+
+		for( ; i + 4 <= count; i += 4, src += 8, dst += 8 ) {
+			float32x4_t p0 = vld1q_f32(src);
+			float32x4_t p1 = vld1q_f32(src + 4);
+			if( kind == kEJTransformKindScale ) {
+				p0 = vmlaq_f32(offset, p0, scale);
+				p1 = vmlaq_f32(offset, p1, scale);
+			}
+			else {
+				p0 = vaddq_f32(p0, offset);
+				p1 = vaddq_f32(p1, offset);
+			}
+			vst1q_f32(dst, p0);
+			vst1q_f32(dst + 4, p1);
+		}
+	}
+	else if( kind == kEJTransformKindAffine ) {
+		// Deinterleave 4 points into x0..x3 and y0..y3
+		float32x4_t a = vdupq_n_f32(t.a), b = vdupq_n_f32(t.b);
+		float32x4_t c = vdupq_n_f32(t.c), d = vdupq_n_f32(t.d);
+		float32x4_t tx = vdupq_n_f32(t.tx), ty = vdupq_n_f32(t.ty);
+
+		for( ; i + 4 <= count; i += 4, src += 8, dst += 8 ) {
+			float32x4x2_t p = vld2q_f32(src);
+			float32x4x2_t r;
+			r.val[0] = vmlaq_f32(vmlaq_f32(tx, p.val[0], a), p.val[1], c);
+			r.val[1] = vmlaq_f32(vmlaq_f32(ty, p.val[0], b), p.val[1], d);
+			vst2q_f32(dst, r);
+		}
+	}
+
+	if( i < count ) {
+		EJTransformPointsScalar(in + i, out + i, count - i, t, kind);
+	}
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "EJSharedOpenGLContext.h"
+#include <string.h>
+#include "EJCanvas/EJGLState.h"
 
 EJSharedOpenGLContext *EJSharedOpenGLContext::instance = NULL;
 
@@ -6,9 +8,19 @@ EJSharedOpenGLContext::EJSharedOpenGLContext():
 	glProgram2DFlat(NULL),
 	glProgram2DTexture(NULL),
 	glProgram2DAlphaTexture(NULL),
-	glProgram2DPattern(NULL)
+	glProgram2DAlphaMaskTexture(NULL),
+	glProgram2DPattern(NULL),
+	glProgram2DMultiTexture(NULL),
 	//TODO: glProgram2DRadialGradient(NULL),
+	vertexBufferSize(EJ_OPENGL_VERTEX_BUFFER_SIZE),
+	scratchVertexBuffer(NULL),
+	scratchVertexBufferSize(0),
+	vertexBufferObjectIndex(0),
+	quadIndexBuffer(0),
+	ribbonIndexBuffer(0)
 {
+	vertexBuffer = (EJVertex *)malloc(vertexBufferSize * sizeof(EJVertex));
+	memset(vertexBufferObjects, 0, sizeof(vertexBufferObjects));
 }
 
 EJSharedOpenGLContext::~EJSharedOpenGLContext() {
@@ -26,15 +38,28 @@ EJSharedOpenGLContext::~EJSharedOpenGLContext() {
 		glProgram2DAlphaTexture->release();
 		glProgram2DAlphaTexture = NULL;
 	}
+	if(glProgram2DAlphaMaskTexture) {
+		glProgram2DAlphaMaskTexture->release();
+		glProgram2DAlphaMaskTexture = NULL;
+	}
 	if(glProgram2DPattern) {
 		glProgram2DPattern->release();
 		glProgram2DPattern = NULL;
 	}
+	if(glProgram2DMultiTexture) {
+		glProgram2DMultiTexture->release();
+		glProgram2DMultiTexture = NULL;
+	}
 	/*TODO: if(glProgram2DRadialGradient) {
 		glProgram2DRadialGradient->release();
 		glProgram2DRadialGradient = NULL;
 	}*/
 
+	if( vertexBufferObjects[0] ) { glDeleteBuffers(EJ_OPENGL_VERTEX_BUFFER_RING_SIZE, vertexBufferObjects); }
+	if( quadIndexBuffer ) { glDeleteBuffers(1, &quadIndexBuffer); }
+	if( ribbonIndexBuffer ) { glDeleteBuffers(1, &ribbonIndexBuffer); }
+	free(vertexBuffer);
+	free(scratchVertexBuffer);
 }
 
 EJSharedOpenGLContext *EJSharedOpenGLContext::getInstance() {
@@ -45,7 +70,109 @@ EJSharedOpenGLContext *EJSharedOpenGLContext::getInstance() {
 }
 
 EJVertex *EJSharedOpenGLContext::getVertexBuffer() {
-	return &vertexBuffer[0];
+	return vertexBuffer;
+}
+
+int EJSharedOpenGLContext::getVertexBufferSize() const {
+	return vertexBufferSize;
+}
+
+EJVertex *EJSharedOpenGLContext::growVertexBuffer(int minSize) {
+	// Double the size until minSize fits; the buffer is shared by all canvas
+	// contexts, which pick up the new pointer in prepare()
+	int newSize = vertexBufferSize;
+	while( newSize < minSize && newSize < EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE ) {
+		newSize *= 2;
+	}
+	if( newSize > EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE ) {
+		newSize = EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE;
+	}
+	
+	if( newSize != vertexBufferSize ) {
+		EJVertex *newBuffer = (EJVertex *)realloc(vertexBuffer, newSize * sizeof(EJVertex));
+		if( newBuffer ) {
+			vertexBuffer = newBuffer;
+			vertexBufferSize = newSize;
+		}
+	}
+	return vertexBuffer;
+}
+
+EJVertex *EJSharedOpenGLContext::getScratchVertexBuffer(int minSize) {
+	// Second buffer the canvas contexts can reorder their vertices into before
+	// uploading; it only grows and is never read across flushes
+	if( minSize > scratchVertexBufferSize ) {
+		EJVertex *newBuffer = (EJVertex *)realloc(scratchVertexBuffer, minSize * sizeof(EJVertex));
+		if( !newBuffer ) { return NULL; }
+		scratchVertexBuffer = newBuffer;
+		scratchVertexBufferSize = minSize;
+	}
+	return scratchVertexBuffer;
+}
+
+void EJSharedOpenGLContext::createBufferObjectsOnce() {
+	if( quadIndexBuffer ) { return; }
+	
+	glGenBuffers(EJ_OPENGL_VERTEX_BUFFER_RING_SIZE, vertexBufferObjects);
+	
+	// Every quad in the vertex buffer is stored as 4 vertices (top left, top right,
+	// bottom left, bottom right) and drawn as the two triangles 0,1,2 and 1,2,3.
+	// Single triangles are stored as a quad with the last vertex repeated.
+	GLushort *indices = (GLushort *)malloc(EJ_OPENGL_QUAD_INDEX_COUNT * sizeof(GLushort));
+	for( int i = 0, v = 0; i < EJ_OPENGL_QUAD_INDEX_COUNT; i += 6, v += 4 ) {
+		indices[i+0] = v+0;
+		indices[i+1] = v+1;
+		indices[i+2] = v+2;
+		indices[i+3] = v+1;
+		indices[i+4] = v+2;
+		indices[i+5] = v+3;
+	}
+	
+	glGenBuffers(1, &quadIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, EJ_OPENGL_QUAD_INDEX_COUNT * sizeof(GLushort), indices, GL_STATIC_DRAW);
+	free(indices);
+	
+	// Ribbon rows are 4 vertices across a stroke (outer feather, edge, edge,
+	// outer feather). Each row is connected to the next one by 3 quads, so
+	// neighbouring rows share their vertices.
+	indices = (GLushort *)malloc(EJ_OPENGL_RIBBON_INDEX_COUNT * sizeof(GLushort));
+	for( int i = 0, v = 0; i < EJ_OPENGL_RIBBON_INDEX_COUNT; v += 4 ) {
+		for( int column = 0; column < 3; column++, i += 6 ) {
+			indices[i+0] = v+column;
+			indices[i+1] = v+column+1;
+			indices[i+2] = v+column+4;
+			indices[i+3] = v+column+1;
+			indices[i+4] = v+column+4;
+			indices[i+5] = v+column+5;
+		}
+	}
+	
+	glGenBuffers(1, &ribbonIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ribbonIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, EJ_OPENGL_RIBBON_INDEX_COUNT * sizeof(GLushort), indices, GL_STATIC_DRAW);
+	free(indices);
+}
+
+void EJSharedOpenGLContext::bindVertexBufferObjects() {
+	createBufferObjectsOnce();
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjects[vertexBufferObjectIndex]);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIndexBuffer);
+}
+
+void EJSharedOpenGLContext::bindIndexBuffer(EJIndexLayout layout) {
+	createBufferObjectsOnce();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, layout == kEJIndexLayoutRibbon ? ribbonIndexBuffer : quadIndexBuffer);
+}
+
+void EJSharedOpenGLContext::uploadVertexBuffer(int count, EJVertex *vertices) {
+	createBufferObjectsOnce();
+	
+	// Move on to the next buffer in the ring and orphan its old storage by
+	// respecifying it, so the driver doesn't have to wait for a pending draw
+	vertexBufferObjectIndex = (vertexBufferObjectIndex + 1) % EJ_OPENGL_VERTEX_BUFFER_RING_SIZE;
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjects[vertexBufferObjectIndex]);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(EJVertex), vertices ? vertices : vertexBuffer, GL_STREAM_DRAW);
 }
 
 #define EJ_GL_PROGRAM_GETTER(TYPE, NAME, VERTEX_SHADER, FRAGMENT_SHADER) \
@@ -67,7 +194,24 @@ EJVertex *EJSharedOpenGLContext::getVertexBuffer() {
 EJ_GL_PROGRAM_GETTER(EJGLProgram2D, Flat, Vertex, Flat);
 EJ_GL_PROGRAM_GETTER(EJGLProgram2D, Texture, Vertex, Texture);
 EJ_GL_PROGRAM_GETTER(EJGLProgram2D, AlphaTexture, Vertex, AlphaTexture);
+EJ_GL_PROGRAM_GETTER(EJGLProgram2D, AlphaMaskTexture, Vertex, AlphaMaskTexture);
 EJ_GL_PROGRAM_GETTER(EJGLProgram2D, Pattern, Vertex, Pattern);
 //TODO: EJ_GL_PROGRAM_GETTER(EJGLProgram2DRadialGradient, RadialGradient, Vertex, RadialGradient);
 
-#undef EJ_GL_PROGRAM_GETTER
\ No newline at end of file
+#undef EJ_GL_PROGRAM_GETTER
+
+EJGLProgram2D *EJSharedOpenGLContext::getGlProgram2DMultiTexture() {
+	if(glProgram2DMultiTexture == NULL) {
+		GLint maxTextureUnits = EJGLState::getInstance()->getMaxTextureImageUnits();
+		int slots = maxTextureUnits < EJ_OPENGL_MAX_TEXTURE_SLOTS ? maxTextureUnits : EJ_OPENGL_MAX_TEXTURE_SLOTS;
+		
+		glProgram2DMultiTexture = new EJGLProgram2D();
+		bool shaderInitialization = glProgram2DMultiTexture->initWithVertexShader(NSStringMake("shaders/MultiTexture.vsh"), NSStringMake("shaders/MultiTexture.fsh"), slots);
+		if(!shaderInitialization) {
+			delete glProgram2DMultiTexture;
+			glProgram2DMultiTexture = NULL;
+			return NULL;
+		}
+	}
+	return glProgram2DMultiTexture;
+}
\ No newline at end of file
@@ -8,20 +8,56 @@
 #include "EJGLProgram2D.h"
 //TODO: #import "EJGLProgram2DRadialGradient.h"
 
-#define EJ_OPENGL_VERTEX_BUFFER_SIZE 2048 //(32 * 1024) // 32kb on Ejecta iOS
+#define EJ_OPENGL_VERTEX_BUFFER_SIZE 4096 // Initial size in vertices, grows on demand
+
+// Quads are drawn with a shared GLushort index buffer, so a single batch can't
+// address more than 64k vertices
+#define EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE 65536
+#define EJ_OPENGL_QUAD_INDEX_COUNT (EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE / 4 * 6)
+
+// Strokes are drawn as ribbons of rows with 4 vertices each, connected to the
+// next row by 3 quads
+#define EJ_OPENGL_RIBBON_INDEX_COUNT ((EJ_OPENGL_VERTEX_BUFFER_MAX_SIZE / 4 - 1) * 18)
+
+// Number of vertex buffer objects we cycle through, so that we never have to
+// write into a buffer the GPU may still be reading from
+#define EJ_OPENGL_VERTEX_BUFFER_RING_SIZE 3
+
+// Upper bound for the number of texture units the multi texture program
+// samples from; MultiTexture.fsh has a branch for each of them
+#define EJ_OPENGL_MAX_TEXTURE_SLOTS 8
+
+// How the vertices of a command are connected, i.e. which of the static index
+// buffers it is drawn with
+typedef enum {
+	kEJIndexLayoutQuads,
+	kEJIndexLayoutRibbon
+} EJIndexLayout;
 
 class EJSharedOpenGLContext : public NSObject {
 private:
 	EJGLProgram2D *glProgram2DFlat;
 	EJGLProgram2D *glProgram2DTexture;
 	EJGLProgram2D *glProgram2DAlphaTexture;
+	EJGLProgram2D *glProgram2DAlphaMaskTexture;
 	EJGLProgram2D *glProgram2DPattern;
+	EJGLProgram2D *glProgram2DMultiTexture;
 	//TODO: EJGLProgram2DRadialGradient *glProgram2DRadialGradient;
 	
 	//EAGLContext *glContext2D;
 	//EAGLSharegroup *glSharegroup;
 	//NSMutableData *vertexBuffer;
-	EJVertex vertexBuffer[EJ_OPENGL_VERTEX_BUFFER_SIZE];
+	EJVertex *vertexBuffer;
+	int vertexBufferSize;
+	EJVertex *scratchVertexBuffer;
+	int scratchVertexBufferSize;
+
+	GLuint vertexBufferObjects[EJ_OPENGL_VERTEX_BUFFER_RING_SIZE];
+	int vertexBufferObjectIndex;
+	GLuint quadIndexBuffer;
+	GLuint ribbonIndexBuffer;
+
+	void createBufferObjectsOnce();
 
 	static EJSharedOpenGLContext *instance;
 
@@ -33,12 +69,20 @@ public:
 	EJGLProgram2D *getGlProgram2DFlat();
 	EJGLProgram2D *getGlProgram2DTexture();
 	EJGLProgram2D *getGlProgram2DAlphaTexture();
+	EJGLProgram2D *getGlProgram2DAlphaMaskTexture();
 	EJGLProgram2D *getGlProgram2DPattern();
+	EJGLProgram2D *getGlProgram2DMultiTexture();
 	//TODO: EJGLProgram2DRadialGradient *getGlProgram2DRadialGradient() const;
 
 	//EAGLContext *glContext2D;
 	//EAGLSharegroup *glSharegroup;
 	EJVertex *getVertexBuffer();
+	int getVertexBufferSize() const;
+	EJVertex *growVertexBuffer(int minSize);
+	void bindVertexBufferObjects();
+	void bindIndexBuffer(EJIndexLayout layout);
+	EJVertex *getScratchVertexBuffer(int minSize);
+	void uploadVertexBuffer(int count, EJVertex *vertices = NULL);
 
 	static EJSharedOpenGLContext *getInstance();
 
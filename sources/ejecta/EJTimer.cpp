@@ -5,6 +5,21 @@
 
 #include "EJTimer.h"
 
+// Current time in microseconds
+static double EJTimerNow()
+{
+#ifdef _WINDOWS
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return now.QuadPart * 1000000.0 / freq.QuadPart;
+#else
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec * 1000000.0 + time.tv_usec;
+#endif
+}
+
 EJTimerCollection::EJTimerCollection() : lastId(0),simpleMutex(false)
 {
 	timers = new NSDictionary();
@@ -72,6 +87,24 @@ void EJTimerCollection::update()
 	}
 }
 
+double EJTimerCollection::getNextTimeout()
+{
+	double now = EJTimerNow();
+	double next = -1;
+	NSDictElement* pElement = NULL;
+	NSDICT_FOREACH(timers, pElement)
+	{
+		EJTimer* timer = (EJTimer*)pElement->getObject();
+		if( !timer->active ) { continue; }
+
+		double timeout = timer->getTimeout(now);
+		if( next < 0 || timeout < next ) {
+			next = timeout;
+		}
+	}
+	return next < 0 ? -1 : next / 1000.0;
+}
+
 
 EJTimer::EJTimer()
 {
@@ -83,21 +116,7 @@ EJTimer::EJTimer(JSObjectRef callbackp, float intervalp, BOOL repeatp)
 	active = true;
 	interval = intervalp;
 	repeat = repeatp;
-
-#ifdef _WINDOWS	
-	static bool is_first = true;
-	static LARGE_INTEGER freq;
-	static LARGE_INTEGER now;
-
-	QueryPerformanceFrequency(&freq);
-	QueryPerformanceCounter(&now);
-	target =  now.QuadPart * 1000000.0 / freq.QuadPart + interval;
-#else
-	struct timeval time;
-	//struct timezone tz;
-	gettimeofday(&time, NULL);
-	target = time.tv_sec * 1000000.0 + time.tv_usec  + interval;
-#endif
+	target = EJTimerNow() + interval;
 
 	callback = callbackp;
 	JSValueProtect(EJApp::instance()->jsGlobalContext, callback);
@@ -110,21 +129,9 @@ EJTimer::~EJTimer()
 
 void EJTimer::check()
 {
-
-#ifdef _WINDOWS	
-	static bool is_first = true;
-	static LARGE_INTEGER freq;
-	static LARGE_INTEGER now;
-
-	QueryPerformanceFrequency(&freq);
-	QueryPerformanceCounter(&now);
-	double currentTime =  now.QuadPart * 1000000.0 / freq.QuadPart + interval;
-#else
-	struct timeval time;
-	//struct timezone tz;
-	gettimeofday(&time, NULL);
-	double currentTime = time.tv_sec * 1000000.0 + time.tv_usec + interval;
-#endif
+	// The interval used to be added to the current time here as well, which
+	// made every timer fire on the next frame
+	double currentTime = EJTimerNow();
 
 	if( active && target <= currentTime) {
 		EJApp::instance()->invokeCallback(callback, NULL, 0, NULL);
@@ -136,4 +143,9 @@ void EJTimer::check()
 			active = false;
 		}
 	}
-}
\ No newline at end of file
+}
+
+double EJTimer::getTimeout(double now)
+{
+	return target > now ? target - now : 0;
+}
@@ -22,6 +22,8 @@ public:
 	int scheduleCallback(JSObjectRef callback, float interval, BOOL repeat);
 	void cancelId(int timerId);
 	void update();
+	// Milliseconds until the next timer fires, or -1 if there is none
+	double getNextTimeout();
 };
 
 class EJTimer : public NSObject
@@ -38,6 +40,7 @@ public:
 	~EJTimer();
 
 	void check();
+	double getTimeout(double now);
 };
 
 #endif // __EJ_TIMER_H__
\ No newline at end of file
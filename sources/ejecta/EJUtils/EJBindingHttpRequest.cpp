@@ -441,6 +441,11 @@ void EJHttpClient::dispatchResponseCallbacks(float delta)
     
 }
 
+bool EJHttpClient::hasPendingRequests()
+{
+    return s_asyncRequestCount > 0;
+}
+
 EJBindingHttpRequest::EJBindingHttpRequest() :method(NULL), url(NULL), user(NULL), password(NULL), connection(NULL),response(NULL),responseBody(NULL)
 {
 	requestHeaders = new NSDictionary();
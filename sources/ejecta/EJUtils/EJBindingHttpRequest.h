@@ -372,6 +372,9 @@ public:
     
     /** Poll function called from main thread to dispatch callbacks when http requests finished **/
     void dispatchResponseCallbacks(float delta);
+    
+    /** Whether requests were sent whose callbacks haven't been dispatched yet **/
+    bool hasPendingRequests();
         
 private:
     EJHttpClient();
@@ -1,8 +1,32 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+
 #include "lodejpeg.h"
 #include "jpeglib.h"
 
-#include <stdio.h>
-#include <stdlib.h>
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSSE3__)
+#define LODEJPEG_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+#if defined(LODEJPEG_NEON) && defined(__ANDROID__)
+#include <cpu-features.h>
+#endif
+
+/*Number of scanlines requested from libjpeg per call*/
+#define LODEJPEG_SCANLINES 16
 
 #ifdef LODEPNG_COMPILE_CPP
 #include <fstream>
@@ -18,6 +42,11 @@ const char* lodejpeg_error_text(unsigned code)
   switch(code)
   {
     case 0: return "no error, everything went ok";
+    case 1: return "unsupported JPG color space";
+    case 2: return "corrupt or truncated JPG data";
+    case 3: return "output size doesn't match the scaled size of the image";
+    case 78: return "failed to read or map the file";
+    case 83: return "memory allocation failed";
   }
   return "unknown error code";
 }
@@ -50,89 +79,321 @@ unsigned lodejpeg_load_file(unsigned char** out, size_t* outsize, const char* fi
 }
 
 
-unsigned lodejpeg_decode_memory(unsigned char** out, unsigned* w, unsigned* h,
-                               const unsigned char* in, size_t insize, unsigned bitdepth)
+unsigned lodejpeg_map_file(LodeJPEGMappedFile* file, const char* filename)
+{
+  file->data = 0;
+  file->size = 0;
+  file->mapped = 0;
+
+#ifdef _WINDOWS
+  HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if(handle != INVALID_HANDLE_VALUE)
+  {
+    DWORD size = GetFileSize(handle, NULL);
+    HANDLE mapping = (size && size != INVALID_FILE_SIZE)
+      ? CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL)
+      : NULL;
+    if(mapping)
+    {
+      /*the view keeps the mapping alive*/
+      file->data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+    CloseHandle(handle);
+    if(file->data)
+    {
+      file->size = size;
+      file->mapped = 1;
+      return 0;
+    }
+  }
+#else
+  int fd = open(filename, O_RDONLY);
+  if(fd >= 0)
+  {
+    struct stat info;
+    void* data = MAP_FAILED;
+    if(fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+      data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    /*the mapping stays valid after closing the file*/
+    close(fd);
+    if(data != MAP_FAILED)
+    {
+      /*libjpeg reads the file front to back, exactly once*/
+      madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+      file->data = (const unsigned char*)data;
+      file->size = (size_t)info.st_size;
+      file->mapped = 1;
+      return 0;
+    }
+  }
+#endif
+
+  /*e.g. empty files or file systems that can't be mapped*/
+  unsigned char* buffer = 0;
+  unsigned error = lodejpeg_load_file(&buffer, &file->size, filename);
+  file->data = buffer;
+  return error;
+}
+
+void lodejpeg_unmap_file(LodeJPEGMappedFile* file)
+{
+  if(file->mapped)
+  {
+#ifdef _WINDOWS
+    UnmapViewOfFile(file->data);
+#else
+    munmap((void*)file->data, file->size);
+#endif
+  }
+  else
+  {
+    free((void*)file->data);
+  }
+  file->data = 0;
+  file->size = 0;
+  file->mapped = 0;
+}
+
+/*
+The standard libjpeg error handler calls exit(); this one jumps back into the
+decode function instead, so a corrupt file only fails to load.
+*/
+typedef struct LodeJPEGError
+{
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+} LodeJPEGError;
+
+static void lodejpeg_error_exit(j_common_ptr cinfo)
+{
+  LodeJPEGError* error = (LodeJPEGError*)cinfo->err;
+  longjmp(error->jump, 1);
+}
+
+static void lodejpeg_output_message(j_common_ptr cinfo)
+{
+  /*warnings about recoverable errors aren't of interest*/
+}
+
+static void lodejpeg_error_init(struct jpeg_decompress_struct* cinfo, LodeJPEGError* error)
+{
+  cinfo->err = jpeg_std_error(&error->mgr);
+  error->mgr.error_exit = lodejpeg_error_exit;
+  error->mgr.output_message = lodejpeg_output_message;
+}
+
+unsigned lodejpeg_inspect(unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
 {
-  unsigned error = 1;
-  /* these are standard libjpeg structures for reading(decompression) */
   struct jpeg_decompress_struct cinfo;
-  struct jpeg_error_mgr jerr;
-  /* libjpeg data structure for storing one row, that is, scanline of an image */
-  JSAMPROW row_pointer[1] = {0};
-  unsigned long location = 0;
-  unsigned int i = 0;
-  unsigned int j = 0;
-
-  do 
+  LodeJPEGError jerr;
+
+  lodejpeg_error_init(&cinfo, &jerr);
+  jpeg_create_decompress( &cinfo );
+  if(setjmp(jerr.jump))
   {
-      /* here we set up the standard libjpeg error handler */
-      cinfo.err = jpeg_std_error( &jerr );
+    jpeg_destroy_decompress( &cinfo );
+    return 2;
+  }
+  jpeg_mem_src( &cinfo, (unsigned char *) in, insize );
+  jpeg_read_header( &cinfo, true );
 
-      /* setup decompression process and source, then read JPEG header */
-      jpeg_create_decompress( &cinfo );
+  *w = cinfo.image_width;
+  *h = cinfo.image_height;
 
-      jpeg_mem_src( &cinfo, (unsigned char *) in, insize );
+  jpeg_destroy_decompress( &cinfo );
+  return 0;
+}
 
-      /* reading the image header which contains image information */
-      jpeg_read_header( &cinfo, true );
+void lodejpeg_scaled_size(unsigned* w, unsigned* h, unsigned scale_denom)
+{
+  /*libjpeg rounds up*/
+  *w = (*w + scale_denom - 1) / scale_denom;
+  *h = (*h + scale_denom - 1) / scale_denom;
+}
 
-      // we only support RGB or grayscale
-      if (cinfo.jpeg_color_space != JCS_RGB)
-      {
-          if (cinfo.jpeg_color_space == JCS_GRAYSCALE || cinfo.jpeg_color_space == JCS_YCbCr)
-          {
-              cinfo.out_color_space = JCS_RGB;
-          }
-      }
-      else
-      {
-          break;
-      }
+static void lodejpeg_expand_rgb_rgba_scalar(unsigned char* out, const unsigned char* in, unsigned count)
+{
+  for(unsigned i = 0; i < count; i++, in += 3, out += 4)
+  {
+    /*read the whole pixel first, out may overlap the following pixels*/
+    unsigned char r = in[0], g = in[1], b = in[2];
+    out[0] = r;
+    out[1] = g;
+    out[2] = b;
+    out[3] = 0xff;
+  }
+}
+
+#ifdef LODEJPEG_SSSE3
+static unsigned lodejpeg_expand_rgb_rgba_ssse3(unsigned char* out, const unsigned char* in, unsigned count)
+{
+  /*4 pixels per iteration; the shuffle spreads 12 bytes of RGB over 16 bytes and
+  the or sets the alpha. Each load reads 4 bytes past the pixels it expands, so
+  the loop stops 2 pixels before the end of the input.*/
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+
+  unsigned i = 0;
+  for(; i + 6 <= count; i += 4, in += 12, out += 16)
+  {
+    __m128i rgb = _mm_loadu_si128((const __m128i*)in);
+    _mm_storeu_si128((__m128i*)out, _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+  }
+  return i;
+}
+#endif
+
+typedef unsigned (*lodejpeg_expand_function)(unsigned char* out, const unsigned char* in, unsigned count);
+
+static lodejpeg_expand_function lodejpeg_expand_selected = 0;
+static pthread_once_t lodejpeg_expand_once = PTHREAD_ONCE_INIT;
+
+static void lodejpeg_expand_select()
+{
+#if defined(LODEJPEG_NEON)
+  #if defined(__ANDROID__)
+  if(android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM &&
+     (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON))
+  {
+    lodejpeg_expand_selected = lodejpeg_expand_rgb_rgba_neon;
+  }
+  #else
+  lodejpeg_expand_selected = lodejpeg_expand_rgb_rgba_neon;
+  #endif
+#elif defined(LODEJPEG_SSSE3)
+  lodejpeg_expand_selected = lodejpeg_expand_rgb_rgba_ssse3;
+#endif
+}
+
+/*Decoding runs on several loader threads at once*/
+static lodejpeg_expand_function lodejpeg_expand_simd_function()
+{
+  pthread_once(&lodejpeg_expand_once, lodejpeg_expand_select);
+  return lodejpeg_expand_selected;
+}
+
+void lodejpeg_expand_rgb_rgba(unsigned char* out, const unsigned char* in, unsigned count)
+{
+  unsigned done = 0;
+  lodejpeg_expand_function simd = lodejpeg_expand_simd_function();
+  if(simd) done = simd(out, in, count);
+  lodejpeg_expand_rgb_rgba_scalar(out + done * 4, in + done * 3, count - done);
+}
+
+unsigned lodejpeg_decode_into(unsigned char* out, size_t stride, unsigned w, unsigned h,
+                             const unsigned char* in, size_t insize, unsigned scale_denom)
+{
+  struct jpeg_decompress_struct cinfo;
+  LodeJPEGError jerr;
+  JSAMPROW rows[LODEJPEG_SCANLINES];
+
+  lodejpeg_error_init(&cinfo, &jerr);
+  jpeg_create_decompress( &cinfo );
+  if(setjmp(jerr.jump))
+  {
+    jpeg_destroy_decompress( &cinfo );
+    return 2;
+  }
+
+  jpeg_mem_src( &cinfo, (unsigned char *) in, insize );
+  jpeg_read_header( &cinfo, true );
 
-      /* Start decompression jpeg here */
-      jpeg_start_decompress( &cinfo );
+  /*libjpeg converts grayscale, YCbCr and RGB images; CMYK would need an extra pass*/
+  if(cinfo.jpeg_color_space != JCS_GRAYSCALE && cinfo.jpeg_color_space != JCS_YCbCr &&
+     cinfo.jpeg_color_space != JCS_RGB)
+  {
+    jpeg_destroy_decompress( &cinfo );
+    return 1;
+  }
 
-      /* init image info */
-      *w = cinfo.image_width;
-      *h = cinfo.image_height;
-      row_pointer[0] = new unsigned char[cinfo.output_width*cinfo.output_components];
+#ifdef JCS_EXTENSIONS
+  /*libjpeg-turbo writes RGBA itself, with an opaque alpha*/
+  cinfo.out_color_space = JCS_EXT_RGBA;
+  const int expand = 0;
+#else
+  cinfo.out_color_space = JCS_RGB;
+  const int expand = 1;
+#endif
 
-      unsigned char * _out = new unsigned char[cinfo.output_width*cinfo.output_height*4];
+  /*DCT scaling; only a part of each block is computed for smaller sizes*/
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale_denom;
+
+  jpeg_start_decompress( &cinfo );
+  if(cinfo.output_width != w || cinfo.output_height != h)
+  {
+    jpeg_destroy_decompress( &cinfo );
+    return 3;
+  }
 
-      /* now actually read the jpeg into the raw buffer */
-      /* read one scan line at a time */
-      while( cinfo.output_scanline < cinfo.image_height )
+  /*without the extended colour space, the RGB scanlines are stored in the last
+  3/4 of each row and expanded to RGBA from the front*/
+  size_t rowoffset = expand ? w : 0;
+  while(cinfo.output_scanline < cinfo.output_height)
+  {
+    unsigned first = cinfo.output_scanline;
+    unsigned count = cinfo.output_height - first;
+    if(count > LODEJPEG_SCANLINES) count = LODEJPEG_SCANLINES;
+    for(unsigned i = 0; i < count; i++)
+    {
+      rows[i] = out + (first + i) * stride + rowoffset;
+    }
+
+    /*libjpeg returns as many lines as it has ready, at least one*/
+    unsigned read = jpeg_read_scanlines( &cinfo, rows, count );
+    if(expand)
+    {
+      for(unsigned i = 0; i < read; i++)
       {
-          jpeg_read_scanlines( &cinfo, row_pointer, 1 );
-		  j=0;
-          for( i=0; i<cinfo.image_width*4;i++) 
-          {
-			  if(i%4==3){
-				  _out[location++] = 0xff;
-			  }else {
-				  _out[location++] = (row_pointer[0][j++]);
-			  }
-          }
+        lodejpeg_expand_rgb_rgba(rows[i] - rowoffset, rows[i], w);
       }
-	  *out = _out;
-      jpeg_finish_decompress( &cinfo );
-      jpeg_destroy_decompress( &cinfo );
-      /* wrap up decompression, destroy objects, free pointers and close open files */        
-      error = 0;
-  } while (0);
-
-  if(row_pointer[0])delete row_pointer[0];
+    }
+  }
+
+  jpeg_finish_decompress( &cinfo );
+  jpeg_destroy_decompress( &cinfo );
+  return 0;
+}
+
+unsigned lodejpeg_decode_memory(unsigned char** out, unsigned* w, unsigned* h,
+                               const unsigned char* in, size_t insize, unsigned bitdepth)
+{
+  return lodejpeg_decode_scaled_memory(out, w, h, in, insize, 1);
+}
+
+unsigned lodejpeg_decode_scaled_memory(unsigned char** out, unsigned* w, unsigned* h,
+                               const unsigned char* in, size_t insize, unsigned scale_denom)
+{
+  *out = 0;
+  unsigned error = lodejpeg_inspect(w, h, in, insize);
+  if(error) return error;
+
+  lodejpeg_scaled_size(w, h, scale_denom);
+
+  /* callers release the pixels with free() */
+  *out = (unsigned char *)malloc((size_t)(*w) * (*h) * 4);
+  if(!*out) return 83;
+
+  error = lodejpeg_decode_into(*out, (size_t)(*w) * 4, *w, *h, in, insize, scale_denom);
+  if(error)
+  {
+    free(*out);
+    *out = 0;
+  }
   return error;
 }
 
 unsigned lodejpeg_decode_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename, unsigned bitdepth)
 {
-  unsigned char* buffer;
-  size_t buffersize;
+  LodeJPEGMappedFile file;
   unsigned error;
-  error = lodejpeg_load_file(&buffer, &buffersize, filename);
-  if(!error) error = lodejpeg_decode_memory(out, w, h, buffer, buffersize, bitdepth);
-  free(buffer);
+  error = lodejpeg_map_file(&file, filename);
+  if(!error) error = lodejpeg_decode_memory(out, w, h, file.data, file.size, bitdepth);
+  lodejpeg_unmap_file(&file);
   return error;
 }
 
@@ -19,8 +19,62 @@ return value: error code (0 means ok)
 */
 unsigned lodejpeg_load_file(unsigned char** out, size_t* outsize, const char* filename);
 
+/*A file mapped into memory; falls back to reading it if mapping isn't possible*/
+typedef struct LodeJPEGMappedFile
+{
+  const unsigned char* data;
+  size_t size;
+  int mapped; /*data has to be unmapped instead of freed*/
+} LodeJPEGMappedFile;
+
+/*
+Maps the file read-only into memory, so the compressed data never has to be
+copied. Release it with lodejpeg_unmap_file, also if an error is returned.
+*/
+unsigned lodejpeg_map_file(LodeJPEGMappedFile* file, const char* filename);
+void lodejpeg_unmap_file(LodeJPEGMappedFile* file);
+
 unsigned lodejpeg_decode_memory(unsigned char** out, unsigned* w, unsigned* h,
 							const unsigned char* in, size_t insize, unsigned bitdepth);
+
+/*Reads the size of the image from the JPG header, without decoding it.*/
+unsigned lodejpeg_inspect(unsigned* w, unsigned* h, const unsigned char* in, size_t insize);
+
+/*
+Same as lodejpeg_decode_memory, but lets libjpeg scale the image down by 1/scale_denom
+while decoding (1, 2, 4 or 8). This is much faster than decoding the full image, as
+only a part of each DCT block is computed. w and h are set to the scaled size, which
+is rounded up. The out buffer is allocated with malloc.
+*/
+unsigned lodejpeg_decode_scaled_memory(unsigned char** out, unsigned* w, unsigned* h,
+							const unsigned char* in, size_t insize, unsigned scale_denom);
+
+/*
+Decodes into an existing buffer as 32-bit RGBA, with stride bytes per row, e.g. the
+upper left corner of a larger texture. w and h must be the scaled size as returned
+by lodejpeg_scaled_size; the buffer has to hold h rows of at least w*4 bytes.
+Several scanlines are read per call. If libjpeg has the extended RGBA colour space
+(libjpeg-turbo), it writes the RGBA rows itself; otherwise RGB rows are expanded
+in place.
+*/
+unsigned lodejpeg_decode_into(unsigned char* out, size_t stride, unsigned w, unsigned h,
+							const unsigned char* in, size_t insize, unsigned scale_denom);
+
+/*Size of the image after scaling it by 1/scale_denom while decoding*/
+void lodejpeg_scaled_size(unsigned* w, unsigned* h, unsigned scale_denom);
+
+/*
+Expands count RGB pixels to RGBA with an opaque alpha. The buffers may overlap if
+out + count <= in, e.g. RGB pixels stored at the end of an RGBA row, as the pixels
+are processed front to back. Uses NEON or SSSE3 where available.
+*/
+void lodejpeg_expand_rgb_rgba(unsigned char* out, const unsigned char* in, unsigned count);
+
+#ifdef LODEJPEG_NEON
+/*Implemented in lodejpeg_neon.cpp, the only file compiled with NEON enabled; only
+called if the CPU supports it. Returns the number of pixels expanded.*/
+unsigned lodejpeg_expand_rgb_rgba_neon(unsigned char* out, const unsigned char* in, unsigned count);
+#endif
 /*
 Load JPG from disk, from file with given name.
 Same as the other decode functions, but instead takes a filename as input.
@@ -0,0 +1,25 @@
+#include "lodejpeg.h"
+
+#if defined(LODEJPEG_NEON) && defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+unsigned lodejpeg_expand_rgb_rgba_neon(unsigned char* out, const unsigned char* in, unsigned count)
+{
+  /*vld3 deinterleaves 16 pixels into r, g and b registers, vst4 interleaves them
+  again with the alpha register*/
+  uint8x16x4_t rgba;
+  rgba.val[3] = vdupq_n_u8(0xff);
+
+  unsigned i = 0;
+  for(; i + 16 <= count; i += 16, in += 48, out += 64)
+  {
+    uint8x16x3_t rgb = vld3q_u8(in);
+    rgba.val[0] = rgb.val[0];
+    rgba.val[1] = rgb.val[1];
+    rgba.val[2] = rgb.val[2];
+    vst4q_u8(out, rgba);
+  }
+  return i;
+}
+
+#endif
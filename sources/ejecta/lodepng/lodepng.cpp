@@ -4068,15 +4068,13 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
   return 0;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+/*reads the header and all chunks, appending the data of the IDAT chunks to idat. returns the error*/
+static unsigned readChunks(unsigned* w, unsigned* h, LodePNGState* state,
+                           const unsigned char* in, size_t insize, ucvector* idat)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
   size_t i;
-  ucvector idat; /*the data from idat chunks*/
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4084,13 +4082,9 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
-  if(state->error) return;
+  if(state->error) return state->error;
 
-  ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
@@ -4118,9 +4112,9 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i < chunkLength; i++) idat.data[oldsize + i] = data[i];
+      size_t oldsize = idat->size;
+      if(!ucvector_resize(idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
+      for(i = 0; i < chunkLength; i++) idat->data[oldsize + i] = data[i];
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4439,6 +4433,22 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(!IEND) chunk = lodepng_chunk_next_const(chunk);
   }
 
+  return state->error;
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
+                          LodePNGState* state,
+                          const unsigned char* in, size_t insize)
+{
+  ucvector idat; /*the data from idat chunks*/
+
+  /*provide some proper output values if error will happen*/
+  *out = 0;
+
+  ucvector_init(&idat);
+  readChunks(w, h, state, in, insize, &idat);
+
   if(!state->error)
   {
     ucvector scanlines;
@@ -4515,6 +4525,126 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
   return state->error;
 }
 
+/*converts w pixels, starting at pixel index start of in, to 8-bit RGB or RGBA*/
+static unsigned convertRowRGBA8(unsigned char* out, const unsigned char* in, size_t start, unsigned w,
+                                const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in)
+{
+  unsigned x;
+  unsigned channels = mode_out->colortype == LCT_RGBA ? 4 : 3;
+
+  if(lodepng_color_mode_equal(mode_out, mode_in))
+  {
+    const unsigned char* line = &in[start * channels];
+    for(x = 0; x < w * channels; x++) out[x] = line[x];
+    return 0;
+  }
+
+  for(x = 0; x < w; x++)
+  {
+    unsigned char r = 0, g = 0, b = 0, a = 0;
+    unsigned error = getPixelColorRGBA8(&r, &g, &b, &a, in, start + x, mode_in);
+    if(error) return error;
+    out[x * channels + 0] = r;
+    out[x * channels + 1] = g;
+    out[x * channels + 2] = b;
+    if(channels == 4) out[x * channels + 3] = a;
+  }
+  return 0;
+}
+
+void lodepng_scratch_init(LodePNGScratch* scratch)
+{
+  scratch->idat = 0;
+  scratch->idatsize = 0;
+  scratch->scanlines = 0;
+  scratch->scanlinessize = 0;
+}
+
+void lodepng_scratch_cleanup(LodePNGScratch* scratch)
+{
+  myfree(scratch->idat);
+  myfree(scratch->scanlines);
+  lodepng_scratch_init(scratch);
+}
+
+unsigned lodepng_decode_into(unsigned char* out, size_t stride, unsigned* w, unsigned* h,
+                             LodePNGState* state, const unsigned char* in, size_t insize,
+                             LodePNGScratch* scratch)
+{
+  ucvector idat;
+  unsigned char* scanlines;
+  size_t scanlinessize;
+  unsigned bpp, y;
+
+  if(state->info_raw.bitdepth != 8
+     || !(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA))
+  {
+    return state->error = 56; /*unsupported color mode conversion*/
+  }
+
+  /*the IDAT data is collected in the scratch buffer, which keeps its allocated size*/
+  idat.data = scratch->idat;
+  idat.size = 0;
+  idat.allocsize = scratch->idatsize;
+  readChunks(w, h, state, in, insize, &idat);
+  scratch->idat = idat.data;
+  scratch->idatsize = idat.allocsize;
+  if(state->error) return state->error;
+
+  /*the decompressor writes into the scanline buffer from the start and only grows it if needed*/
+  scanlines = scratch->scanlines;
+  scanlinessize = scratch->scanlinessize;
+  state->error = lodepng_zlib_decompress(&scanlines, &scanlinessize, idat.data, idat.size,
+                                         &state->decoder.zlibsettings);
+  scratch->scanlines = scanlines;
+  if(scanlinessize > scratch->scanlinessize) scratch->scanlinessize = scanlinessize;
+  if(state->error) return state->error;
+
+  bpp = lodepng_get_bpp(&state->info_png.color);
+  if(bpp == 0) return state->error = 31; /*error: invalid colortype*/
+
+  if(state->info_png.interlace_method == 0)
+  {
+    /*unfilter each scanline in place and convert it straight into its row of out; this
+    needs neither a buffer for the whole image in the PNG's color type nor a copy of it*/
+    size_t bytewidth = (bpp + 7) / 8;
+    size_t linebytes = (*w * bpp + 7) / 8;
+    unsigned char* prevline = 0;
+
+    if(scanlinessize < (1 + linebytes) * *h) return state->error = 91;
+
+    for(y = 0; y < *h; y++)
+    {
+      unsigned char* line = &scanlines[(1 + linebytes) * y];
+      state->error = unfilterScanline(&line[1], &line[1], prevline, bytewidth, line[0], linebytes);
+      if(state->error) return state->error;
+      prevline = &line[1];
+
+      /*rows are byte aligned, even with padding bits at their end*/
+      state->error = convertRowRGBA8(&out[stride * y], &line[1], 0, *w, &state->info_raw, &state->info_png.color);
+      if(state->error) return state->error;
+    }
+  }
+  else
+  {
+    /*Adam7 needs the whole deinterlaced image, rows are converted from there*/
+    ucvector image;
+    ucvector_init(&image);
+    if(scanlinessize < lodepng_get_raw_size(*w, *h, &state->info_png.color) + *h) state->error = 91;
+    else if(!ucvector_resizev(&image, lodepng_get_raw_size(*w, *h, &state->info_png.color), 0)) state->error = 83;
+    else state->error = postProcessScanlines(image.data, scanlines, *w, *h, &state->info_png);
+
+    for(y = 0; y < *h && !state->error; y++)
+    {
+      state->error = convertRowRGBA8(&out[stride * y], image.data, (size_t)y * *w, *w,
+                                     &state->info_raw, &state->info_png.color);
+    }
+    ucvector_cleanup(&image);
+  }
+
+  return state->error;
+}
+
 unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -5686,6 +5816,7 @@ const char* lodepng_error_text(unsigned code)
     case 84: return "given image too small to contain all pixels to be encoded";
     case 85: return "internal color conversion bug";
     case 86: return "impossible offset in lz77 encoding (internal bug)";
+    case 91: return "decompressed image data is smaller than the image";
   }
   return "unknown error code";
 }
@@ -625,6 +625,34 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+/*
+Buffers for the compressed and decompressed image data, kept between calls of
+lodepng_decode_into so that sequential decodes don't allocate them again.
+*/
+typedef struct LodePNGScratch
+{
+  unsigned char* idat;
+  size_t idatsize;
+  unsigned char* scanlines;
+  size_t scanlinessize;
+} LodePNGScratch;
+
+void lodepng_scratch_init(LodePNGScratch* scratch);
+void lodepng_scratch_cleanup(LodePNGScratch* scratch);
+
+/*
+Decodes into a buffer provided by the caller, with rows that are stride bytes
+apart, e.g. to decode straight into a larger texture. Get the size with
+lodepng_inspect first; out must hold stride * h bytes. Bytes of a row beyond
+the image width are not touched.
+Only 8-bit RGB and RGBA are supported as state->info_raw. Scanlines of images
+that aren't interlaced are converted one at a time, without an intermediate
+buffer for the whole image.
+*/
+unsigned lodepng_decode_into(unsigned char* out, size_t stride, unsigned* w, unsigned* h,
+                             LodePNGState* state, const unsigned char* in, size_t insize,
+                             LodePNGScratch* scratch);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 
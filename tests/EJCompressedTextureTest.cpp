@@ -0,0 +1,227 @@
+// Standalone tests for the PKM/KTX parser and the ETC1/ETC2 decoder in
+// EJCompressedTexture.cpp. The expected pixels of the single block tests
+// were produced by uploading the same blocks to Mesa.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EJCompressedTexture.h"
+
+static int failures = 0;
+
+#define EXPECT(condition) \
+	do { \
+		if( !(condition) ) { \
+			printf("%s:%d: expected %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while( 0 )
+
+
+// ---------------------------------------------------------------------------------
+// Fixtures
+
+// 13x7 ETC1 image: "PKM 10", type 0, padded size 16x8, size 13x7, then
+// 4x2 blocks of 8 bytes
+static unsigned char * pkmFixture( size_t * size ) {
+	static const unsigned char header[16] = {
+		'P', 'K', 'M', ' ', '1', '0',
+		0x00, 0x00,
+		0x00, 0x10, 0x00, 0x08,
+		0x00, 0x0d, 0x00, 0x07
+	};
+	*size = sizeof(header) + 4 * 2 * 8;
+	unsigned char * data = (unsigned char *)calloc(*size, 1);
+	memcpy(data, header, sizeof(header));
+	return data;
+}
+
+static void writeUInt32( unsigned char * p, unsigned int value, bool bigEndian ) {
+	for( int i = 0; i < 4; i++ ) {
+		p[bigEndian ? 3 - i : i] = (unsigned char)(value >> (i * 8));
+	}
+}
+
+// 8x8 ETC2 RGB image with a single mipmap level and 8 bytes of key/value
+// data, in either byte order
+static unsigned char * ktxFixture( size_t * size, bool bigEndian ) {
+	static const unsigned char identifier[12] = {
+		0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+	};
+	const unsigned int keyValueBytes = 8, imageSize = 2 * 2 * 8;
+
+	*size = 64 + keyValueBytes + 4 + imageSize;
+	unsigned char * data = (unsigned char *)calloc(*size, 1);
+	memcpy(data, identifier, sizeof(identifier));
+	writeUInt32(data + 12, 0x04030201, bigEndian);
+
+	unsigned char * header = data + 16;
+	writeUInt32(header + 12, GL_COMPRESSED_RGB8_ETC2, bigEndian);	// glInternalFormat
+	writeUInt32(header + 16, GL_RGB, bigEndian);					// glBaseInternalFormat
+	writeUInt32(header + 24, 8, bigEndian);							// pixelWidth
+	writeUInt32(header + 28, 8, bigEndian);							// pixelHeight
+	writeUInt32(header + 40, 1, bigEndian);							// numberOfFaces
+	writeUInt32(header + 44, 1, bigEndian);							// numberOfMipmapLevels
+	writeUInt32(header + 48, keyValueBytes, bigEndian);				// bytesOfKeyValueData
+
+	writeUInt32(data + 64 + keyValueBytes, imageSize, bigEndian);
+	for( unsigned int i = 0; i < imageSize; i++ ) {
+		data[64 + keyValueBytes + 4 + i] = (unsigned char)i;
+	}
+	return data;
+}
+
+
+// ---------------------------------------------------------------------------------
+// Parsing
+
+static void testPKM() {
+	size_t size;
+	unsigned char * data = pkmFixture(&size);
+
+	EJCompressedImage image;
+	EXPECT(EJCompressedTextureParse(&image, data, size));
+	EXPECT(image.internalFormat == GL_ETC1_RGB8_OES);
+	EXPECT(image.width == 13 && image.height == 7);
+	EXPECT(image.levels == 1);
+	EXPECT(image.dataSize == 4 * 2 * 8);
+	EXPECT(image.data == data + 16);
+
+	// Missing the last byte of the last block
+	EXPECT(!EJCompressedTextureParse(&image, data, size - 1));
+	EXPECT(image.dataSize == 0 && image.data == NULL);
+
+	// Unknown texture type
+	data[7] = 2;
+	EXPECT(!EJCompressedTextureParse(&image, data, size));
+
+	free(data);
+}
+
+static void testKTX( bool bigEndian ) {
+	size_t size;
+	unsigned char * data = ktxFixture(&size, bigEndian);
+
+	EJCompressedImage image;
+	EXPECT(EJCompressedTextureParse(&image, data, size));
+	EXPECT(image.internalFormat == GL_COMPRESSED_RGB8_ETC2);
+	EXPECT(image.width == 8 && image.height == 8);
+	EXPECT(image.levels == 1);
+	EXPECT(image.dataSize == 2 * 2 * 8);
+	EXPECT(image.data == data + 64 + 8 + 4);
+	EXPECT(image.data && image.data[0] == 0 && image.data[31] == 31);
+
+	// Truncated image data
+	EXPECT(!EJCompressedTextureParse(&image, data, size - 1));
+
+	// Truncated header
+	EXPECT(!EJCompressedTextureParse(&image, data, 63));
+
+	// Key/value data that runs past the end of the file, including a size
+	// that would overflow the offset of the image data
+	writeUInt32(data + 16 + 48, (unsigned int)size, bigEndian);
+	EXPECT(!EJCompressedTextureParse(&image, data, size));
+	writeUInt32(data + 16 + 48, 0xffffffff, bigEndian);
+	EXPECT(!EJCompressedTextureParse(&image, data, size));
+
+	free(data);
+}
+
+
+// ---------------------------------------------------------------------------------
+// Decoding
+
+static void testDecode( const char * name, GLenum format, const unsigned char * block, size_t blockSize, const unsigned char expected[64] ) {
+	EJCompressedImage image;
+	memset(&image, 0, sizeof(image));
+	image.internalFormat = format;
+	image.width = 4;
+	image.height = 4;
+	image.levels = 1;
+	image.data = block;
+	image.dataSize = blockSize;
+
+	EXPECT(EJCompressedTextureDataSize(format, 4, 4) == blockSize);
+
+	// Decode into a larger buffer to check that the padding stays empty
+	const unsigned int realWidth = 8, realHeight = 8;
+	unsigned char * pixels = EJCompressedTextureDecode(&image, realWidth, realHeight);
+	EXPECT(pixels != NULL);
+	if( !pixels ) { return; }
+
+	for( unsigned int y = 0; y < realHeight; y++ ) {
+		for( unsigned int x = 0; x < realWidth; x++ ) {
+			const unsigned char * p = pixels + (y * realWidth + x) * 4;
+			static const unsigned char empty[4] = {0, 0, 0, 0};
+			const unsigned char * e = (x < 4 && y < 4) ? expected + (y * 4 + x) * 4 : empty;
+			if( memcmp(p, e, 4) != 0 ) {
+				printf(
+					"%s: pixel %u,%u is %d,%d,%d,%d, expected %d,%d,%d,%d\n", name, x, y,
+					p[0], p[1], p[2], p[3], e[0], e[1], e[2], e[3]
+				);
+				failures++;
+			}
+		}
+	}
+	free(pixels);
+}
+
+// Differential mode with flipped sub blocks
+static const unsigned char etc1Block[8] = {0x82, 0x4A, 0xF4, 0x63, 0x1B, 0xE4, 0x50, 0x9C};
+static const unsigned char etc1Pixels[64] = {
+	145, 87,255,255,  174,116,255,255,  119, 61,234,255,   90, 32,205,255,
+	145, 87,255,255,  119, 61,234,255,  119, 61,234,255,  145, 87,255,255,
+	140, 82,206,255,  146, 88,212,255,  150, 92,216,255,  156, 98,222,255,
+	156, 98,222,255,  140, 82,206,255,  146, 88,212,255,  150, 92,216,255
+};
+
+// Red overflows in differential mode, which selects the T mode
+static const unsigned char etc2Block[8] = {0xF9, 0x35, 0x8E, 0x47, 0xC3, 0x5A, 0x69, 0x0F};
+static const unsigned char etc2Pixels[64] = {
+	152,254, 84,255,  136,238, 68,255,  120,222, 52,255,  221, 51, 85,255,
+	120,222, 52,255,  221, 51, 85,255,  136,238, 68,255,  152,254, 84,255,
+	152,254, 84,255,  136,238, 68,255,  221, 51, 85,255,  120,222, 52,255,
+	120,222, 52,255,  221, 51, 85,255,  152,254, 84,255,  136,238, 68,255
+};
+
+// Opaque bit cleared; pixels with index 2 are transparent black
+static const unsigned char punchthroughBlock[8] = {0x82, 0x4A, 0xF4, 0x60, 0xA5, 0x3C, 0x0F, 0x96};
+static const unsigned char punchthroughPixels[64] = {
+	132, 74,247,255,   90, 32,205,255,  140, 82,206,255,  148, 90,214,255,
+	174,116,255,255,    0,  0,  0,  0,  156, 98,222,255,    0,  0,  0,  0,
+	 90, 32,205,255,  132, 74,247,255,  140, 82,206,255,  148, 90,214,255,
+	  0,  0,  0,  0,  174,116,255,255,  156, 98,222,255,    0,  0,  0,  0
+};
+
+// EAC alpha with base 128, multiplier 3 and table 5, followed by the ETC1
+// color block from above
+static const unsigned char eacBlock[16] = {
+	0x80, 0x35, 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC,
+	0x82, 0x4A, 0xF4, 0x63, 0x1B, 0xE4, 0x50, 0x9C
+};
+static const unsigned char eacPixels[64] = {
+	145, 87,255,119,  174,116,255,101,  119, 61,234, 95,   90, 32,205,146,
+	145, 87,255,134,  119, 61,234,107,  119, 61,234,152,  145, 87,255,101,
+	140, 82,206,134,  146, 88,212,101,  150, 92,216,107,  156, 98,222,158,
+	156, 98,222, 95,  140, 82,206,152,  146, 88,212,107,  150, 92,216,134
+};
+
+
+int main( int argc, char ** argv ) {
+	testPKM();
+	testKTX(false);
+	testKTX(true);
+
+	testDecode("ETC1", GL_ETC1_RGB8_OES, etc1Block, sizeof(etc1Block), etc1Pixels);
+	testDecode("ETC2", GL_COMPRESSED_RGB8_ETC2, etc2Block, sizeof(etc2Block), etc2Pixels);
+	testDecode("ETC2 punchthrough", GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, punchthroughBlock, sizeof(punchthroughBlock), punchthroughPixels);
+	testDecode("ETC2 EAC", GL_COMPRESSED_RGBA8_ETC2_EAC, eacBlock, sizeof(eacBlock), eacPixels);
+
+	if( failures ) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}